@@ -0,0 +1,90 @@
+// Benchmark for the line diff engine on large synthetic inputs.
+//
+// Usage: kit_diff_bench [size in MB] [number of edits]
+//
+// Generates a text of the requested size, applies random line insertions, deletions and
+// replacements, and times tokenizing plus diffing with each algorithm.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include "utils/line_diff.hpp"
+
+namespace
+{
+    std::string generate_text(size_t bytes, std::mt19937 &rng)
+    {
+        std::string text;
+        text.reserve(bytes + 128);
+        for (size_t line = 0; text.size() < bytes; ++line)
+        {
+            text += "generated line " + std::to_string(line) + " value " + std::to_string(rng() % 100000) + "\n";
+        }
+        return text;
+    }
+
+    std::string apply_edits(const std::string &text, size_t edits, std::mt19937 &rng)
+    {
+        std::string edited = text;
+        for (size_t i = 0; i < edits; ++i)
+        {
+            size_t start = edited.find('\n', rng() % edited.size());
+            if (start == std::string::npos)
+            {
+                continue;
+            }
+            ++start;
+            size_t end = edited.find('\n', start);
+            switch (rng() % 3)
+            {
+            case 0:
+                edited.insert(start, "inserted line " + std::to_string(i) + "\n");
+                break;
+            case 1:
+                if (end != std::string::npos)
+                    edited.erase(start, end + 1 - start);
+                break;
+            default:
+                if (end != std::string::npos)
+                    edited.replace(start, end - start, "replaced line " + std::to_string(i));
+                break;
+            }
+        }
+        return edited;
+    }
+
+    long peak_rss_mb()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+    size_t edits = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+
+    std::mt19937 rng(12345);
+    std::string old_text = generate_text(megabytes << 20, rng);
+    std::string new_text = apply_edits(old_text, edits, rng);
+    std::cout << "Input: " << megabytes << " MB, " << edits << " edits, peak RSS before diffing " << peak_rss_mb()
+              << " MB\n";
+
+    for (auto algorithm : {line_diff::Algorithm::Histogram, line_diff::Algorithm::Myers})
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto diff = line_diff::diff(old_text, new_text, algorithm);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << (algorithm == line_diff::Algorithm::Histogram ? "histogram" : "myers    ")
+                  << ": " << diff.old_lines.size() << " lines, +" << diff.insertions() << " -" << diff.deletions()
+                  << " in " << seconds * 1000 << " ms (" << (old_text.size() + new_text.size()) / seconds / (1 << 20)
+                  << " MB/s), peak RSS " << peak_rss_mb() << " MB\n";
+    }
+    return 0;
+}
@@ -0,0 +1,437 @@
+// Benchmarks for kit commands and core primitives on synthetic repositories.
+//
+// Usage: kit_bench [--max-files=N] [--repo-dir=DIR] [Google Benchmark flags]
+//
+// Commands and tree-sized primitives run against generated repositories of 1k, 100k and 1M files
+// (capped by --max-files). Repositories are generated once under --repo-dir and reused by later
+// runs with the same generator settings. Results are written as JSON to kit_bench.json unless
+// --benchmark_out is given, so runs can be compared across releases.
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "commands/add.hpp"
+#include "commands/commit.hpp"
+#include "commands/diff.hpp"
+#include "commands/status.hpp"
+#include "repo_generator.hpp"
+#include "utils/commit_graph.hpp"
+#include "utils/hash_object.hpp"
+#include "utils/mapped_file.hpp"
+#include "utils/merge_base.hpp"
+#include "utils/object_db.hpp"
+#include "utils/object_store.hpp"
+#include "utils/refs.hpp"
+#include "utils/tree.hpp"
+#include "utils/worktree.hpp"
+#include "version.hpp"
+
+namespace
+{
+    const std::vector<size_t> FILE_COUNTS = {1000, 100000, 1000000};
+    constexpr size_t TOUCHED_FILES = 100;
+
+    size_t max_files = 1000000;
+    std::filesystem::path repo_dir = "kit_bench_repos";
+    std::filesystem::path start_dir;
+
+    // Discard what commands print while they are measured
+    class QuietOutput
+    {
+    public:
+        QuietOutput() : null_(nullptr), out_(std::cout.rdbuf(null_.rdbuf())), err_(std::cerr.rdbuf(null_.rdbuf())) {}
+        ~QuietOutput()
+        {
+            std::cout.rdbuf(out_);
+            std::cerr.rdbuf(err_);
+        }
+
+    private:
+        std::ostream null_;
+        std::streambuf *out_;
+        std::streambuf *err_;
+    };
+
+    // Enter the generated repository with `files` files, generating it on first use
+    const repo_generator::Result &use_repo(size_t files)
+    {
+        static std::map<size_t, repo_generator::Result> repos;
+        std::filesystem::current_path(start_dir);
+        std::filesystem::path dir = repo_dir / ("files-" + std::to_string(files));
+
+        auto it = repos.find(files);
+        if (it != repos.end())
+        {
+            std::filesystem::current_path(dir);
+            kit_utils::initialize_repository();
+            return it->second;
+        }
+
+        repo_generator::Options options;
+        options.files = files;
+        QuietOutput quiet;
+        return repos[files] = repo_generator::open_or_generate(dir.string(), options);
+    }
+
+    // Enter an empty repository for object store benchmarks
+    void use_scratch_repo()
+    {
+        std::filesystem::current_path(start_dir);
+        std::filesystem::path dir = repo_dir / "scratch";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir);
+        std::filesystem::create_directories(OBJECTS_DIR);
+        kit_utils::initialize_repository();
+    }
+
+    // Undo what a benchmark did to the repository: the index, the branch HEAD points at, the
+    // commit-graph chain and the working tree files it touched come back as they were
+    class RepoGuard
+    {
+    public:
+        RepoGuard()
+            : index_(kit_utils::read_file(INDEX_FILE)), ref_(refs::head_ref_name()),
+              head_(refs::resolve(ref_)), had_chain_(mapped_file::read_all(commit_graph::CHAIN_FILE, chain_))
+        {
+        }
+
+        ~RepoGuard()
+        {
+            for (const auto &[path, content] : originals_)
+            {
+                repo_generator::detail::write_file(path, content);
+            }
+            kit_utils::create_file(INDEX_FILE, index_);
+            refs::Transaction transaction;
+            transaction.update(ref_, head_);
+            transaction.commit();
+            std::error_code ec;
+            if (had_chain_)
+            {
+                kit_utils::create_file(commit_graph::CHAIN_FILE, chain_);
+            }
+            else
+            {
+                std::filesystem::remove(commit_graph::CHAIN_FILE, ec);
+            }
+            commit_graph::reload();
+        }
+
+        // Append a line to `count` files spread over the tree; returns their paths
+        std::vector<std::string> touch(const repo_generator::Result &repo, size_t count, size_t round)
+        {
+            std::vector<std::string> paths;
+            size_t step = std::max<size_t>(1, repo.paths.size() / std::max<size_t>(1, count));
+            for (size_t i = 0; i < repo.paths.size() && paths.size() < count; i += step)
+            {
+                const std::string &path = repo.paths[i];
+                std::string content = kit_utils::read_file(path);
+                originals_.emplace(path, content);
+                repo_generator::detail::write_file(path, content + "touched " + std::to_string(round) + "\n");
+                paths.push_back(path);
+            }
+            return paths;
+        }
+
+    private:
+        std::string index_;
+        std::string ref_;
+        std::string head_;
+        std::string chain_;
+        bool had_chain_;
+        std::map<std::string, std::string> originals_;
+    };
+
+    void set_file_counters(benchmark::State &state, const repo_generator::Result &repo)
+    {
+        state.counters["files"] = static_cast<double>(repo.paths.size());
+        state.counters["files/s"] = benchmark::Counter(static_cast<double>(repo.paths.size()) * state.iterations(),
+                                                       benchmark::Counter::kIsRate);
+    }
+
+    // --- Commands -----------------------------------------------------------------------------
+
+    void BM_Status(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        QuietOutput quiet;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(kit_vcs::get_repository_status());
+        }
+        set_file_counters(state, repo);
+    }
+
+    // `kit add .` when nothing changed: every file is stat'ed, none is read
+    void BM_AddUnchanged(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        RepoGuard guard;
+        QuietOutput quiet;
+        for (auto _ : state)
+        {
+            kit_vcs::stage_paths({"."});
+        }
+        set_file_counters(state, repo);
+    }
+
+    // `kit add .` after TOUCHED_FILES files changed
+    void BM_AddModified(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        RepoGuard guard;
+        QuietOutput quiet;
+        size_t round = 0;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            guard.touch(repo, TOUCHED_FILES, ++round);
+            state.ResumeTiming();
+            kit_vcs::stage_paths({"."});
+        }
+        set_file_counters(state, repo);
+    }
+
+    // `kit commit` of TOUCHED_FILES staged changes
+    void BM_Commit(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        RepoGuard guard;
+        QuietOutput quiet;
+        size_t round = 0;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            kit_vcs::stage_paths(guard.touch(repo, TOUCHED_FILES, ++round));
+            state.ResumeTiming();
+            kit_vcs::create_commit("benchmark commit " + std::to_string(round));
+        }
+        set_file_counters(state, repo);
+    }
+
+    // `kit diff` with TOUCHED_FILES modified files
+    void BM_Diff(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        RepoGuard guard;
+        guard.touch(repo, TOUCHED_FILES, 1);
+        QuietOutput quiet;
+        std::ostream null(nullptr);
+        for (auto _ : state)
+        {
+            kit_vcs::show_diff("HEAD", kit_vcs::DiffOptions{}, null);
+        }
+        set_file_counters(state, repo);
+    }
+
+    // `kit log` over the trunk, starting from a cold object cache as a new process would
+    void BM_Log(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            object_db::clear();
+            state.ResumeTiming();
+            size_t count = 0;
+            for (std::string commit = kit_utils::resolve_head(); !commit.empty();
+                 commit = kit_utils::get_parent_commit(commit))
+            {
+                benchmark::DoNotOptimize(commit_object::summary(*kit_utils::read_commit(commit)));
+                ++count;
+            }
+            benchmark::DoNotOptimize(count);
+        }
+        state.counters["commits"] = static_cast<double>(repo.trunk.size());
+    }
+
+    // Three-way merge of a side branch into the trunk, without touching the working tree
+    void BM_Merge(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        if (repo.branch_tips.empty())
+        {
+            state.SkipWithError("repository has no branches");
+            return;
+        }
+        QuietOutput quiet;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            object_db::clear();
+            state.ResumeTiming();
+            benchmark::DoNotOptimize(kit_utils::perform_three_way_merge(repo.branch_forks[0], repo.trunk.back(),
+                                                                        repo.branch_tips[0]));
+        }
+        set_file_counters(state, repo);
+    }
+
+    // --- Primitives ---------------------------------------------------------------------------
+
+    void BM_HashObject(benchmark::State &state)
+    {
+        use_scratch_repo();
+        std::string content = repo_generator::detail::content(static_cast<size_t>(state.range(0)), 1);
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(object_store::hash_object("blob", content));
+        }
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+        state.SetLabel(hash_object::hardware_acceleration());
+    }
+
+    void BM_WriteObject(benchmark::State &state)
+    {
+        use_scratch_repo();
+        std::string content = repo_generator::detail::content(static_cast<size_t>(state.range(0)), 2);
+        size_t round = 0;
+        for (auto _ : state)
+        {
+            // A new object every time, so nothing is skipped as already stored
+            benchmark::DoNotOptimize(object_store::write_object("blob", content + std::to_string(++round)));
+        }
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+    }
+
+    void BM_ReadObject(benchmark::State &state)
+    {
+        use_scratch_repo();
+        std::string oid = object_store::write_object(
+            "blob", repo_generator::detail::content(static_cast<size_t>(state.range(0)), 3));
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(object_store::read_object(oid, "blob"));
+        }
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations()) * state.range(0));
+    }
+
+    // Flatten the trunk tip's tree from a cold object cache
+    void BM_TreeWalk(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        std::string tree = kit_utils::read_commit(repo.trunk.back())->tree;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            object_db::clear();
+            state.ResumeTiming();
+            benchmark::DoNotOptimize(tree_object::read_tree_files(tree));
+        }
+        set_file_counters(state, repo);
+    }
+
+    void BM_WorktreeScan(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        kit_index::Index index = kit_index::load();
+        worktree::ScanOptions options;
+        options.index = &index;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(worktree::scan(".", options));
+        }
+        set_file_counters(state, repo);
+    }
+
+    void BM_MergeBase(benchmark::State &state)
+    {
+        const auto &repo = use_repo(static_cast<size_t>(state.range(0)));
+        if (repo.branch_tips.empty())
+        {
+            state.SkipWithError("repository has no branches");
+            return;
+        }
+        for (auto _ : state)
+        {
+            for (const auto &tip : repo.branch_tips)
+            {
+                benchmark::DoNotOptimize(merge_base::merge_base(repo.trunk.back(), tip));
+            }
+        }
+        state.counters["commits"] = static_cast<double>(repo.trunk.size());
+    }
+
+    void register_benchmarks()
+    {
+        using Benchmark = void (*)(benchmark::State &);
+        const std::pair<const char *, Benchmark> sized[] = {
+            {"Status", BM_Status}, {"AddUnchanged", BM_AddUnchanged}, {"AddModified", BM_AddModified},
+            {"Commit", BM_Commit}, {"Diff", BM_Diff}, {"Log", BM_Log}, {"Merge", BM_Merge},
+            {"TreeWalk", BM_TreeWalk}, {"WorktreeScan", BM_WorktreeScan}, {"MergeBase", BM_MergeBase},
+        };
+        for (const auto &[name, function] : sized)
+        {
+            auto *bench = benchmark::RegisterBenchmark(name, function)->Unit(benchmark::kMillisecond)->UseRealTime();
+            for (size_t files : FILE_COUNTS)
+            {
+                if (files <= max_files)
+                {
+                    bench->Arg(static_cast<std::int64_t>(files));
+                }
+            }
+        }
+
+        const std::pair<const char *, Benchmark> bytes[] = {
+            {"HashObject", BM_HashObject}, {"WriteObject", BM_WriteObject}, {"ReadObject", BM_ReadObject}};
+        for (const auto &[name, function] : bytes)
+        {
+            benchmark::RegisterBenchmark(name, function)->Arg(64)->Arg(4096)->Arg(1 << 20)->UseRealTime();
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // Our own flags first; everything else goes to Google Benchmark
+    std::vector<char *> args{argv[0]};
+    bool has_out = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--max-files=", 0) == 0)
+        {
+            max_files = std::strtoull(arg.c_str() + 12, nullptr, 10);
+            continue;
+        }
+        if (arg.rfind("--repo-dir=", 0) == 0)
+        {
+            repo_dir = arg.substr(11);
+            continue;
+        }
+        has_out = has_out || arg.rfind("--benchmark_out=", 0) == 0;
+        args.push_back(argv[i]);
+    }
+    std::string out_flag = "--benchmark_out=kit_bench.json";
+    std::string format_flag = "--benchmark_out_format=json";
+    if (!has_out)
+    {
+        args.push_back(out_flag.data());
+        args.push_back(format_flag.data());
+    }
+
+    start_dir = std::filesystem::current_path();
+    repo_dir = std::filesystem::absolute(repo_dir);
+
+    int count = static_cast<int>(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return 1;
+    }
+    benchmark::AddCustomContext("kit_version", KIT_VCS_VERSION);
+    benchmark::AddCustomContext("hash_acceleration", hash_object::hardware_acceleration());
+    benchmark::AddCustomContext("generator", repo_generator::Options{}.signature());
+
+    register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    std::filesystem::current_path(start_dir);
+    return 0;
+}
@@ -0,0 +1,311 @@
+// Deterministic synthetic repositories for benchmarks.
+//
+// The same options always produce the same files, the same commit ids and the same branches:
+// contents come from a seeded generator and commits carry fixed timestamps. The trunk is built
+// through the working tree and the index like `kit add` + `kit commit`; side branches fork off
+// trunk commits and are written straight to the object store, so only the trunk tip is checked out.
+
+#ifndef REPO_GENERATOR_HPP
+#define REPO_GENERATOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "commands/add.hpp"
+#include "utils/commit_graph.hpp"
+#include "utils/commit_object.hpp"
+#include "utils/config.hpp"
+#include "utils/constants.hpp"
+#include "utils/hash_object.hpp"
+#include "utils/index.hpp"
+#include "utils/kit_utils.hpp"
+#include "utils/merge_base.hpp"
+#include "utils/object_store.hpp"
+#include "utils/refs.hpp"
+#include "utils/tree.hpp"
+
+namespace repo_generator
+{
+    struct Options
+    {
+        size_t files = 1000;
+        size_t median_file_size = 512; // bytes; sizes are log-normal around the median
+        double size_spread = 1.0;      // sigma of the log-normal distribution
+        size_t max_file_size = 256 * 1024;
+        unsigned depth = 3;            // deepest directory level below the root
+        unsigned fanout = 8;           // subdirectories per directory
+        size_t commits = 50;           // trunk history length, including the initial commit
+        size_t changes_per_commit = 10; // files rewritten by each later commit
+        size_t branches = 4;           // side branches forking off the trunk
+        size_t branch_commits = 10;    // commits on each side branch
+        std::uint64_t seed = 1;
+        bool commit_graph = true;      // write the commit-graph at the end
+        std::string object_format = "sha1";
+
+        // Short description that changes whenever the generated repository would
+        std::string signature() const
+        {
+            std::ostringstream out;
+            out << "files=" << files << " median=" << median_file_size << " spread=" << size_spread
+                << " max=" << max_file_size << " depth=" << depth << " fanout=" << fanout
+                << " commits=" << commits << " changes=" << changes_per_commit << " branches=" << branches
+                << " branch_commits=" << branch_commits << " seed=" << seed << " graph=" << commit_graph
+                << " format=" << object_format;
+            return out.str();
+        }
+    };
+
+    // What was generated, for benchmarks that need concrete ids and paths
+    struct Result
+    {
+        std::vector<std::string> paths;         // every file, sorted
+        std::vector<std::string> trunk;         // trunk commits, oldest first
+        std::vector<std::string> branch_tips;   // one per side branch
+        std::vector<std::string> branch_forks;  // the trunk commit each branch forked from
+        std::uint64_t bytes = 0;                // total size of the checked-out files
+    };
+
+    const std::string SIGNATURE_FILE = KIT_DIR + "/bench-signature";
+
+    namespace detail
+    {
+        constexpr std::int64_t EPOCH = 1700000000; // timestamp of the initial commit
+
+        inline std::string file_path(size_t index, std::mt19937_64 &rng, const Options &options)
+        {
+            std::string path;
+            unsigned levels = options.depth == 0 ? 0 : static_cast<unsigned>(rng() % (options.depth + 1));
+            for (unsigned level = 0; level < levels; ++level)
+            {
+                path += "d" + std::to_string(rng() % std::max(1u, options.fanout)) + "/";
+            }
+            return path + "file" + std::to_string(index) + ".txt";
+        }
+
+        inline size_t file_size(std::mt19937_64 &rng, const Options &options)
+        {
+            std::lognormal_distribution<double> sizes(std::log(static_cast<double>(std::max<size_t>(1, options.median_file_size))),
+                                                      options.size_spread);
+            double size = sizes(rng);
+            return std::min(options.max_file_size, static_cast<size_t>(std::max(1.0, size)));
+        }
+
+        // Text lines, so diffs and merges have something realistic to work on
+        inline std::string content(size_t size, std::uint64_t salt)
+        {
+            std::mt19937_64 rng(salt);
+            std::string text;
+            text.reserve(size + 64);
+            for (size_t line = 0; text.size() < size; ++line)
+            {
+                text += "line " + std::to_string(line) + " value " + std::to_string(rng() % 1000000) + "\n";
+            }
+            text.resize(size);
+            text.back() = '\n';
+            return text;
+        }
+
+        // Rewrite one line near the middle of a file, as an edit would
+        inline std::string edit(const std::string &text, std::uint64_t salt)
+        {
+            size_t middle = text.find('\n', text.size() / 2);
+            if (middle == std::string::npos || middle + 1 >= text.size())
+            {
+                return text + "edit " + std::to_string(salt) + "\n";
+            }
+            size_t end = text.find('\n', middle + 1);
+            return text.substr(0, middle + 1) + "edited " + std::to_string(salt) + "\n" +
+                   (end == std::string::npos ? "" : text.substr(end + 1));
+        }
+
+        inline void write_file(const std::string &path, const std::string &data)
+        {
+            std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            if (!parent.empty())
+            {
+                std::filesystem::create_directories(parent);
+            }
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if (!out)
+            {
+                throw std::runtime_error("Failed to write " + path);
+            }
+        }
+
+        inline std::string write_commit(const std::string &tree, const std::vector<std::string> &parents,
+                                        std::int64_t timestamp, const std::string &message)
+        {
+            commit_object::Commit commit;
+            commit.tree = tree;
+            commit.parents = parents;
+            commit.timestamp = timestamp;
+            commit.message = message;
+            return object_store::write_object("commit", commit_object::serialize(commit));
+        }
+    } // namespace detail
+
+    // Generate a repository in the current directory, which must not hold one yet
+    inline Result generate(const Options &options)
+    {
+        if (std::filesystem::exists(KIT_DIR))
+        {
+            throw std::runtime_error("A repository already exists here");
+        }
+        hash_object::Algorithm algorithm;
+        if (!hash_object::parse_algorithm(options.object_format, algorithm))
+        {
+            throw std::runtime_error("Unknown object format: " + options.object_format);
+        }
+        std::filesystem::create_directories(HEADS_DIR);
+        std::filesystem::create_directories(OBJECTS_DIR);
+        kit_utils::create_file(INDEX_FILE);
+        kit_config::set("objectformat", options.object_format);
+        kit_utils::initialize_repository();
+        refs::Transaction head;
+        head.set_symbolic(refs::HEAD, refs::HEADS_PREFIX + "master");
+        head.commit();
+
+        Result result;
+        std::mt19937_64 rng(options.seed);
+        for (size_t i = 0; i < options.files; ++i)
+        {
+            result.paths.push_back(detail::file_path(i, rng, options));
+            std::string text = detail::content(detail::file_size(rng, options), options.seed * 1000003 + i);
+            detail::write_file(result.paths[i], text);
+            result.bytes += text.size();
+        }
+
+        // Trunk: edit, stage and commit through the index, reusing its cached trees
+        if (!kit_vcs::stage_paths({"."}))
+        {
+            throw std::runtime_error("Failed to stage the generated files");
+        }
+        for (size_t c = 0; c < options.commits; ++c)
+        {
+            std::vector<std::string> changed;
+            for (size_t k = 0; c > 0 && k < options.changes_per_commit && options.files > 0; ++k)
+            {
+                const std::string &path = result.paths[rng() % options.files];
+                std::string text = kit_utils::read_file(path);
+                std::string updated = detail::edit(text, rng());
+                result.bytes = result.bytes - text.size() + updated.size();
+                detail::write_file(path, updated);
+                changed.push_back(path);
+            }
+            if (!changed.empty())
+            {
+                std::sort(changed.begin(), changed.end());
+                changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+                if (!kit_vcs::stage_paths(changed))
+                {
+                    throw std::runtime_error("Failed to stage trunk commit " + std::to_string(c));
+                }
+            }
+
+            kit_index::Index index = kit_index::load();
+            std::string tree = tree_object::write_tree(index);
+            kit_index::save(index);
+            std::vector<std::string> parents;
+            if (!result.trunk.empty())
+            {
+                parents.push_back(result.trunk.back());
+            }
+            result.trunk.push_back(detail::write_commit(tree, parents, detail::EPOCH + static_cast<std::int64_t>(c) * 60,
+                                                        "trunk commit " + std::to_string(c)));
+        }
+        refs::Transaction branches("generate");
+        if (!result.trunk.empty())
+        {
+            branches.update(refs::HEADS_PREFIX + "master", result.trunk.back());
+        }
+
+        // Side branches: edit blobs in a private index and write the objects directly
+        for (size_t b = 0; b < options.branches && !result.trunk.empty(); ++b)
+        {
+            std::string fork = result.trunk[rng() % result.trunk.size()];
+            kit_index::Index index;
+            tree_object::flatten(kit_utils::read_commit(fork)->tree, "", index.entries, &index.cache_tree);
+
+            std::string tip = fork;
+            for (size_t c = 0; c < options.branch_commits && !index.entries.empty(); ++c)
+            {
+                for (size_t k = 0; k < options.changes_per_commit; ++k)
+                {
+                    kit_index::Entry entry = index.entries[rng() % index.entries.size()];
+                    std::string text = object_store::read_object(entry.oid.hex(), "blob");
+                    entry.oid = object_id::ObjectId::from_hex(object_store::write_object("blob", detail::edit(text, rng())));
+                    kit_index::upsert_entry(index, std::move(entry));
+                }
+                std::string tree = tree_object::write_tree(index);
+                tip = detail::write_commit(tree, {tip}, detail::EPOCH + static_cast<std::int64_t>(options.commits + c) * 60,
+                                           "branch " + std::to_string(b) + " commit " + std::to_string(c));
+            }
+            branches.update(refs::HEADS_PREFIX + "branch-" + std::to_string(b), tip);
+            result.branch_tips.push_back(tip);
+            result.branch_forks.push_back(fork);
+        }
+        branches.commit();
+
+        if (options.commit_graph && !result.trunk.empty())
+        {
+            commit_graph::write(kit_utils::list_ref_tips());
+        }
+        std::sort(result.paths.begin(), result.paths.end());
+        kit_utils::create_file(SIGNATURE_FILE, options.signature());
+        return result;
+    }
+
+    // Rebuild the description of a repository generated earlier with the same options
+    inline Result describe(const Options &options)
+    {
+        Result result;
+        for (const auto &entry : kit_index::load().entries)
+        {
+            result.paths.push_back(entry.path);
+            result.bytes += entry.stat.size;
+        }
+        for (std::string commit = kit_utils::resolve_head(); !commit.empty(); commit = kit_utils::get_parent_commit(commit))
+        {
+            result.trunk.push_back(commit);
+        }
+        std::reverse(result.trunk.begin(), result.trunk.end());
+        for (size_t b = 0; b < options.branches; ++b)
+        {
+            std::string tip = refs::resolve(refs::HEADS_PREFIX + "branch-" + std::to_string(b));
+            if (!tip.empty())
+            {
+                result.branch_tips.push_back(tip);
+                result.branch_forks.push_back(merge_base::merge_base(tip, result.trunk.back()));
+            }
+        }
+        return result;
+    }
+
+    // Open the repository in `dir` if it was generated with `options`, or generate it there.
+    // Changes into `dir`.
+    inline Result open_or_generate(const std::string &dir, const Options &options)
+    {
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir);
+        std::error_code ec;
+        if (std::filesystem::exists(SIGNATURE_FILE, ec) && kit_utils::read_file(SIGNATURE_FILE) == options.signature())
+        {
+            kit_utils::initialize_repository();
+            return describe(options);
+        }
+        for (const auto &entry : std::filesystem::directory_iterator("."))
+        {
+            std::filesystem::remove_all(entry.path());
+        }
+        return generate(options);
+    }
+} // namespace repo_generator
+
+#endif // REPO_GENERATOR_HPP
@@ -2,6 +2,7 @@
 #define CLI_HPP
 
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <cxxopts.hpp>
@@ -9,9 +10,30 @@
 #include "../version.hpp"
 #include "../utils/error_handler.hpp"
 #include "../utils/kit_utils.hpp"
+#include "../utils/logger.hpp"
+#include "../utils/repo_daemon.hpp"
+#include "../utils/trace.hpp"
 
 namespace cli
 {
+    // Run a read-only command in the repository daemon when one is running; returns false when
+    // the caller must run it itself. Traced or file-logged runs always stay in this process.
+    inline bool forward_to_daemon(const std::string &command)
+    {
+        if (repo_daemon::is_serving() || trace::enabled() || logger::has_file())
+        {
+            return false;
+        }
+        repo_daemon::Reply reply;
+        if (!repo_daemon::forward(std::to_string(static_cast<int>(logger::level())) + " " + command, reply))
+        {
+            return false;
+        }
+        std::cout << reply.out << std::flush;
+        std::cerr << reply.err;
+        return true;
+    }
+
     // Display the welcome screen
     inline void display_welcome_screen()
     {
@@ -19,11 +41,11 @@ namespace cli
          🦊
         KIT-VCS
         A minimal version control system
-        )" << std::endl;
+        )" << '\n';
         std::cout << "Version: " << KIT_VCS_VERSION << "\n"
-                  << std::endl;
+                  << '\n';
         std::cout << "Type `kit --help` to see available commands.\n"
-                  << std::endl;
+                  << '\n';
     }
 
     // Display the help screen
@@ -34,20 +56,48 @@ Usage: kit [command] [options]
 
 Commands:
   init          Initialize a new kit repository
-  add           Add file(s) to the staging area
+  add           Add files, directories or glob pathspecs to the staging area
+                (-j <n> sets the number of hashing threads)
   commit        Commit staged files
   status        Show repository status
   log           Show commit history
-  stash         Stash changes temporarily
+  stash         Save local changes as a stash commit and reset to HEAD (push, the default);
+                list, show, apply, pop or drop --stash-entry (default stash@{0});
+                --stash-message names the stash
   branch        Manage branches
-  checkout      Switch branches
+  checkout      Switch branches, rewriting only the files that differ (-j <n> writer threads)
   merge         Merge branches
-  reset         Reset to a specific commit
-  diff          Show differences between commits or the working directory
+  merge-base    Find the best common ancestors of commits (--all, --octopus)
+  reset         Reset to a commit, branch or reflog entry (HEAD@{1}, master@{yesterday});
+                --soft moves only the branch, --mixed (default) also resets the index,
+                --hard also the working tree; only differing entries and files are rewritten
+  reflog        Show where HEAD (or --reflog=<branch>) pointed over time;
+                --reflog=expire drops entries older than --expire (default 90.days.ago)
+  repack        Pack loose objects into a delta-compressed packfile
+  gc            Delete objects no ref, reflog, stash or the index reaches and repack the rest;
+                unreachable objects newer than --prune (default 2.weeks.ago) are kept
+  commit-graph  Write the commit-graph used to speed up history walks
+  pack-refs     Move branch refs into the sorted packed-refs file
+  batch         Answer object, info, rev-parse, ref and status requests read from stdin,
+                one per line, until end of input (--buffer: flush only on `flush`)
+  daemon        Keep the index, commit-graph and object caches of the repository loaded and
+                answer status, log, diff and rev-parse from them (start, stop, status, or run
+                in the foreground; exits after --idle-timeout seconds without requests)
+  rev-parse     Print the object id a revision names
+  fsmonitor     Watch the working tree so status, diff and add only look at changed paths
+                (start, stop, status, or run in the foreground)
+  diff          Show a unified diff against HEAD (-U<n>, --stat, --numstat, --diff-algorithm)
   visualize     Visualize the repository structure
   version       Show the version of kit-vcs
   help          Show this help message
-)" << std::endl;
+
+Options:
+  -q, --quiet      Only print warnings and errors
+  -v, --verbose    Also print debug messages (KIT_LOG_LEVEL=error|warning|info|debug)
+  --log-file FILE  Append log messages to FILE as well (KIT_LOG_FILE=FILE)
+  --trace[=FILE]   Write a Chrome trace of the command to FILE (default kit-trace.json);
+                   KIT_TRACE=FILE does the same
+)" << '\n';
     }
 
     // Visualize the repository structure
@@ -63,57 +113,49 @@ Commands:
         }
 
         std::cout << "\nRepository Visualization:\n"
-                  << std::endl;
+                  << '\n';
 
         // Display branches
-        std::cout << "Branches:" << std::endl;
+        std::cout << "Branches:\n";
         for (const auto &branch : branches)
         {
-            std::cout << "  - " << branch << std::endl;
+            std::cout << "  - " << branch << '\n';
         }
 
         // Display commit history
         if (!commit_history.empty())
         {
-            std::cout << "\nCommit History:" << std::endl;
+            std::cout << "\nCommit History:\n";
             for (const auto &commit : commit_history)
             {
-                std::cout << "  * " << commit << std::endl;
+                std::cout << "  * " << commit << '\n';
             }
         }
         else
         {
-            std::cout << "\nNo commits found in the repository." << std::endl;
+            std::cout << "\nNo commits found in the repository.\n";
         }
 
         std::cout << "\nVisualization complete.\n"
-                  << std::endl;
+                  << '\n';
     }
 
     // Handle the `init` command
-    inline void handle_init()
+    inline void handle_init(const std::string &object_format = "sha1")
     {
         display_welcome_screen();
-        if (!kit_vcs::initialize_repository())
+        if (!kit_vcs::initialize_repository(object_format))
         {
             error_handler::print_error("Failed to initialize repository.");
         }
     }
 
     // Handle the `add` command
-    inline void handle_add(const std::vector<std::string> &files)
+    inline void handle_add(const std::vector<std::string> &pathspecs, unsigned jobs = 0)
     {
-        for (const auto &file : files)
+        if (!kit_vcs::stage_paths(pathspecs, jobs))
         {
-            if (!std::filesystem::exists(file))
-            {
-                error_handler::print_error("File does not exist: " + file);
-                continue;
-            }
-            if (!kit_vcs::stage_file(file))
-            {
-                error_handler::print_error("Failed to stage file: " + file);
-            }
+            error_handler::print_error("Failed to stage some files.");
         }
     }
 
@@ -134,6 +176,10 @@ Commands:
     // Handle the `status` command
     inline void handle_status()
     {
+        if (forward_to_daemon("status"))
+        {
+            return;
+        }
         auto status = kit_vcs::get_repository_status();
         if (status.empty())
         {
@@ -143,7 +189,7 @@ Commands:
         {
             for (const auto &line : status)
             {
-                std::cout << line << std::endl;
+                std::cout << line << '\n';
             }
         }
     }
@@ -151,6 +197,10 @@ Commands:
     // Handle the `log` command
     inline void handle_log()
     {
+        if (forward_to_daemon("log"))
+        {
+            return;
+        }
         auto commit_history = kit_vcs::get_commit_history();
         if (commit_history.empty())
         {
@@ -160,17 +210,48 @@ Commands:
         {
             for (const auto &commit : commit_history)
             {
-                std::cout << commit << std::endl;
+                std::cout << commit << '\n';
             }
         }
     }
 
     // Handle the `stash` command
-    inline void handle_stash()
+    inline void handle_stash(const std::string &subcommand, const std::string &entry, const std::string &message,
+                             unsigned jobs = 0)
     {
-        if (!kit_vcs::stash_changes())
+        bool ok = false;
+        if (subcommand == "push")
+        {
+            ok = kit_vcs::push_stash(message, jobs);
+        }
+        else if (subcommand == "list")
+        {
+            ok = kit_vcs::list_stashes();
+        }
+        else if (subcommand == "show")
+        {
+            ok = kit_vcs::show_stash(entry);
+        }
+        else if (subcommand == "apply")
+        {
+            ok = kit_vcs::apply_stash(entry, jobs);
+        }
+        else if (subcommand == "pop")
+        {
+            ok = kit_vcs::pop_stash(entry, jobs);
+        }
+        else if (subcommand == "drop")
+        {
+            ok = kit_vcs::drop_stash(entry);
+        }
+        else
+        {
+            error_handler::print_error("Unknown stash command: " + subcommand);
+            return;
+        }
+        if (!ok)
         {
-            error_handler::print_error("Failed to stash changes.");
+            error_handler::print_error("Failed to run stash " + subcommand + ".");
         }
     }
 
@@ -187,20 +268,20 @@ Commands:
             kit_utils::print_message("Available branches:");
             for (const auto &branch : branches)
             {
-                std::cout << branch << std::endl;
+                std::cout << branch << '\n';
             }
         }
     }
 
     // Handle the `checkout` command
-    inline void handle_checkout(const std::string &branch)
+    inline void handle_checkout(const std::string &branch, unsigned jobs = 0)
     {
         if (branch.empty())
         {
             error_handler::print_error("Branch name cannot be empty.");
             return;
         }
-        if (!kit_vcs::switch_branch(branch))
+        if (!kit_vcs::switch_branch(branch, jobs))
         {
             error_handler::print_error("Failed to switch to branch: " + branch);
         }
@@ -221,19 +302,123 @@ Commands:
     }
 
     // Handle the `reset` command
-    inline void handle_reset(const std::string &commit)
+    inline void handle_reset(const std::string &commit, kit_vcs::ResetMode mode = kit_vcs::ResetMode::Mixed,
+                             unsigned jobs = 0)
     {
         if (commit.empty())
         {
             error_handler::print_error("Commit hash cannot be empty.");
             return;
         }
-        if (!kit_vcs::reset_to_commit(commit))
+        if (!kit_vcs::reset_to_commit(commit, mode, jobs))
         {
             error_handler::print_error("Failed to reset to commit: " + commit);
         }
     }
 
+    // Handle the `repack` command
+    inline void handle_repack()
+    {
+        if (!kit_vcs::repack_objects())
+        {
+            error_handler::print_error("Failed to repack objects.");
+        }
+    }
+
+    // Handle the `gc` command
+    inline void handle_gc(const std::string &prune, unsigned jobs = 0)
+    {
+        if (!kit_vcs::collect_garbage(prune, jobs))
+        {
+            error_handler::print_error("Failed to collect garbage.");
+        }
+    }
+
+    // Handle the `merge-base` command
+    inline void handle_merge_base(const std::vector<std::string> &revisions, bool all, bool octopus)
+    {
+        for (const auto &base : kit_vcs::find_merge_bases(revisions, all, octopus))
+        {
+            std::cout << base << '\n';
+        }
+    }
+
+    // Handle the `commit-graph` command
+    inline void handle_commit_graph(const std::string &subcommand)
+    {
+        if (subcommand != "write")
+        {
+            error_handler::print_error("Unknown commit-graph subcommand: " + subcommand + " (expected 'write')");
+            return;
+        }
+        if (!kit_vcs::write_commit_graph())
+        {
+            error_handler::print_error("Failed to write commit-graph.");
+        }
+    }
+
+    // Handle the `reflog` command
+    inline void handle_reflog(const std::string &subcommand, const std::string &expire)
+    {
+        bool ok = subcommand == "expire" ? kit_vcs::expire_reflogs(expire) : kit_vcs::show_reflog(subcommand);
+        if (!ok)
+        {
+            error_handler::print_error("Failed to run reflog " + subcommand + ".");
+        }
+    }
+
+    // Handle the `batch` command
+    inline void handle_batch(bool buffered)
+    {
+        // Reading a request must not flush responses that --buffer holds back
+        std::cin.tie(nullptr);
+        if (!kit_vcs::run_batch(std::cin, std::cout, buffered))
+        {
+            error_handler::print_error("Failed to run batch mode.");
+        }
+    }
+
+    // Handle the `pack-refs` command
+    inline void handle_pack_refs()
+    {
+        if (!kit_vcs::pack_refs())
+        {
+            error_handler::print_error("Failed to pack refs.");
+        }
+    }
+
+    // Handle the `fsmonitor` command
+    inline void handle_fsmonitor(const std::string &subcommand)
+    {
+        bool ok = true;
+        if (subcommand == "start")
+        {
+            ok = kit_vcs::start_fsmonitor();
+        }
+        else if (subcommand == "run")
+        {
+            ok = kit_vcs::run_fsmonitor();
+        }
+        else if (subcommand == "stop")
+        {
+            ok = kit_vcs::stop_fsmonitor();
+        }
+        else if (subcommand == "status")
+        {
+            ok = kit_vcs::show_fsmonitor_status();
+        }
+        else
+        {
+            error_handler::print_error("Unknown fsmonitor subcommand: " + subcommand +
+                                       " (expected 'start', 'run', 'stop' or 'status')");
+            return;
+        }
+        if (!ok)
+        {
+            error_handler::print_error("fsmonitor " + subcommand + " failed.");
+        }
+    }
+
     inline void handle_command(const std::string &command, const cxxopts::ParseResult &result)
     {
         static const std::unordered_map<std::string, std::function<void(const cxxopts::ParseResult &)>> commands = {
@@ -260,33 +445,130 @@ Commands:
     }
 
     // Handle the `diff` command
-    inline void handle_diff()
+    inline void handle_diff(const kit_vcs::DiffOptions &options)
+    {
+        std::string request = "diff " + std::to_string(options.context) + " " + std::to_string(options.stat) + " " +
+                              std::to_string(options.numstat) + " " +
+                              (options.algorithm == line_diff::Algorithm::Myers ? "myers" : "histogram");
+        if (forward_to_daemon(request))
+        {
+            return;
+        }
+        if (!kit_vcs::show_diff("HEAD", options))
+        {
+            error_handler::print_error("Failed to display differences.");
+        }
+    }
+
+    // Handle the `rev-parse` command
+    inline void handle_rev_parse(const std::string &revision)
     {
-        try
+        if (forward_to_daemon("rev-parse " + revision))
+        {
+            return;
+        }
+        if (!kit_utils::ensure_repository_initialized())
         {
-            // Default to HEAD or specify the desired commit hash
-            std::string commit_hash = "HEAD";
+            return;
+        }
+        std::string oid = kit_utils::resolve_revision(revision);
+        if (oid.empty() || oid.find_first_not_of("0123456789abcdef") != std::string::npos ||
+            !object_store::object_exists(oid))
+        {
+            error_handler::print_error("Unknown revision: " + revision);
+            return;
+        }
+        std::cout << oid << '\n';
+    }
 
-            // Retrieve differences
-            auto differences = kit_vcs::get_differences(commit_hash);
+    // Answer one request forwarded by `forward_to_daemon`: "<log level> <command> [args...]".
+    // The command runs with the client's log level and its output is captured for the reply.
+    inline repo_daemon::Reply serve_daemon_request(const std::string &request)
+    {
+        std::istringstream fields(request);
+        int level = static_cast<int>(logger::Level::Info);
+        std::string command;
+        fields >> level >> command;
 
-            // Check if differences are empty
-            if (differences.empty())
+        std::ostringstream out, err;
+        struct Capture
+        {
+            logger::Level level;
+            std::streambuf *out;
+            std::streambuf *err;
+            ~Capture()
             {
-                kit_utils::print_message("No differences to display.");
-                return;
+                std::cout.rdbuf(out);
+                std::cerr.rdbuf(err);
+                logger::set_level(level);
             }
+        } capture{logger::level(), std::cout.rdbuf(out.rdbuf()), std::cerr.rdbuf(err.rdbuf())};
+        logger::set_level(static_cast<logger::Level>(level));
 
-            // Display differences
-            std::cout << "Differences:\n";
-            for (const auto &diff : differences)
+        if (command == "status")
+        {
+            handle_status();
+        }
+        else if (command == "log")
+        {
+            handle_log();
+        }
+        else if (command == "diff")
+        {
+            kit_vcs::DiffOptions options;
+            std::string algorithm;
+            fields >> options.context >> options.stat >> options.numstat >> algorithm;
+            options.algorithm = algorithm == "myers" ? line_diff::Algorithm::Myers : line_diff::Algorithm::Histogram;
+            handle_diff(options);
+        }
+        else if (command == "rev-parse")
+        {
+            // The revision is the rest of the request, spaces included ("master@{1 second ago}")
+            std::string revision;
+            std::getline(fields, revision, '\0');
+            if (!revision.empty() && revision[0] == ' ')
             {
-                std::cout << "  - " << diff << std::endl;
+                revision.erase(0, 1);
             }
+            handle_rev_parse(revision);
+        }
+        else
+        {
+            error_handler::print_error("Unknown daemon request: " + command);
+        }
+        std::cout.flush();
+        return {out.str(), err.str()};
+    }
+
+    // Handle the `daemon` command
+    inline void handle_daemon(const std::string &subcommand, int idle_timeout)
+    {
+        bool ok = true;
+        if (subcommand == "start")
+        {
+            ok = kit_vcs::start_daemon(serve_daemon_request, idle_timeout);
+        }
+        else if (subcommand == "run")
+        {
+            ok = kit_vcs::run_daemon(serve_daemon_request, idle_timeout);
+        }
+        else if (subcommand == "stop")
+        {
+            ok = kit_vcs::stop_daemon();
+        }
+        else if (subcommand == "status")
+        {
+            ok = kit_vcs::show_daemon_status();
+        }
+        else
+        {
+            error_handler::print_error("Unknown daemon subcommand: " + subcommand +
+                                       " (expected 'start', 'run', 'stop' or 'status')");
+            return;
         }
-        catch (const std::exception &e)
+        if (!ok)
         {
-            kit_utils::print_error("Failed to display differences: " + std::string(e.what()));
+            error_handler::print_error("daemon " + subcommand + " failed.");
         }
     }
 
@@ -0,0 +1,296 @@
+#ifndef ADD_HPP
+#define ADD_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <iomanip>
+#include <sstream>
+#include "../utils/constants.hpp"
+#include "../utils/fsmonitor.hpp"
+#include "../utils/kit_utils.hpp"
+#include "../utils/index.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/pathspec.hpp"
+#include "../utils/thread_pool.hpp"
+#include "../utils/trace.hpp"
+#include "../utils/worktree.hpp"
+
+namespace kit_vcs
+{
+    // Throughput figures reported by `stage_paths`
+    struct StageStats
+    {
+        size_t files = 0;         // files staged
+        size_t removed = 0;       // tracked files staged as deleted
+        size_t hashed_files = 0;  // files whose stat data was stale and had to be read
+        std::uint64_t bytes = 0;  // bytes read and hashed
+        size_t failures = 0;      // files that could not be staged
+        double seconds = 0.0;
+        unsigned jobs = 0;
+    };
+
+    namespace detail
+    {
+        // The tracked files the pathspecs cover, and which of them the walk found on disk. A covered
+        // index entry the walk did not produce was deleted from the working tree.
+        struct Coverage
+        {
+            std::vector<std::string> prefixes; // directories and explicit paths; "" is the top level
+            std::vector<std::string> patterns; // glob pathspecs
+            std::unordered_set<std::string> walked;
+
+            bool covers(const std::string &path) const
+            {
+                for (const auto &prefix : prefixes)
+                {
+                    if (prefix.empty() || path == prefix ||
+                        (path.size() > prefix.size() && path[prefix.size()] == '/' && path.compare(0, prefix.size(), prefix) == 0))
+                    {
+                        return true;
+                    }
+                }
+                for (const auto &pattern : patterns)
+                {
+                    if (pathspec::match(pattern, path))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+        };
+
+        inline std::string spec_prefix(const std::string &spec)
+        {
+            std::string prefix = kit_index::normalize_path(spec);
+            return prefix == "." ? "" : prefix;
+        }
+
+        // Scan a directory and feed every file below it to the queue; `.kit`, build trees and
+        // ignored paths that are not already tracked are skipped
+        inline void enumerate_directory(const std::string &root, const std::string &pattern,
+                                        const kit_index::Index &index, thread_pool::BlockingQueue<std::string> &queue,
+                                        Coverage &coverage, size_t &matched)
+        {
+            worktree::ScanOptions options;
+            options.index = &index;
+            for (auto &record : fsmonitor::scan(root, options))
+            {
+                if (pattern.empty() || pathspec::match(pattern, record.path))
+                {
+                    coverage.walked.insert(record.path);
+                    queue.push(std::move(record.path));
+                    ++matched;
+                }
+            }
+        }
+
+        // Expand files, directories and glob pathspecs into individual files
+        inline void enumerate_pathspecs(const std::vector<std::string> &pathspecs, const kit_index::Index &index,
+                                        thread_pool::BlockingQueue<std::string> &queue, Coverage &coverage)
+        {
+            for (const auto &spec : pathspecs)
+            {
+                size_t matched = 0;
+                Coverage own;
+                try
+                {
+                    if (pathspec::has_wildcards(spec))
+                    {
+                        own.patterns.push_back(kit_index::normalize_path(spec));
+                        std::string root = pathspec::walk_root(spec);
+                        if (std::filesystem::is_directory(root))
+                        {
+                            enumerate_directory(root, own.patterns.back(), index, queue, coverage, matched);
+                        }
+                    }
+                    else if (std::filesystem::is_directory(spec))
+                    {
+                        own.prefixes.push_back(spec_prefix(spec));
+                        enumerate_directory(spec, "", index, queue, coverage, matched);
+                    }
+                    else if (std::filesystem::exists(std::filesystem::symlink_status(spec)))
+                    {
+                        coverage.walked.insert(kit_index::normalize_path(spec));
+                        queue.push(kit_index::normalize_path(spec));
+                        ++matched;
+                    }
+                    else
+                    {
+                        own.prefixes.push_back(spec_prefix(spec));
+                    }
+                }
+                catch (const std::exception &e)
+                {
+                    kit_utils::print_error("Failed to read pathspec " + spec + ": " + e.what());
+                    continue; // a partial walk must not stage the files it missed as deleted
+                }
+
+                // A pathspec that only names deleted tracked files still matches them
+                if (matched == 0 && std::none_of(index.entries.begin(), index.entries.end(), [&](const kit_index::Entry &entry)
+                                                 { return own.covers(entry.path); }))
+                {
+                    kit_utils::print_error("Pathspec did not match any files: " + spec);
+                }
+                coverage.prefixes.insert(coverage.prefixes.end(), own.prefixes.begin(), own.prefixes.end());
+                coverage.patterns.insert(coverage.patterns.end(), own.patterns.begin(), own.patterns.end());
+            }
+            queue.close();
+        }
+
+        // Remove the covered entries whose files were deleted; returns how many were removed
+        inline size_t stage_deletions(kit_index::Index &index, const Coverage &coverage)
+        {
+            std::vector<kit_index::Entry> kept;
+            kept.reserve(index.entries.size());
+            size_t removed = 0;
+            for (auto &entry : index.entries)
+            {
+                if (!coverage.walked.count(entry.path) && coverage.covers(entry.path))
+                {
+                    kit_index::invalidate_cache_tree(index, entry.path);
+                    ++removed;
+                }
+                else
+                {
+                    kept.push_back(std::move(entry));
+                }
+            }
+            index.entries = std::move(kept);
+            return removed;
+        }
+    } // namespace detail
+
+    // Stage files, directories and glob pathspecs in bulk.
+    // One thread enumerates paths, `jobs` workers read, hash and compress them in parallel,
+    // and the index is rewritten once at the end. Tracked files under the pathspecs that no
+    // longer exist are staged as deleted.
+    inline bool stage_paths(const std::vector<std::string> &pathspecs, unsigned jobs = 0, StageStats *stats = nullptr)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        trace::Span span("add");
+        StageStats result;
+        result.jobs = thread_pool::default_jobs(jobs);
+        auto start = std::chrono::steady_clock::now();
+
+        try
+        {
+            // Workers only read the snapshot; updates are applied by the single writer below. The
+            // index stays locked until then, so a concurrent writer cannot lose its changes.
+            kit_index::Update update;
+            const kit_index::Index &index = update.index();
+
+            thread_pool::BlockingQueue<std::string> paths(4096);
+            detail::Coverage coverage;
+            std::thread enumerator([&]
+                                   {
+                trace::Span enumerate_span("add.enumerate");
+                detail::enumerate_pathspecs(pathspecs, index, paths, coverage); });
+
+            std::vector<std::vector<kit_index::Entry>> staged(result.jobs);
+            std::atomic<size_t> hashed_files{0};
+            std::atomic<std::uint64_t> bytes{0};
+            std::atomic<size_t> failures{0};
+
+            std::vector<std::thread> workers;
+            workers.reserve(result.jobs);
+            for (unsigned worker = 0; worker < result.jobs; ++worker)
+            {
+                workers.emplace_back([&, worker]
+                                     {
+                    trace::Span hash_span("add.hash");
+                    while (auto path = paths.pop())
+                    {
+                        try
+                        {
+                            kit_index::Entry entry;
+                            entry.path = *path;
+                            if (!kit_index::stat_file(entry.path, entry.stat))
+                            {
+                                throw std::runtime_error("cannot stat file");
+                            }
+
+                            const auto *existing = kit_index::find_entry(index, entry.path);
+                            if (existing && kit_index::is_stat_clean(index, *existing, entry.stat))
+                            {
+                                entry.oid = existing->oid;
+                            }
+                            else
+                            {
+                                entry.oid = object_id::ObjectId::from_hex(object_store::write_blob_from_file(entry.path));
+                                hashed_files.fetch_add(1, std::memory_order_relaxed);
+                                bytes.fetch_add(entry.stat.size, std::memory_order_relaxed);
+                            }
+                            staged[worker].push_back(std::move(entry));
+                        }
+                        catch (const std::exception &e)
+                        {
+                            failures.fetch_add(1, std::memory_order_relaxed);
+                            kit_utils::print_error("Failed to stage file " + *path + ": " + e.what());
+                        }
+                    } });
+            }
+
+            enumerator.join();
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+
+            // Single writer: merge all updates and rewrite the index atomically
+            std::vector<kit_index::Entry> updates;
+            for (auto &batch : staged)
+            {
+                result.files += batch.size();
+                std::move(batch.begin(), batch.end(), std::back_inserter(updates));
+            }
+
+            {
+                trace::Span merge_span("add.merge_index");
+                kit_index::merge_entries(update.index(), std::move(updates));
+                result.removed = detail::stage_deletions(update.index(), coverage);
+            }
+            update.commit();
+
+            result.hashed_files = hashed_files.load();
+            result.bytes = bytes.load();
+            result.failures = failures.load();
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to stage files: " + std::string(e.what()));
+            return false;
+        }
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double megabytes = static_cast<double>(result.bytes) / (1024.0 * 1024.0);
+        double seconds = result.seconds > 0.0 ? result.seconds : 1e-9;
+        std::ostringstream summary;
+        summary << std::fixed << std::setprecision(2)
+                << "Staged " << result.files << " file(s), " << result.removed << " deletion(s), hashed " << result.hashed_files
+                << " (" << megabytes << " MB) in " << result.seconds << "s with " << result.jobs
+                << " thread(s): " << static_cast<double>(result.files) / seconds << " files/s, "
+                << megabytes / seconds << " MB/s";
+        kit_utils::print_message(summary.str());
+
+        if (stats)
+        {
+            *stats = result;
+        }
+        return result.failures == 0 && result.files + result.removed > 0;
+    }
+} // namespace kit_vcs
+
+#endif // ADD_HPP
@@ -0,0 +1,255 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include "../utils/constants.hpp"
+#include "../utils/index.hpp"
+#include "../utils/kit_utils.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/refs.hpp"
+#include "../utils/trace.hpp"
+#include "../utils/worktree.hpp"
+
+// Long-lived request loop for tools that would otherwise start `kit` once per lookup. Requests
+// are read one per line from stdin and answered on stdout, in order:
+//
+//   object <rev>     <id> <type> <size>\n<content>\n
+//   info <rev>       <id> <type> <size>\n
+//   rev-parse <rev>  <id>\n
+//   ref <name>       <id> <full ref name>\n           (HEAD, refs/... or a branch name)
+//   status <path>    <XY> <path>\n                    (X: index vs HEAD, Y: worktree vs index;
+//                                                     '.' unchanged, A/M/D, "??" untracked,
+//                                                     "!!" ignored)
+//   flush            nothing; writes out buffered responses
+//
+// Anything that cannot be found is answered with "<request argument> missing\n", malformed
+// requests with "error <size>\n<message>\n". Responses are flushed one by one, or with --buffer
+// only on `flush` and at end of input. The index, the HEAD tree and the object caches stay loaded
+// between requests and are reread only when the index file, the ignore file or HEAD changes.
+namespace kit_vcs
+{
+    class BatchSession
+    {
+    public:
+        // Answer one request line, appending the response to `out`; returns false for `flush`
+        bool handle(const std::string &line, std::string &out)
+        {
+            trace::Span span("batch.request");
+            size_t space = line.find(' ');
+            std::string command = line.substr(0, space);
+            std::string argument = space == std::string::npos ? "" : line.substr(space + 1);
+
+            if (command == "flush")
+            {
+                return false;
+            }
+            try
+            {
+                if (command == "object" || command == "info")
+                {
+                    std::string oid = resolve(argument);
+                    if (oid.empty())
+                    {
+                        out += argument + " missing\n";
+                        return true;
+                    }
+                    std::string type;
+                    std::string content = object_store::read_object(oid, &type);
+                    out += oid + " " + type + " " + std::to_string(content.size()) + "\n";
+                    if (command == "object")
+                    {
+                        out += content;
+                        out += '\n';
+                    }
+                }
+                else if (command == "rev-parse")
+                {
+                    std::string oid = resolve(argument);
+                    out += oid.empty() ? argument + " missing\n" : oid + "\n";
+                }
+                else if (command == "ref")
+                {
+                    std::string name = argument == refs::HEAD || argument.rfind("refs/", 0) == 0
+                                           ? argument
+                                           : refs::HEADS_PREFIX + argument;
+                    std::string oid = refs::is_valid_name(name) ? refs::resolve(name) : "";
+                    out += oid.empty() ? argument + " missing\n" : oid + " " + name + "\n";
+                }
+                else if (command == "status")
+                {
+                    out += status(argument);
+                }
+                else
+                {
+                    error(out, line.empty() ? std::string("Empty request") : "Unknown request: " + command);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                error(out, e.what());
+            }
+            return true;
+        }
+
+    private:
+        static void error(std::string &out, const std::string &message)
+        {
+            out += "error " + std::to_string(message.size()) + "\n" + message + "\n";
+        }
+
+        // Object id of a revision, or empty if it names no object
+        static std::string resolve(const std::string &revision)
+        {
+            if (revision.empty())
+            {
+                return "";
+            }
+            std::string oid = kit_utils::resolve_revision(revision);
+            if (oid.find_first_not_of("0123456789abcdef") != std::string::npos)
+            {
+                return "";
+            }
+            return object_store::object_exists(oid) ? oid : "";
+        }
+
+        // Reload the index only when the file changed since it was last read
+        const kit_index::Index &index()
+        {
+            kit_index::StatData stat;
+            bool exists = kit_index::stat_file(INDEX_FILE, stat);
+            if (!loaded_index_ || !exists || !(stat == index_stat_))
+            {
+                index_ = exists ? kit_index::load_shared() : std::make_shared<const kit_index::Index>();
+                index_stat_ = stat;
+                loaded_index_ = exists;
+            }
+            return *index_;
+        }
+
+        // Files of the HEAD commit, reread only when HEAD moves
+        const std::map<std::string, std::string> &head_files()
+        {
+            std::string head = kit_utils::resolve_head();
+            if (head != head_)
+            {
+                head_files_ = head.empty() ? std::map<std::string, std::string>() : kit_utils::read_commit_files(head);
+                head_ = head;
+            }
+            return head_files_;
+        }
+
+        bool ignored(const std::string &path)
+        {
+            // Reload the ignore rules only when the ignore file changed since they were read
+            kit_index::StatData stat;
+            bool exists = kit_index::stat_file(IGNORE_FILE, stat);
+            if (!ignore_rules_ || exists != ignore_exists_ || !(stat == ignore_stat_))
+            {
+                ignore_rules_ = std::make_unique<worktree::IgnoreRules>(worktree::IgnoreRules::load());
+                ignore_stat_ = stat;
+                ignore_exists_ = exists;
+            }
+            for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1))
+            {
+                if (ignore_rules_->is_ignored(path.substr(0, slash), true))
+                {
+                    return true;
+                }
+            }
+            return ignore_rules_->is_ignored(path, false);
+        }
+
+        std::string status(const std::string &argument)
+        {
+            std::string path = kit_index::normalize_path(argument);
+            const kit_index::Index &idx = index();
+            const auto &committed = head_files();
+            const kit_index::Entry *entry = kit_index::find_entry(idx, path);
+            auto head_it = committed.find(path);
+            kit_index::StatData stat;
+            bool on_disk = kit_index::stat_file(path, stat);
+
+            if (!entry && head_it == committed.end())
+            {
+                if (!on_disk)
+                {
+                    return argument + " missing\n";
+                }
+                return (ignored(path) ? "!! " : "?? ") + path + "\n";
+            }
+
+            char staged = '.';
+            if (!entry)
+            {
+                staged = 'D';
+            }
+            else if (head_it == committed.end())
+            {
+                staged = 'A';
+            }
+            else if (head_it->second != entry->oid.hex())
+            {
+                staged = 'M';
+            }
+
+            char unstaged = '.';
+            if (entry && !on_disk)
+            {
+                unstaged = 'D';
+            }
+            else if (entry && !kit_index::is_stat_clean(idx, *entry, stat) &&
+                     object_store::hash_file(path) != entry->oid.hex())
+            {
+                unstaged = 'M';
+            }
+            return std::string{staged, unstaged, ' '} + path + "\n";
+        }
+
+        std::shared_ptr<const kit_index::Index> index_;
+        kit_index::StatData index_stat_;
+        bool loaded_index_ = false;
+        std::string head_;
+        std::map<std::string, std::string> head_files_;
+        std::unique_ptr<worktree::IgnoreRules> ignore_rules_;
+        kit_index::StatData ignore_stat_;
+        bool ignore_exists_ = false;
+    };
+
+    // Answer requests from `in` until it ends. Unless `buffered`, every response is flushed as
+    // soon as it is written so the caller can use kit as a coprocess.
+    inline bool run_batch(std::istream &in, std::ostream &out, bool buffered)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        BatchSession session;
+        std::string line;
+        std::string response;
+        while (std::getline(in, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            bool answered = session.handle(line, response);
+            if (!response.empty())
+            {
+                out.write(response.data(), static_cast<std::streamsize>(response.size()));
+                response.clear();
+            }
+            if (!answered || !buffered)
+            {
+                out.flush();
+            }
+        }
+        out.flush();
+        return true;
+    }
+} // namespace kit_vcs
+
+#endif // BATCH_HPP
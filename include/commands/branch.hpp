@@ -6,6 +6,8 @@
 #include <filesystem>
 #include "../utils/constants.hpp"
 #include "../utils/kit_utils.hpp"
+#include "../utils/refs.hpp"
+#include "checkout.hpp"
 
 namespace kit_vcs
 {
@@ -19,24 +21,32 @@ namespace kit_vcs
 
         try
         {
-            std::string branch_path = HEADS_DIR + "/" + branch_name;
+            std::string branch = refs::HEADS_PREFIX + branch_name;
+            if (!refs::is_valid_name(branch))
+            {
+                kit_utils::print_error("Invalid branch name: " + branch_name);
+                return false;
+            }
 
             // Check if the branch already exists
-            if (std::filesystem::exists(branch_path))
+            if (refs::exists(branch))
             {
                 kit_utils::print_error("Branch already exists: " + branch_name);
                 return false;
             }
 
             // Read the current HEAD commit hash
-            std::string current_commit;
-            if (std::ifstream head_file(HEAD_FILE); head_file)
+            std::string current_commit = kit_utils::resolve_head();
+            if (current_commit.empty())
             {
-                std::getline(head_file, current_commit);
+                kit_utils::print_error("Cannot create a branch before the first commit.");
+                return false;
             }
 
-            // Create the branch file with the current commit hash
-            kit_utils::create_file(branch_path, current_commit);
+            // Create the branch at the current commit; fails if another process created it meanwhile
+            refs::Transaction transaction("branch: Created from HEAD");
+            transaction.create(branch, current_commit);
+            transaction.commit();
             kit_utils::print_message("Branch created successfully: " + branch_name);
             return true;
         }
@@ -59,12 +69,9 @@ namespace kit_vcs
 
         try
         {
-            for (const auto &entry : std::filesystem::directory_iterator(HEADS_DIR))
+            for (const auto &ref : refs::list(refs::HEADS_PREFIX))
             {
-                if (entry.is_regular_file())
-                {
-                    branches.push_back(entry.path().filename().string());
-                }
+                branches.push_back(ref.name.substr(refs::HEADS_PREFIX.size()));
             }
 
             if (branches.empty())
@@ -80,35 +87,10 @@ namespace kit_vcs
         return branches;
     }
 
-    // Change to a different branch
+    // Change to a different branch, updating the working tree
     inline bool change_branch(const std::string &branch_name)
     {
-        if (!kit_utils::ensure_repository_initialized())
-        {
-            return false;
-        }
-
-        try
-        {
-            std::string branch_path = HEADS_DIR + "/" + branch_name;
-
-            // Check if the branch exists
-            if (!std::filesystem::exists(branch_path))
-            {
-                kit_utils::print_error("Branch does not exist: " + branch_name);
-                return false;
-            }
-
-            // Update the HEAD file to point to the branch
-            kit_utils::create_file(HEAD_FILE, branch_name);
-            kit_utils::print_message("Switched to branch: " + branch_name);
-            return true;
-        }
-        catch (const std::exception &e)
-        {
-            kit_utils::print_error("Failed to switch branch: " + std::string(e.what()));
-            return false;
-        }
+        return switch_branch(branch_name);
     }
 
     // Delete a branch
@@ -121,30 +103,27 @@ namespace kit_vcs
 
         try
         {
-            std::string branch_path = HEADS_DIR + "/" + branch_name;
+            std::string branch = refs::HEADS_PREFIX + branch_name;
 
             // Check if the branch exists
-            if (!std::filesystem::exists(branch_path))
+            std::string tip;
+            if (!refs::is_valid_name(branch) || !refs::read(branch, tip))
             {
                 kit_utils::print_error("Branch does not exist: " + branch_name);
                 return false;
             }
 
             // Check if the branch is the currently checked-out branch
-            std::string current_branch;
-            if (std::ifstream head_file(HEAD_FILE); head_file)
-            {
-                std::getline(head_file, current_branch);
-            }
-
-            if (current_branch == branch_name)
+            if (refs::head_target() == branch)
             {
                 kit_utils::print_error("Cannot delete the currently checked-out branch: " + branch_name);
                 return false;
             }
 
-            // Delete the branch file
-            std::filesystem::remove(branch_path);
+            // Delete the loose and packed copies, unless the branch moved since it was read
+            refs::Transaction transaction;
+            transaction.remove(branch, tip);
+            transaction.commit();
             kit_utils::print_message("Branch deleted successfully: " + branch_name);
             return true;
         }
@@ -4,12 +4,52 @@
 #include <string>
 #include <filesystem>
 #include "../utils/constants.hpp"
+#include "../utils/index.hpp"
 #include "../utils/kit_utils.hpp"
+#include "../utils/logger.hpp"
+#include "../utils/refs.hpp"
+#include "../utils/trace.hpp"
+#include "../utils/tree_checkout.hpp"
 
 namespace kit_vcs
 {
-    inline bool switch_branch(const std::string &branch_name)
+    // Move the working tree and index from the current commit to `target`, touching only the files
+    // that differ. Nothing is written if a local change would be overwritten.
+    inline bool checkout_tree(const std::string &current, const std::string &target, unsigned jobs = 0)
     {
+        std::string from_tree = current.empty() ? "" : kit_utils::read_commit(current)->tree;
+        std::string to_tree = kit_utils::read_commit(target)->tree;
+        auto changes = tree_checkout::diff_trees(from_tree, to_tree);
+        if (changes.empty())
+        {
+            return true;
+        }
+
+        kit_index::Update update;
+        kit_index::Index &index = update.index();
+        auto conflicts = tree_checkout::find_conflicts(index, changes);
+        if (!conflicts.empty())
+        {
+            kit_utils::print_error("Your local changes to the following files would be overwritten by checkout:");
+            for (const auto &path : conflicts)
+            {
+                kit_utils::print_error("  " + path);
+            }
+            kit_utils::print_error("Commit or stash them before switching branches.");
+            return false;
+        }
+
+        auto result = tree_checkout::apply(index, changes, jobs);
+        update.commit();
+        logger::debug([&]
+                      { return "Checkout wrote " + std::to_string(result.written) + ", removed " +
+                               std::to_string(result.removed) + " and chmodded " + std::to_string(result.chmodded) + " files"; });
+        return true;
+    }
+
+    inline bool switch_branch(const std::string &branch_name, unsigned jobs = 0)
+    {
+        trace::Span span("checkout");
         // Ensure the repository is initialized
         if (!kit_utils::ensure_repository_initialized())
         {
@@ -18,18 +58,27 @@ namespace kit_vcs
 
         try
         {
-            // Construct the branch path
-            std::string branch_path = HEADS_DIR + "/" + branch_name;
+            std::string branch = refs::HEADS_PREFIX + branch_name;
 
             // Check if the branch exists
-            if (!std::filesystem::exists(branch_path))
+            if (!refs::is_valid_name(branch) || !refs::exists(branch))
             {
                 kit_utils::print_error("Branch does not exist: " + branch_name);
                 return false;
             }
 
-            // Update the HEAD file to point to the new branch
-            kit_utils::create_file(HEAD_FILE, "ref: refs/heads/" + branch_name + "\n");
+            // Update the files first, so HEAD only moves once the working tree matches the branch
+            std::string current = kit_utils::resolve_head();
+            std::string target = refs::resolve(branch);
+            if (current != target && !checkout_tree(current, target, jobs))
+            {
+                return false;
+            }
+
+            // Point HEAD at the new branch
+            refs::Transaction transaction(kit_utils::checkout_message(branch_name));
+            transaction.set_symbolic(refs::HEAD, branch);
+            transaction.commit();
             kit_utils::print_message("Switched to branch: " + branch_name);
 
             return true;
@@ -0,0 +1,32 @@
+#ifndef COMMIT_GRAPH_COMMAND_HPP
+#define COMMIT_GRAPH_COMMAND_HPP
+
+#include <string>
+#include "../utils/commit_graph.hpp"
+#include "../utils/kit_utils.hpp"
+
+namespace kit_vcs
+{
+    // Rewrite the commit-graph from scratch for every commit reachable from HEAD and the branches
+    inline bool write_commit_graph()
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            size_t count = commit_graph::write(kit_utils::list_ref_tips());
+            kit_utils::print_message("Wrote commit-graph with " + std::to_string(count) + " commit(s)");
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to write commit-graph: " + std::string(e.what()));
+            return false;
+        }
+    }
+} // namespace kit_vcs
+
+#endif // COMMIT_GRAPH_COMMAND_HPP
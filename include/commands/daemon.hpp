@@ -0,0 +1,162 @@
+#ifndef DAEMON_COMMAND_HPP
+#define DAEMON_COMMAND_HPP
+
+#include <string>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../utils/fsmonitor.hpp"
+#include "../utils/index.hpp"
+#include "../utils/kit_utils.hpp"
+#include "../utils/logger.hpp"
+#include "../utils/repo_daemon.hpp"
+
+namespace kit_vcs
+{
+    namespace detail
+    {
+        // Serve requests until stopped or idle. The working tree is watched by the daemon's own
+        // filesystem monitor unless one is already running, so status never rescans the tree.
+        inline void serve_repository(const repo_daemon::Handler &handler, int idle_timeout)
+        {
+            std::unique_ptr<fsmonitor::Daemon> watcher;
+            std::thread watcher_thread;
+            if (!fsmonitor::is_running())
+            {
+                watcher = std::make_unique<fsmonitor::Daemon>();
+                watcher_thread = std::thread([&watcher] { watcher->run(); });
+            }
+
+            auto shut_down = [&]
+            {
+                kit_index::keep_resident(false);
+                fsmonitor::keep_state_resident(false);
+                if (watcher)
+                {
+                    std::string reply;
+                    fsmonitor::request("stop", reply);
+                    watcher_thread.join();
+                }
+            };
+            try
+            {
+                repo_daemon::Server server(handler, idle_timeout);
+                kit_index::keep_resident(true);
+                fsmonitor::keep_state_resident(true);
+                server.run();
+            }
+            catch (...)
+            {
+                shut_down();
+                throw;
+            }
+            shut_down();
+        }
+    } // namespace detail
+
+    // Serve the repository in the foreground until `kit daemon stop` or the idle timeout
+    inline bool run_daemon(const repo_daemon::Handler &handler, int idle_timeout)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            detail::serve_repository(handler, idle_timeout);
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Repository daemon failed: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    // Start the daemon in the background and wait until it answers
+    inline bool start_daemon(const repo_daemon::Handler &handler, int idle_timeout)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+        if (repo_daemon::is_running())
+        {
+            kit_utils::print_message("Repository daemon is already running.");
+            return true;
+        }
+
+        pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            kit_utils::print_error("Failed to start repository daemon: fork failed");
+            return false;
+        }
+        if (pid == 0)
+        {
+            // Detach from the terminal so the daemon outlives the command
+            logger::after_fork();
+            ::setsid();
+            int null_fd = ::open("/dev/null", O_RDWR);
+            if (null_fd >= 0)
+            {
+                ::dup2(null_fd, STDIN_FILENO);
+                ::dup2(null_fd, STDOUT_FILENO);
+                ::dup2(null_fd, STDERR_FILENO);
+                ::close(null_fd);
+            }
+            int status = 1;
+            try
+            {
+                detail::serve_repository(handler, idle_timeout);
+                status = 0;
+            }
+            catch (...)
+            {
+            }
+            ::_exit(status);
+        }
+
+        for (int attempt = 0; attempt < 100; ++attempt)
+        {
+            if (repo_daemon::is_running())
+            {
+                kit_utils::print_message("Repository daemon started (pid " + std::to_string(pid) + ").");
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        kit_utils::print_error("Repository daemon did not start.");
+        return false;
+    }
+
+    inline bool stop_daemon()
+    {
+        std::string reply;
+        if (!repo_daemon::send("stop", reply))
+        {
+            kit_utils::print_message("Repository daemon is not running.");
+            return true;
+        }
+        kit_utils::print_message("Repository daemon stopped.");
+        return true;
+    }
+
+    inline bool show_daemon_status()
+    {
+        std::string reply;
+        if (!repo_daemon::send("ping", reply) || reply.rfind("ok ", 0) != 0)
+        {
+            kit_utils::print_message("Repository daemon is not running.");
+            return true;
+        }
+        std::string pid = reply.substr(3, reply.find('\n') - 3);
+        kit_utils::print_message("Repository daemon is running (pid " + pid + ").");
+        return true;
+    }
+} // namespace kit_vcs
+
+#endif // DAEMON_COMMAND_HPP
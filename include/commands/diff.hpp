@@ -2,67 +2,211 @@
 #define DIFF_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
 #include <unordered_map>
 #include <filesystem>
 #include "../utils/kit_utils.hpp"
 #include "../utils/constants.hpp"
+#include "../utils/line_diff.hpp"
+#include "../utils/mapped_file.hpp"
+#include "../utils/trace.hpp"
 
 namespace kit_vcs
 {
+    // Output settings for `kit diff`
+    struct DiffOptions
+    {
+        size_t context = 3;
+        bool stat = false;
+        bool numstat = false;
+        line_diff::Algorithm algorithm = line_diff::Algorithm::Histogram;
+    };
+
     // Get differences between the working directory and a specific commit
     inline std::vector<std::string> get_differences(const std::string &commit_hash)
     {
-        std::vector<std::string> differences;
+        // Unchanged files are recognised from the index stat cache and never read
+        return kit_utils::get_differences(commit_hash);
+    }
 
-        try
+    namespace detail
+    {
+        struct FileStat
         {
-            // Validate the commit hash
-            if (commit_hash.empty())
+            std::string path;
+            size_t insertions = 0;
+            size_t deletions = 0;
+            bool binary = false;
+        };
+
+        inline void write_stat(std::ostream &out, const std::vector<FileStat> &stats)
+        {
+            constexpr size_t BAR_WIDTH = 50;
+            size_t name_width = 0, max_changes = 0, insertions = 0, deletions = 0;
+            for (const auto &file : stats)
             {
-                throw std::runtime_error("Commit hash is empty.");
+                name_width = std::max(name_width, file.path.size());
+                max_changes = std::max(max_changes, file.insertions + file.deletions);
+                insertions += file.insertions;
+                deletions += file.deletions;
             }
+            size_t count_width = std::to_string(max_changes).size();
 
-            // Retrieve files from the specified commit
-            auto commit_files = kit_utils::get_commit_files(commit_hash);
+            for (const auto &file : stats)
+            {
+                out << " " << std::left << std::setw(static_cast<int>(name_width)) << file.path << " | ";
+                if (file.binary)
+                {
+                    out << "Bin\n";
+                    continue;
+                }
+                size_t changes = file.insertions + file.deletions;
+                size_t plus = file.insertions, minus = file.deletions;
+                if (max_changes > BAR_WIDTH)
+                {
+                    plus = (file.insertions * BAR_WIDTH + max_changes - 1) / max_changes;
+                    minus = (file.deletions * BAR_WIDTH + max_changes - 1) / max_changes;
+                }
+                out << std::right << std::setw(static_cast<int>(count_width)) << changes << " "
+                    << std::string(plus, '+') << std::string(minus, '-') << "\n";
+            }
+            out << " " << stats.size() << (stats.size() == 1 ? " file changed" : " files changed");
+            if (insertions > 0)
+            {
+                out << ", " << insertions << (insertions == 1 ? " insertion(+)" : " insertions(+)");
+            }
+            if (deletions > 0)
+            {
+                out << ", " << deletions << (deletions == 1 ? " deletion(-)" : " deletions(-)");
+            }
+            out << "\n";
+        }
+    } // namespace detail
 
-            // Retrieve files from the working directory
-            auto working_files = kit_utils::get_working_directory_files();
+    // Write a unified diff (or a diffstat) of every tracked file that differs between a commit
+    // and the working directory. Returns false on error.
+    inline bool show_diff(const std::string &revision, const DiffOptions &options, std::ostream &out = std::cout)
+    {
+        trace::Span span("diff");
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            std::string commit_hash = kit_utils::resolve_revision(revision);
+            auto commit_files = commit_hash.empty() ? std::map<std::string, std::string>{}
+                                                    : kit_utils::read_commit_files(commit_hash);
+            auto index_ptr = kit_index::load_shared();
+            const kit_index::Index &index = *index_ptr;
+            auto working_files = kit_utils::list_working_tree(index);
+
+            // Tracked files: everything in the commit or the index
+            std::set<std::string> paths;
+            for (const auto &[path, oid] : commit_files)
+            {
+                paths.insert(path);
+            }
+            for (const auto &entry : index.entries)
+            {
+                paths.insert(entry.path);
+            }
 
-            // Compare files between the commit and the working directory
-            for (const auto &[file_name, commit_content] : commit_files)
+            std::vector<detail::FileStat> stats;
+            for (const auto &path : paths)
             {
-                if (working_files.find(file_name) == working_files.end())
+                auto old_it = commit_files.find(path);
+                auto new_it = working_files.find(path);
+                std::string old_oid = old_it == commit_files.end() ? "" : old_it->second;
+                std::string new_oid = new_it == working_files.end() ? "" : kit_utils::working_file_oid(index, path, new_it->second);
+                if (old_oid == new_oid)
                 {
-                    differences.push_back("File deleted: " + file_name);
+                    continue;
                 }
-                else if (working_files[file_name] != commit_content)
+
+                // Large working files are mapped rather than copied
+                std::string old_text = old_oid.empty() ? "" : object_store::read_object(old_oid, "blob");
+                std::unique_ptr<mapped_file::MappedFile> mapped;
+                std::string_view new_text;
+                if (!new_oid.empty())
                 {
-                    differences.push_back("File modified: " + file_name);
+                    mapped = std::make_unique<mapped_file::MappedFile>(path);
+                    new_text = std::string_view(reinterpret_cast<const char *>(mapped->data()), mapped->size());
                 }
+
+                detail::FileStat stat;
+                stat.path = path;
+                stat.binary = line_diff::is_binary(old_text) || line_diff::is_binary(new_text);
+                std::string old_name = old_oid.empty() ? "/dev/null" : "a/" + path;
+                std::string new_name = new_oid.empty() ? "/dev/null" : "b/" + path;
+
+                if (stat.binary)
+                {
+                    if (!options.stat && !options.numstat)
+                    {
+                        out << "diff --kit a/" << path << " b/" << path << "\n"
+                            << "Binary files " << old_name << " and " << new_name << " differ\n";
+                    }
+                    stats.push_back(std::move(stat));
+                    continue;
+                }
+
+                auto diff = line_diff::diff(old_text, new_text, options.algorithm);
+                stat.insertions = diff.insertions();
+                stat.deletions = diff.deletions();
+                if (!options.stat && !options.numstat)
+                {
+                    out << "diff --kit a/" << path << " b/" << path << "\n";
+                    if (old_oid.empty())
+                    {
+                        out << "new file\n";
+                    }
+                    else if (new_oid.empty())
+                    {
+                        out << "deleted file\n";
+                    }
+                    out << "index " << (old_oid.empty() ? std::string(7, '0') : old_oid.substr(0, 7)) << ".."
+                        << (new_oid.empty() ? std::string(7, '0') : new_oid.substr(0, 7)) << "\n"
+                        << "--- " << old_name << "\n"
+                        << "+++ " << new_name << "\n";
+                    line_diff::write_unified(out, diff, options.context);
+                }
+                stats.push_back(std::move(stat));
             }
 
-            // Check for new files in the working directory
-            for (const auto &[file_name, working_content] : working_files)
+            if (options.numstat)
             {
-                if (commit_files.find(file_name) == commit_files.end())
+                for (const auto &file : stats)
                 {
-                    differences.push_back("File added: " + file_name);
+                    if (file.binary)
+                    {
+                        out << "-\t-\t" << file.path << "\n";
+                    }
+                    else
+                    {
+                        out << file.insertions << "\t" << file.deletions << "\t" << file.path << "\n";
+                    }
                 }
             }
-
-            // If no differences are found, indicate that explicitly
-            if (differences.empty())
+            else if (options.stat && !stats.empty())
             {
-                differences.push_back("No differences found.");
+                detail::write_stat(out, stats);
             }
+            return true;
         }
         catch (const std::exception &e)
         {
-            kit_utils::print_error("Failed to get differences: " + std::string(e.what()));
+            kit_utils::print_error("Failed to show differences: " + std::string(e.what()));
+            return false;
         }
-
-        return differences;
     }
 }
 
@@ -0,0 +1,131 @@
+#ifndef FSMONITOR_COMMAND_HPP
+#define FSMONITOR_COMMAND_HPP
+
+#include <string>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../utils/fsmonitor.hpp"
+#include "../utils/kit_utils.hpp"
+#include "../utils/logger.hpp"
+
+namespace kit_vcs
+{
+    // Watch the working tree in the foreground until `kit fsmonitor stop`
+    inline bool run_fsmonitor()
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            fsmonitor::Daemon daemon;
+            daemon.run();
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Filesystem monitor failed: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    // Start the daemon in the background and wait until it answers
+    inline bool start_fsmonitor()
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+        if (fsmonitor::is_running())
+        {
+            kit_utils::print_message("Filesystem monitor is already running.");
+            return true;
+        }
+
+        pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            kit_utils::print_error("Failed to start filesystem monitor: fork failed");
+            return false;
+        }
+        if (pid == 0)
+        {
+            // Detach from the terminal so the daemon outlives the command
+            logger::after_fork();
+            ::setsid();
+            int null_fd = ::open("/dev/null", O_RDWR);
+            if (null_fd >= 0)
+            {
+                ::dup2(null_fd, STDIN_FILENO);
+                ::dup2(null_fd, STDOUT_FILENO);
+                ::dup2(null_fd, STDERR_FILENO);
+                ::close(null_fd);
+            }
+            int status = 1;
+            try
+            {
+                fsmonitor::Daemon daemon;
+                daemon.run();
+                status = 0;
+            }
+            catch (...)
+            {
+            }
+            ::_exit(status);
+        }
+
+        for (int attempt = 0; attempt < 100; ++attempt)
+        {
+            if (fsmonitor::is_running())
+            {
+                kit_utils::print_message("Filesystem monitor started (pid " + std::to_string(pid) + ").");
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        kit_utils::print_error("Filesystem monitor did not start.");
+        return false;
+    }
+
+    inline bool stop_fsmonitor()
+    {
+        std::string reply;
+        if (!fsmonitor::request("stop", reply))
+        {
+            kit_utils::print_message("Filesystem monitor is not running.");
+            return true;
+        }
+        kit_utils::print_message("Filesystem monitor stopped.");
+        return true;
+    }
+
+    // Print the daemon's token, watch count and journal length
+    inline bool show_fsmonitor_status()
+    {
+        std::string reply;
+        if (!fsmonitor::request("status", reply) || reply.rfind("ok ", 0) != 0)
+        {
+            kit_utils::print_message("Filesystem monitor is not running.");
+            return true;
+        }
+
+        std::istringstream fields(reply.substr(3));
+        std::string token, degraded;
+        size_t watches = 0, journal = 0;
+        fields >> token >> watches >> journal >> degraded;
+        kit_utils::print_message("Filesystem monitor is running: " + std::to_string(watches) + " directories watched, " +
+                                 std::to_string(journal) + " journal entries, token " + token);
+        if (!degraded.empty())
+        {
+            kit_utils::print_message("The inotify watch limit was reached; every status rescans the working tree.");
+        }
+        return true;
+    }
+} // namespace kit_vcs
+
+#endif // FSMONITOR_COMMAND_HPP
@@ -0,0 +1,418 @@
+#ifndef GC_HPP
+#define GC_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <ctime>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "../utils/commit_graph.hpp"
+#include "../utils/commit_object.hpp"
+#include "../utils/constants.hpp"
+#include "../utils/index.hpp"
+#include "../utils/kit_utils.hpp"
+#include "../utils/object_db.hpp"
+#include "../utils/object_id.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/pack.hpp"
+#include "../utils/refs.hpp"
+#include "../utils/reflog.hpp"
+#include "../utils/thread_pool.hpp"
+#include "../utils/trace.hpp"
+#include "../utils/tree.hpp"
+#include "repack.hpp"
+
+namespace kit_vcs
+{
+    namespace detail
+    {
+        // Every object in the store, loose or packed, numbered by its position in sorted order,
+        // with one visited bit per position that any number of threads can set
+        class ObjectMarks
+        {
+        public:
+            explicit ObjectMarks(std::vector<object_id::ObjectId> ids) : ids_(std::move(ids))
+            {
+                std::sort(ids_.begin(), ids_.end());
+                ids_.erase(std::unique(ids_.begin(), ids_.end()), ids_.end());
+                words_ = (ids_.size() + 63) / 64;
+                bits_.reset(new std::atomic<std::uint64_t>[words_]);
+                for (size_t i = 0; i < words_; ++i)
+                {
+                    bits_[i].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            size_t size() const { return ids_.size(); }
+            const object_id::ObjectId &id(size_t position) const { return ids_[position]; }
+
+            // Set the bit of an object; false when it was already set or the object is not stored
+            bool mark(const object_id::ObjectId &oid)
+            {
+                auto it = std::lower_bound(ids_.begin(), ids_.end(), oid);
+                if (it == ids_.end() || !(*it == oid))
+                {
+                    return false;
+                }
+                size_t position = static_cast<size_t>(it - ids_.begin());
+                std::uint64_t bit = std::uint64_t{1} << (position % 64);
+                return (bits_[position / 64].fetch_or(bit, std::memory_order_relaxed) & bit) == 0;
+            }
+
+            bool is_marked(size_t position) const
+            {
+                return (bits_[position / 64].load(std::memory_order_relaxed) >> (position % 64)) & 1;
+            }
+
+            size_t count() const
+            {
+                size_t marked = 0;
+                for (size_t i = 0; i < words_; ++i)
+                {
+                    marked += static_cast<size_t>(__builtin_popcountll(bits_[i].load(std::memory_order_relaxed)));
+                }
+                return marked;
+            }
+
+        private:
+            std::vector<object_id::ObjectId> ids_;
+            std::unique_ptr<std::atomic<std::uint64_t>[]> bits_;
+            size_t words_ = 0;
+        };
+
+        struct MarkItem
+        {
+            enum class Kind
+            {
+                Commit,
+                Tree,
+                Unknown // read to find out
+            };
+
+            object_id::ObjectId oid;
+            Kind kind = Kind::Commit;
+        };
+
+        inline void add_root(std::vector<MarkItem> &roots, const std::string &hex,
+                             MarkItem::Kind kind = MarkItem::Kind::Commit)
+        {
+            object_id::ObjectId oid;
+            if (!hex.empty() && object_id::ObjectId::parse(hex, oid))
+            {
+                roots.push_back({oid, kind});
+            }
+        }
+
+        // Mark everything reachable from `roots`. Commits and trees are spread over a work-stealing
+        // pool; a subtree is only read by the thread that set its bit, so shared history is walked once.
+        inline void mark_from(ObjectMarks &marks, std::vector<MarkItem> roots, unsigned jobs)
+        {
+            using Kind = MarkItem::Kind;
+            thread_pool::WorkStealingPool<MarkItem> pool(jobs);
+            pool.run(std::move(roots), [&marks](const MarkItem &item, unsigned, auto &spawn)
+                     {
+                if (!marks.mark(item.oid))
+                {
+                    return;
+                }
+                std::string type = item.kind == Kind::Tree ? "tree" : "commit";
+                std::string content;
+                if (item.kind == Kind::Unknown)
+                {
+                    content = object_store::read_object(item.oid.hex(), &type);
+                }
+                if (type == "commit" && item.kind == Kind::Unknown)
+                {
+                    auto commit = commit_object::parse(content);
+                    spawn({object_id::ObjectId::from_hex(commit.tree), Kind::Tree});
+                    for (const auto &parent : commit.parents)
+                    {
+                        spawn({object_id::ObjectId::from_hex(parent), Kind::Commit});
+                    }
+                    return;
+                }
+                if (type == "commit")
+                {
+                    auto commit = commit_graph::lookup(item.oid);
+                    spawn({commit.tree, Kind::Tree});
+                    for (const auto &parent : commit.parents)
+                    {
+                        spawn({parent, Kind::Commit});
+                    }
+                    return;
+                }
+                if (type != "tree")
+                {
+                    return;
+                }
+                // Parsed directly rather than through the object cache, which a full walk would only churn
+                if (item.kind == Kind::Tree)
+                {
+                    content = object_store::read_object(item.oid.hex(), "tree");
+                }
+                for (const auto &entry : tree_object::parse(content))
+                {
+                    if (entry.is_tree())
+                    {
+                        spawn({entry.oid, Kind::Tree});
+                    }
+                    else
+                    {
+                        marks.mark(entry.oid);
+                    }
+                } });
+        }
+
+        // Mark everything reachable from HEAD, every ref and reflog entry (refs/stash and its log
+        // included) and the index
+        inline void mark_reachable(ObjectMarks &marks, unsigned jobs)
+        {
+            trace::Span span("gc.mark");
+            std::vector<MarkItem> roots;
+            add_root(roots, kit_utils::resolve_head());
+            for (const auto &ref : refs::list("refs/"))
+            {
+                add_root(roots, refs::resolve(ref.name));
+            }
+            for (const auto &ref : reflog::list())
+            {
+                for (const auto &entry : reflog::read(ref))
+                {
+                    add_root(roots, entry.old_id);
+                    add_root(roots, entry.new_id);
+                }
+            }
+            auto index = kit_index::load_shared();
+            for (const auto &entry : index->entries)
+            {
+                marks.mark(entry.oid);
+            }
+            for (const auto &[dir, cached] : index->cache_tree)
+            {
+                roots.push_back({cached.oid, MarkItem::Kind::Tree});
+            }
+            mark_from(marks, std::move(roots), jobs);
+        }
+
+        // Modification time of a file in seconds; false when it cannot be stat'ed
+        inline bool file_mtime(const std::string &path, std::int64_t &mtime)
+        {
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+            {
+                return false;
+            }
+            mtime = static_cast<std::int64_t>(st.st_mtime);
+            return true;
+        }
+
+        inline void set_file_mtime(const std::string &path, std::int64_t mtime)
+        {
+            timespec times[2];
+            times[0].tv_sec = times[1].tv_sec = static_cast<time_t>(mtime);
+            times[0].tv_nsec = times[1].tv_nsec = 0;
+            ::utimensat(AT_FDCWD, path.c_str(), times, 0);
+        }
+
+        // Bytes of loose objects, packs and the commit-graph
+        inline std::uint64_t object_store_bytes()
+        {
+            std::uint64_t bytes = 0;
+            std::error_code ec;
+            for (auto it = std::filesystem::recursive_directory_iterator(OBJECTS_DIR, ec);
+                 !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+            {
+                if (it->is_regular_file(ec))
+                {
+                    bytes += it->file_size(ec);
+                }
+            }
+            return bytes;
+        }
+
+        inline double seconds_since(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        inline std::string format_seconds(double seconds)
+        {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(2) << seconds << "s";
+            return out.str();
+        }
+    } // namespace detail
+
+    // Remove objects nothing refers to. Unreachable objects whose files are older than `prune`
+    // ("2.weeks.ago", "now", a date...) are deleted. Younger ones, and everything they refer to,
+    // are kept loose, since a command running concurrently may be about to reference them; they
+    // keep their file times, so they expire once they and whatever refers to them are old. The
+    // reachable objects are then repacked into a single pack.
+    inline bool collect_garbage(const std::string &prune, unsigned jobs = 0)
+    {
+        trace::Span span("gc");
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        std::int64_t cutoff;
+        if (!reflog::parse_time(prune, static_cast<std::int64_t>(std::time(nullptr)), cutoff))
+        {
+            kit_utils::print_error("Invalid prune time: " + prune);
+            return false;
+        }
+
+        try
+        {
+            // Another command in this process may have seen a different repository's packs
+            pack::reload();
+            commit_graph::reload();
+            object_db::clear();
+
+            // The newest file time of every object, taken before marking so that an object written
+            // during the walk is never older than the cutoff
+            std::uint64_t bytes_before = detail::object_store_bytes();
+            std::unordered_map<std::string, std::int64_t> loose_mtimes, packed_mtimes;
+            std::vector<object_id::ObjectId> ids;
+            for (const auto &id : object_store::list_loose_objects())
+            {
+                std::int64_t mtime;
+                if (detail::file_mtime(object_store::object_path(id), mtime)) // gone since it was listed
+                {
+                    loose_mtimes.emplace(id, mtime);
+                    ids.push_back(object_id::ObjectId::from_hex(id));
+                }
+            }
+            for (const auto &p : *pack::packs())
+            {
+                std::int64_t mtime;
+                if (!detail::file_mtime(PACK_DIR + "/" + p->name() + ".pack", mtime))
+                {
+                    throw std::runtime_error("Pack " + p->name() + " disappeared; is another repack running?");
+                }
+                for (std::uint32_t i = 0; i < p->count(); ++i)
+                {
+                    ids.push_back(object_id::ObjectId::from_raw(p->id_at(i), p->oid_size()));
+                    std::int64_t &newest = packed_mtimes.emplace(ids.back().hex(), mtime).first->second;
+                    newest = std::max(newest, mtime);
+                }
+            }
+            auto newest_mtime = [&](const std::string &id)
+            {
+                auto loose = loose_mtimes.find(id);
+                auto packed = packed_mtimes.find(id);
+                return std::max(loose == loose_mtimes.end() ? INT64_MIN : loose->second,
+                                packed == packed_mtimes.end() ? INT64_MIN : packed->second);
+            };
+
+            auto start = std::chrono::steady_clock::now();
+            detail::ObjectMarks marks(std::move(ids));
+            detail::mark_reachable(marks, jobs);
+            size_t reachable_count = marks.count();
+            std::vector<bool> reachable(marks.size());
+            std::vector<detail::MarkItem> recent;
+            for (size_t position = 0; position < marks.size(); ++position)
+            {
+                reachable[position] = marks.is_marked(position);
+                if (!reachable[position] && newest_mtime(marks.id(position).hex()) >= cutoff)
+                {
+                    recent.push_back({marks.id(position), detail::MarkItem::Kind::Unknown});
+                }
+            }
+            // Recent unreachable objects are kept, so what they refer to must be kept too
+            detail::mark_from(marks, std::move(recent), jobs);
+            double mark_seconds = detail::seconds_since(start);
+
+            // Sweep: delete old unreachable loose objects, move kept unreachable ones out of the packs
+            // that are about to be replaced, and collect what the new pack holds
+            start = std::chrono::steady_clock::now();
+            std::unordered_set<std::string> keep;
+            std::vector<std::string> packed_loose;
+            size_t pruned = 0, retained = 0, dropped = 0;
+            {
+                trace::Span sweep("gc.sweep");
+                for (size_t position = 0; position < marks.size(); ++position)
+                {
+                    std::string id = marks.id(position).hex();
+                    bool is_loose = loose_mtimes.count(id) > 0;
+                    if (reachable[position])
+                    {
+                        keep.insert(id);
+                        if (is_loose)
+                        {
+                            packed_loose.push_back(id);
+                        }
+                    }
+                    else if (marks.is_marked(position))
+                    {
+                        ++retained;
+                        if (!is_loose)
+                        {
+                            std::string type;
+                            std::string content = object_store::read_object(id, &type);
+                            object_store::write_loose_object(type, content);
+                            detail::set_file_mtime(object_store::object_path(id), packed_mtimes[id]);
+                        }
+                    }
+                    else if (is_loose)
+                    {
+                        std::string path = object_store::object_path(id);
+                        std::filesystem::remove(path);
+                        std::error_code ec;
+                        std::filesystem::remove(std::filesystem::path(path).parent_path(), ec); // only succeeds when empty
+                        ++pruned;
+                    }
+                    else
+                    {
+                        ++dropped; // packed, unreachable and left out of the new pack
+                    }
+                }
+            }
+            double sweep_seconds = detail::seconds_since(start);
+
+            start = std::chrono::steady_clock::now();
+            auto repacked = detail::pack_objects(keep, packed_loose);
+            if (commit_graph::graph())
+            {
+                commit_graph::write(kit_utils::list_ref_tips()); // it may list pruned commits
+            }
+            object_db::clear();
+            double repack_seconds = detail::seconds_since(start);
+
+            std::uint64_t bytes_after = detail::object_store_bytes();
+            kit_utils::print_message("Marked " + std::to_string(reachable_count) + " of " +
+                                     std::to_string(marks.size()) + " object(s) reachable in " +
+                                     detail::format_seconds(mark_seconds) + " with " +
+                                     std::to_string(thread_pool::default_jobs(jobs)) + " thread(s)");
+            kit_utils::print_message("Pruned " + std::to_string(pruned) + " unreachable loose object(s) in " +
+                                     detail::format_seconds(sweep_seconds) + ", kept " + std::to_string(retained) +
+                                     " newer than " + prune + " or referenced by one");
+            kit_utils::print_message("Packed " + std::to_string(repacked.pack.objects) + " object(s) in " +
+                                     detail::format_seconds(repack_seconds) + ", dropping " + std::to_string(dropped) +
+                                     " unreachable packed object(s)");
+            kit_utils::print_message("Reclaimed " +
+                                     std::to_string(bytes_before > bytes_after ? bytes_before - bytes_after : 0) +
+                                     " bytes: " + std::to_string(bytes_before) + " -> " + std::to_string(bytes_after) +
+                                     " bytes of objects");
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to collect garbage: " + std::string(e.what()));
+            return false;
+        }
+    }
+} // namespace kit_vcs
+
+#endif // GC_HPP
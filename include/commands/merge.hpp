@@ -7,6 +7,8 @@
 #include "../utils/logger.hpp"
 #include "../utils/constants.hpp"
 #include "../utils/mock_kit_utils.hpp" // Include the definition of MockKitUtils
+#include "../utils/refs.hpp"
+#include "../utils/trace.hpp"
 
 #include <string>
 #include <filesystem>
@@ -16,64 +18,41 @@
 
 namespace kit_vcs
 {
-    // Update the HEAD file with the given commit hash
-    inline void update_head(const std::string &commit_hash)
+    // Move the current branch to the given commit
+    inline void update_head(const std::string &commit_hash, const std::string &message = "update HEAD")
     {
-        try
-        {
-            kit_utils::create_file(HEAD_FILE, commit_hash);
-            logger::info("HEAD updated to: " + commit_hash);
-        }
-        catch (const std::exception &e)
-        {
-            logger::error("Failed to update HEAD: " + std::string(e.what()));
-            throw;
-        }
+        kit_utils::update_head(commit_hash, std::nullopt, message);
+        logger::info("HEAD updated to: " + commit_hash);
     }
 
     // Retrieve files from a specific commit
     inline std::unordered_map<std::string, std::string> get_commit_files(const std::string &commit_hash)
     {
-        std::unordered_map<std::string, std::string> files;
-        std::string commit_path = OBJECTS_DIR + "/" + commit_hash;
-
-        if (!std::filesystem::exists(commit_path))
-        {
-            throw std::runtime_error("Commit not found: " + commit_hash);
-        }
-
-        for (const auto &entry : std::filesystem::directory_iterator(commit_path))
-        {
-            if (entry.is_regular_file())
-            {
-                files[entry.path().filename().string()] = kit_utils::read_file(entry.path().string());
-            }
-        }
-
-        return files;
+        return kit_utils::get_commit_files(commit_hash);
     }
 
     // Merge a branch into the current branch
     inline bool merge_branch(const std::string &branch_name, MockKitUtils &kit_utils)
     {
+        trace::Span span("merge");
         if (!kit_utils.ensure_repository_initialized())
         {
             logger::error("Repository is not initialized.");
             return false;
         }
 
-        std::string branch_path = HEADS_DIR + "/" + branch_name;
-        if (!std::filesystem::exists(branch_path))
-        {
-            logger::error("Branch does not exist: " + branch_name);
-            return false;
-        }
-
         try
         {
             // Read the current and target commit hashes
-            std::string current_commit = kit_utils.read_file(HEAD_FILE);
-            std::string target_commit = kit_utils.read_file(branch_path);
+            std::string target_commit = refs::is_valid_name(refs::HEADS_PREFIX + branch_name)
+                                            ? refs::resolve(refs::HEADS_PREFIX + branch_name)
+                                            : "";
+            if (target_commit.empty())
+            {
+                logger::error("Branch does not exist: " + branch_name);
+                return false;
+            }
+            std::string current_commit = ::kit_utils::resolve_head();
 
             if (current_commit == target_commit)
             {
@@ -101,7 +80,7 @@ namespace kit_vcs
             }
 
             // Update HEAD to the new commit
-            update_head(new_commit_hash);
+            update_head(new_commit_hash, "merge " + branch_name);
             logger::info("Merge completed successfully.");
             return true;
         }
@@ -0,0 +1,57 @@
+#ifndef MERGE_BASE_COMMAND_HPP
+#define MERGE_BASE_COMMAND_HPP
+
+#include <string>
+#include <vector>
+#include "../utils/kit_utils.hpp"
+#include "../utils/merge_base.hpp"
+
+namespace kit_vcs
+{
+    // Common ancestors of the given revisions. With more than two revisions the first is compared
+    // against a hypothetical merge of the rest, unless `octopus` asks for the ancestors shared by all.
+    // Only the best base is returned unless `all` is set.
+    inline std::vector<std::string> find_merge_bases(const std::vector<std::string> &revisions, bool all, bool octopus)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return {};
+        }
+
+        try
+        {
+            std::vector<std::string> commits;
+            for (const auto &revision : revisions)
+            {
+                std::string commit = kit_utils::resolve_revision(revision);
+                if (commit.empty() || !commit_graph::is_commit(commit))
+                {
+                    kit_utils::print_error("Not a valid commit: " + revision);
+                    return {};
+                }
+                commits.push_back(commit);
+            }
+            if (commits.size() < (octopus ? 1u : 2u))
+            {
+                kit_utils::print_error("merge-base needs at least two commits.");
+                return {};
+            }
+
+            std::vector<std::string> bases =
+                octopus ? merge_base::octopus_bases(commits)
+                        : merge_base::merge_bases_many(commits.front(), {commits.begin() + 1, commits.end()});
+            if (!all && bases.size() > 1)
+            {
+                bases.resize(1);
+            }
+            return bases;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to compute merge base: " + std::string(e.what()));
+            return {};
+        }
+    }
+} // namespace kit_vcs
+
+#endif // MERGE_BASE_COMMAND_HPP
@@ -0,0 +1,32 @@
+#ifndef PACK_REFS_COMMAND_HPP
+#define PACK_REFS_COMMAND_HPP
+
+#include <string>
+#include "../utils/kit_utils.hpp"
+#include "../utils/refs.hpp"
+
+namespace kit_vcs
+{
+    // Move all loose branch refs into the sorted packed-refs file
+    inline bool pack_refs()
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            size_t count = refs::pack_refs();
+            kit_utils::print_message("Packed " + std::to_string(count) + " ref(s)");
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to pack refs: " + std::string(e.what()));
+            return false;
+        }
+    }
+} // namespace kit_vcs
+
+#endif // PACK_REFS_COMMAND_HPP
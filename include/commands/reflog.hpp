@@ -0,0 +1,78 @@
+#ifndef REFLOG_COMMAND_HPP
+#define REFLOG_COMMAND_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include "../utils/kit_utils.hpp"
+#include "../utils/reflog.hpp"
+#include "../utils/refs.hpp"
+
+namespace kit_vcs
+{
+    // Print the reflog of HEAD or a branch, newest first, as "<commit> <ref>@{n}: <message>"
+    inline bool show_reflog(const std::string &name)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        std::string ref = name == refs::HEAD ? name : refs::HEADS_PREFIX + name;
+        if (!refs::is_valid_name(ref))
+        {
+            kit_utils::print_error("Invalid ref: " + name);
+            return false;
+        }
+        try
+        {
+            std::string out;
+            size_t n = 0;
+            for (const auto &entry : reflog::read(ref))
+            {
+                out += entry.new_id + " " + name + "@{" + std::to_string(n++) + "}: " + entry.message + "\n";
+            }
+            std::cout << out;
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to read reflog: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    // Drop reflog entries older than `expire` ("90.days.ago", "now", a date...) from every reflog
+    inline bool expire_reflogs(const std::string &expire)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        std::int64_t cutoff;
+        if (!reflog::parse_time(expire, static_cast<std::int64_t>(std::time(nullptr)), cutoff))
+        {
+            kit_utils::print_error("Invalid expiry time: " + expire);
+            return false;
+        }
+        try
+        {
+            size_t removed = 0;
+            for (const auto &ref : reflog::list())
+            {
+                removed += refs::expire_reflog(ref, cutoff);
+            }
+            kit_utils::print_message("Expired " + std::to_string(removed) + " reflog entries");
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to expire reflogs: " + std::string(e.what()));
+            return false;
+        }
+    }
+} // namespace kit_vcs
+
+#endif // REFLOG_COMMAND_HPP
@@ -0,0 +1,214 @@
+#ifndef REPACK_HPP
+#define REPACK_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include "../utils/constants.hpp"
+#include "../utils/kit_utils.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/pack.hpp"
+#include "../utils/tree.hpp"
+
+namespace kit_vcs
+{
+    namespace detail
+    {
+        // Record a path hint for a tree and everything below it, skipping subtrees already visited
+        inline void collect_tree_hints(const std::string &tree_oid, const std::string &path,
+                                       std::unordered_set<std::string> &seen,
+                                       std::unordered_map<std::string, std::string> &hints)
+        {
+            if (!seen.insert(tree_oid).second)
+            {
+                return;
+            }
+            hints.emplace(tree_oid, path);
+            for (const auto &entry : *tree_object::read_tree(tree_oid))
+            {
+                std::string child = path.empty() ? entry.name : path + "/" + entry.name;
+                if (entry.is_tree())
+                {
+                    collect_tree_hints(entry.oid.hex(), child, seen, hints);
+                }
+                else
+                {
+                    hints.emplace(entry.oid.hex(), child);
+                }
+            }
+        }
+
+        // Map blob and tree ids to a path they were committed under, so similar files are delta'd together
+        inline std::unordered_map<std::string, std::string> collect_path_hints()
+        {
+            std::unordered_map<std::string, std::string> hints;
+            std::vector<std::string> pending = kit_utils::list_ref_tips();
+
+            std::unordered_set<std::string> seen;
+            while (!pending.empty())
+            {
+                std::string commit_hash = pending.back();
+                pending.pop_back();
+                if (commit_hash.empty() || !seen.insert(commit_hash).second || !object_store::object_exists(commit_hash))
+                {
+                    continue;
+                }
+
+                auto commit = kit_utils::read_commit(commit_hash);
+                collect_tree_hints(commit->tree, "", seen, hints);
+                pending.insert(pending.end(), commit->parents.begin(), commit->parents.end());
+            }
+            return hints;
+        }
+
+        struct RepackResult
+        {
+            pack::PackResult pack;
+            std::uint64_t bytes_before = 0; // of the old packs and the loose objects removed
+        };
+
+        // Read back every object of a freshly written pack, resolving its deltas, and check that it
+        // hashes to its id. On any mismatch the new pack is removed, unless it replaced an identical
+        // old one, and an error is thrown before the old copies are touched.
+        inline void verify_pack(const std::string &name, size_t expected, const pack::PackList &old_packs)
+        {
+            const std::string base_path = PACK_DIR + "/" + name;
+            try
+            {
+                pack::Pack written(base_path + ".idx");
+                if (written.count() != expected)
+                {
+                    throw std::runtime_error("has " + std::to_string(written.count()) + " objects, expected " +
+                                             std::to_string(expected));
+                }
+                for (std::uint32_t i = 0; i < written.count(); ++i)
+                {
+                    unsigned char code;
+                    std::string content = written.read_at(written.offset_at(i), code);
+                    std::string id = hash_object::to_hex(written.id_at(i), written.oid_size());
+                    if (object_store::hash_object(pack::type_name(code), content) != id)
+                    {
+                        throw std::runtime_error("object " + id + " does not read back");
+                    }
+                }
+            }
+            catch (const std::exception &e)
+            {
+                bool replaced_old = std::any_of(old_packs.begin(), old_packs.end(), [&](const auto &p)
+                                                { return p->name() == name; });
+                if (!replaced_old)
+                {
+                    std::error_code ec;
+                    std::filesystem::remove(base_path + ".idx", ec);
+                    std::filesystem::remove(base_path + ".pack", ec);
+                }
+                pack::reload();
+                throw std::runtime_error("New pack " + name + " failed verification: " + e.what() +
+                                         "; the old objects were kept");
+            }
+        }
+
+        // Write `ids` into a single delta-compressed pack, check that every object reads back from
+        // it, then remove the old packs and the loose copies in `loose`. Every id must be readable
+        // from the store when this is called.
+        inline RepackResult pack_objects(const std::unordered_set<std::string> &ids, const std::vector<std::string> &loose)
+        {
+            RepackResult repacked;
+            auto old_packs = pack::packs();
+            for (const auto &p : *old_packs)
+            {
+                repacked.bytes_before += p->pack_size();
+            }
+            for (const auto &id : loose)
+            {
+                repacked.bytes_before += std::filesystem::file_size(object_store::object_path(id));
+            }
+
+            if (!ids.empty())
+            {
+                auto hints = collect_path_hints();
+
+                // Only headers are read up front; write_pack reads each object's content as it packs it
+                std::vector<pack::PackInput> objects;
+                objects.reserve(ids.size());
+                for (const auto &id : ids)
+                {
+                    pack::PackInput input;
+                    input.id = id;
+                    object_store::read_object_info(id, input.type, input.size);
+                    if (auto hint = hints.find(id); hint != hints.end())
+                    {
+                        input.name_hash = pack::name_hash(hint->second);
+                    }
+                    objects.push_back(std::move(input));
+                }
+
+                repacked.pack = pack::write_pack(std::move(objects), [](const std::string &id)
+                                                 { return object_store::read_object(id); });
+                verify_pack(repacked.pack.name, ids.size(), *old_packs);
+            }
+
+            // Everything now lives in the new pack; drop the old packs and loose copies
+            for (const auto &p : *old_packs)
+            {
+                if (p->name() != repacked.pack.name)
+                {
+                    std::filesystem::remove(PACK_DIR + "/" + p->name() + ".idx");
+                    std::filesystem::remove(PACK_DIR + "/" + p->name() + ".pack");
+                }
+            }
+            old_packs.reset();
+            for (const auto &id : loose)
+            {
+                std::string path = object_store::object_path(id);
+                std::filesystem::remove(path);
+                std::error_code ec;
+                std::filesystem::remove(std::filesystem::path(path).parent_path(), ec); // only succeeds when empty
+            }
+            pack::reload();
+            return repacked;
+        }
+    } // namespace detail
+
+    // Pack every object (loose and previously packed) into a single delta-compressed pack,
+    // then remove the redundant loose objects and old packs
+    inline bool repack_objects()
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            std::vector<std::string> loose = object_store::list_loose_objects();
+            std::unordered_set<std::string> ids(loose.begin(), loose.end());
+            pack::for_each_object([&](const std::string &id)
+                                  { ids.insert(id); });
+
+            if (ids.empty())
+            {
+                kit_utils::print_message("Nothing to pack.");
+                return true;
+            }
+
+            auto result = detail::pack_objects(ids, loose);
+            kit_utils::print_message("Packed " + std::to_string(result.pack.objects) + " object(s) (" +
+                                     std::to_string(result.pack.deltas) + " delta(s)) into " + result.pack.name + ": " +
+                                     std::to_string(result.bytes_before) + " -> " +
+                                     std::to_string(result.pack.pack_bytes) + " bytes");
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to repack objects: " + std::string(e.what()));
+            return false;
+        }
+    }
+} // namespace kit_vcs
+
+#endif // REPACK_HPP
@@ -2,14 +2,64 @@
 #define RESET_HPP
 
 #include <string>
+#include <vector>
 #include <filesystem>
 #include "../utils/constants.hpp"
+#include "../utils/index.hpp"
 #include "../utils/kit_utils.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/trace.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/tree_checkout.hpp"
 
 namespace kit_vcs
 {
-    inline bool reset_to_commit(const std::string &commit_hash)
+    enum class ResetMode
     {
+        Soft,  // move the branch only
+        Mixed, // and make the index match the commit
+        Hard   // and make the working tree match it too
+    };
+
+    namespace detail
+    {
+        // Refresh the stat data of tracked files and return the ones whose working copy differs
+        // from the index, as changes that rewrite them. Only files with stale stat data are hashed.
+        inline std::vector<tree_checkout::Change> refresh_working_tree(kit_index::Index &index)
+        {
+            trace::Span span("reset.refresh");
+            auto files = kit_utils::list_working_tree(index);
+            std::vector<tree_checkout::Change> changes;
+            for (auto &entry : index.entries)
+            {
+                auto file = files.find(entry.path);
+                if (file != files.end() && kit_index::is_stat_clean(index, entry, file->second))
+                {
+                    continue;
+                }
+                if (file != files.end() && file->second.mode == entry.stat.mode &&
+                    object_store::hash_file(entry.path) == entry.oid.hex())
+                {
+                    entry.stat = file->second;
+                    continue;
+                }
+                if (file == files.end() && std::filesystem::is_directory(std::filesystem::symlink_status(entry.path)))
+                {
+                    std::filesystem::remove_all(entry.path); // a directory where a tracked file belongs
+                }
+                changes.push_back({entry.path, {}, {entry.stat.mode, entry.oid}});
+            }
+            span.arg("modified", changes.size());
+            return changes;
+        }
+    } // namespace detail
+
+    // Reset to a commit hash, branch or reflog entry such as HEAD@{1}. The index and working tree
+    // are compared with the target by tree id, so only the entries and files that differ are
+    // rewritten; unchanged entries keep their stat data.
+    inline bool reset_to_commit(const std::string &revision, ResetMode mode = ResetMode::Mixed, unsigned jobs = 0)
+    {
+        trace::Span span("reset");
         if (!kit_utils::ensure_repository_initialized())
         {
             return false;
@@ -17,18 +67,36 @@ namespace kit_vcs
 
         try
         {
-            std::string commit_path = std::string(OBJECTS_DIR) + "/" + commit_hash;
-            if (!std::filesystem::exists(commit_path))
+            std::string commit_hash = kit_utils::resolve_revision(revision);
+            if (!commit_graph::is_commit(commit_hash))
             {
-                kit_utils::print_error("Commit does not exist: " + commit_hash);
+                kit_utils::print_error("Commit does not exist: " + revision);
                 return false;
             }
 
-            // Reset HEAD to the specified commit
-            kit_utils::create_file(HEAD_FILE, commit_hash + "\n");
+            if (mode != ResetMode::Soft)
+            {
+                // Writing the index's tree only writes the directories changed since it was cached
+                kit_index::Update update;
+                kit_index::Index &index = update.index();
+                std::string index_tree = tree_object::write_tree(index);
+                auto changes = tree_checkout::diff_trees(index_tree, kit_utils::read_commit(commit_hash)->tree);
+                span.arg("changes", changes.size());
+
+                if (mode == ResetMode::Hard)
+                {
+                    tree_checkout::apply(index, changes, jobs);
+                    tree_checkout::apply(index, detail::refresh_working_tree(index), jobs);
+                }
+                else
+                {
+                    tree_checkout::update_index(index, changes);
+                }
+                update.commit();
+            }
 
-            // Clear the index file
-            kit_utils::create_file(INDEX_FILE);
+            // Move the current branch (or a detached HEAD) to the specified commit
+            kit_utils::update_head(commit_hash, std::nullopt, "reset: moving to " + revision);
 
             kit_utils::print_message("Repository reset to commit: " + commit_hash);
             return true;
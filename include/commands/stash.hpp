@@ -1,16 +1,185 @@
 #ifndef STASH_HPP
 #define STASH_HPP
 
+#include <ctime>
+#include <iostream>
+#include <map>
 #include <string>
-#include <fstream>
+#include <vector>
 #include <filesystem>
+#include "../utils/commit_object.hpp"
 #include "../utils/constants.hpp"
+#include "../utils/index.hpp"
 #include "../utils/kit_utils.hpp"
+#include "../utils/merge_file.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/refs.hpp"
+#include "../utils/reflog.hpp"
+#include "../utils/trace.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/tree_checkout.hpp"
 
+// Stashes are commits. A stash W records the working tree of the tracked files; its parents are
+// the commit it was made on (B) and a commit I recording the index at that time. refs/stash names
+// the newest stash and its reflog is the stack, so stash@{n} is the n-th reflog entry.
 namespace kit_vcs
 {
-    inline bool stash_changes()
+    namespace detail
     {
+        struct Stash
+        {
+            std::string commit;
+            std::string base_tree;
+            std::string index_tree;
+            std::string work_tree;
+        };
+
+        // "stash@{n}", "n" or empty for the newest
+        inline size_t stash_position(const std::string &name)
+        {
+            std::string number = name;
+            if (number.rfind("stash@{", 0) == 0 && number.back() == '}')
+            {
+                number = number.substr(7, number.size() - 8);
+            }
+            if (number.empty())
+            {
+                return 0;
+            }
+            if (number.find_first_not_of("0123456789") != std::string::npos)
+            {
+                throw std::runtime_error("Not a stash reference: " + name);
+            }
+            return std::stoull(number);
+        }
+
+        inline Stash read_stash(const std::string &name)
+        {
+            size_t n = stash_position(name);
+            reflog::Entry entry;
+            if (!reflog::nth(refs::STASH, n, entry))
+            {
+                throw std::runtime_error("No stash entry stash@{" + std::to_string(n) + "}");
+            }
+            auto commit = kit_utils::read_commit(entry.new_id);
+            if (commit->parents.size() != 2)
+            {
+                throw std::runtime_error("Not a stash commit: " + entry.new_id);
+            }
+            return {entry.new_id, kit_utils::read_commit(commit->parents[0])->tree,
+                    kit_utils::read_commit(commit->parents[1])->tree, commit->tree};
+        }
+
+        inline std::string write_stash_commit(const std::string &tree, const std::vector<std::string> &parents,
+                                              const std::string &message)
+        {
+            commit_object::Commit commit;
+            commit.tree = tree;
+            commit.parents = parents;
+            commit.timestamp = static_cast<std::int64_t>(std::time(nullptr));
+            commit.message = message;
+            return object_store::write_object("commit", commit_object::serialize(commit));
+        }
+
+        // The index with every tracked file replaced by its working-tree version. Only files whose
+        // stat data is stale are read, and those are stored as blobs on the way.
+        inline kit_index::Index working_tree_index(const kit_index::Index &index)
+        {
+            kit_index::Index work = index;
+            auto files = kit_utils::list_working_tree(index);
+            for (const auto &entry : index.entries)
+            {
+                auto file = files.find(entry.path);
+                if (file == files.end())
+                {
+                    kit_index::remove_entry(work, entry.path);
+                }
+                else if (!kit_index::is_stat_clean(index, entry, file->second))
+                {
+                    kit_index::Entry updated;
+                    updated.path = entry.path;
+                    updated.oid = object_id::ObjectId::from_hex(object_store::write_blob_from_file(entry.path));
+                    updated.stat = file->second;
+                    kit_index::upsert_entry(work, std::move(updated));
+                }
+            }
+            return work;
+        }
+
+        inline tree_checkout::Side index_side(const kit_index::Index &index, const std::string &path)
+        {
+            const kit_index::Entry *entry = kit_index::find_entry(index, path);
+            return entry ? tree_checkout::Side{entry->stat.mode, entry->oid} : tree_checkout::Side{};
+        }
+
+        inline bool same(const tree_checkout::Side &a, const tree_checkout::Side &b)
+        {
+            return a.mode == b.mode && (!a.present() || a.oid == b.oid);
+        }
+
+        inline std::string blob_content(const tree_checkout::Side &side)
+        {
+            return side.present() ? object_store::read_object(side.oid.hex(), "blob") : "";
+        }
+
+        // Three-way merge of one path: our index version against the stash's change from base to
+        // theirs. Conflicting text is written with markers; a modify/delete conflict keeps ours.
+        inline tree_checkout::Side merge_path(const std::string &path, const tree_checkout::Side &base,
+                                              const tree_checkout::Side &ours, const tree_checkout::Side &theirs,
+                                              std::vector<std::string> &conflicts)
+        {
+            if (same(ours, base) || same(ours, theirs))
+            {
+                return theirs;
+            }
+            if (!ours.present() || !theirs.present())
+            {
+                conflicts.push_back(path);
+                return ours.present() ? ours : theirs;
+            }
+            merge_file::Options options;
+            options.ours_label = "Updated upstream";
+            options.theirs_label = "Stashed changes";
+            auto merged = merge_file::merge(blob_content(base), blob_content(ours), blob_content(theirs), options);
+            if (merged.conflicts > 0)
+            {
+                conflicts.push_back(path);
+            }
+            return {theirs.mode, object_id::ObjectId::from_hex(object_store::write_object("blob", merged.content))};
+        }
+
+        // Paths the stash touches that have unstaged edits, or untracked files the stash would replace
+        inline std::vector<std::string> local_changes(const kit_index::Index &index,
+                                                      const std::map<std::string, tree_checkout::Side> &work)
+        {
+            std::vector<std::string> paths;
+            for (const auto &[path, side] : work)
+            {
+                const kit_index::Entry *entry = kit_index::find_entry(index, path);
+                kit_index::StatData stat;
+                bool on_disk = kit_index::stat_file(path, stat);
+                if (!entry)
+                {
+                    if (on_disk && (!side.present() || object_store::hash_file(path) != side.oid.hex()))
+                    {
+                        paths.push_back(path);
+                    }
+                }
+                else if (!on_disk ||
+                         (!kit_index::is_stat_clean(index, *entry, stat) && object_store::hash_file(path) != entry->oid.hex()))
+                {
+                    paths.push_back(path);
+                }
+            }
+            return paths;
+        }
+    } // namespace detail
+
+    // Record the index and the working tree of the tracked files as a stash, then return both to
+    // HEAD. Only the files that differ from HEAD are rewritten.
+    inline bool push_stash(const std::string &message = "", unsigned jobs = 0)
+    {
+        trace::Span span("stash.push");
         if (!kit_utils::ensure_repository_initialized())
         {
             return false;
@@ -18,41 +187,227 @@ namespace kit_vcs
 
         try
         {
-            std::string stash_path = std::string(KIT_DIR) + "/stash";
-            std::ofstream stash_file(stash_path, std::ios::app);
-            if (!stash_file)
+            std::string head = kit_utils::resolve_head();
+            if (head.empty())
             {
-                kit_utils::print_error("Failed to open stash file.");
+                kit_utils::print_error("Cannot stash before the first commit.");
                 return false;
             }
 
-            // Add staged files to the stash
-            std::ifstream index_file(INDEX_FILE);
-            if (!index_file)
+            kit_index::Update update;
+            kit_index::Index &index = update.index();
+            std::string index_tree = tree_object::write_tree(index);
+            kit_index::Index work = detail::working_tree_index(index);
+            std::string work_tree = tree_object::write_tree(work);
+            auto head_commit = kit_utils::read_commit(head);
+            if (index_tree == head_commit->tree && work_tree == head_commit->tree)
+            {
+                kit_utils::print_message("No local changes to save.");
+                return true;
+            }
+
+            std::string branch = refs::head_target();
+            branch = branch.rfind(refs::HEADS_PREFIX, 0) == 0 ? branch.substr(refs::HEADS_PREFIX.size()) : "(no branch)";
+            std::string on = branch + ": " + head.substr(0, 7) + " " + commit_object::summary(*head_commit);
+            std::string index_commit = detail::write_stash_commit(index_tree, {head}, "index on " + on);
+            std::string description = message.empty() ? "WIP on " + on : "On " + branch + ": " + message;
+            std::string stash = detail::write_stash_commit(work_tree, {head, index_commit}, description);
+
+            refs::Transaction transaction(description);
+            transaction.update(refs::STASH, stash);
+            transaction.commit();
+
+            tree_checkout::update_index(index, tree_checkout::diff_trees(index_tree, head_commit->tree));
+            auto result = tree_checkout::apply(index, tree_checkout::diff_trees(work_tree, head_commit->tree), jobs);
+            update.commit();
+            span.arg("files", result.written + result.removed + result.chmodded);
+
+            kit_utils::print_message("Saved working directory and index state " + description);
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to stash changes: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    inline bool stash_changes()
+    {
+        return push_stash();
+    }
+
+    inline bool list_stashes()
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+        auto entries = reflog::read(refs::STASH);
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            std::cout << "stash@{" << i << "}: " << entries[i].message << '\n';
+        }
+        return true;
+    }
+
+    // List the files a stash changes relative to the commit it was made on
+    inline bool show_stash(const std::string &name)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            detail::Stash stash = detail::read_stash(name);
+            for (const auto &change : tree_checkout::diff_trees(stash.base_tree, stash.work_tree))
+            {
+                char status = !change.from.present() ? 'A' : !change.to.present() ? 'D' : 'M';
+                std::cout << status << ' ' << change.path << '\n';
+            }
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to show stash: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    // Reapply a stash onto the current index and working tree. Only the paths the stash changed
+    // are merged and written; staged changes are restored as staged where the index allows it.
+    // Returns false on conflicts, which are left in the files as markers.
+    inline bool apply_stash(const std::string &name, unsigned jobs = 0)
+    {
+        trace::Span span("stash.apply");
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            detail::Stash stash = detail::read_stash(name);
+            auto work_changes = tree_checkout::diff_trees(stash.base_tree, stash.work_tree);
+            auto index_changes = tree_checkout::diff_trees(stash.base_tree, stash.index_tree);
+            span.arg("changes", work_changes.size());
+
+            kit_index::Update update;
+            kit_index::Index &index = update.index();
+            std::map<std::string, tree_checkout::Side> touched;
+            for (const auto &change : work_changes)
             {
-                kit_utils::print_error("Failed to read index file.");
+                touched[change.path] = change.to;
+            }
+            for (const auto &change : index_changes)
+            {
+                touched.emplace(change.path, detail::index_side(index, change.path));
+            }
+            auto dirty = detail::local_changes(index, touched);
+            if (!dirty.empty())
+            {
+                kit_utils::print_error("Your local changes to the following files would be overwritten by stash apply:");
+                for (const auto &path : dirty)
+                {
+                    kit_utils::print_error("  " + path);
+                }
                 return false;
             }
 
-            std::string line;
-            while (std::getline(index_file, line))
+            // The working tree gets the stash's changes merged into our versions
+            std::vector<std::string> conflicts;
+            std::vector<tree_checkout::Change> writes;
+            std::map<std::string, tree_checkout::Side> ours;
+            for (const auto &change : work_changes)
             {
-                stash_file << line << "\n";
+                tree_checkout::Side current = detail::index_side(index, change.path);
+                tree_checkout::Side merged = detail::merge_path(change.path, change.from, current, change.to, conflicts);
+                ours[change.path] = current;
+                if (!detail::same(merged, current))
+                {
+                    writes.push_back({change.path, current, merged});
+                }
             }
-            index_file.close();
+            tree_checkout::apply(index, writes, jobs);
 
-            // Clear the index file after stashing
-            kit_utils::create_file(INDEX_FILE);
+            // The index takes the stash's staged changes where our entry is still the base, and
+            // keeps our entry everywhere else, so unstaged stashed changes stay unstaged
+            std::map<std::string, tree_checkout::Side> staged;
+            for (const auto &change : index_changes)
+            {
+                tree_checkout::Side current = ours.count(change.path) ? ours[change.path]
+                                                                      : detail::index_side(index, change.path);
+                staged[change.path] = detail::same(current, change.from) ? change.to : current;
+            }
+            for (const auto &write : writes)
+            {
+                staged.emplace(write.path, write.from);
+            }
+            std::vector<tree_checkout::Change> restaged;
+            for (const auto &[path, side] : staged)
+            {
+                tree_checkout::Side now = detail::index_side(index, path);
+                if (!detail::same(now, side))
+                {
+                    restaged.push_back({path, now, side});
+                }
+            }
+            tree_checkout::update_index(index, restaged);
+            update.commit();
 
-            kit_utils::print_message("Changes stashed successfully.");
+            if (!conflicts.empty())
+            {
+                kit_utils::print_error("Conflicts while applying the stash:");
+                for (const auto &path : conflicts)
+                {
+                    kit_utils::print_error("  " + path);
+                }
+                return false;
+            }
+            kit_utils::print_message("Applied " + stash.commit.substr(0, 7) + " (" + std::to_string(writes.size()) +
+                                     " files updated).");
             return true;
         }
         catch (const std::exception &e)
         {
-            kit_utils::print_error("Failed to stash changes: " + std::string(e.what()));
+            kit_utils::print_error("Failed to apply stash: " + std::string(e.what()));
             return false;
         }
     }
+
+    inline bool drop_stash(const std::string &name)
+    {
+        if (!kit_utils::ensure_repository_initialized())
+        {
+            return false;
+        }
+
+        try
+        {
+            size_t n = detail::stash_position(name);
+            reflog::Entry entry;
+            if (!reflog::nth(refs::STASH, n, entry) || !refs::drop_reflog_entry(refs::STASH, n))
+            {
+                kit_utils::print_error("No stash entry stash@{" + std::to_string(n) + "}");
+                return false;
+            }
+            kit_utils::print_message("Dropped stash@{" + std::to_string(n) + "} (" + entry.new_id + ")");
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to drop stash: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    // Apply a stash and drop it, unless applying it conflicted
+    inline bool pop_stash(const std::string &name, unsigned jobs = 0)
+    {
+        return apply_stash(name, jobs) && drop_stash(name);
+    }
 } // namespace kit_vcs
 
 #endif // STASH_HPP
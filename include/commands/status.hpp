@@ -3,14 +3,19 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <filesystem>
+#include <utility>
 #include "../utils/constants.hpp"
 #include "../utils/kit_utils.hpp"
+#include "../utils/index.hpp"
+#include "../utils/trace.hpp"
 
 namespace kit_vcs
 {
     inline std::vector<std::string> get_repository_status()
     {
+        trace::Span span("status");
         std::vector<std::string> status;
 
         if (!kit_utils::ensure_repository_initialized())
@@ -20,24 +25,91 @@ namespace kit_vcs
 
         try
         {
-            // Check if there are staged files
-            if (kit_utils::has_staged_files())
+            auto index_ptr = kit_index::load_shared();
+            const kit_index::Index &index = *index_ptr;
+
+            // Changes staged relative to HEAD
+            std::map<std::string, std::string> committed;
+            std::string head = kit_utils::resolve_head();
+            if (!head.empty())
+            {
+                committed = kit_utils::read_commit_files(head);
+            }
+
+            std::vector<std::string> staged;
+            for (const auto &entry : index.entries)
+            {
+                auto it = committed.find(entry.path);
+                if (it == committed.end() || it->second != entry.oid.hex())
+                {
+                    staged.push_back("Staged file: " + entry.path);
+                }
+            }
+            for (const auto &[path, blob] : committed)
+            {
+                if (!kit_index::find_entry(index, path))
+                {
+                    staged.push_back("Staged deletion: " + path);
+                }
+            }
+
+            if (!staged.empty())
             {
                 status.push_back("Staged files are ready for commit.");
+                status.insert(status.end(), staged.begin(), staged.end());
             }
-            else
+
+            // Working tree changes relative to the index; only files with stale stat data are re-hashed
+            auto working_files = kit_utils::list_working_tree(index);
+            std::vector<std::pair<std::string, kit_index::StatData>> refreshed;
+
+            for (const auto &[path, stat] : working_files)
             {
-                status.push_back("Working directory clean. Nothing to commit.");
+                auto *entry = kit_index::find_entry(index, path);
+                if (!entry)
+                {
+                    status.push_back("Untracked file: " + path);
+                    continue;
+                }
+                if (kit_index::is_stat_clean(index, *entry, stat))
+                {
+                    continue;
+                }
+
+                if (object_store::hash_file(path) != entry->oid.hex())
+                {
+                    status.push_back("Modified file: " + path);
+                }
+                else
+                {
+                    // Contents are unchanged; remember the new stat data so the next run skips the file
+                    refreshed.emplace_back(path, stat);
+                }
             }
 
-            // Check for untracked files
-            for (const auto &entry : std::filesystem::recursive_directory_iterator("."))
+            for (const auto &entry : index.entries)
             {
-                if (entry.is_regular_file() && entry.path().string().find(KIT_DIR) == std::string::npos)
+                if (working_files.find(entry.path) == working_files.end())
                 {
-                    status.push_back("Untracked file: " + entry.path().string());
+                    status.push_back("Deleted file: " + entry.path);
                 }
             }
+
+            if (!refreshed.empty())
+            {
+                // Copy the shared index only when there is stat data to write back
+                kit_index::Index updated = index;
+                for (const auto &[path, stat] : refreshed)
+                {
+                    kit_index::find_entry(updated, path)->stat = stat;
+                }
+                kit_index::save_refreshed(updated); // skipped if another command is updating the index
+            }
+
+            if (status.empty())
+            {
+                status.push_back("Working directory clean. Nothing to commit.");
+            }
         }
         catch (const std::exception &e)
         {
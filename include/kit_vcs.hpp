@@ -1,24 +1,38 @@
 #ifndef KIT_VCS_HPP
 #define KIT_VCS_HPP
 
+#include "commands/add.hpp"
+#include "commands/batch.hpp"
 #include "commands/branch.hpp"
 #include "commands/checkout.hpp"
 #include "commands/commit.hpp"
+#include "commands/commit_graph.hpp"
+#include "commands/daemon.hpp"
 #include "commands/diff.hpp"
+#include "commands/fsmonitor.hpp"
+#include "commands/gc.hpp"
 #include "commands/merge.hpp"
+#include "commands/merge_base.hpp"
+#include "commands/pack_refs.hpp"
+#include "commands/reflog.hpp"
+#include "commands/repack.hpp"
 #include "commands/reset.hpp"
 #include "commands/stash.hpp"
 #include "commands/status.hpp"
+#include "utils/config.hpp"
 #include "utils/constants.hpp"
 #include "utils/kit_utils.hpp"
 #include "utils/error_handler.hpp"
 #include "utils/hash_object.hpp"
+#include "utils/object_store.hpp"
+#include "utils/index.hpp"
+#include "utils/trace.hpp"
 #include "version.hpp"
 
 namespace kit_vcs
 {
-    // Initialize a new repository
-    inline bool initialize_repository()
+    // Initialize a new repository whose objects are named with `object_format` (sha1 or sha256)
+    inline bool initialize_repository(const std::string &object_format = "sha1")
     {
         if (std::filesystem::exists(KIT_DIR))
         {
@@ -26,12 +40,23 @@ namespace kit_vcs
             return false;
         }
 
+        hash_object::Algorithm algorithm;
+        if (!hash_object::parse_algorithm(object_format, algorithm))
+        {
+            error_handler::print_error("Unknown object format: " + object_format);
+            return false;
+        }
+
         try
         {
             std::filesystem::create_directories(HEADS_DIR);
             std::filesystem::create_directories(OBJECTS_DIR);
-            kit_utils::create_file(HEAD_FILE, "ref: refs/heads/master\n");
+            refs::Transaction transaction;
+            transaction.set_symbolic(refs::HEAD, refs::HEADS_PREFIX + "master");
+            transaction.commit();
             kit_utils::create_file(INDEX_FILE);
+            kit_config::set("objectformat", hash_object::backend(algorithm).name);
+            hash_object::reload_repository_algorithm();
             kit_utils::print_message("Repository initialized successfully.");
             return true;
         }
@@ -58,13 +83,30 @@ namespace kit_vcs
 
         try
         {
-            std::ofstream index_file(INDEX_FILE, std::ios::app);
-            if (!index_file)
+            kit_index::Update update;
+            kit_index::Index &index = update.index();
+
+            kit_index::Entry entry;
+            entry.path = kit_index::normalize_path(file);
+            if (!kit_index::stat_file(file, entry.stat))
             {
-                error_handler::print_error("Failed to open index file.");
+                error_handler::print_error("Failed to stat file: " + file);
                 return false;
             }
-            index_file << file << "\n";
+
+            // Hash the contents once and store them as a blob, unless the stat cache proves them unchanged
+            const auto *existing = kit_index::find_entry(index, entry.path);
+            if (existing && kit_index::is_stat_clean(index, *existing, entry.stat))
+            {
+                entry.oid = existing->oid;
+            }
+            else
+            {
+                entry.oid = object_id::ObjectId::from_hex(object_store::write_blob_from_file(file));
+            }
+
+            kit_index::upsert_entry(index, std::move(entry));
+            update.commit();
             kit_utils::print_message("File staged: " + file);
             return true;
         }
@@ -83,41 +125,25 @@ namespace kit_vcs
             return {};
         }
 
+        trace::Span span("log.walk");
         std::vector<std::string> history;
         try
         {
-            std::ifstream head_file(HEAD_FILE);
-            if (!head_file)
-            {
-                error_handler::print_error("Failed to open HEAD file.");
-                return {};
-            }
-
-            std::string current_commit;
-            std::getline(head_file, current_commit);
+            std::string current_commit = kit_utils::resolve_head();
 
             while (!current_commit.empty())
             {
-                std::string commit_path = OBJECTS_DIR + "/" + current_commit;
-                if (!std::filesystem::exists(commit_path))
+                if (!object_store::object_exists(current_commit))
                 {
+                    error_handler::print_error("Missing commit object: " + current_commit);
                     break;
                 }
 
-                std::ifstream commit_file(commit_path);
-                if (!commit_file)
-                {
-                    error_handler::print_error("Failed to open commit file: " + commit_path);
-                    break;
-                }
-
-                std::string commit_message;
-                std::getline(commit_file, commit_message);
-
-                history.push_back(current_commit + ": " + commit_message);
+                // The parent chain comes from the commit-graph when present; only the message needs the object
+                auto commit = kit_utils::read_commit(current_commit);
+                history.push_back(current_commit + ": " + commit_object::summary(*commit));
 
-                // Assume the second line in the commit file contains the parent commit hash
-                std::getline(commit_file, current_commit);
+                current_commit = kit_utils::get_parent_commit(current_commit);
             }
         }
         catch (const std::exception &e)
@@ -131,7 +157,8 @@ namespace kit_vcs
     // Show the version of kit-vcs
     inline void show_version()
     {
-        std::cout << "kit-vcs version " << KIT_VCS_VERSION << std::endl;
+        std::cout << "kit-vcs version " << KIT_VCS_VERSION << '\n';
+        std::cout << "hash acceleration: " << hash_object::hardware_acceleration() << '\n';
     }
 } // namespace kit_vcs
 
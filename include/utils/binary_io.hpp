@@ -0,0 +1,87 @@
+#ifndef BINARY_IO_HPP
+#define BINARY_IO_HPP
+
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+// Big-endian integer encoding shared by the index, pack and graph file formats
+namespace binary_io
+{
+    inline void put_u16(std::string &out, std::uint16_t value)
+    {
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    inline void put_u32(std::string &out, std::uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            out.push_back(static_cast<char>(value >> shift));
+        }
+    }
+
+    inline void put_u64(std::string &out, std::uint64_t value)
+    {
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            out.push_back(static_cast<char>(value >> shift));
+        }
+    }
+
+    inline std::uint64_t get_uint(const unsigned char *data, size_t bytes)
+    {
+        std::uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    inline std::uint32_t get_u32(const unsigned char *data)
+    {
+        return static_cast<std::uint32_t>(get_uint(data, 4));
+    }
+
+    inline std::uint64_t get_u64(const unsigned char *data)
+    {
+        return get_uint(data, 8);
+    }
+
+    // Little-endian base-128 variable length integer
+    inline void put_varint(std::string &out, std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Decode a varint at `pos`, advancing it; `end` bounds the read
+    inline std::uint64_t get_varint(const unsigned char *data, size_t &pos, size_t end)
+    {
+        std::uint64_t value = 0;
+        int shift = 0;
+        while (pos < end)
+        {
+            if (shift > 63)
+            {
+                throw std::runtime_error("Varint too long");
+            }
+            unsigned char byte = data[pos++];
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+            shift += 7;
+        }
+        return value;
+    }
+} // namespace binary_io
+
+#endif // BINARY_IO_HPP
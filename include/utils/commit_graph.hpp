@@ -0,0 +1,711 @@
+#ifndef COMMIT_GRAPH_HPP
+#define COMMIT_GRAPH_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <openssl/sha.h>
+#include "constants.hpp"
+#include "binary_io.hpp"
+#include "commit_object.hpp"
+#include "hash_object.hpp"
+#include "lock_file.hpp"
+#include "mapped_file.hpp"
+#include "object_db.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "trace.hpp"
+
+// The commit-graph caches the shape of history in fixed-width, memory-mapped tables so history
+// walks do not have to open and parse commit objects.
+//
+// A graph is a base file (objects/info/commit-graph) plus an optional chain of incremental layers
+// (objects/info/commit-graphs/graph-<sha>.graph, listed bottom-up in commit-graph-chain).
+// Commits are addressed by their global position: the number of commits in lower layers plus
+// their position inside their own layer.
+//
+// Layer layout (big-endian):
+//   "KCGR" | version u32 | commit count u32 | commits in lower layers u32 | extra edge count u32
+//   fan-out table 256 x u32 | sorted commit ids (20 or 32 bytes each, per the object format)
+//   per commit: root tree id | parent 1 u32 | parent 2 u32 | generation u32 | commit time u64
+//   extra edges: u32 parent positions for octopus merges, the last one flagged with EDGE_LAST
+//   SHA-1 trailer
+namespace commit_graph
+{
+    constexpr char GRAPH_SIGNATURE[4] = {'K', 'C', 'G', 'R'};
+    constexpr std::uint32_t GRAPH_VERSION = 1;
+    constexpr size_t CHECKSUM_SIZE = SHA_DIGEST_LENGTH;
+    constexpr size_t HEADER_SIZE = 20;
+    constexpr size_t FANOUT_SIZE = 256 * 4;
+
+    // Per-commit data after the root tree id
+    constexpr size_t DATA_FIELDS_SIZE = 4 + 4 + 4 + 8;
+
+    constexpr std::uint32_t PARENT_NONE = 0x70000000;
+    constexpr std::uint32_t PARENT_EXTRA = 0x80000000; // parent 2 points into the extra edge list
+    constexpr std::uint32_t EDGE_LAST = 0x80000000;
+    constexpr std::uint32_t GENERATION_INFINITY = 0xFFFFFFFF; // commit is not in the graph
+
+    const std::string GRAPH_FILE = OBJECTS_DIR + "/info/commit-graph";
+    const std::string CHAIN_DIR = OBJECTS_DIR + "/info/commit-graphs";
+    const std::string CHAIN_FILE = CHAIN_DIR + "/commit-graph-chain";
+    constexpr int LOCK_TIMEOUT_MS = 2000; // how long a writer waits for another to finish
+
+    // Everything history walkers need to know about a commit
+    struct CommitInfo
+    {
+        object_id::ObjectId id;
+        object_id::ObjectId tree;
+        std::vector<object_id::ObjectId> parents;
+        std::uint32_t generation = GENERATION_INFINITY;
+        std::int64_t timestamp = 0;
+    };
+
+    // One memory-mapped graph file
+    class Layer
+    {
+    public:
+        explicit Layer(const std::string &path) : file_(path), path_(path), oid_size_(hash_object::oid_size())
+        {
+            if (!file_.is_open() || file_.size() < HEADER_SIZE + FANOUT_SIZE + CHECKSUM_SIZE ||
+                std::memcmp(file_.data(), GRAPH_SIGNATURE, 4) != 0 ||
+                binary_io::get_u32(file_.data() + 4) != GRAPH_VERSION)
+            {
+                throw std::runtime_error("Invalid commit-graph file: " + path);
+            }
+            count_ = binary_io::get_u32(file_.data() + 8);
+            base_count_ = binary_io::get_u32(file_.data() + 12);
+            edge_count_ = binary_io::get_u32(file_.data() + 16);
+            if (file_.size() != HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(count_) * (oid_size_ + data_size()) +
+                                    static_cast<size_t>(edge_count_) * 4 + CHECKSUM_SIZE)
+            {
+                throw std::runtime_error("Truncated commit-graph file: " + path);
+            }
+        }
+
+        const std::string &path() const { return path_; }
+        std::uint32_t count() const { return count_; }
+        std::uint32_t base_count() const { return base_count_; }
+        size_t oid_size() const { return oid_size_; }
+
+        // Width of a commit's data record: root tree id followed by the fixed fields
+        size_t data_size() const { return oid_size_ + DATA_FIELDS_SIZE; }
+
+        bool find(const unsigned char *oid, std::uint32_t &local) const
+        {
+            const unsigned char *fanout = file_.data() + HEADER_SIZE;
+            std::uint32_t low = oid[0] == 0 ? 0 : binary_io::get_u32(fanout + (oid[0] - 1) * 4);
+            std::uint32_t high = binary_io::get_u32(fanout + oid[0] * 4);
+            while (low < high)
+            {
+                std::uint32_t mid = low + (high - low) / 2;
+                int cmp = std::memcmp(id_at(mid), oid, oid_size_);
+                if (cmp == 0)
+                {
+                    local = mid;
+                    return true;
+                }
+                if (cmp < 0)
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+            return false;
+        }
+
+        const unsigned char *id_at(std::uint32_t local) const
+        {
+            return file_.data() + HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(local) * oid_size_;
+        }
+
+        const unsigned char *data_at(std::uint32_t local) const
+        {
+            return file_.data() + HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(count_) * oid_size_ +
+                   static_cast<size_t>(local) * data_size();
+        }
+
+        std::uint32_t edge_at(std::uint32_t index) const
+        {
+            if (index >= edge_count_)
+            {
+                throw std::runtime_error("Corrupt commit-graph edge list: " + path_);
+            }
+            return binary_io::get_u32(file_.data() + HEADER_SIZE + FANOUT_SIZE +
+                                      static_cast<size_t>(count_) * (oid_size_ + data_size()) + index * 4);
+        }
+
+    private:
+        mapped_file::MappedFile file_;
+        std::string path_;
+        size_t oid_size_;
+        std::uint32_t count_ = 0;
+        std::uint32_t base_count_ = 0;
+        std::uint32_t edge_count_ = 0;
+    };
+
+    // The base graph and its incremental layers
+    class Graph
+    {
+    public:
+        std::vector<std::unique_ptr<Layer>> layers; // bottom-up
+        bool has_base = false;
+
+        std::uint32_t size() const
+        {
+            return layers.empty() ? 0 : layers.back()->base_count() + layers.back()->count();
+        }
+
+        // Find the global position of a commit, searching only the lowest `layer_limit` layers
+        bool find(const object_id::ObjectId &oid, std::uint32_t &position, size_t layer_limit = SIZE_MAX) const
+        {
+            for (size_t i = 0; i < layers.size() && i < layer_limit; ++i)
+            {
+                std::uint32_t local;
+                if (oid.size == layers[i]->oid_size() && layers[i]->find(oid.data(), local))
+                {
+                    position = layers[i]->base_count() + local;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool find(const std::string &hash, std::uint32_t &position, size_t layer_limit = SIZE_MAX) const
+        {
+            object_id::ObjectId oid;
+            return object_id::ObjectId::parse(hash, oid) && find(oid, position, layer_limit);
+        }
+
+        object_id::ObjectId id(std::uint32_t position) const
+        {
+            const auto &[layer, local] = locate(position);
+            return object_id::ObjectId::from_raw(layer->id_at(local), layer->oid_size());
+        }
+
+        std::uint32_t generation(std::uint32_t position) const
+        {
+            const auto &[layer, local] = locate(position);
+            return binary_io::get_u32(layer->data_at(local) + layer->oid_size() + 8);
+        }
+
+        std::int64_t timestamp(std::uint32_t position) const
+        {
+            const auto &[layer, local] = locate(position);
+            return static_cast<std::int64_t>(binary_io::get_u64(layer->data_at(local) + layer->oid_size() + 12));
+        }
+
+        // Parent positions, in commit order
+        std::vector<std::uint32_t> parents(std::uint32_t position) const
+        {
+            const auto &[layer, local] = locate(position);
+            const unsigned char *data = layer->data_at(local);
+            std::vector<std::uint32_t> result;
+            std::uint32_t first = binary_io::get_u32(data + layer->oid_size());
+            std::uint32_t second = binary_io::get_u32(data + layer->oid_size() + 4);
+            if (first == PARENT_NONE)
+            {
+                return result;
+            }
+            result.push_back(first);
+            if (second == PARENT_NONE)
+            {
+                return result;
+            }
+            if (!(second & PARENT_EXTRA))
+            {
+                result.push_back(second);
+                return result;
+            }
+            for (std::uint32_t edge = second & ~PARENT_EXTRA;; ++edge)
+            {
+                std::uint32_t value = layer->edge_at(edge);
+                result.push_back(value & ~EDGE_LAST);
+                if (value & EDGE_LAST)
+                {
+                    break;
+                }
+            }
+            return result;
+        }
+
+        CommitInfo info(std::uint32_t position) const
+        {
+            const auto &[layer, local] = locate(position);
+            CommitInfo commit;
+            commit.id = object_id::ObjectId::from_raw(layer->id_at(local), layer->oid_size());
+            commit.tree = object_id::ObjectId::from_raw(layer->data_at(local), layer->oid_size());
+            for (std::uint32_t parent : parents(position))
+            {
+                commit.parents.push_back(id(parent));
+            }
+            commit.generation = generation(position);
+            commit.timestamp = timestamp(position);
+            return commit;
+        }
+
+    private:
+        std::pair<const Layer *, std::uint32_t> locate(std::uint32_t position) const
+        {
+            for (auto it = layers.rbegin(); it != layers.rend(); ++it)
+            {
+                if (position >= (*it)->base_count())
+                {
+                    std::uint32_t local = position - (*it)->base_count();
+                    if (local >= (*it)->count())
+                    {
+                        break;
+                    }
+                    return {it->get(), local};
+                }
+            }
+            throw std::runtime_error("Commit-graph position out of range: " + std::to_string(position));
+        }
+    };
+
+    namespace detail
+    {
+        struct Registry
+        {
+            std::mutex mutex;
+            bool loaded = false;
+            std::shared_ptr<const Graph> graph;
+        };
+
+        inline Registry &registry()
+        {
+            static Registry instance;
+            return instance;
+        }
+
+        inline std::vector<std::string> read_chain()
+        {
+            std::vector<std::string> names;
+            std::ifstream chain(CHAIN_FILE);
+            std::string line;
+            while (std::getline(chain, line))
+            {
+                if (!line.empty())
+                {
+                    names.push_back(line);
+                }
+            }
+            return names;
+        }
+
+        // Load the graph; a missing or inconsistent graph is treated as absent
+        inline std::shared_ptr<const Graph> load_graph()
+        {
+            trace::Span span("commit_graph.load");
+            auto graph = std::make_shared<Graph>();
+            try
+            {
+                if (std::filesystem::exists(GRAPH_FILE))
+                {
+                    graph->layers.push_back(std::make_unique<Layer>(GRAPH_FILE));
+                    graph->has_base = true;
+                }
+                for (const auto &name : read_chain())
+                {
+                    auto layer = std::make_unique<Layer>(CHAIN_DIR + "/" + name);
+                    if (layer->base_count() != graph->size())
+                    {
+                        throw std::runtime_error("Commit-graph chain does not line up: " + name);
+                    }
+                    graph->layers.push_back(std::move(layer));
+                }
+            }
+            catch (const std::exception &)
+            {
+                return nullptr;
+            }
+            return graph->layers.empty() ? nullptr : graph;
+        }
+    } // namespace detail
+
+    // The current commit-graph, or nullptr when the repository has none
+    inline std::shared_ptr<const Graph> graph()
+    {
+        auto &reg = detail::registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (!reg.loaded)
+        {
+            reg.graph = detail::load_graph();
+            reg.loaded = true;
+        }
+        return reg.graph;
+    }
+
+    // Drop the mapped graph so the next lookup reloads it from disk
+    inline void reload()
+    {
+        auto &reg = detail::registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.graph.reset();
+        reg.loaded = false;
+    }
+
+    // Parse a commit object into the same shape the graph provides
+    inline CommitInfo read_commit_object(const object_id::ObjectId &oid)
+    {
+        auto commit = object_db::read_commit(oid.hex());
+        CommitInfo info;
+        info.id = oid;
+        info.tree = object_id::ObjectId::from_hex(commit->tree);
+        info.parents.reserve(commit->parents.size());
+        for (const auto &parent : commit->parents)
+        {
+            info.parents.push_back(object_id::ObjectId::from_hex(parent));
+        }
+        info.timestamp = commit->timestamp;
+        return info;
+    }
+
+    // Look a commit up in the graph, falling back to the commit object when it is not covered
+    inline CommitInfo lookup(const object_id::ObjectId &oid)
+    {
+        if (auto g = graph())
+        {
+            std::uint32_t position;
+            if (g->find(oid, position))
+            {
+                return g->info(position);
+            }
+        }
+        return read_commit_object(oid);
+    }
+
+    inline CommitInfo lookup(const std::string &hash)
+    {
+        object_id::ObjectId oid;
+        if (!object_id::ObjectId::parse(hash, oid))
+        {
+            throw std::runtime_error("Commit not found: " + hash);
+        }
+        return lookup(oid);
+    }
+
+    // True if `hash` names a commit
+    inline bool is_commit(const std::string &hash)
+    {
+        if (auto g = graph())
+        {
+            std::uint32_t position;
+            if (g->find(hash, position))
+            {
+                return true;
+            }
+        }
+        std::string type;
+        try
+        {
+            object_store::read_object(hash, &type);
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        return type == "commit";
+    }
+
+    namespace detail
+    {
+        // Serialize one layer. Parents missing from the layer are resolved through `lower`,
+        // which must contain every commit of the layers below it.
+        inline std::string build_layer(std::vector<CommitInfo> commits, const Graph *lower, size_t lower_layers,
+                                       std::uint32_t base_count)
+        {
+            std::sort(commits.begin(), commits.end(), [](const CommitInfo &a, const CommitInfo &b)
+                      { return a.id < b.id; });
+
+            std::unordered_map<object_id::ObjectId, std::uint32_t> local;
+            local.reserve(commits.size());
+            for (std::uint32_t i = 0; i < commits.size(); ++i)
+            {
+                local.emplace(commits[i].id, i);
+            }
+
+            auto resolve = [&](const object_id::ObjectId &parent, std::uint32_t &position, bool &in_layer)
+            {
+                auto it = local.find(parent);
+                if (it != local.end())
+                {
+                    position = base_count + it->second;
+                    in_layer = true;
+                    return;
+                }
+                in_layer = false;
+                if (!lower || !lower->find(parent, position, lower_layers))
+                {
+                    throw std::runtime_error("Commit-graph is missing parent " + parent.hex());
+                }
+            };
+
+            // Generations: parents first, computed with an explicit stack to survive long histories
+            std::vector<std::uint32_t> generation(commits.size(), 0);
+            for (std::uint32_t start = 0; start < commits.size(); ++start)
+            {
+                if (generation[start] != 0)
+                {
+                    continue;
+                }
+                std::vector<std::uint32_t> stack{start};
+                while (!stack.empty())
+                {
+                    std::uint32_t current = stack.back();
+                    std::uint32_t value = 1;
+                    bool ready = true;
+                    for (const auto &parent : commits[current].parents)
+                    {
+                        std::uint32_t position;
+                        bool in_layer;
+                        resolve(parent, position, in_layer);
+                        std::uint32_t parent_generation =
+                            in_layer ? generation[position - base_count] : lower->generation(position);
+                        if (parent_generation == 0)
+                        {
+                            stack.push_back(position - base_count);
+                            ready = false;
+                        }
+                        else
+                        {
+                            value = std::max(value, parent_generation + 1);
+                        }
+                    }
+                    if (ready)
+                    {
+                        generation[current] = value;
+                        stack.pop_back();
+                    }
+                }
+            }
+
+            const size_t oid_size = hash_object::oid_size();
+            std::string out;
+            out.append(GRAPH_SIGNATURE, 4);
+            binary_io::put_u32(out, GRAPH_VERSION);
+            binary_io::put_u32(out, static_cast<std::uint32_t>(commits.size()));
+            binary_io::put_u32(out, base_count);
+            size_t edge_count_offset = out.size();
+            binary_io::put_u32(out, 0);
+
+            std::uint32_t fanout[256] = {};
+            std::string ids;
+            for (const auto &commit : commits)
+            {
+                if (commit.id.size != oid_size || commit.tree.size != oid_size)
+                {
+                    throw std::runtime_error("Object id width does not match the repository: " + commit.id.hex());
+                }
+                ++fanout[commit.id.bytes[0]];
+                ids.append(reinterpret_cast<const char *>(commit.id.data()), oid_size);
+            }
+            std::uint32_t running = 0;
+            for (int i = 0; i < 256; ++i)
+            {
+                running += fanout[i];
+                binary_io::put_u32(out, running);
+            }
+            out += ids;
+
+            std::string edges;
+            std::uint32_t edge_count = 0;
+            for (std::uint32_t i = 0; i < commits.size(); ++i)
+            {
+                const auto &commit = commits[i];
+                out.append(reinterpret_cast<const char *>(commit.tree.data()), oid_size);
+
+                std::vector<std::uint32_t> parents;
+                for (const auto &parent : commit.parents)
+                {
+                    std::uint32_t position;
+                    bool in_layer;
+                    resolve(parent, position, in_layer);
+                    parents.push_back(position);
+                }
+
+                binary_io::put_u32(out, parents.empty() ? PARENT_NONE : parents[0]);
+                if (parents.size() <= 1)
+                {
+                    binary_io::put_u32(out, PARENT_NONE);
+                }
+                else if (parents.size() == 2)
+                {
+                    binary_io::put_u32(out, parents[1]);
+                }
+                else
+                {
+                    binary_io::put_u32(out, PARENT_EXTRA | edge_count);
+                    for (size_t p = 1; p < parents.size(); ++p)
+                    {
+                        binary_io::put_u32(edges, parents[p] | (p + 1 == parents.size() ? EDGE_LAST : 0));
+                        ++edge_count;
+                    }
+                }
+                binary_io::put_u32(out, generation[i]);
+                binary_io::put_u64(out, static_cast<std::uint64_t>(commit.timestamp));
+            }
+            out += edges;
+
+            std::string count_bytes;
+            binary_io::put_u32(count_bytes, edge_count);
+            out.replace(edge_count_offset, 4, count_bytes);
+
+            unsigned char checksum[SHA_DIGEST_LENGTH];
+            SHA1(reinterpret_cast<const unsigned char *>(out.data()), out.size(), checksum);
+            out.append(reinterpret_cast<const char *>(checksum), SHA_DIGEST_LENGTH);
+            return out;
+        }
+
+        inline void write_atomically(const std::string &path, const std::string &data)
+        {
+            lock_file::LockFile lock(path, LOCK_TIMEOUT_MS);
+            lock.write(data);
+            lock.commit();
+        }
+
+        // Collect every commit reachable from `tips` that is not already in the lowest `layer_limit` layers
+        inline std::vector<CommitInfo> collect_commits(const std::vector<std::string> &tips, const Graph *existing,
+                                                       size_t layer_limit)
+        {
+            std::vector<CommitInfo> commits;
+            std::unordered_set<object_id::ObjectId> seen;
+            std::vector<object_id::ObjectId> pending;
+            for (const auto &tip : tips)
+            {
+                if (!tip.empty())
+                {
+                    pending.push_back(object_id::ObjectId::from_hex(tip));
+                }
+            }
+            while (!pending.empty())
+            {
+                object_id::ObjectId oid = pending.back();
+                pending.pop_back();
+                std::uint32_t position;
+                if (!seen.insert(oid).second || (existing && existing->find(oid, position, layer_limit)))
+                {
+                    continue;
+                }
+
+                CommitInfo info;
+                if (existing && existing->find(oid, position))
+                {
+                    info = existing->info(position);
+                }
+                else
+                {
+                    info = read_commit_object(oid);
+                }
+                pending.insert(pending.end(), info.parents.begin(), info.parents.end());
+                commits.push_back(std::move(info));
+            }
+            return commits;
+        }
+    } // namespace detail
+
+    // Write a complete commit-graph for everything reachable from `tips`, replacing any chain
+    inline size_t write(const std::vector<std::string> &tips)
+    {
+        trace::Span span("commit_graph.write");
+        auto existing = graph();
+        auto commits = detail::collect_commits(tips, existing.get(), 0);
+        size_t count = commits.size();
+
+        detail::write_atomically(GRAPH_FILE, detail::build_layer(std::move(commits), nullptr, 0, 0));
+
+        std::error_code ec;
+        std::filesystem::remove_all(CHAIN_DIR, ec);
+        reload();
+        return count;
+    }
+
+    // Add a new commit (and any of its ancestors the graph is missing) as an incremental layer.
+    // Does nothing when the repository has no commit-graph. Small layers are merged together
+    // whenever the new top layer grows to at least half the size of the one below it.
+    inline void append(const std::string &commit_hash)
+    {
+        if (!graph())
+        {
+            return;
+        }
+
+        // Hold the chain lock from reading the layers to replacing the chain, so two appends
+        // cannot each drop layers the other's chain still lists
+        lock_file::LockFile chain_lock(CHAIN_FILE, LOCK_TIMEOUT_MS);
+        reload();
+        auto existing = graph();
+        if (!existing)
+        {
+            return;
+        }
+
+        auto commits = detail::collect_commits({commit_hash}, existing.get(), SIZE_MAX);
+        if (commits.empty())
+        {
+            return;
+        }
+
+        size_t first_chain = existing->has_base ? 1 : 0;
+        size_t keep = existing->layers.size();
+        size_t merged_size = commits.size();
+        while (keep > first_chain && existing->layers[keep - 1]->count() < 2 * merged_size)
+        {
+            --keep;
+            merged_size += existing->layers[keep]->count();
+        }
+
+        for (size_t i = keep; i < existing->layers.size(); ++i)
+        {
+            const auto &layer = existing->layers[i];
+            for (std::uint32_t local = 0; local < layer->count(); ++local)
+            {
+                commits.push_back(existing->info(layer->base_count() + local));
+            }
+        }
+
+        std::uint32_t base_count = keep == 0 ? 0 : existing->layers[keep - 1]->base_count() + existing->layers[keep - 1]->count();
+        std::string data = detail::build_layer(std::move(commits), existing.get(), keep, base_count);
+        std::string name = "graph-" + hash_object::to_hex(
+                                          reinterpret_cast<const unsigned char *>(data.data() + data.size() - CHECKSUM_SIZE), CHECKSUM_SIZE) +
+                           ".graph";
+        detail::write_atomically(CHAIN_DIR + "/" + name, data);
+
+        std::string chain;
+        std::vector<std::string> obsolete;
+        for (size_t i = first_chain; i < existing->layers.size(); ++i)
+        {
+            std::string layer_name = std::filesystem::path(existing->layers[i]->path()).filename().string();
+            if (i < keep)
+            {
+                chain += layer_name + "\n";
+            }
+            else
+            {
+                obsolete.push_back(CHAIN_DIR + "/" + layer_name);
+            }
+        }
+        chain += name + "\n";
+        chain_lock.write(chain);
+        chain_lock.commit();
+
+        existing.reset();
+        reload();
+        for (const auto &path : obsolete)
+        {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    }
+} // namespace commit_graph
+
+#endif // COMMIT_GRAPH_HPP
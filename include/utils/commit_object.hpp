@@ -0,0 +1,92 @@
+#ifndef COMMIT_OBJECT_HPP
+#define COMMIT_OBJECT_HPP
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdint>
+#include <stdexcept>
+
+namespace commit_object
+{
+    // In-memory representation of a commit object
+    struct Commit
+    {
+        std::string tree; // root tree id
+        std::vector<std::string> parents;
+        std::int64_t timestamp = 0;
+        std::string message;
+    };
+
+    // Serialize a commit:
+    //   tree <id>
+    //   parent <id>          (zero or more)
+    //   time <epoch seconds>
+    //   <blank line>
+    //   <message>
+    inline std::string serialize(const Commit &commit)
+    {
+        std::ostringstream out;
+        out << "tree " << commit.tree << "\n";
+        for (const auto &parent : commit.parents)
+        {
+            out << "parent " << parent << "\n";
+        }
+        out << "time " << commit.timestamp << "\n";
+        out << "\n"
+            << commit.message;
+        return out.str();
+    }
+
+    // Parse the output of `serialize`
+    inline Commit parse(const std::string &content)
+    {
+        Commit commit;
+        size_t pos = 0;
+
+        while (pos < content.size())
+        {
+            size_t end = content.find('\n', pos);
+            if (end == std::string::npos)
+            {
+                throw std::runtime_error("Corrupt commit object: missing message separator");
+            }
+
+            std::string line = content.substr(pos, end - pos);
+            pos = end + 1;
+
+            if (line.empty())
+            {
+                commit.message = content.substr(pos);
+                return commit;
+            }
+
+            size_t space = line.find(' ');
+            std::string key = line.substr(0, space);
+            std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+
+            if (key == "tree")
+            {
+                commit.tree = value;
+            }
+            else if (key == "parent")
+            {
+                commit.parents.push_back(value);
+            }
+            else if (key == "time")
+            {
+                commit.timestamp = std::stoll(value);
+            }
+        }
+
+        throw std::runtime_error("Corrupt commit object: missing message separator");
+    }
+
+    // First line of the commit message, used for one-line summaries
+    inline std::string summary(const Commit &commit)
+    {
+        return commit.message.substr(0, commit.message.find('\n'));
+    }
+} // namespace commit_object
+
+#endif // COMMIT_OBJECT_HPP
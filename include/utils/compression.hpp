@@ -0,0 +1,181 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <string>
+#include <algorithm>
+#include <climits>
+#include <ostream>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace compression
+{
+    // Compress a buffer with zlib
+    inline std::string deflate(const char *data, size_t size, int level = Z_DEFAULT_COMPRESSION)
+    {
+        uLongf bound = compressBound(static_cast<uLong>(size));
+        std::string output(bound, '\0');
+
+        int status = compress2(reinterpret_cast<Bytef *>(&output[0]), &bound,
+                               reinterpret_cast<const Bytef *>(data), static_cast<uLong>(size), level);
+        if (status != Z_OK)
+        {
+            throw std::runtime_error("zlib compression failed with status " + std::to_string(status));
+        }
+
+        output.resize(bound);
+        return output;
+    }
+
+    inline std::string deflate(const std::string &input, int level = Z_DEFAULT_COMPRESSION)
+    {
+        return deflate(input.data(), input.size(), level);
+    }
+
+    // Streaming zlib compressor writing to an output stream; memory use is independent of the input size
+    class Deflater
+    {
+    public:
+        explicit Deflater(std::ostream &out, int level = Z_DEFAULT_COMPRESSION) : out_(out)
+        {
+            if (deflateInit(&stream_, level) != Z_OK)
+            {
+                throw std::runtime_error("zlib deflateInit failed");
+            }
+        }
+
+        ~Deflater() { deflateEnd(&stream_); }
+
+        Deflater(const Deflater &) = delete;
+        Deflater &operator=(const Deflater &) = delete;
+
+        void write(const void *data, size_t size)
+        {
+            const Bytef *next = static_cast<const Bytef *>(data);
+            while (size > 0)
+            {
+                // avail_in is 32 bits wide, so very large ranges are fed in slices
+                uInt slice = static_cast<uInt>(std::min<size_t>(size, 1u << 30));
+                stream_.next_in = const_cast<Bytef *>(next);
+                stream_.avail_in = slice;
+                pump(Z_NO_FLUSH);
+                next += slice;
+                size -= slice;
+            }
+        }
+
+        // Flush the remaining output and the stream trailer
+        void finish()
+        {
+            stream_.next_in = nullptr;
+            stream_.avail_in = 0;
+            pump(Z_FINISH);
+        }
+
+    private:
+        void pump(int flush)
+        {
+            int status;
+            do
+            {
+                stream_.next_out = buffer_;
+                stream_.avail_out = sizeof(buffer_);
+                status = ::deflate(&stream_, flush);
+                if (status == Z_STREAM_ERROR)
+                {
+                    throw std::runtime_error("zlib compression failed with status " + std::to_string(status));
+                }
+                out_.write(reinterpret_cast<const char *>(buffer_),
+                           static_cast<std::streamsize>(sizeof(buffer_) - stream_.avail_out));
+            } while (stream_.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+            if (!out_)
+            {
+                throw std::runtime_error("Failed to write compressed data");
+            }
+        }
+
+        std::ostream &out_;
+        z_stream stream_{};
+        Bytef buffer_[64 * 1024];
+    };
+
+    // Decompress a zlib stream; `size_hint` is only used to size the first output chunk
+    inline std::string inflate(const char *data, size_t size, size_t size_hint = 0)
+    {
+        z_stream stream{};
+        if (inflateInit(&stream) != Z_OK)
+        {
+            throw std::runtime_error("zlib inflateInit failed");
+        }
+
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        stream.avail_in = static_cast<uInt>(size);
+
+        std::string output;
+        output.resize(size_hint > 0 ? size_hint : size * 4 + 64);
+
+        int status = Z_OK;
+        while (status != Z_STREAM_END)
+        {
+            if (stream.total_out >= output.size())
+            {
+                output.resize(output.size() * 2);
+            }
+            stream.next_out = reinterpret_cast<Bytef *>(&output[stream.total_out]);
+            stream.avail_out = static_cast<uInt>(output.size() - stream.total_out);
+
+            status = ::inflate(&stream, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END)
+            {
+                inflateEnd(&stream);
+                throw std::runtime_error("zlib decompression failed with status " + std::to_string(status));
+            }
+            if (status == Z_OK && stream.avail_in == 0 && stream.avail_out != 0)
+            {
+                inflateEnd(&stream);
+                throw std::runtime_error("zlib stream is truncated");
+            }
+        }
+
+        output.resize(stream.total_out);
+        inflateEnd(&stream);
+        return output;
+    }
+
+    inline std::string inflate(const std::string &input, size_t size_hint = 0)
+    {
+        return inflate(input.data(), input.size(), size_hint);
+    }
+
+    // Decompress only the first `limit` bytes of a zlib stream (fewer if it is shorter), for
+    // reading a header without inflating what follows it
+    inline std::string inflate_prefix(const char *data, size_t size, size_t limit)
+    {
+        z_stream stream{};
+        if (inflateInit(&stream) != Z_OK)
+        {
+            throw std::runtime_error("zlib inflateInit failed");
+        }
+
+        std::string output(limit, '\0');
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        stream.avail_in = static_cast<uInt>(std::min<size_t>(size, UINT_MAX));
+        stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+        stream.avail_out = static_cast<uInt>(limit);
+
+        int status = Z_OK;
+        while (status == Z_OK && stream.avail_out > 0 && stream.avail_in > 0)
+        {
+            status = ::inflate(&stream, Z_NO_FLUSH);
+        }
+        inflateEnd(&stream);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+        {
+            throw std::runtime_error("zlib decompression failed with status " + std::to_string(status));
+        }
+        output.resize(stream.total_out);
+        return output;
+    }
+} // namespace compression
+
+#endif // COMPRESSION_HPP
@@ -0,0 +1,87 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include "constants.hpp"
+#include "lock_file.hpp"
+
+// Repository settings in `.kit/config`: one `key = value` per line, `#` starts a comment
+namespace kit_config
+{
+    constexpr int LOCK_TIMEOUT_MS = 2000;
+
+    namespace detail
+    {
+        inline std::string trim(const std::string &value)
+        {
+            size_t begin = value.find_first_not_of(" \t\r");
+            if (begin == std::string::npos)
+            {
+                return "";
+            }
+            size_t end = value.find_last_not_of(" \t\r");
+            return value.substr(begin, end - begin + 1);
+        }
+    } // namespace detail
+
+    // Value of a setting, or `fallback` if it is not set
+    inline std::string get(const std::string &key, const std::string &fallback = "",
+                           const std::string &path = CONFIG_FILE)
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            size_t equals = line.find('=');
+            if (line.empty() || line[0] == '#' || equals == std::string::npos)
+            {
+                continue;
+            }
+            if (detail::trim(line.substr(0, equals)) == key)
+            {
+                return detail::trim(line.substr(equals + 1));
+            }
+        }
+        return fallback;
+    }
+
+    // Add or replace a setting. The file is read and replaced under its lock, so readers see either
+    // the old or the new config and concurrent writers do not lose each other's settings.
+    inline void set(const std::string &key, const std::string &value, const std::string &path = CONFIG_FILE)
+    {
+        lock_file::LockFile lock(path, LOCK_TIMEOUT_MS);
+        std::vector<std::string> lines;
+        bool replaced = false;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line))
+            {
+                size_t equals = line.find('=');
+                if (!replaced && equals != std::string::npos && line[0] != '#' &&
+                    detail::trim(line.substr(0, equals)) == key)
+                {
+                    line = key + " = " + value;
+                    replaced = true;
+                }
+                lines.push_back(line);
+            }
+        }
+        if (!replaced)
+        {
+            lines.push_back(key + " = " + value);
+        }
+
+        std::string content;
+        for (const auto &line : lines)
+        {
+            content += line + '\n';
+        }
+        lock.write(content);
+        lock.commit();
+    }
+} // namespace kit_config
+
+#endif // CONFIG_HPP
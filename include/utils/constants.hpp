@@ -9,13 +9,25 @@ const std::string KIT_DIR = ".kit";
 // Directory for branch references
 const std::string HEADS_DIR = KIT_DIR + "/refs/heads";
 
+// Sorted file of packed refs, one "<id> <name>" line per ref
+const std::string PACKED_REFS_FILE = KIT_DIR + "/packed-refs";
+
 // File for the current HEAD reference
 const std::string HEAD_FILE = KIT_DIR + "/HEAD";
 
 // File for the staging area index
 const std::string INDEX_FILE = KIT_DIR + "/index";
 
+// Repository settings, such as the object format chosen at `init`
+const std::string CONFIG_FILE = KIT_DIR + "/config";
+
 // Directory for storing objects (commits, blobs, etc.)
 const std::string OBJECTS_DIR = KIT_DIR + "/objects";
 
+// Directory for packfiles and their indexes
+const std::string PACK_DIR = OBJECTS_DIR + "/pack";
+
+// Ignore rules for untracked files, read from the top of the working tree
+const std::string IGNORE_FILE = ".kitignore";
+
 #endif // CONSTANTS_HPP
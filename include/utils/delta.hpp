@@ -0,0 +1,256 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include "binary_io.hpp"
+
+// Binary deltas in the copy/insert format used by packfiles:
+//   varint base size | varint result size | instructions
+// An instruction byte with the high bit set copies a range of the base; bits 0-3 flag which
+// offset bytes follow and bits 4-6 which size bytes follow. Otherwise the byte is a literal
+// insert of 1-127 bytes taken from the delta itself.
+namespace delta
+{
+    constexpr size_t BLOCK_SIZE = 16;
+    constexpr size_t MAX_COPY = 0xFFFFFF;
+
+    // Fingerprints of every BLOCK_SIZE-aligned block of a base buffer
+    class DeltaIndex
+    {
+    public:
+        explicit DeltaIndex(const std::string &base) : base_(base)
+        {
+            if (base.size() < BLOCK_SIZE)
+            {
+                return;
+            }
+            blocks_.reserve(base.size() / BLOCK_SIZE);
+            for (size_t offset = 0; offset + BLOCK_SIZE <= base.size(); offset += BLOCK_SIZE)
+            {
+                // Keep the first occurrence so copies prefer earlier, longer runs
+                blocks_.emplace(fingerprint(base.data() + offset), static_cast<std::uint32_t>(offset));
+            }
+        }
+
+        const std::string &base() const { return base_; }
+
+        bool find(const char *data, std::uint32_t &offset) const
+        {
+            auto it = blocks_.find(fingerprint(data));
+            if (it == blocks_.end() || std::memcmp(base_.data() + it->second, data, BLOCK_SIZE) != 0)
+            {
+                return false;
+            }
+            offset = it->second;
+            return true;
+        }
+
+    private:
+        static std::uint64_t fingerprint(const char *data)
+        {
+            std::uint64_t hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < BLOCK_SIZE; ++i)
+            {
+                hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        const std::string &base_;
+        std::unordered_map<std::uint64_t, std::uint32_t> blocks_;
+    };
+
+    namespace detail
+    {
+        inline void flush_insert(std::string &out, const char *data, size_t length)
+        {
+            while (length > 0)
+            {
+                size_t chunk = length > 127 ? 127 : length;
+                out.push_back(static_cast<char>(chunk));
+                out.append(data, chunk);
+                data += chunk;
+                length -= chunk;
+            }
+        }
+
+        inline void emit_copy(std::string &out, std::uint64_t offset, std::uint64_t size)
+        {
+            unsigned char op = 0x80;
+            std::string args;
+            for (int i = 0; i < 4; ++i)
+            {
+                if ((offset >> (8 * i)) & 0xFF)
+                {
+                    op |= static_cast<unsigned char>(1 << i);
+                    args.push_back(static_cast<char>((offset >> (8 * i)) & 0xFF));
+                }
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                if ((size >> (8 * i)) & 0xFF)
+                {
+                    op |= static_cast<unsigned char>(0x10 << i);
+                    args.push_back(static_cast<char>((size >> (8 * i)) & 0xFF));
+                }
+            }
+            out.push_back(static_cast<char>(op));
+            out += args;
+        }
+    } // namespace detail
+
+    // Encode `target` against an indexed base. Returns false when the delta would be larger than `max_size`.
+    inline bool create(const DeltaIndex &index, const std::string &target, std::string &out, size_t max_size)
+    {
+        const std::string &base = index.base();
+        out.clear();
+        binary_io::put_varint(out, base.size());
+        binary_io::put_varint(out, target.size());
+
+        size_t pos = 0;
+        size_t insert_start = 0;
+        while (pos + BLOCK_SIZE <= target.size())
+        {
+            std::uint32_t match;
+            if (!index.find(target.data() + pos, match))
+            {
+                ++pos;
+                continue;
+            }
+
+            // Extend the match backwards over pending literals and forwards as far as it goes
+            size_t base_start = match;
+            size_t target_start = pos;
+            while (base_start > 0 && target_start > insert_start && base[base_start - 1] == target[target_start - 1])
+            {
+                --base_start;
+                --target_start;
+            }
+            size_t length = (pos - target_start) + BLOCK_SIZE;
+            while (target_start + length < target.size() && base_start + length < base.size() &&
+                   base[base_start + length] == target[target_start + length])
+            {
+                ++length;
+            }
+
+            detail::flush_insert(out, target.data() + insert_start, target_start - insert_start);
+            size_t copied = 0;
+            while (copied < length)
+            {
+                size_t chunk = std::min(length - copied, MAX_COPY);
+                detail::emit_copy(out, base_start + copied, chunk);
+                copied += chunk;
+            }
+
+            pos = target_start + length;
+            insert_start = pos;
+            if (out.size() > max_size)
+            {
+                return false;
+            }
+        }
+
+        detail::flush_insert(out, target.data() + insert_start, target.size() - insert_start);
+        return out.size() <= max_size;
+    }
+
+    // Reconstruct the target of a delta. Every operation is checked against the delta, the base
+    // and the declared result size, so a corrupt or hostile delta throws instead of reading or
+    // writing out of bounds.
+    inline std::string apply(const std::string &base, const unsigned char *data, size_t size)
+    {
+        size_t pos = 0;
+        std::uint64_t base_size = binary_io::get_varint(data, pos, size);
+        std::uint64_t result_size = binary_io::get_varint(data, pos, size);
+        if (base_size != base.size())
+        {
+            throw std::runtime_error("Delta base size mismatch");
+        }
+        // Every byte left could at most open a maximal copy, so a larger size cannot be genuine
+        if (result_size > static_cast<std::uint64_t>(size - pos) * MAX_COPY)
+        {
+            throw std::runtime_error("Delta result size out of range");
+        }
+
+        // The declared size is not trusted for the allocation; the per-op checks below bound the result
+        std::string result;
+        result.reserve(static_cast<size_t>(std::min<std::uint64_t>(result_size, base.size() + size)));
+        while (pos < size)
+        {
+            unsigned char op = data[pos++];
+            if (op & 0x80)
+            {
+                size_t arguments = static_cast<size_t>(__builtin_popcount(op & 0x7F));
+                if (arguments > size - pos)
+                {
+                    throw std::runtime_error("Delta copy truncated");
+                }
+                std::uint64_t offset = 0;
+                std::uint64_t length = 0;
+                for (int i = 0; i < 4; ++i)
+                {
+                    if (op & (1 << i))
+                    {
+                        offset |= static_cast<std::uint64_t>(data[pos++]) << (8 * i);
+                    }
+                }
+                for (int i = 0; i < 3; ++i)
+                {
+                    if (op & (0x10 << i))
+                    {
+                        length |= static_cast<std::uint64_t>(data[pos++]) << (8 * i);
+                    }
+                }
+                if (length == 0)
+                {
+                    length = 0x10000;
+                }
+                if (offset + length > base.size())
+                {
+                    throw std::runtime_error("Delta copy out of range");
+                }
+                if (length > result_size - result.size())
+                {
+                    throw std::runtime_error("Delta copy overflows the result");
+                }
+                result.append(base, offset, length);
+            }
+            else if (op > 0)
+            {
+                if (op > size - pos)
+                {
+                    throw std::runtime_error("Delta insert out of range");
+                }
+                if (op > result_size - result.size())
+                {
+                    throw std::runtime_error("Delta insert overflows the result");
+                }
+                result.append(reinterpret_cast<const char *>(data + pos), op);
+                pos += op;
+            }
+            else
+            {
+                throw std::runtime_error("Invalid delta opcode");
+            }
+        }
+
+        if (result.size() != result_size)
+        {
+            throw std::runtime_error("Delta result size mismatch");
+        }
+        return result;
+    }
+
+    inline std::string apply(const std::string &base, const std::string &delta_data)
+    {
+        return apply(base, reinterpret_cast<const unsigned char *>(delta_data.data()), delta_data.size());
+    }
+} // namespace delta
+
+#endif // DELTA_HPP
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include "logger.hpp"
 
 namespace error_handler
 {
@@ -11,13 +12,13 @@ namespace error_handler
     // Function to print error messages
     inline void print_error(const std::string &message)
     {
-        std::cerr << "\033[1;31m[kit]\033[0m Error: " << message << std::endl;
+        logger::error(message);
     }
 
     // Function to print warning messages
     inline void print_warning(const std::string &message)
     {
-        std::cerr << "\033[1;33m[kit]\033[0m Warning: " << message << std::endl;
+        logger::warning(message);
     }
 
     // Function to handle exceptions
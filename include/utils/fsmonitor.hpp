@@ -0,0 +1,879 @@
+#ifndef FSMONITOR_HPP
+#define FSMONITOR_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "constants.hpp"
+#include "binary_io.hpp"
+#include "index.hpp"
+#include "lock_file.hpp"
+#include "worktree.hpp"
+
+// Filesystem monitor.
+//
+// The daemon watches every directory of the working tree with inotify and appends each changed
+// path to a journal under a monotonically increasing sequence number. Clients hold a token
+// ("<daemon instance>:<sequence>") and ask over a Unix socket which paths changed since it; a
+// token the daemon cannot answer for (another daemon instance, a journal that was trimmed, an
+// inotify queue overflow, or a watch limit that was hit) gets a "rescan everything" reply.
+//
+// Protocol, one request per connection:
+//   "query <token>\n" -> "changes <new token>\n" followed by NUL-terminated paths,
+//                        or "full <new token>\n"
+//   "status\n"        -> "ok <token> <watched directories> <journal entries>[ degraded]\n"
+//   "stop\n"          -> "ok\n", and the daemon exits
+//
+// Client side, `scan` keeps the daemon's last token in .kit/fsmonitor-state together with the file
+// listing it produced at that token. The next listing is the saved one with only the paths the
+// daemon reports being read from disk again.
+namespace fsmonitor
+{
+    const std::string SOCKET_FILE = KIT_DIR + "/fsmonitor.sock";
+    const std::string STATE_FILE = KIT_DIR + "/fsmonitor-state";
+
+    constexpr char STATE_SIGNATURE[4] = {'K', 'F', 'S', 'M'};
+    constexpr size_t MAX_JOURNAL = 1 << 20;
+
+    // Reply to a "changes since token" query
+    struct Changes
+    {
+        std::string token;              // pass back on the next query
+        bool full = false;              // the daemon cannot tell what changed; rescan everything
+        std::vector<std::string> paths; // changed files and directories, sorted
+    };
+
+    namespace detail
+    {
+        // Closes a descriptor when it goes out of scope
+        struct Fd
+        {
+            int fd = -1;
+            explicit Fd(int value) : fd(value) {}
+            ~Fd()
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+            Fd(const Fd &) = delete;
+            Fd &operator=(const Fd &) = delete;
+        };
+
+        inline bool socket_address(const std::string &path, sockaddr_un &address)
+        {
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+            {
+                return false;
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+
+        inline void set_timeout(int fd, int seconds)
+        {
+            timeval timeout{seconds, 0};
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+
+        inline bool write_all(int fd, const std::string &data)
+        {
+            size_t written = 0;
+            while (written < data.size())
+            {
+                ssize_t count = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    return false;
+                }
+                written += static_cast<size_t>(count);
+            }
+            return true;
+        }
+
+        // Read until EOF, or until `delimiter` when one is given
+        inline bool read_all(int fd, std::string &out, int delimiter = -1)
+        {
+            char buffer[64 * 1024];
+            while (true)
+            {
+                ssize_t count = ::recv(fd, buffer, sizeof(buffer), 0);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count < 0)
+                {
+                    return false;
+                }
+                if (count == 0)
+                {
+                    return true;
+                }
+                out.append(buffer, static_cast<size_t>(count));
+                if (delimiter >= 0 && std::memchr(buffer, delimiter, static_cast<size_t>(count)))
+                {
+                    return true;
+                }
+            }
+        }
+    } // namespace detail
+
+    // Send one request to the daemon; returns false when no daemon answers
+    inline bool request(const std::string &line, std::string &reply, const std::string &socket_path = SOCKET_FILE)
+    {
+        sockaddr_un address;
+        if (!detail::socket_address(socket_path, address))
+        {
+            return false;
+        }
+        detail::Fd sock(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (sock.fd < 0 || ::connect(sock.fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            return false;
+        }
+        detail::set_timeout(sock.fd, 10);
+        reply.clear();
+        return detail::write_all(sock.fd, line + "\n") && ::shutdown(sock.fd, SHUT_WR) == 0 &&
+               detail::read_all(sock.fd, reply) && !reply.empty();
+    }
+
+    // Ask the daemon what changed since `token` ("" for just a fresh token)
+    inline bool query(const std::string &token, Changes &changes, const std::string &socket_path = SOCKET_FILE)
+    {
+        std::string reply;
+        if (!request("query " + token, reply, socket_path))
+        {
+            return false;
+        }
+        size_t newline = reply.find('\n');
+        if (newline == std::string::npos)
+        {
+            return false;
+        }
+        std::istringstream header(reply.substr(0, newline));
+        std::string kind;
+        header >> kind >> changes.token;
+        if ((kind != "changes" && kind != "full") || changes.token.empty())
+        {
+            return false;
+        }
+        changes.full = kind == "full";
+        changes.paths.clear();
+        for (size_t pos = newline + 1; pos < reply.size();)
+        {
+            size_t end = reply.find('\0', pos);
+            if (end == std::string::npos)
+            {
+                end = reply.size();
+            }
+            changes.paths.push_back(reply.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        return true;
+    }
+
+    // True when a daemon is serving this repository
+    inline bool is_running(const std::string &socket_path = SOCKET_FILE)
+    {
+        std::string reply;
+        return request("status", reply, socket_path) && reply.rfind("ok", 0) == 0;
+    }
+
+    // The inotify watcher. Construct it from the top of the working tree, then call run().
+    class Daemon
+    {
+    public:
+        explicit Daemon(const std::string &socket_path = SOCKET_FILE) : socket_path_(socket_path)
+        {
+            if (is_running(socket_path_))
+            {
+                throw std::runtime_error("A filesystem monitor is already running");
+            }
+            instance_ = std::to_string(::getpid()) + "-" +
+                        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+            inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (inotify_fd_ < 0)
+            {
+                throw std::runtime_error("inotify_init1 failed: " + std::string(std::strerror(errno)));
+            }
+
+            // Watches go in before the socket opens, so no token is handed out for unwatched changes
+            add_watches("");
+
+            sockaddr_un address;
+            if (!detail::socket_address(socket_path_, address))
+            {
+                throw std::runtime_error("Socket path too long: " + socket_path_);
+            }
+            listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            ::unlink(socket_path_.c_str()); // left behind by a daemon that did not shut down cleanly
+            if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+                ::listen(listen_fd_, 64) != 0)
+            {
+                std::string reason = std::strerror(errno);
+                if (listen_fd_ >= 0)
+                {
+                    ::close(listen_fd_); // not bound to the path, so leave whatever is there
+                    listen_fd_ = -1;
+                }
+                close_fds();
+                throw std::runtime_error("Failed to listen on " + socket_path_ + ": " + reason);
+            }
+        }
+
+        ~Daemon() { close_fds(); }
+
+        Daemon(const Daemon &) = delete;
+        Daemon &operator=(const Daemon &) = delete;
+
+        // Serve queries until a stop request arrives or the working tree disappears
+        void run()
+        {
+            while (running_)
+            {
+                pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {listen_fd_, POLLIN, 0}};
+                if (::poll(fds, 2, -1) < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw std::runtime_error("poll failed: " + std::string(std::strerror(errno)));
+                }
+                if (fds[0].revents & POLLIN)
+                {
+                    drain();
+                }
+                if (fds[1].revents & POLLIN)
+                {
+                    serve();
+                }
+            }
+            close_fds();
+        }
+
+        std::string token() const { return instance_ + ":" + std::to_string(seq_); }
+        bool degraded() const { return degraded_; }
+
+    private:
+        // Stop listening and remove the socket, so clients see no daemon from here on
+        void close_fds()
+        {
+            if (listen_fd_ >= 0)
+            {
+                ::close(listen_fd_);
+                ::unlink(socket_path_.c_str());
+                listen_fd_ = -1;
+            }
+            if (inotify_fd_ >= 0)
+            {
+                ::close(inotify_fd_);
+                inotify_fd_ = -1;
+            }
+        }
+
+        // Watch a directory and everything below it, except `.kit`
+        void add_watches(const std::string &root)
+        {
+            constexpr std::uint32_t MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM |
+                                           IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+            std::vector<std::string> pending{root};
+            while (!pending.empty() && !degraded_)
+            {
+                std::string dir = std::move(pending.back());
+                pending.pop_back();
+                int wd = ::inotify_add_watch(inotify_fd_, dir.empty() ? "." : dir.c_str(), MASK);
+                if (wd < 0)
+                {
+                    if (errno == ENOSPC || errno == ENOMEM)
+                    {
+                        // Out of watches: changes can no longer be tracked, so every query rescans
+                        degraded_ = true;
+                        valid_since_ = ++seq_;
+                    }
+                    continue; // the directory vanished or is unreadable
+                }
+                watches_[wd] = dir;
+                for (const auto &entry : worktree::detail::read_directory(dir))
+                {
+                    std::string path = dir.empty() ? entry.name : dir + "/" + entry.name;
+                    bool is_dir = entry.type == DT_DIR;
+                    if (entry.type == DT_UNKNOWN)
+                    {
+                        struct stat st;
+                        is_dir = ::lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+                    }
+                    if (is_dir && !(dir.empty() && entry.name == KIT_DIR))
+                    {
+                        pending.push_back(std::move(path));
+                    }
+                }
+            }
+        }
+
+        // Stop watching a directory that moved away, and everything below it
+        void remove_watches(const std::string &root)
+        {
+            std::string prefix = root + "/";
+            for (auto it = watches_.begin(); it != watches_.end();)
+            {
+                if (it->second == root || it->second.compare(0, prefix.size(), prefix) == 0)
+                {
+                    ::inotify_rm_watch(inotify_fd_, it->first);
+                    it = watches_.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        void record(std::string path)
+        {
+            journal_.push_back({++seq_, std::move(path)});
+            if (journal_.size() > MAX_JOURNAL)
+            {
+                // Forget the older half; tokens from before it must rescan
+                size_t drop = journal_.size() / 2;
+                valid_since_ = journal_[drop - 1].first;
+                journal_.erase(journal_.begin(), journal_.begin() + static_cast<long>(drop));
+            }
+        }
+
+        // Read every queued inotify event
+        void drain()
+        {
+            alignas(inotify_event) char buffer[256 * 1024];
+            while (true)
+            {
+                ssize_t length = ::read(inotify_fd_, buffer, sizeof(buffer));
+                if (length <= 0)
+                {
+                    return; // EAGAIN: the queue is empty
+                }
+                for (ssize_t offset = 0; offset < length;)
+                {
+                    const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                    offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                    handle(*event);
+                }
+            }
+        }
+
+        void handle(const inotify_event &event)
+        {
+            if (event.mask & IN_Q_OVERFLOW)
+            {
+                valid_since_ = ++seq_;
+                return;
+            }
+            auto it = watches_.find(event.wd);
+            if (it == watches_.end())
+            {
+                return;
+            }
+            if (event.mask & IN_IGNORED)
+            {
+                watches_.erase(it);
+                return;
+            }
+            const std::string &dir = it->second;
+            if (event.mask & IN_DELETE_SELF)
+            {
+                if (dir.empty())
+                {
+                    running_ = false; // the working tree itself is gone
+                }
+                return;
+            }
+
+            std::string name = event.len > 0 ? std::string(event.name) : std::string();
+            if (name.empty() || (dir.empty() && name == KIT_DIR))
+            {
+                return;
+            }
+            std::string path = dir.empty() ? name : dir + "/" + name;
+            if (event.mask & IN_ISDIR)
+            {
+                if (event.mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    add_watches(path);
+                }
+                else if (event.mask & IN_MOVED_FROM)
+                {
+                    remove_watches(path);
+                }
+            }
+            record(std::move(path));
+        }
+
+        void serve()
+        {
+            detail::Fd client(::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC));
+            if (client.fd < 0)
+            {
+                return;
+            }
+            detail::set_timeout(client.fd, 5);
+            std::string line;
+            if (!detail::read_all(client.fd, line, '\n'))
+            {
+                return;
+            }
+            line = line.substr(0, line.find('\n'));
+            detail::write_all(client.fd, answer(line));
+        }
+
+        std::string answer(const std::string &line)
+        {
+            if (line == "stop")
+            {
+                running_ = false;
+                return "ok\n";
+            }
+
+            drain(); // every change made before the request is in the journal now
+            if (line == "status")
+            {
+                return "ok " + token() + " " + std::to_string(watches_.size()) + " " +
+                       std::to_string(journal_.size()) + (degraded_ ? " degraded\n" : "\n");
+            }
+            if (line.rfind("query", 0) != 0)
+            {
+                return "error unknown request\n";
+            }
+
+            std::string since = line.size() > 6 ? line.substr(6) : "";
+            size_t colon = since.rfind(':');
+            bool full = degraded_ || colon == std::string::npos || since.compare(0, colon, instance_) != 0;
+            std::uint64_t seq = 0;
+            if (!full)
+            {
+                seq = std::strtoull(since.c_str() + colon + 1, nullptr, 10);
+                full = seq < valid_since_ || seq > seq_;
+            }
+            if (full)
+            {
+                return "full " + token() + "\n";
+            }
+
+            auto first = std::upper_bound(journal_.begin(), journal_.end(), seq,
+                                          [](std::uint64_t value, const auto &entry)
+                                          { return value < entry.first; });
+            std::vector<std::string> paths;
+            for (auto it = first; it != journal_.end(); ++it)
+            {
+                paths.push_back(it->second);
+            }
+            std::sort(paths.begin(), paths.end());
+            paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+            std::string reply = "changes " + token() + "\n";
+            for (const auto &path : paths)
+            {
+                reply += path;
+                reply.push_back('\0');
+            }
+            return reply;
+        }
+
+        std::string socket_path_;
+        std::string instance_;
+        int inotify_fd_ = -1;
+        int listen_fd_ = -1;
+        bool running_ = true;
+        bool degraded_ = false;
+        std::uint64_t seq_ = 0;
+        std::uint64_t valid_since_ = 0; // tokens older than this must rescan
+        std::unordered_map<int, std::string> watches_;
+        std::vector<std::pair<std::uint64_t, std::string>> journal_;
+    };
+
+    // What `scan` saw at a token: every listed file, and which paths the index tracked then
+    struct State
+    {
+        std::string token;
+        std::map<std::string, kit_index::StatData> files;
+        std::vector<std::string> tracked; // sorted
+    };
+
+    namespace detail
+    {
+        constexpr size_t STAT_SIZE = 8 * 5 + 4;
+
+        inline void put_stat(std::string &out, const kit_index::StatData &stat)
+        {
+            binary_io::put_u64(out, static_cast<std::uint64_t>(stat.ctime_ns));
+            binary_io::put_u64(out, static_cast<std::uint64_t>(stat.mtime_ns));
+            binary_io::put_u64(out, stat.dev);
+            binary_io::put_u64(out, stat.ino);
+            binary_io::put_u32(out, stat.mode);
+            binary_io::put_u64(out, stat.size);
+        }
+
+        inline kit_index::StatData get_stat(const unsigned char *p)
+        {
+            kit_index::StatData stat;
+            stat.ctime_ns = static_cast<std::int64_t>(binary_io::get_u64(p));
+            stat.mtime_ns = static_cast<std::int64_t>(binary_io::get_u64(p + 8));
+            stat.dev = binary_io::get_u64(p + 16);
+            stat.ino = binary_io::get_u64(p + 24);
+            stat.mode = binary_io::get_u32(p + 32);
+            stat.size = binary_io::get_u64(p + 36);
+            return stat;
+        }
+
+        inline void put_string(std::string &out, const std::string &value)
+        {
+            binary_io::put_u32(out, static_cast<std::uint32_t>(value.size()));
+            out += value;
+        }
+
+        inline bool get_string(const unsigned char *data, size_t size, size_t &pos, std::string &value)
+        {
+            if (pos + 4 > size)
+            {
+                return false;
+            }
+            size_t length = binary_io::get_u32(data + pos);
+            pos += 4;
+            if (pos + length > size)
+            {
+                return false;
+            }
+            value.assign(reinterpret_cast<const char *>(data + pos), length);
+            pos += length;
+            return true;
+        }
+    } // namespace detail
+
+    // Load the saved state; returns false when there is none or it is unreadable
+    inline bool load_state(State &state, const std::string &path = STATE_FILE)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+        size_t pos = 4;
+        if (data.size() < 8 || std::memcmp(p, STATE_SIGNATURE, 4) != 0 ||
+            !detail::get_string(p, data.size(), pos, state.token) || pos + 8 > data.size())
+        {
+            return false;
+        }
+        std::uint32_t files = binary_io::get_u32(p + pos);
+        std::uint32_t tracked = binary_io::get_u32(p + pos + 4);
+        pos += 8;
+        std::string name;
+        for (std::uint32_t i = 0; i < files; ++i)
+        {
+            if (!detail::get_string(p, data.size(), pos, name) || pos + detail::STAT_SIZE > data.size())
+            {
+                return false;
+            }
+            state.files.emplace_hint(state.files.end(), name, detail::get_stat(p + pos));
+            pos += detail::STAT_SIZE;
+        }
+        state.tracked.reserve(tracked);
+        for (std::uint32_t i = 0; i < tracked; ++i)
+        {
+            if (!detail::get_string(p, data.size(), pos, name))
+            {
+                return false;
+            }
+            state.tracked.push_back(name);
+        }
+        return true;
+    }
+
+    inline void save_state(const State &state, const std::string &path = STATE_FILE)
+    {
+        std::string data(STATE_SIGNATURE, 4);
+        detail::put_string(data, state.token);
+        binary_io::put_u32(data, static_cast<std::uint32_t>(state.files.size()));
+        binary_io::put_u32(data, static_cast<std::uint32_t>(state.tracked.size()));
+        for (const auto &[name, stat] : state.files)
+        {
+            detail::put_string(data, name);
+            detail::put_stat(data, stat);
+        }
+        for (const auto &name : state.tracked)
+        {
+            detail::put_string(data, name);
+        }
+
+        // The state is only a cache, so failing to write it, or finding another process writing
+        // it, is not an error
+        try
+        {
+            lock_file::LockFile lock(path);
+            lock.write(data);
+            lock.commit();
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+    }
+
+    namespace detail
+    {
+        inline std::string parent_dir(const std::string &path)
+        {
+            size_t slash = path.rfind('/');
+            return slash == std::string::npos ? "" : path.substr(0, slash);
+        }
+
+        inline std::string base_name(const std::string &path)
+        {
+            size_t slash = path.rfind('/');
+            return slash == std::string::npos ? path : path.substr(slash + 1);
+        }
+
+        // True if some index entry lives below `dir`
+        inline bool is_tracked_dir(const kit_index::Index &index, const std::string &dir)
+        {
+            std::string prefix = dir + "/";
+            auto it = std::lower_bound(index.entries.begin(), index.entries.end(), prefix,
+                                       [](const kit_index::Entry &entry, const std::string &key)
+                                       { return entry.path < key; });
+            return it != index.entries.end() && it->path.compare(0, prefix.size(), prefix) == 0;
+        }
+
+        // True if the scanner would skip `path` for its name or the ignore rules, were it untracked
+        inline bool is_ignored(const worktree::IgnoreRules &rules, const std::string &path, bool is_directory)
+        {
+            for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1))
+            {
+                std::string dir = path.substr(0, slash);
+                if (base_name(dir) == KIT_DIR || (!rules.empty() && rules.is_ignored(dir, true)))
+                {
+                    return true;
+                }
+            }
+            return (is_directory && base_name(path) == KIT_DIR) || (!rules.empty() && rules.is_ignored(path, is_directory));
+        }
+
+        // True if `dir` or a directory above it holds a build tree the scanner does not descend into.
+        // With an index, tracked directories are descended into regardless.
+        inline bool in_build_tree(const kit_index::Index *index, std::string dir)
+        {
+            for (; !dir.empty(); dir = parent_dir(dir))
+            {
+                struct stat st;
+                if ((!index || !is_tracked_dir(*index, dir)) &&
+                    ::lstat((dir + "/" + worktree::detail::BUILD_TREE_MARKER).c_str(), &st) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Apply the daemon's changes to the last listing. Returns false when the changes can move
+        // the ignore or build tree boundaries, which only a full scan can settle.
+        inline bool replay(const kit_index::Index &index, const Changes &changes, const worktree::ScanOptions &options,
+                           State &state)
+        {
+            const worktree::IgnoreRules rules = worktree::IgnoreRules::load();
+            std::vector<std::string> paths = changes.paths;
+
+            // A path that became tracked or untracked is listed or skipped differently only when the
+            // scanner would have skipped it for being ignored or in a build tree
+            std::vector<std::string> retracked;
+            std::vector<std::string> tracked;
+            tracked.reserve(index.entries.size());
+            for (const auto &entry : index.entries)
+            {
+                tracked.push_back(entry.path);
+            }
+            std::set_symmetric_difference(tracked.begin(), tracked.end(), state.tracked.begin(), state.tracked.end(),
+                                          std::back_inserter(retracked));
+            for (const auto &path : retracked)
+            {
+                if (is_ignored(rules, path, false) || in_build_tree(nullptr, parent_dir(path)))
+                {
+                    return false;
+                }
+            }
+
+            for (const auto &path : paths)
+            {
+                if (path == IGNORE_FILE || base_name(path) == worktree::detail::BUILD_TREE_MARKER)
+                {
+                    return false;
+                }
+
+                // Anything at or below the changed path is read again from disk
+                state.files.erase(path);
+                state.files.erase(state.files.lower_bound(path + "/"), state.files.lower_bound(path + "0")); // '0' follows '/'
+
+                struct stat st;
+                if (::lstat(path.c_str(), &st) != 0)
+                {
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode))
+                {
+                    bool tracked_dir = is_tracked_dir(index, path);
+                    if (is_ignored(rules, path, true))
+                    {
+                        if (tracked_dir)
+                        {
+                            return false; // the scanner lists only the tracked files in here
+                        }
+                        continue;
+                    }
+                    if (!tracked_dir && in_build_tree(&index, path))
+                    {
+                        continue;
+                    }
+                    for (auto &record : worktree::scan(path, options))
+                    {
+                        state.files[std::move(record.path)] = record.stat;
+                    }
+                }
+                else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))
+                {
+                    if (!kit_index::find_entry(index, path) &&
+                        (is_ignored(rules, path, false) || in_build_tree(&index, parent_dir(path))))
+                    {
+                        continue;
+                    }
+                    kit_index::StatData stat;
+                    if (kit_index::stat_file(path, stat))
+                    {
+                        state.files[path] = stat;
+                    }
+                }
+            }
+            state.tracked = std::move(tracked);
+            return true;
+        }
+    } // namespace detail
+
+    namespace detail
+    {
+        // The last saved state, kept by long-lived processes so a scan does not decode the state
+        // file again; it is used only while the file is the one this process wrote
+        struct ResidentState
+        {
+            bool enabled = false;
+            bool valid = false;
+            kit_index::StatData stat;
+            State state;
+        };
+
+        inline ResidentState &resident_state()
+        {
+            static ResidentState instance;
+            return instance;
+        }
+
+        inline bool load_resident_state(State &state)
+        {
+            ResidentState &resident = resident_state();
+            kit_index::StatData stat;
+            if (resident.enabled && resident.valid && kit_index::stat_file(STATE_FILE, stat) && stat == resident.stat)
+            {
+                state = resident.state;
+                return true;
+            }
+            return load_state(state);
+        }
+
+        inline void save_resident_state(State &state)
+        {
+            save_state(state);
+            ResidentState &resident = resident_state();
+            if (resident.enabled)
+            {
+                resident.valid = kit_index::stat_file(STATE_FILE, resident.stat);
+                resident.state = std::move(state);
+            }
+        }
+    } // namespace detail
+
+    // Keep the scan state in memory between scans (the repository daemon). Not thread-safe: the
+    // daemon serves one request at a time.
+    inline void keep_state_resident(bool enabled)
+    {
+        detail::ResidentState &resident = detail::resident_state();
+        resident.enabled = enabled;
+        resident.valid = false;
+        resident.state = State{};
+    }
+
+    // List the working tree below `root` like worktree::scan. When a daemon is running, only the
+    // paths it reports as changed since the last call are read from disk; otherwise this scans.
+    inline std::vector<worktree::FileRecord> scan(const std::string &root = ".", const worktree::ScanOptions &options = {})
+    {
+        trace::Span span("fsmonitor.scan");
+        State state;
+        Changes changes;
+        bool have_state = options.index && detail::load_resident_state(state);
+        if (!options.index || !query(have_state ? state.token : "", changes))
+        {
+            return worktree::scan(root, options);
+        }
+
+        span.arg("changed", changes.paths.size());
+        if (!have_state || changes.full || !detail::replay(*options.index, changes, options, state))
+        {
+            span.arg("full_scan", 1);
+            state.files.clear();
+            for (auto &record : worktree::scan(".", options))
+            {
+                state.files.emplace_hint(state.files.end(), std::move(record.path), record.stat);
+            }
+            state.tracked.clear();
+            for (const auto &entry : options.index->entries)
+            {
+                state.tracked.push_back(entry.path);
+            }
+        }
+        state.token = changes.token;
+
+        std::string start = kit_index::normalize_path(root);
+        while (start.size() > 1 && start.back() == '/')
+        {
+            start.pop_back();
+        }
+        std::string prefix = start == "." ? "" : start + "/";
+        std::vector<worktree::FileRecord> records;
+        for (auto it = state.files.lower_bound(prefix);
+             it != state.files.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+        {
+            records.push_back({it->first, it->second});
+        }
+        detail::save_resident_state(state);
+        return records;
+    }
+} // namespace fsmonitor
+
+#endif // FSMONITOR_HPP
@@ -2,27 +2,287 @@
 #define HASH_OBJECT_HPP
 
 #include <string>
-#include <sstream> // Include this header for std::ostringstream
-#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#include "config.hpp"
+#include "trace.hpp"
 
 namespace hash_object
 {
+    // Write `length` bytes as lowercase hex into `out`, which must hold 2 * length characters
+    inline void to_hex(const unsigned char *hash, size_t length, char *out)
+    {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        for (size_t i = 0; i < length; ++i)
+        {
+            out[2 * i] = DIGITS[hash[i] >> 4];
+            out[2 * i + 1] = DIGITS[hash[i] & 0x0F];
+        }
+    }
+
     inline std::string to_hex(const unsigned char *hash, size_t length)
     {
-        std::ostringstream oss;
+        std::string hex(2 * length, '\0');
+        to_hex(hash, length, &hex[0]);
+        return hex;
+    }
+
+    namespace detail
+    {
+        // Value of each hex digit, or -1
+        struct HexTable
+        {
+            signed char values[256];
+
+            constexpr HexTable() : values()
+            {
+                for (int c = 0; c < 256; ++c)
+                {
+                    values[c] = -1;
+                }
+                for (int c = 0; c < 10; ++c)
+                {
+                    values['0' + c] = static_cast<signed char>(c);
+                }
+                for (int c = 0; c < 6; ++c)
+                {
+                    values['a' + c] = static_cast<signed char>(10 + c);
+                    values['A' + c] = static_cast<signed char>(10 + c);
+                }
+            }
+        };
+
+        inline constexpr HexTable HEX_TABLE{};
+    } // namespace detail
+
+    // Decode 2 * length hex characters into raw bytes; returns false on malformed input
+    inline bool from_hex(const char *hex, unsigned char *out, size_t length)
+    {
         for (size_t i = 0; i < length; ++i)
         {
-            oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+            int high = detail::HEX_TABLE.values[static_cast<unsigned char>(hex[2 * i])];
+            int low = detail::HEX_TABLE.values[static_cast<unsigned char>(hex[2 * i + 1])];
+            if ((high | low) < 0)
+            {
+                return false;
+            }
+            out[i] = static_cast<unsigned char>((high << 4) | low);
+        }
+        return true;
+    }
+
+    inline bool from_hex(const std::string &hex, unsigned char *out, size_t length)
+    {
+        return hex.size() == length * 2 && from_hex(hex.data(), out, length);
+    }
+
+    // Hash functions an object id can be computed with; chosen per repository at `init`
+    enum class Algorithm : std::uint8_t
+    {
+        Sha1,
+        Sha256,
+    };
+
+    constexpr size_t MAX_OID_SIZE = 32;
+
+    // A hash backend: its configuration name, digest width and OpenSSL implementation.
+    // OpenSSL selects SHA-NI (x86) or the ARMv8 crypto extensions at run time when the CPU has them.
+    struct Backend
+    {
+        Algorithm algorithm;
+        const char *name;
+        size_t digest_size;
+        const EVP_MD *(*md)();
+    };
+
+    namespace detail
+    {
+        inline const EVP_MD *sha1_md()
+        {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            // Fetch once; an implicit fetch on every EVP_DigestInit_ex costs a provider lookup
+            static EVP_MD *md = EVP_MD_fetch(nullptr, "SHA1", nullptr);
+            return md;
+#else
+            return EVP_sha1();
+#endif
+        }
+
+        inline const EVP_MD *sha256_md()
+        {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            static EVP_MD *md = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+            return md;
+#else
+            return EVP_sha256();
+#endif
+        }
+
+        constexpr Backend BACKENDS[] = {
+            {Algorithm::Sha1, "sha1", SHA_DIGEST_LENGTH, sha1_md},
+            {Algorithm::Sha256, "sha256", SHA256_DIGEST_LENGTH, sha256_md},
+        };
+    } // namespace detail
+
+    inline const Backend &backend(Algorithm algorithm)
+    {
+        return detail::BACKENDS[static_cast<size_t>(algorithm)];
+    }
+
+    // Look up an algorithm by its configuration name
+    inline bool parse_algorithm(const std::string &name, Algorithm &algorithm)
+    {
+        for (const auto &candidate : detail::BACKENDS)
+        {
+            if (name == candidate.name)
+            {
+                algorithm = candidate.algorithm;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    namespace detail
+    {
+        // Cached repository algorithm; -1 until the config has been read
+        inline std::atomic<int> &repository_algorithm_slot()
+        {
+            static std::atomic<int> slot{-1};
+            return slot;
+        }
+    } // namespace detail
+
+    // Object format of the current repository, read from `objectformat` in the config once.
+    // Repositories without the setting use SHA-1.
+    inline Algorithm repository_algorithm()
+    {
+        int cached = detail::repository_algorithm_slot().load(std::memory_order_relaxed);
+        if (cached >= 0)
+        {
+            return static_cast<Algorithm>(cached);
+        }
+        Algorithm algorithm = Algorithm::Sha1;
+        std::string name = kit_config::get("objectformat", "sha1");
+        if (!parse_algorithm(name, algorithm))
+        {
+            throw std::runtime_error("Unknown object format in config: " + name);
+        }
+        detail::repository_algorithm_slot().store(static_cast<int>(algorithm), std::memory_order_relaxed);
+        return algorithm;
+    }
+
+    // Forget the cached object format, e.g. after `init` wrote a new config
+    inline void reload_repository_algorithm()
+    {
+        detail::repository_algorithm_slot().store(-1, std::memory_order_relaxed);
+    }
+
+    // Width in bytes of the object ids of the current repository
+    inline size_t oid_size()
+    {
+        return backend(repository_algorithm()).digest_size;
+    }
+
+    // Name of the CPU hash instructions available to the backends, or "none"
+    inline std::string hardware_acceleration()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29)))
+        {
+            return "SHA-NI";
+        }
+#elif defined(__aarch64__) && defined(__APPLE__)
+        return "ARMv8 SHA";
+#elif defined(__aarch64__) && defined(__linux__)
+        unsigned long hwcap = getauxval(AT_HWCAP);
+        if ((hwcap & (1ul << 5)) && (hwcap & (1ul << 6))) // HWCAP_SHA1 | HWCAP_SHA2
+        {
+            return "ARMv8 SHA";
         }
-        return oss.str();
+#endif
+        return "none";
+    }
+
+    // Incremental hash: feed data in any number of chunks, then take the digest once
+    class Hasher
+    {
+    public:
+        explicit Hasher(Algorithm algorithm = repository_algorithm()) : ctx_(EVP_MD_CTX_new())
+        {
+            if (!ctx_ || EVP_DigestInit_ex(ctx_, backend(algorithm).md(), nullptr) != 1)
+            {
+                EVP_MD_CTX_free(ctx_);
+                throw std::runtime_error(std::string("Failed to initialise ") + backend(algorithm).name +
+                                         " context");
+            }
+        }
+
+        ~Hasher() { EVP_MD_CTX_free(ctx_); }
+
+        Hasher(const Hasher &) = delete;
+        Hasher &operator=(const Hasher &) = delete;
+
+        void update(const void *data, size_t size)
+        {
+            if (size > 0 && EVP_DigestUpdate(ctx_, data, size) != 1)
+            {
+                throw std::runtime_error("Hash update failed");
+            }
+            trace::count(trace::Counter::BytesHashed, size);
+        }
+
+        void update(const std::string &data) { update(data.data(), data.size()); }
+
+        // Finish the hash into `out` (MAX_OID_SIZE bytes) and return the digest length
+        size_t digest(unsigned char *out)
+        {
+            unsigned char hash[EVP_MAX_MD_SIZE];
+            unsigned int length = 0;
+            if (EVP_DigestFinal_ex(ctx_, hash, &length) != 1 || length > MAX_OID_SIZE)
+            {
+                throw std::runtime_error("Hash finalisation failed");
+            }
+            std::copy(hash, hash + length, out);
+            trace::count(trace::Counter::ObjectsHashed);
+            return length;
+        }
+
+        // Finish the hash and return it as lowercase hex
+        std::string hex_digest()
+        {
+            unsigned char hash[MAX_OID_SIZE];
+            size_t length = digest(hash);
+            return to_hex(hash, length);
+        }
+
+    private:
+        EVP_MD_CTX *ctx_;
+    };
+
+    // Object id of `input` in the repository's object format, as hex
+    inline std::string compute_oid(const std::string &input)
+    {
+        Hasher hasher;
+        hasher.update(input);
+        return hasher.hex_digest();
     }
 
     inline std::string compute_sha1(const std::string &input)
     {
-        unsigned char hash[SHA_DIGEST_LENGTH];
-        SHA1(reinterpret_cast<const unsigned char *>(input.c_str()), input.size(), hash);
-        return to_hex(hash, SHA_DIGEST_LENGTH);
+        Hasher hasher(Algorithm::Sha1);
+        hasher.update(input);
+        return hasher.hex_digest();
     }
 }
 
@@ -0,0 +1,541 @@
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+#include "constants.hpp"
+#include "binary_io.hpp"
+#include "hash_object.hpp"
+#include "lock_file.hpp"
+#include "mapped_file.hpp"
+#include "object_id.hpp"
+#include "trace.hpp"
+
+// Binary staging index.
+//
+// Layout (all integers big-endian):
+//   header    "KIDX" | version u32 | entry count u32
+//   entries   sorted by path; each is
+//             ctime_ns u64 | mtime_ns u64 | dev u64 | ino u64 | mode u32 | size u64 |
+//             object id | path length u16 | path bytes
+//             (object ids are 20 or 32 bytes wide, following the repository's object format)
+//   extensions signature (4 bytes) | length u32 | payload
+//             "TREE" (cached tree): per directory, path length u16 | path | entry count u32 | tree id
+//   trailer   SHA-1 of everything above
+namespace kit_index
+{
+    constexpr char INDEX_SIGNATURE[4] = {'K', 'I', 'D', 'X'};
+    constexpr std::uint32_t INDEX_VERSION = 1;
+    constexpr size_t HEADER_SIZE = 12;
+
+    // Size of an entry without its path
+    inline size_t entry_fixed_size(size_t oid_size)
+    {
+        return 8 * 4 + 4 + 8 + oid_size + 2;
+    }
+
+    // Cached stat data used to detect unchanged files without reading them
+    struct StatData
+    {
+        std::uint32_t mode = 0;
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        std::int64_t ctime_ns = 0;
+        std::uint64_t ino = 0;
+        std::uint64_t dev = 0;
+
+        bool operator==(const StatData &other) const
+        {
+            return mode == other.mode && size == other.size && mtime_ns == other.mtime_ns &&
+                   ctime_ns == other.ctime_ns && ino == other.ino && dev == other.dev;
+        }
+        bool operator!=(const StatData &other) const { return !(*this == other); }
+    };
+
+    struct Entry
+    {
+        std::string path;
+        object_id::ObjectId oid; // staged blob
+        StatData stat;
+    };
+
+    // Tree id of a directory whose staged contents are unchanged since the tree was written
+    struct CachedTree
+    {
+        object_id::ObjectId oid;
+        std::uint32_t entry_count = 0; // index entries below the directory
+    };
+
+    constexpr char CACHE_TREE_SIGNATURE[] = "TREE";
+
+    struct Index
+    {
+        std::vector<Entry> entries;                        // sorted by path
+        std::map<std::string, CachedTree> cache_tree;      // directory ("" for the root) -> tree
+        std::map<std::string, std::string> extensions;     // other extensions, preserved on save
+        std::int64_t timestamp_ns = 0;                     // mtime of the index file when it was loaded
+    };
+
+    // Drop the cached trees of every directory containing `path`
+    inline void invalidate_cache_tree(Index &index, const std::string &path)
+    {
+        if (index.cache_tree.empty())
+        {
+            return;
+        }
+        index.cache_tree.erase("");
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1))
+        {
+            index.cache_tree.erase(path.substr(0, slash));
+        }
+    }
+
+    // Normalize a user-supplied path to the repository-relative form stored in the index
+    inline std::string normalize_path(const std::string &path)
+    {
+        std::filesystem::path p(path);
+        if (p.is_absolute())
+        {
+            p = std::filesystem::relative(p, std::filesystem::current_path());
+        }
+        std::string normalized = p.lexically_normal().generic_string();
+        if (normalized.rfind("./", 0) == 0)
+        {
+            normalized = normalized.substr(2);
+        }
+        return normalized;
+    }
+
+    // Collect the stat data of a working tree file; returns false if it cannot be stat'ed
+    inline bool stat_file(const std::string &path, StatData &out)
+    {
+        struct stat st;
+        if (::lstat(path.c_str(), &st) != 0)
+        {
+            return false;
+        }
+
+        if (S_ISLNK(st.st_mode))
+        {
+            out.mode = 0120000;
+        }
+        else
+        {
+            out.mode = (st.st_mode & S_IXUSR) ? 0100755 : 0100644;
+        }
+        out.size = static_cast<std::uint64_t>(st.st_size);
+#ifdef __APPLE__
+        out.mtime_ns = mapped_file::timespec_ns(st.st_mtimespec);
+        out.ctime_ns = mapped_file::timespec_ns(st.st_ctimespec);
+#else
+        out.mtime_ns = mapped_file::timespec_ns(st.st_mtim);
+        out.ctime_ns = mapped_file::timespec_ns(st.st_ctim);
+#endif
+        out.ino = static_cast<std::uint64_t>(st.st_ino);
+        out.dev = static_cast<std::uint64_t>(st.st_dev);
+        return true;
+    }
+
+    // True when the cached stat data proves the file is unchanged.
+    // Files modified in the same instant the index was written are "racy" and must be re-hashed.
+    inline bool is_stat_clean(const Index &index, const Entry &entry, const StatData &current)
+    {
+        return entry.stat == current && entry.stat.mtime_ns < index.timestamp_ns;
+    }
+
+    // Locate an entry by path
+    inline Entry *find_entry(Index &index, const std::string &path)
+    {
+        auto it = std::lower_bound(index.entries.begin(), index.entries.end(), path,
+                                   [](const Entry &entry, const std::string &key)
+                                   { return entry.path < key; });
+        return (it != index.entries.end() && it->path == path) ? &*it : nullptr;
+    }
+
+    inline const Entry *find_entry(const Index &index, const std::string &path)
+    {
+        return find_entry(const_cast<Index &>(index), path);
+    }
+
+    // Insert or replace an entry, keeping the entries sorted
+    inline void upsert_entry(Index &index, Entry entry)
+    {
+        auto it = std::lower_bound(index.entries.begin(), index.entries.end(), entry.path,
+                                   [](const Entry &existing, const std::string &key)
+                                   { return existing.path < key; });
+        if (it == index.entries.end() || it->path != entry.path || it->oid != entry.oid ||
+            it->stat.mode != entry.stat.mode)
+        {
+            invalidate_cache_tree(index, entry.path);
+        }
+        if (it != index.entries.end() && it->path == entry.path)
+        {
+            *it = std::move(entry);
+        }
+        else
+        {
+            index.entries.insert(it, std::move(entry));
+        }
+    }
+
+    // Remove an entry; returns false if the path was not staged
+    inline bool remove_entry(Index &index, const std::string &path)
+    {
+        auto it = std::lower_bound(index.entries.begin(), index.entries.end(), path,
+                                   [](const Entry &entry, const std::string &key)
+                                   { return entry.path < key; });
+        if (it == index.entries.end() || it->path != path)
+        {
+            return false;
+        }
+        invalidate_cache_tree(index, path);
+        index.entries.erase(it);
+        return true;
+    }
+
+    // Apply a batch of entries in a single linear merge; later updates for the same path win
+    inline void merge_entries(Index &index, std::vector<Entry> updates)
+    {
+        std::stable_sort(updates.begin(), updates.end(), [](const Entry &a, const Entry &b)
+                         { return a.path < b.path; });
+
+        std::vector<Entry> merged;
+        merged.reserve(index.entries.size() + updates.size());
+
+        auto current = index.entries.begin();
+        for (size_t i = 0; i < updates.size(); ++i)
+        {
+            if (i + 1 < updates.size() && updates[i + 1].path == updates[i].path)
+            {
+                continue;
+            }
+            while (current != index.entries.end() && current->path < updates[i].path)
+            {
+                merged.push_back(std::move(*current++));
+            }
+            if (current != index.entries.end() && current->path == updates[i].path)
+            {
+                if (current->oid != updates[i].oid || current->stat.mode != updates[i].stat.mode)
+                {
+                    invalidate_cache_tree(index, updates[i].path);
+                }
+                ++current;
+            }
+            else
+            {
+                invalidate_cache_tree(index, updates[i].path);
+            }
+            merged.push_back(std::move(updates[i]));
+        }
+        std::move(current, index.entries.end(), std::back_inserter(merged));
+
+        index.entries = std::move(merged);
+    }
+
+    // Parse an index image (header, entries, extensions and checksum trailer)
+    inline Index parse(const unsigned char *data, size_t size)
+    {
+        Index index;
+        if (size == 0)
+        {
+            return index;
+        }
+        if (size < HEADER_SIZE + SHA_DIGEST_LENGTH || std::memcmp(data, INDEX_SIGNATURE, 4) != 0)
+        {
+            throw std::runtime_error("Unsupported index format");
+        }
+
+        std::uint32_t version = static_cast<std::uint32_t>(binary_io::get_uint(data + 4, 4));
+        if (version != INDEX_VERSION)
+        {
+            throw std::runtime_error("Unsupported index version: " + std::to_string(version));
+        }
+
+        size_t body_size = size - SHA_DIGEST_LENGTH;
+        unsigned char checksum[SHA_DIGEST_LENGTH];
+        SHA1(data, body_size, checksum);
+        if (std::memcmp(checksum, data + body_size, SHA_DIGEST_LENGTH) != 0)
+        {
+            throw std::runtime_error("Index checksum mismatch");
+        }
+
+        std::uint32_t count = static_cast<std::uint32_t>(binary_io::get_uint(data + 8, 4));
+        index.entries.reserve(count);
+        const size_t oid_size = hash_object::oid_size();
+        const size_t fixed_size = entry_fixed_size(oid_size);
+
+        size_t pos = HEADER_SIZE;
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            if (pos + fixed_size > body_size)
+            {
+                throw std::runtime_error("Index entry truncated");
+            }
+            const unsigned char *p = data + pos;
+            Entry entry;
+            entry.stat.ctime_ns = static_cast<std::int64_t>(binary_io::get_uint(p, 8));
+            entry.stat.mtime_ns = static_cast<std::int64_t>(binary_io::get_uint(p + 8, 8));
+            entry.stat.dev = binary_io::get_uint(p + 16, 8);
+            entry.stat.ino = binary_io::get_uint(p + 24, 8);
+            entry.stat.mode = static_cast<std::uint32_t>(binary_io::get_uint(p + 32, 4));
+            entry.stat.size = binary_io::get_uint(p + 36, 8);
+            entry.oid = object_id::ObjectId::from_raw(p + 44, oid_size);
+            size_t path_length = static_cast<size_t>(binary_io::get_uint(p + 44 + oid_size, 2));
+            pos += fixed_size;
+            if (pos + path_length > body_size)
+            {
+                throw std::runtime_error("Index entry path truncated");
+            }
+            entry.path.assign(reinterpret_cast<const char *>(data + pos), path_length);
+            pos += path_length;
+            index.entries.push_back(std::move(entry));
+        }
+
+        while (pos + 8 <= body_size)
+        {
+            std::string signature(reinterpret_cast<const char *>(data + pos), 4);
+            size_t length = static_cast<size_t>(binary_io::get_uint(data + pos + 4, 4));
+            pos += 8;
+            if (pos + length > body_size)
+            {
+                throw std::runtime_error("Index extension truncated: " + signature);
+            }
+            if (signature == CACHE_TREE_SIGNATURE)
+            {
+                size_t cursor = pos;
+                while (cursor + 2 <= pos + length)
+                {
+                    size_t path_length = static_cast<size_t>(binary_io::get_uint(data + cursor, 2));
+                    if (cursor + 2 + path_length + 4 + oid_size > pos + length)
+                    {
+                        throw std::runtime_error("Cached tree extension truncated");
+                    }
+                    std::string dir(reinterpret_cast<const char *>(data + cursor + 2), path_length);
+                    cursor += 2 + path_length;
+                    CachedTree cached;
+                    cached.entry_count = binary_io::get_u32(data + cursor);
+                    cached.oid = object_id::ObjectId::from_raw(data + cursor + 4, oid_size);
+                    cursor += 4 + oid_size;
+                    index.cache_tree.emplace(std::move(dir), std::move(cached));
+                }
+            }
+            else
+            {
+                index.extensions[signature].assign(reinterpret_cast<const char *>(data + pos), length);
+            }
+            pos += length;
+        }
+
+        return index;
+    }
+
+    namespace detail
+    {
+        // The last parsed index, kept by long-lived processes and reused while the file's stat
+        // data is unchanged; saving replaces the file, so a new inode always invalidates it
+        struct Resident
+        {
+            std::mutex mutex;
+            bool enabled = false;
+            std::string path;
+            StatData stat;
+            std::shared_ptr<const Index> index;
+        };
+
+        inline Resident &resident()
+        {
+            static Resident instance;
+            return instance;
+        }
+    } // namespace detail
+
+    // Keep the parsed index in memory between loads (the repository daemon)
+    inline void keep_resident(bool enabled)
+    {
+        detail::Resident &r = detail::resident();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.enabled = enabled;
+        r.index.reset();
+    }
+
+    // Load the index through a read-only memory mapping, for reading only. A resident index is
+    // shared rather than copied, so a daemon request costs one stat while the file is unchanged.
+    inline std::shared_ptr<const Index> load_shared(const std::string &path = INDEX_FILE)
+    {
+        trace::Span span("index.load");
+        detail::Resident &r = detail::resident();
+        // Stat before mapping: a write after this point changes the stat data, so what gets cached
+        // under it is never older than the file it describes
+        StatData stat;
+        bool have_stat = stat_file(path, stat);
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            if (r.enabled && r.index && r.path == path && have_stat && stat == r.stat)
+            {
+                span.arg("resident", 1);
+                return r.index;
+            }
+        }
+
+        mapped_file::MappedFile file(path);
+        if (!file.is_open())
+        {
+            return std::make_shared<const Index>();
+        }
+        auto index = std::make_shared<Index>(parse(file.data(), file.size()));
+        index->timestamp_ns = file.mtime_ns();
+        span.arg("entries", index->entries.size());
+
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (r.enabled && have_stat)
+        {
+            r.path = path;
+            r.stat = stat;
+            r.index = index;
+        }
+        return index;
+    }
+
+    // Load a copy of the index to modify
+    inline Index load(const std::string &path = INDEX_FILE)
+    {
+        return *load_shared(path);
+    }
+
+    // Serialize the index into its on-disk representation
+    inline std::string serialize(const Index &index)
+    {
+        const size_t oid_size = hash_object::oid_size();
+        std::string out;
+        out.reserve(HEADER_SIZE + index.entries.size() * (entry_fixed_size(oid_size) + 32) + SHA_DIGEST_LENGTH);
+        out.append(INDEX_SIGNATURE, 4);
+        binary_io::put_u32(out, INDEX_VERSION);
+        binary_io::put_u32(out, static_cast<std::uint32_t>(index.entries.size()));
+
+        for (const auto &entry : index.entries)
+        {
+            if (entry.oid.size != oid_size)
+            {
+                throw std::runtime_error("Invalid object id in index entry: " + entry.path);
+            }
+            if (entry.path.size() > 0xFFFF)
+            {
+                throw std::runtime_error("Path too long for index: " + entry.path);
+            }
+            binary_io::put_u64(out, static_cast<std::uint64_t>(entry.stat.ctime_ns));
+            binary_io::put_u64(out, static_cast<std::uint64_t>(entry.stat.mtime_ns));
+            binary_io::put_u64(out, entry.stat.dev);
+            binary_io::put_u64(out, entry.stat.ino);
+            binary_io::put_u32(out, entry.stat.mode);
+            binary_io::put_u64(out, entry.stat.size);
+            out.append(reinterpret_cast<const char *>(entry.oid.data()), oid_size);
+            binary_io::put_u16(out, static_cast<std::uint16_t>(entry.path.size()));
+            out += entry.path;
+        }
+
+        if (!index.cache_tree.empty())
+        {
+            std::string payload;
+            for (const auto &[dir, cached] : index.cache_tree)
+            {
+                if (cached.oid.size != oid_size)
+                {
+                    continue;
+                }
+                binary_io::put_u16(payload, static_cast<std::uint16_t>(dir.size()));
+                payload += dir;
+                binary_io::put_u32(payload, cached.entry_count);
+                payload.append(reinterpret_cast<const char *>(cached.oid.data()), oid_size);
+            }
+            out.append(CACHE_TREE_SIGNATURE, 4);
+            binary_io::put_u32(out, static_cast<std::uint32_t>(payload.size()));
+            out += payload;
+        }
+
+        for (const auto &[signature, payload] : index.extensions)
+        {
+            out.append(signature, 0, 4);
+            binary_io::put_u32(out, static_cast<std::uint32_t>(payload.size()));
+            out += payload;
+        }
+
+        unsigned char checksum[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char *>(out.data()), out.size(), checksum);
+        out.append(reinterpret_cast<const char *>(checksum), SHA_DIGEST_LENGTH);
+        return out;
+    }
+
+    // How long a writer waits for another process to release the index lock
+    constexpr int LOCK_TIMEOUT_MS = 2000;
+
+    // Replace the index with `index` through its exclusive lock file. Use Update instead when
+    // `index` was derived from the current index, so no concurrent change is overwritten.
+    inline void save(const Index &index, const std::string &path = INDEX_FILE)
+    {
+        trace::Span span("index.save");
+        span.arg("entries", index.entries.size());
+        lock_file::LockFile lock(path, LOCK_TIMEOUT_MS);
+        lock.write(serialize(index));
+        lock.commit();
+    }
+
+    // A read-modify-write of the index. The lock is taken before the index is read and held until
+    // commit, so two writers are serialized instead of one silently losing the other's changes.
+    // Dropping an Update without committing leaves the index untouched.
+    class Update
+    {
+    public:
+        explicit Update(const std::string &path = INDEX_FILE) : lock_(path, LOCK_TIMEOUT_MS), index_(load(path)) {}
+
+        Index &index() { return index_; }
+
+        void commit()
+        {
+            trace::Span span("index.save");
+            span.arg("entries", index_.entries.size());
+            lock_.write(serialize(index_));
+            lock_.commit();
+        }
+
+    private:
+        lock_file::LockFile lock_;
+        Index index_;
+    };
+
+    // Write back an index whose stat data a reader refreshed, unless another process holds the
+    // lock or changed the index since `index` was loaded; returns whether it was written
+    inline bool save_refreshed(const Index &index, const std::string &path = INDEX_FILE)
+    {
+        std::unique_ptr<lock_file::LockFile> lock;
+        try
+        {
+            lock = std::make_unique<lock_file::LockFile>(path);
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        StatData current;
+        if (stat_file(path, current) && current.mtime_ns != index.timestamp_ns)
+        {
+            return false;
+        }
+        lock->write(serialize(index));
+        lock->commit();
+        return true;
+    }
+} // namespace kit_index
+
+#endif // INDEX_HPP
@@ -2,16 +2,37 @@
 #define KIT_UTILS_HPP
 
 #include <string>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <map>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <ctime>
 #include <stdexcept>
 #include "constants.hpp"
 #include "error_handler.hpp"
+#include "logger.hpp"
 #include "hash_object.hpp"
+#include "object_store.hpp"
+#include "commit_object.hpp"
+#include "commit_graph.hpp"
+#include "fsmonitor.hpp"
+#include "merge_base.hpp"
+#include "mapped_file.hpp"
+#include "merge_file.hpp"
+#include "object_db.hpp"
+#include "reflog.hpp"
+#include "refs.hpp"
+#include "index.hpp"
+#include "tree.hpp"
+#include "trace.hpp"
+#include "worktree.hpp"
 
 namespace kit_utils
 {
@@ -20,14 +41,12 @@ namespace kit_utils
     {
         try
         {
-            std::ifstream file(path);
-            if (!file)
+            std::string content;
+            if (!mapped_file::read_all(path, content))
             {
                 throw std::runtime_error("Failed to open file: " + path);
             }
-            std::stringstream buffer;
-            buffer << file.rdbuf();
-            return buffer.str();
+            return content;
         }
         catch (const std::exception &e)
         {
@@ -39,22 +58,18 @@ namespace kit_utils
     // Print a standard message
     inline void print_message(const std::string &message)
     {
-        std::cout << "[kit] " << message << std::endl;
+        logger::info(message);
     }
 
     // Print an error message
     inline void print_error(const std::string &message)
     {
-        std::cerr << "[kit] Error: " << message << std::endl;
+        logger::error(message);
     }
 
     inline void debug(const std::string &message)
     {
-#ifdef DEBUG
-        std::cout << "[DEBUG] " << message << std::endl;
-#else
-        (void)message; // Suppress unused parameter warning
-#endif
+        logger::debug(message);
     }
 
     // Create a file with optional content
@@ -84,6 +99,8 @@ namespace kit_utils
             create_file(".kit/HEAD", "");  // Create an empty HEAD file
             create_file(".kit/index", ""); // Create an empty index file
         }
+        hash_object::reload_repository_algorithm();
+        object_db::clear();
     }
 
     // Ensure the repository is initialized
@@ -97,19 +114,113 @@ namespace kit_utils
         return true;
     }
 
-    // Check if there are staged files
-    inline bool has_staged_files()
+    // Trim trailing whitespace and newlines from a ref value
+    inline std::string trim_ref(std::string value)
+    {
+        while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+        {
+            value.pop_back();
+        }
+        return value;
+    }
+
+    // Resolve HEAD to a commit hash, or an empty string if there are no commits yet
+    inline std::string resolve_head()
+    {
+        return refs::resolve(refs::head_ref_name());
+    }
+
+    // The ref a short name stands for: a branch first, then a ref directly below refs/ ("stash")
+    inline std::string full_ref_name(const std::string &name)
     {
-        return std::filesystem::exists(INDEX_FILE) && std::filesystem::file_size(INDEX_FILE) > 0;
+        if (name.rfind("refs/", 0) == 0)
+        {
+            return name;
+        }
+        std::string branch = refs::HEADS_PREFIX + name;
+        if (refs::is_valid_name(branch) && !refs::exists(branch) && refs::is_valid_name("refs/" + name) &&
+            refs::exists("refs/" + name))
+        {
+            return "refs/" + name;
+        }
+        return branch;
     }
 
-    // Update the HEAD file with the given commit hash
-    inline void update_head(const std::string &commit_hash)
+    // Where a ref pointed according to its reflog: "<ref>@{<n>}" is the value n changes ago and
+    // "<ref>@{<time>}" the value at that time. An empty ref means HEAD.
+    inline std::string resolve_reflog_revision(const std::string &revision)
+    {
+        size_t at = revision.find("@{");
+        std::string base = revision.substr(0, at);
+        std::string selector = revision.substr(at + 2, revision.size() - at - 3);
+        std::string ref = base.empty() || base == refs::HEAD ? refs::HEAD : full_ref_name(base);
+        if (!refs::is_valid_name(ref) || selector.empty())
+        {
+            throw std::runtime_error("Invalid revision: " + revision);
+        }
+
+        reflog::Entry entry;
+        if (selector.find_first_not_of("0123456789") == std::string::npos)
+        {
+            if (!reflog::nth(ref, std::stoull(selector), entry))
+            {
+                throw std::runtime_error("Log for " + ref + " only has " + std::to_string(reflog::count(ref)) + " entries");
+            }
+            return entry.new_id;
+        }
+        std::int64_t timestamp;
+        if (!reflog::parse_time(selector, static_cast<std::int64_t>(std::time(nullptr)), timestamp))
+        {
+            throw std::runtime_error("Invalid time in revision: " + revision);
+        }
+        if (!reflog::at_time(ref, timestamp, entry))
+        {
+            // Before the first entry: the ref held what that entry moved it from
+            if (!reflog::nth(ref, reflog::count(ref) - 1, entry) || entry.old_id.empty())
+            {
+                throw std::runtime_error("Log for " + ref + " does not go back to " + selector);
+            }
+            return entry.old_id;
+        }
+        return entry.new_id;
+    }
+
+    // Resolve "HEAD", a branch name, a reflog selector or a commit hash to a commit hash
+    inline std::string resolve_revision(const std::string &revision)
+    {
+        if (revision == "HEAD")
+        {
+            return resolve_head();
+        }
+        if (revision.find("@{") != std::string::npos && revision.back() == '}')
+        {
+            return resolve_reflog_revision(revision);
+        }
+        std::string ref = full_ref_name(revision);
+        if (refs::is_valid_name(ref))
+        {
+            std::string commit_hash = refs::resolve(ref);
+            if (!commit_hash.empty())
+            {
+                return commit_hash;
+            }
+        }
+        return revision;
+    }
+
+    // Move the current branch (or a detached HEAD) to the given commit. With `expected_old`, the
+    // update fails unless the ref still points at that commit ("" for an unborn branch).
+    // `message` is recorded in the reflog.
+    inline void update_head(const std::string &commit_hash, std::optional<std::string> expected_old = std::nullopt,
+                            const std::string &message = "update HEAD")
     {
         try
         {
-            kit_utils::create_file(HEAD_FILE, commit_hash);
-            std::cout << "[DEBUG] HEAD file updated to: " << commit_hash << "\n";
+            refs::Transaction transaction(message);
+            transaction.update(refs::head_ref_name(), commit_hash, std::move(expected_old));
+            transaction.commit();
+            logger::debug([&]
+                          { return "HEAD updated to: " + commit_hash; });
         }
         catch (const std::exception &e)
         {
@@ -118,48 +229,190 @@ namespace kit_utils
         }
     }
 
-    inline std::string get_parent_commit(const std::string &commit_hash)
+    // Reflog message for moving HEAD to `branch_name`
+    inline std::string checkout_message(const std::string &branch_name)
+    {
+        std::string from = refs::head_target();
+        from = from.rfind(refs::HEADS_PREFIX, 0) == 0 ? from.substr(refs::HEADS_PREFIX.size()) : resolve_head();
+        return "checkout: moving from " + from + " to " + branch_name;
+    }
+
+    // Load and parse a commit object; repeated reads are served from the object cache
+    inline std::shared_ptr<const commit_object::Commit> read_commit(const std::string &commit_hash)
     {
-        std::string commit_path = OBJECTS_DIR + "/" + commit_hash;
-        if (!std::filesystem::exists(commit_path))
+        if (!object_store::object_exists(commit_hash))
         {
             throw std::runtime_error("Commit not found: " + commit_hash);
         }
+        return object_db::read_commit(commit_hash);
+    }
 
-        std::ifstream commit_file(commit_path + "/commit");
-        if (!commit_file)
+    // Get the first parent of a commit, or an empty string for a root commit
+    inline std::string get_parent_commit(const std::string &commit_hash)
+    {
+        auto commit = commit_graph::lookup(commit_hash);
+        return commit.parents.empty() ? "" : commit.parents.front().hex();
+    }
+
+    // Commits at the tips of HEAD and every branch
+    inline std::vector<std::string> list_ref_tips()
+    {
+        std::vector<std::string> tips;
+        std::string head = resolve_head();
+        if (!head.empty())
         {
-            throw std::runtime_error("Failed to open commit file: " + commit_path + "/commit");
+            tips.push_back(head);
         }
+        for (const auto &ref : refs::list(refs::HEADS_PREFIX))
+        {
+            std::string tip = refs::resolve(ref.name);
+            if (!tip.empty())
+            {
+                tips.push_back(tip);
+            }
+        }
+        return tips;
+    }
+
+    // All files recorded in a commit as a path -> blob id map
+    inline std::map<std::string, std::string> read_commit_files(const std::string &commit_hash)
+    {
+        return tree_object::read_tree_files(read_commit(commit_hash)->tree);
+    }
 
-        std::string parent_commit;
-        std::getline(commit_file, parent_commit); // Assume the second line contains the parent commit hash
-        return parent_commit;
+    // Read the staging area as a map of path -> blob id
+    inline std::map<std::string, std::string> read_index()
+    {
+        std::map<std::string, std::string> entries;
+        for (const auto &entry : kit_index::load_shared()->entries)
+        {
+            entries[entry.path] = entry.oid.hex();
+        }
+        return entries;
     }
 
-    // Find the common ancestor of two commits
-    inline std::string find_common_ancestor(const std::string &commit1, const std::string &commit2)
+    // Check if the index differs from the HEAD commit
+    inline bool has_staged_files()
     {
-        std::unordered_set<std::string> commit1_ancestors;
+        if (!std::filesystem::exists(INDEX_FILE))
+        {
+            return false;
+        }
 
-        std::string current = commit1;
-        while (!current.empty())
+        auto index_ptr = kit_index::load_shared();
+        const kit_index::Index &index = *index_ptr;
+        std::string head = resolve_head();
+        if (head.empty())
         {
-            commit1_ancestors.insert(current);
-            current = get_parent_commit(current); // Helper function to get the parent commit
+            return !index.entries.empty();
         }
 
-        current = commit2;
-        while (!current.empty())
+        // A valid cached root tree answers the question without flattening HEAD
+        std::string head_tree = read_commit(head)->tree;
+        auto root = index.cache_tree.find("");
+        if (root != index.cache_tree.end() && root->second.entry_count == index.entries.size())
+        {
+            return root->second.oid.hex() != head_tree;
+        }
+
+        std::map<std::string, std::string> staged;
+        for (const auto &entry : index.entries)
+        {
+            staged.emplace(entry.path, entry.oid.hex());
+        }
+        return staged != tree_object::read_tree_files(head_tree);
+    }
+
+    // Rebuild the index from a commit, keeping the cached stat data of entries whose blob is unchanged.
+    // Every tree of the commit is recorded in the cached tree, so the next commit rewrites nothing.
+    inline void reset_index_to_commit(const std::string &commit_hash)
+    {
+        kit_index::Update update;
+        const kit_index::Index previous = update.index();
+        kit_index::Index &index = update.index();
+        index = kit_index::Index();
+        index.extensions = previous.extensions;
+
+        if (!commit_hash.empty())
         {
-            if (commit1_ancestors.count(current))
+            tree_object::flatten(read_commit(commit_hash)->tree, "", index.entries, &index.cache_tree);
+            for (auto &entry : index.entries)
             {
-                return current; // Found the common ancestor
+                const auto *old_entry = kit_index::find_entry(previous, entry.path);
+                if (old_entry && old_entry->oid == entry.oid && old_entry->stat.mode == entry.stat.mode)
+                {
+                    entry.stat = old_entry->stat;
+                }
             }
-            current = get_parent_commit(current);
         }
 
-        return ""; // No common ancestor found
+        update.commit();
+    }
+
+    // List the files in the working tree (relative paths) with their stat data. Contents are not read;
+    // ignored paths are left out unless the index tracks them. A running fsmonitor daemon limits the
+    // stat calls to the paths that changed since the last listing.
+    inline std::map<std::string, kit_index::StatData> list_working_tree(const kit_index::Index &index)
+    {
+        worktree::ScanOptions options;
+        options.index = &index;
+
+        std::map<std::string, kit_index::StatData> files;
+        for (auto &record : fsmonitor::scan(".", options))
+        {
+            files.emplace_hint(files.end(), std::move(record.path), record.stat);
+        }
+        return files;
+    }
+
+    // Object id of a working tree file; the file is only read when its cached stat data is stale
+    inline std::string working_file_oid(const kit_index::Index &index, const std::string &path,
+                                        const kit_index::StatData &stat)
+    {
+        const auto *entry = kit_index::find_entry(index, path);
+        if (entry && kit_index::is_stat_clean(index, *entry, stat))
+        {
+            return entry->oid.hex();
+        }
+        return object_store::hash_file(path);
+    }
+
+    // Write a commit object for a root tree on top of HEAD and advance HEAD to it
+    inline std::string write_commit(const std::string &tree_oid, const std::string &message)
+    {
+        commit_object::Commit commit;
+        commit.tree = tree_oid;
+        std::string parent = resolve_head();
+        if (!parent.empty())
+        {
+            commit.parents.push_back(parent);
+        }
+        commit.timestamp = static_cast<std::int64_t>(std::time(nullptr));
+        commit.message = message;
+
+        std::string commit_hash = object_store::write_object("commit", commit_object::serialize(commit));
+        logger::debug([&]
+                      { return "Commit " + commit_hash + " written to " + object_store::object_path(commit_hash); });
+
+        std::string subject = message.substr(0, message.find('\n'));
+        update_head(commit_hash, parent, (parent.empty() ? "commit (initial): " : "commit: ") + subject);
+
+        // Keep an existing commit-graph current; a failure here never loses the commit
+        try
+        {
+            commit_graph::append(commit_hash);
+        }
+        catch (const std::exception &e)
+        {
+            print_error("Failed to update commit-graph: " + std::string(e.what()));
+        }
+        return commit_hash;
+    }
+
+    // Find the best common ancestor of two commits, or an empty string if they share no history
+    inline std::string find_common_ancestor(const std::string &commit1, const std::string &commit2)
+    {
+        return merge_base::merge_base(trim_ref(commit1), trim_ref(commit2));
     }
 
     // Create a commit with files and a message
@@ -167,29 +420,14 @@ namespace kit_utils
     {
         try
         {
-            // Prepare commit content
-            std::ostringstream commit_content;
-            commit_content << "Commit message: " << message << "\n";
-
-            // Add files to the commit
+            // Store every file as a blob and record its id in the commit
+            std::map<std::string, std::string> entries;
             for (const auto &[file_name, file_content] : files)
             {
-                commit_content << "File: " << file_name << "\n";
-                commit_content << file_content << "\n";
+                entries[file_name] = object_store::write_object("blob", file_content);
             }
 
-            // Generate a hash for the commit
-            std::string commit_hash = hash_object::compute_sha1(commit_content.str());
-            std::cout << "[DEBUG] Generated commit hash: " << commit_hash << "\n";
-
-            // Write the commit to the objects directory
-            std::string commit_path = OBJECTS_DIR + "/" + commit_hash;
-            kit_utils::create_file(commit_path, commit_content.str());
-            std::cout << "[DEBUG] Commit written to: " << commit_path << "\n";
-
-            // Update HEAD to point to the new commit
-            kit_utils::update_head(commit_hash);
-            std::cout << "[DEBUG] HEAD updated to: " << commit_hash << "\n";
+            std::string commit_hash = write_commit(tree_object::write_tree(entries), message);
 
             kit_utils::print_message("Commit created successfully with message: " + message);
             return commit_hash;
@@ -201,41 +439,56 @@ namespace kit_utils
         }
     }
 
-    // Retrieve files from a specific commit
-    inline std::unordered_map<std::string, std::string> get_commit_files(const std::string &commit_hash)
+    // A file of a merge result: the blob id and mode, or merged content still to be stored
+    struct MergedFile
     {
-        std::unordered_map<std::string, std::string> files;
-        std::string commit_path = OBJECTS_DIR + "/" + commit_hash;
-
-        if (!std::filesystem::exists(commit_path))
-        {
-            throw std::runtime_error("Commit not found: " + commit_hash);
-        }
-
-        for (const auto &entry : std::filesystem::directory_iterator(commit_path))
+        std::string oid;
+        std::uint32_t mode = tree_object::MODE_FILE;
+        std::string content; // only when `oid` is empty
+    };
+    using MergedFiles = std::unordered_map<std::string, MergedFile>;
+
+    // Create a commit from a merge result. Files already in the object store are referenced by id;
+    // only merged content is written as new blobs.
+    inline std::string create_commit(const MergedFiles &files, const std::string &message)
+    {
+        try
         {
-            if (entry.is_regular_file())
+            kit_index::Index index;
+            index.entries.reserve(files.size());
+            for (const auto &[path, file] : files)
             {
-                files[entry.path().filename().string()] = kit_utils::read_file(entry.path().string());
+                kit_index::Entry entry;
+                entry.path = path;
+                entry.oid = object_id::ObjectId::from_hex(file.oid.empty() ? object_store::write_object("blob", file.content)
+                                                                           : file.oid);
+                entry.stat.mode = file.mode;
+                index.entries.push_back(std::move(entry));
             }
-        }
+            std::sort(index.entries.begin(), index.entries.end(),
+                      [](const kit_index::Entry &a, const kit_index::Entry &b)
+                      { return a.path < b.path; });
 
-        return files;
+            std::string commit_hash = write_commit(tree_object::write_tree(index), message);
+
+            kit_utils::print_message("Commit created successfully with message: " + message);
+            return commit_hash;
+        }
+        catch (const std::exception &e)
+        {
+            kit_utils::print_error("Failed to create commit: " + std::string(e.what()));
+            return "";
+        }
     }
 
-    inline std::unordered_map<std::string, std::string> get_working_directory_files()
+    // Retrieve files from a specific commit
+    inline std::unordered_map<std::string, std::string> get_commit_files(const std::string &commit_hash)
     {
         std::unordered_map<std::string, std::string> files;
 
-        for (const auto &entry : std::filesystem::recursive_directory_iterator("."))
+        for (const auto &[path, blob] : read_commit_files(commit_hash))
         {
-            if (entry.is_regular_file() && entry.path().string().find(KIT_DIR) == std::string::npos)
-            {
-                std::ifstream file(entry.path());
-                std::stringstream buffer;
-                buffer << file.rdbuf();
-                files[entry.path().filename().string()] = buffer.str();
-            }
+            files[path] = object_store::read_object(blob, "blob");
         }
 
         return files;
@@ -248,35 +501,31 @@ namespace kit_utils
 
         try
         {
-            // Retrieve files from the specified commit
-            std::unordered_map<std::string, std::string> commit_files;
-            if (!commit_hash.empty())
-            {
-                commit_files = kit_utils::get_commit_files(commit_hash);
-            }
-            else
+            if (commit_hash.empty())
             {
                 throw std::runtime_error("Commit hash is empty.");
             }
 
-            // Retrieve files from the working directory
-            auto working_files = kit_utils::get_working_directory_files();
+            // Compare object ids only: unchanged files are recognised from the index stat cache
+            auto commit_files = read_commit_files(resolve_revision(commit_hash));
+            auto index = kit_index::load_shared();
+            auto working_files = list_working_tree(*index);
 
-            // Compare files between the commit and the working directory
-            for (const auto &[file_name, commit_content] : commit_files)
+            for (const auto &[file_name, blob] : commit_files)
             {
-                if (working_files.find(file_name) == working_files.end())
+                auto working = working_files.find(file_name);
+                if (working == working_files.end())
                 {
                     differences.push_back("File deleted: " + file_name);
                 }
-                else if (working_files[file_name] != commit_content)
+                else if (working_file_oid(*index, file_name, working->second) != blob)
                 {
                     differences.push_back("File modified: " + file_name);
                 }
             }
 
             // Check for new files in the working directory
-            for (const auto &[file_name, working_content] : working_files)
+            for (const auto &[file_name, stat] : working_files)
             {
                 if (commit_files.find(file_name) == commit_files.end())
                 {
@@ -297,34 +546,74 @@ namespace kit_utils
         return differences;
     }
 
-    inline std::unordered_map<std::string, std::string> perform_three_way_merge(
-        const std::string &base_commit,
-        const std::string &current_commit,
-        const std::string &target_commit)
+    namespace detail
     {
-        // Example logic for merging files (you can replace this with your actual logic)
-        std::unordered_map<std::string, std::string> merged_files;
-
-        // Retrieve files from each commit
-        auto base_files = get_commit_files(base_commit);
-        auto current_files = get_commit_files(current_commit);
-        auto target_files = get_commit_files(target_commit);
+        // Blob ids and modes of every file in a commit
+        struct CommitFiles
+        {
+            std::map<std::string, std::string> oids;
+            std::map<std::string, std::uint32_t> modes;
+        };
 
-        // Perform a simple merge (replace this with your actual merge logic)
-        for (const auto &[file, content] : base_files)
+        inline CommitFiles read_commit_files_with_modes(const std::string &commit_hash)
         {
-            if (current_files[file] == target_files[file])
+            std::vector<kit_index::Entry> entries;
+            tree_object::flatten(read_commit(commit_hash)->tree, "", entries);
+            CommitFiles files;
+            for (auto &entry : entries)
             {
-                merged_files[file] = current_files[file]; // No conflict
+                files.modes.emplace(entry.path, entry.stat.mode);
+                files.oids.emplace(std::move(entry.path), entry.oid.hex());
             }
-            else
+            return files;
+        }
+
+        // A mode changed on one side wins; a file missing on one side keeps the other side's mode
+        inline std::uint32_t merge_mode(const CommitFiles &base, const CommitFiles &ours, const CommitFiles &theirs,
+                                        const std::string &path)
+        {
+            auto mode_of = [&path](const CommitFiles &files) -> std::uint32_t
             {
-                merged_files[file] = "<<<<<<< CURRENT\n" + current_files[file] +
-                                     "=======\n" + target_files[file] +
-                                     ">>>>>>>\n"; // Simple conflict marker
-            }
+                auto it = files.modes.find(path);
+                return it == files.modes.end() ? 0 : it->second;
+            };
+            std::uint32_t b = mode_of(base), o = mode_of(ours), t = mode_of(theirs);
+            std::uint32_t mode = o == 0 ? t : t == 0 ? o : o == b ? t : o;
+            return mode != 0 ? mode : tree_object::MODE_FILE;
         }
+    } // namespace detail
 
+    // Merge the files of two commits against their common ancestor. Files only one side touched
+    // are returned by blob id and mode without being read; only files changed on both sides are
+    // merged into new content. Conflicting files hold conflict markers and are reported.
+    inline MergedFiles perform_three_way_merge(
+        const std::string &base_commit,
+        const std::string &current_commit,
+        const std::string &target_commit,
+        const merge_file::Options &options = {})
+    {
+        trace::Span span("merge.three_way");
+        auto base = detail::read_commit_files_with_modes(trim_ref(base_commit));
+        auto ours = detail::read_commit_files_with_modes(trim_ref(current_commit));
+        auto theirs = detail::read_commit_files_with_modes(trim_ref(target_commit));
+        auto results = merge_file::merge_trees(base.oids, ours.oids, theirs.oids, options);
+
+        MergedFiles merged_files;
+        merged_files.reserve(results.size());
+        size_t merged = 0;
+        for (auto &file : results)
+        {
+            if (file.conflict != merge_file::Conflict::None)
+            {
+                print_error("CONFLICT (" + std::string(merge_file::conflict_name(file.conflict)) +
+                            "): Merge conflict in " + file.path);
+            }
+            merged += file.merged ? 1 : 0;
+            MergedFile result{file.merged ? std::string() : std::move(file.oid),
+                              detail::merge_mode(base, ours, theirs, file.path), std::move(file.content)};
+            merged_files.emplace(std::move(file.path), std::move(result));
+        }
+        span.arg("merged", merged);
         return merged_files;
     }
 } // namespace kit_utils
@@ -0,0 +1,636 @@
+#ifndef LINE_DIFF_HPP
+#define LINE_DIFF_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+
+// Line-level diff engine. Both sides are split into lines (memchr, which libc vectorises) and
+// every distinct line is interned to an integer id, so the algorithms only compare integers.
+// The default histogram algorithm anchors on the rarest common lines and falls back to a
+// linear-space Myers O(ND) search for regions without a usable anchor. Memory stays linear in
+// the number of lines on both paths.
+namespace line_diff
+{
+    enum class Algorithm
+    {
+        Myers,
+        Histogram,
+    };
+
+    // The lines of one side of a diff, as views into the caller's text
+    struct Lines
+    {
+        std::string_view text;
+        std::vector<size_t> starts; // start offset of each line, plus a final end offset
+        std::vector<std::uint32_t> ids;
+        bool missing_newline = false; // the last line has no trailing '\n'
+
+        size_t size() const { return ids.size(); }
+        std::string_view line(size_t i) const { return text.substr(starts[i], starts[i + 1] - starts[i]); }
+    };
+
+    // Maps line contents to dense ids shared by both sides of a diff. Open addressing over
+    // (hash, id) slots keeps interning a 100 MB file to one probe per line and no per-line allocation.
+    class Interner
+    {
+    public:
+        explicit Interner(size_t expected_lines = 1024)
+        {
+            size_t capacity = 16;
+            while (capacity < expected_lines * 2)
+            {
+                capacity <<= 1;
+            }
+            slots_.assign(capacity, Slot{});
+            lines_.reserve(expected_lines);
+        }
+
+        std::uint32_t intern(std::string_view line)
+        {
+            if ((lines_.size() + 1) * 2 > slots_.size())
+            {
+                grow();
+            }
+            std::uint64_t h = hash(line);
+            std::uint32_t tag = static_cast<std::uint32_t>(h >> 32);
+            size_t mask = slots_.size() - 1;
+            for (size_t i = static_cast<size_t>(h) & mask;; i = (i + 1) & mask)
+            {
+                Slot &slot = slots_[i];
+                if (slot.id == EMPTY)
+                {
+                    slot.hash = tag;
+                    slot.id = static_cast<std::uint32_t>(lines_.size());
+                    lines_.push_back(line);
+                    return slot.id;
+                }
+                if (slot.hash == tag && lines_[slot.id] == line)
+                {
+                    return slot.id;
+                }
+            }
+        }
+
+        size_t size() const { return lines_.size(); }
+
+        // 64-bit hash that consumes eight bytes per step
+        static std::uint64_t hash(std::string_view line)
+        {
+            constexpr std::uint64_t K = 0x9E3779B97F4A7C15ULL;
+            std::uint64_t h = line.size() * K;
+            const char *p = line.data();
+            size_t n = line.size();
+            while (n >= 8)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, p, 8);
+                h = (h ^ word) * K;
+                h ^= h >> 29;
+                p += 8;
+                n -= 8;
+            }
+            std::uint64_t tail = 0;
+            std::memcpy(&tail, p, n);
+            h = (h ^ tail) * K;
+            return h ^ (h >> 31);
+        }
+
+    private:
+        static constexpr std::uint32_t EMPTY = 0xFFFFFFFF;
+
+        struct Slot
+        {
+            std::uint32_t hash = 0; // low bits select the slot, these filter comparisons
+            std::uint32_t id = EMPTY;
+        };
+
+        void grow()
+        {
+            std::vector<Slot> old(slots_.size() * 2, Slot{});
+            old.swap(slots_);
+            size_t mask = slots_.size() - 1;
+            for (const auto &slot : old)
+            {
+                if (slot.id == EMPTY)
+                {
+                    continue;
+                }
+                size_t i = static_cast<size_t>(hash(lines_[slot.id])) & mask;
+                while (slots_[i].id != EMPTY)
+                {
+                    i = (i + 1) & mask;
+                }
+                slots_[i] = slot;
+            }
+        }
+
+        std::vector<Slot> slots_;
+        std::vector<std::string_view> lines_;
+    };
+
+    inline size_t count_lines(std::string_view text)
+    {
+        size_t count = 0;
+        const char *p = text.data();
+        const char *end = p + text.size();
+        while (p < end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            ++count;
+            p = newline ? newline + 1 : end;
+        }
+        return count;
+    }
+
+    inline Lines split_lines(std::string_view text, Interner &interner)
+    {
+        Lines lines;
+        lines.text = text;
+        size_t expected = count_lines(text);
+        lines.starts.reserve(expected + 1);
+        lines.ids.reserve(expected);
+        const char *begin = text.data();
+        const char *end = begin + text.size();
+        const char *p = begin;
+        while (p < end)
+        {
+            lines.starts.push_back(static_cast<size_t>(p - begin));
+            const char *newline = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            const char *next = newline ? newline + 1 : end;
+            lines.ids.push_back(interner.intern(std::string_view(p, static_cast<size_t>(next - p))));
+            lines.missing_newline = newline == nullptr;
+            p = next;
+        }
+        lines.starts.push_back(text.size());
+        return lines;
+    }
+
+    // Git's heuristic for binary content: a NUL byte near the start
+    inline bool is_binary(std::string_view text)
+    {
+        return std::memchr(text.data(), '\0', std::min<size_t>(text.size(), 8000)) != nullptr;
+    }
+
+    namespace detail
+    {
+        constexpr long MAX_COST_MIN = 256;
+        constexpr size_t HISTOGRAM_MAX_CHAIN = 64;
+
+        struct Range
+        {
+            long off1, lim1, off2, lim2;
+        };
+
+        // Shared state of one comparison: the id sequences and the per-line change flags
+        struct Context
+        {
+            const std::uint32_t *a;
+            const std::uint32_t *b;
+            std::vector<char> &removed;
+            std::vector<char> &added;
+
+            void mark(const Range &r)
+            {
+                std::fill(removed.begin() + r.off1, removed.begin() + r.lim1, 1);
+                std::fill(added.begin() + r.off2, added.begin() + r.lim2, 1);
+            }
+
+            // Drop the common prefix and suffix; returns false when nothing is left to compare
+            bool shrink(Range &r) const
+            {
+                while (r.off1 < r.lim1 && r.off2 < r.lim2 && a[r.off1] == b[r.off2])
+                {
+                    ++r.off1;
+                    ++r.off2;
+                }
+                while (r.off1 < r.lim1 && r.off2 < r.lim2 && a[r.lim1 - 1] == b[r.lim2 - 1])
+                {
+                    --r.lim1;
+                    --r.lim2;
+                }
+                return r.off1 < r.lim1 && r.off2 < r.lim2;
+            }
+        };
+
+        // Linear-space Myers: find the middle snake of a range and recurse on both halves.
+        // Past `max_cost` edit steps the furthest-reaching diagonal is used as the split point,
+        // which bounds the running time on very different inputs at the cost of a minimal diff.
+        class Myers
+        {
+        public:
+            Myers(Context &ctx, size_t n, size_t m)
+                : ctx_(ctx), offset_(static_cast<long>(m) + 1),
+                  forward_(n + m + 3), backward_(n + m + 3),
+                  max_cost_(std::max(MAX_COST_MIN, static_cast<long>(std::sqrt(static_cast<double>(n + m)))))
+            {
+            }
+
+            void compare(Range range)
+            {
+                std::vector<Range> pending{range};
+                while (!pending.empty())
+                {
+                    Range r = pending.back();
+                    pending.pop_back();
+                    if (!ctx_.shrink(r))
+                    {
+                        ctx_.mark(r);
+                        continue;
+                    }
+
+                    long x, y;
+                    split(r, x, y);
+                    if ((x == r.off1 && y == r.off2) || (x == r.lim1 && y == r.lim2))
+                    {
+                        ctx_.mark(r); // no progress possible; report the whole region as changed
+                        continue;
+                    }
+                    pending.push_back({x, r.lim1, y, r.lim2});
+                    pending.push_back({r.off1, x, r.off2, y});
+                }
+            }
+
+        private:
+            long &fwd(long d) { return forward_[static_cast<size_t>(d + offset_)]; }
+            long &bwd(long d) { return backward_[static_cast<size_t>(d + offset_)]; }
+
+            void split(const Range &r, long &split1, long &split2)
+            {
+                const std::uint32_t *a = ctx_.a;
+                const std::uint32_t *b = ctx_.b;
+                const long dmin = r.off1 - r.lim2, dmax = r.lim1 - r.off2;
+                const long fmid = r.off1 - r.off2, bmid = r.lim1 - r.lim2;
+                const bool odd = (fmid - bmid) & 1;
+                long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+
+                fwd(fmid) = r.off1;
+                bwd(bmid) = r.lim1;
+
+                for (long cost = 1;; ++cost)
+                {
+                    // Extend the forward paths by one edit
+                    if (fmin > dmin)
+                        fwd(--fmin - 1) = -1;
+                    else
+                        ++fmin;
+                    if (fmax < dmax)
+                        fwd(++fmax + 1) = -1;
+                    else
+                        --fmax;
+
+                    for (long d = fmax; d >= fmin; d -= 2)
+                    {
+                        long i1 = fwd(d - 1) >= fwd(d + 1) ? fwd(d - 1) + 1 : fwd(d + 1);
+                        long i2 = i1 - d;
+                        while (i1 < r.lim1 && i2 < r.lim2 && a[i1] == b[i2])
+                        {
+                            ++i1;
+                            ++i2;
+                        }
+                        fwd(d) = i1;
+                        if (odd && bmin <= d && d <= bmax && bwd(d) <= i1)
+                        {
+                            split1 = i1;
+                            split2 = i2;
+                            return;
+                        }
+                    }
+
+                    // Extend the backward paths by one edit
+                    if (bmin > dmin)
+                        bwd(--bmin - 1) = LONG_MAX;
+                    else
+                        ++bmin;
+                    if (bmax < dmax)
+                        bwd(++bmax + 1) = LONG_MAX;
+                    else
+                        --bmax;
+
+                    for (long d = bmax; d >= bmin; d -= 2)
+                    {
+                        long i1 = bwd(d - 1) < bwd(d + 1) ? bwd(d - 1) : bwd(d + 1) - 1;
+                        long i2 = i1 - d;
+                        while (i1 > r.off1 && i2 > r.off2 && a[i1 - 1] == b[i2 - 1])
+                        {
+                            --i1;
+                            --i2;
+                        }
+                        bwd(d) = i1;
+                        if (!odd && fmin <= d && d <= fmax && i1 <= fwd(d))
+                        {
+                            split1 = i1;
+                            split2 = i2;
+                            return;
+                        }
+                    }
+
+                    if (cost >= max_cost_)
+                    {
+                        // Too expensive: split at whichever frontier got furthest from its corner
+                        long fbest = -1, fbest1 = -1;
+                        for (long d = fmax; d >= fmin; d -= 2)
+                        {
+                            long i1 = std::min(fwd(d), r.lim1);
+                            long i2 = i1 - d;
+                            if (i2 > r.lim2)
+                            {
+                                i1 = r.lim2 + d;
+                                i2 = r.lim2;
+                            }
+                            if (fbest < i1 + i2)
+                            {
+                                fbest = i1 + i2;
+                                fbest1 = i1;
+                            }
+                        }
+                        long bbest = LONG_MAX, bbest1 = LONG_MAX;
+                        for (long d = bmax; d >= bmin; d -= 2)
+                        {
+                            long i1 = std::max(r.off1, bwd(d));
+                            long i2 = i1 - d;
+                            if (i2 < r.off2)
+                            {
+                                i1 = r.off2 + d;
+                                i2 = r.off2;
+                            }
+                            if (i1 + i2 < bbest)
+                            {
+                                bbest = i1 + i2;
+                                bbest1 = i1;
+                            }
+                        }
+                        if ((r.lim1 + r.lim2) - bbest < fbest - (r.off1 + r.off2))
+                        {
+                            split1 = fbest1;
+                            split2 = fbest - fbest1;
+                        }
+                        else
+                        {
+                            split1 = bbest1;
+                            split2 = bbest - bbest1;
+                        }
+                        return;
+                    }
+                }
+            }
+
+            Context &ctx_;
+            long offset_;
+            std::vector<long> forward_;
+            std::vector<long> backward_;
+            long max_cost_;
+        };
+
+        // Histogram diff: split each region around the longest common run anchored on the line
+        // that occurs least often on the old side; regions without a rare enough anchor go to Myers.
+        // Occurrences are chained through arrays indexed by line id, so no region allocates.
+        inline void histogram(Context &ctx, Myers &myers, Range range, size_t unique_lines, size_t old_lines)
+        {
+            constexpr long NONE = -1;
+            const std::uint32_t *a = ctx.a;
+            const std::uint32_t *b = ctx.b;
+            std::vector<long> head(unique_lines, NONE); // first occurrence of each id in the region
+            std::vector<long> next(old_lines, NONE);    // next occurrence of the same id
+            std::vector<std::uint32_t> count(unique_lines, 0);
+
+            std::vector<Range> pending{range};
+            while (!pending.empty())
+            {
+                Range r = pending.back();
+                pending.pop_back();
+                if (!ctx.shrink(r))
+                {
+                    ctx.mark(r);
+                    continue;
+                }
+
+                for (long i = r.lim1 - 1; i >= r.off1; --i)
+                {
+                    next[i] = head[a[i]];
+                    head[a[i]] = i;
+                    ++count[a[i]];
+                }
+
+                long best_as = 0, best_ae = 0, best_bs = 0;
+                std::uint32_t best_count = HISTOGRAM_MAX_CHAIN + 1;
+                for (long bi = r.off2; bi < r.lim2;)
+                {
+                    std::uint32_t id = b[bi];
+                    if (id >= unique_lines || count[id] == 0 || count[id] > HISTOGRAM_MAX_CHAIN)
+                    {
+                        ++bi;
+                        continue;
+                    }
+
+                    long next_bi = bi + 1;
+                    for (long ai = head[id]; ai != NONE; ai = next[ai])
+                    {
+                        long as = ai, bs = bi, ae = ai + 1, be = bi + 1;
+                        std::uint32_t region_count = count[id];
+                        while (as > r.off1 && bs > r.off2 && a[as - 1] == b[bs - 1])
+                        {
+                            --as;
+                            --bs;
+                            region_count = std::min(region_count, count[a[as]]);
+                        }
+                        while (ae < r.lim1 && be < r.lim2 && a[ae] == b[be])
+                        {
+                            region_count = std::min(region_count, count[a[ae]]);
+                            ++ae;
+                            ++be;
+                        }
+                        next_bi = std::max(next_bi, be);
+                        if (best_ae - best_as < ae - as || region_count < best_count)
+                        {
+                            best_as = as;
+                            best_ae = ae;
+                            best_bs = bs;
+                            best_count = region_count;
+                        }
+                    }
+                    bi = next_bi;
+                }
+
+                for (long i = r.off1; i < r.lim1; ++i)
+                {
+                    head[a[i]] = NONE;
+                    count[a[i]] = 0;
+                }
+
+                if (best_count > HISTOGRAM_MAX_CHAIN)
+                {
+                    myers.compare(r);
+                    continue;
+                }
+
+                long best_be = best_bs + (best_ae - best_as);
+                pending.push_back({best_ae, r.lim1, best_be, r.lim2});
+                pending.push_back({r.off1, best_as, r.off2, best_bs});
+            }
+        }
+    } // namespace detail
+
+    // Result of comparing two texts: per-line flags for removed (old) and added (new) lines
+    struct FileDiff
+    {
+        Lines old_lines;
+        Lines new_lines;
+        std::vector<char> removed;
+        std::vector<char> added;
+
+        size_t deletions() const { return static_cast<size_t>(std::count(removed.begin(), removed.end(), 1)); }
+        size_t insertions() const { return static_cast<size_t>(std::count(added.begin(), added.end(), 1)); }
+    };
+
+    // Compare two texts line by line. The texts must outlive the result.
+    inline FileDiff diff(std::string_view old_text, std::string_view new_text, Algorithm algorithm = Algorithm::Histogram)
+    {
+        FileDiff result;
+        size_t unique_lines;
+        {
+            Interner interner(count_lines(old_text) + count_lines(new_text));
+            result.old_lines = split_lines(old_text, interner);
+            result.new_lines = split_lines(new_text, interner);
+            unique_lines = interner.size();
+        }
+        size_t n = result.old_lines.size();
+        size_t m = result.new_lines.size();
+        result.removed.assign(n, 0);
+        result.added.assign(m, 0);
+
+        detail::Context ctx{result.old_lines.ids.data(), result.new_lines.ids.data(), result.removed, result.added};
+        detail::Range range{0, static_cast<long>(n), 0, static_cast<long>(m)};
+        if (!ctx.shrink(range))
+        {
+            ctx.mark(range);
+            return result;
+        }
+
+        detail::Myers myers(ctx, n, m);
+        if (algorithm == Algorithm::Histogram)
+        {
+            detail::histogram(ctx, myers, range, unique_lines, n);
+        }
+        else
+        {
+            myers.compare(range);
+        }
+        return result;
+    }
+
+    // A hunk of consecutive changes with their surrounding context, in 0-based line numbers
+    struct Hunk
+    {
+        size_t old_start, old_count, new_start, new_count;
+    };
+
+    // Group changes into hunks, merging those separated by at most 2 * context unchanged lines
+    inline std::vector<Hunk> hunks(const FileDiff &diff, size_t context)
+    {
+        struct Change
+        {
+            size_t a0, a1, b0, b1;
+        };
+        std::vector<Change> changes;
+        size_t n = diff.removed.size(), m = diff.added.size();
+        size_t i = 0, j = 0;
+        while (i < n || j < m)
+        {
+            if (i < n && j < m && !diff.removed[i] && !diff.added[j])
+            {
+                ++i;
+                ++j;
+                continue;
+            }
+            Change change{i, i, j, j};
+            while (i < n && diff.removed[i])
+                ++i;
+            while (j < m && diff.added[j])
+                ++j;
+            change.a1 = i;
+            change.b1 = j;
+            changes.push_back(change);
+        }
+
+        std::vector<Hunk> result;
+        for (size_t c = 0; c < changes.size();)
+        {
+            size_t last = c;
+            while (last + 1 < changes.size() && changes[last + 1].a0 - changes[last].a1 <= 2 * context)
+            {
+                ++last;
+            }
+            size_t lead = std::min(context, changes[c].a0);
+            size_t trail = std::min(context, n - changes[last].a1);
+            Hunk hunk;
+            hunk.old_start = changes[c].a0 - lead;
+            hunk.new_start = changes[c].b0 - lead;
+            hunk.old_count = changes[last].a1 + trail - hunk.old_start;
+            hunk.new_count = changes[last].b1 + trail - hunk.new_start;
+            result.push_back(hunk);
+            c = last + 1;
+        }
+        return result;
+    }
+
+    namespace detail
+    {
+        inline std::string hunk_range(size_t start, size_t count)
+        {
+            // Unified diff numbers lines from 1; an empty range names the line before it
+            std::string out = std::to_string(count == 0 ? start : start + 1);
+            if (count != 1)
+            {
+                out += "," + std::to_string(count);
+            }
+            return out;
+        }
+
+        inline void write_line(std::ostream &out, char prefix, const Lines &lines, size_t i)
+        {
+            out << prefix << lines.line(i);
+            if (i + 1 == lines.size() && lines.missing_newline)
+            {
+                out << "\n\\ No newline at end of file\n";
+            }
+        }
+    } // namespace detail
+
+    // Write the hunks of a diff in unified format (without the ---/+++ file header)
+    inline void write_unified(std::ostream &out, const FileDiff &diff, size_t context = 3)
+    {
+        for (const auto &hunk : hunks(diff, context))
+        {
+            out << "@@ -" << detail::hunk_range(hunk.old_start, hunk.old_count) << " +"
+                << detail::hunk_range(hunk.new_start, hunk.new_count) << " @@\n";
+
+            size_t i = hunk.old_start, j = hunk.new_start;
+            size_t old_end = hunk.old_start + hunk.old_count, new_end = hunk.new_start + hunk.new_count;
+            while (i < old_end || j < new_end)
+            {
+                if (i < old_end && diff.removed[i])
+                {
+                    detail::write_line(out, '-', diff.old_lines, i++);
+                }
+                else if (j < new_end && diff.added[j])
+                {
+                    detail::write_line(out, '+', diff.new_lines, j++);
+                }
+                else
+                {
+                    detail::write_line(out, ' ', diff.old_lines, i++);
+                    ++j;
+                }
+            }
+        }
+    }
+} // namespace line_diff
+
+#endif // LINE_DIFF_HPP
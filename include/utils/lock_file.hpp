@@ -0,0 +1,114 @@
+#ifndef LOCK_FILE_HPP
+#define LOCK_FILE_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Exclusive `<path>.lock` files, the one way every repository file is replaced. The lock file is
+// created with O_EXCL, so only one process holds it; the new content is written to it and fsynced,
+// then renamed over `path`, so readers see either the old or the new file. A lock that is not
+// committed is removed when it goes out of scope, including when a write fails.
+namespace lock_file
+{
+    class LockFile
+    {
+    public:
+        // Take the lock, retrying for up to `timeout_ms` while another process holds it
+        explicit LockFile(const std::string &path, int timeout_ms = 0) : path_(path), lock_path_(path + ".lock")
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            while ((fd_ = ::open(lock_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0)
+            {
+                if (errno != EEXIST)
+                {
+                    throw std::runtime_error("Unable to create '" + lock_path_ + "': " + std::strerror(errno));
+                }
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    throw std::runtime_error("Unable to lock '" + path_ + "': '" + lock_path_ +
+                                             "' exists. If no other kit process is running, remove it.");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        ~LockFile()
+        {
+            if (fd_ >= 0)
+            {
+                ::close(fd_);
+            }
+            if (!committed_)
+            {
+                ::unlink(lock_path_.c_str());
+            }
+        }
+
+        LockFile(const LockFile &) = delete;
+        LockFile &operator=(const LockFile &) = delete;
+
+        const std::string &path() const { return path_; }
+        const std::string &lock_path() const { return lock_path_; }
+
+        // Write the new content and flush it to disk
+        void write(const std::string &content)
+        {
+            size_t done = 0;
+            while (done < content.size())
+            {
+                ssize_t n = ::write(fd_, content.data() + done, content.size() - done);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    throw std::runtime_error("Failed to write '" + lock_path_ + "': " + std::strerror(errno));
+                }
+                done += static_cast<size_t>(n);
+            }
+            if (::fsync(fd_) != 0)
+            {
+                throw std::runtime_error("Failed to sync '" + lock_path_ + "': " + std::strerror(errno));
+            }
+        }
+
+        // Replace the locked file with what was written
+        void commit()
+        {
+            ::close(fd_);
+            fd_ = -1;
+            if (::rename(lock_path_.c_str(), path_.c_str()) != 0)
+            {
+                throw std::runtime_error("Failed to rename '" + lock_path_ + "': " + std::strerror(errno));
+            }
+            committed_ = true;
+        }
+
+        // Delete the locked file and release the lock
+        void remove()
+        {
+            if (::unlink(path_.c_str()) != 0 && errno != ENOENT)
+            {
+                throw std::runtime_error("Failed to delete '" + path_ + "': " + std::strerror(errno));
+            }
+        }
+
+    private:
+        std::string path_;
+        std::string lock_path_;
+        int fd_ = -1;
+        bool committed_ = false;
+    };
+} // namespace lock_file
+
+#endif // LOCK_FILE_HPP
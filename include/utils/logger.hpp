@@ -1,28 +1,366 @@
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <unistd.h>
 
+// The one logger behind kit_utils::print_message/print_error, error_handler and the debug output.
+// Messages below the runtime level (-q, -v, KIT_LOG_LEVEL) are dropped before they are built when
+// passed as a callable, e.g. logger::debug([&] { return "wrote " + hash; }). Console lines are
+// written without flushing, so bulk output is bounded by the work rather than by the terminal;
+// --log-file / KIT_LOG_FILE additionally appends every line to a file through a ring buffer that a
+// background thread drains in batches.
 namespace logger
 {
-    inline void debug(const std::string &message)
+    enum class Level
     {
-#ifdef DEBUG
-        std::cout << "[DEBUG] " << message << std::endl;
-#else
-        (void)message; // Suppress unused parameter warning
-#endif
+        Error,
+        Warning,
+        Info,
+        Debug
+    };
+
+    namespace detail
+    {
+        constexpr size_t RING_CAPACITY = 4096; // lines queued for the file before writers wait
+
+        inline std::atomic<int> level{static_cast<int>(Level::Info)};
+
+        // Appends lines to a file from a background thread. Producers only copy the line into a
+        // fixed ring; the writer takes everything queued at once and writes it with one call.
+        class FileSink
+        {
+        public:
+            explicit FileSink(const std::string &path) : out_(path, std::ios::binary | std::ios::app), ring_(RING_CAPACITY)
+            {
+                if (!out_)
+                {
+                    throw std::runtime_error("Failed to open log file: " + path);
+                }
+                writer_ = std::thread([this]
+                                      { run(); });
+            }
+
+            ~FileSink()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stopping_ = true;
+                }
+                not_empty_.notify_all();
+                writer_.join();
+            }
+
+            FileSink(const FileSink &) = delete;
+            FileSink &operator=(const FileSink &) = delete;
+
+            void push(std::string line)
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_full_.wait(lock, [this]
+                               { return count_ < ring_.size(); });
+                ring_[(head_ + count_) % ring_.size()] = std::move(line);
+                ++count_;
+                not_empty_.notify_one();
+            }
+
+            // Block until everything queued so far is written
+            void flush()
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                drained_.wait(lock, [this]
+                              { return count_ == 0 && !writing_; });
+            }
+
+        private:
+            void run()
+            {
+                std::string batch;
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (true)
+                {
+                    not_empty_.wait(lock, [this]
+                                    { return stopping_ || count_ > 0; });
+                    if (count_ == 0)
+                    {
+                        return;
+                    }
+                    batch.clear();
+                    for (; count_ > 0; --count_, head_ = (head_ + 1) % ring_.size())
+                    {
+                        batch += ring_[head_];
+                        ring_[head_].clear();
+                    }
+                    writing_ = true;
+                    not_full_.notify_all();
+
+                    lock.unlock();
+                    out_.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+                    out_.flush();
+                    lock.lock();
+
+                    writing_ = false;
+                    if (count_ == 0)
+                    {
+                        drained_.notify_all();
+                    }
+                }
+            }
+
+            std::ofstream out_;
+            std::vector<std::string> ring_;
+            size_t head_ = 0;
+            size_t count_ = 0;
+            bool writing_ = false;
+            bool stopping_ = false;
+            std::mutex mutex_;
+            std::condition_variable not_empty_;
+            std::condition_variable not_full_;
+            std::condition_variable drained_;
+            std::thread writer_;
+        };
+
+        struct State
+        {
+            std::mutex console; // keeps lines from different threads whole
+            std::mutex sink_mutex;
+            std::unique_ptr<FileSink> sink;
+            bool exit_hook = false;
+        };
+
+        inline State &state()
+        {
+            static State instance;
+            return instance;
+        }
+
+        inline const char *level_name(Level level)
+        {
+            switch (level)
+            {
+            case Level::Error:
+                return "ERROR";
+            case Level::Warning:
+                return "WARNING";
+            case Level::Info:
+                return "INFO";
+            default:
+                return "DEBUG";
+            }
+        }
+
+        inline std::string timestamp()
+        {
+            auto now = std::chrono::system_clock::now();
+            std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+            auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+            std::tm utc{};
+            gmtime_r(&seconds, &utc);
+            char text[32];
+            std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+            char with_millis[40];
+            std::snprintf(with_millis, sizeof(with_millis), "%s.%03dZ", text, static_cast<int>(millis));
+            return with_millis;
+        }
+
+        inline void write(Level level, const std::string &message)
+        {
+            State &s = state();
+            {
+                std::lock_guard<std::mutex> lock(s.sink_mutex);
+                if (s.sink)
+                {
+                    s.sink->push(timestamp() + " " + level_name(level) + " " + message + "\n");
+                }
+            }
+
+            // Errors and warnings go to stderr, highlighted when it is a terminal
+            bool to_stderr = level == Level::Error || level == Level::Warning;
+            static const bool colour = ::isatty(STDERR_FILENO) == 1;
+            std::string line;
+            switch (level)
+            {
+            case Level::Error:
+                line = (colour ? "\033[1;31m[kit]\033[0m Error: " : "[kit] Error: ") + message + "\n";
+                break;
+            case Level::Warning:
+                line = (colour ? "\033[1;33m[kit]\033[0m Warning: " : "[kit] Warning: ") + message + "\n";
+                break;
+            case Level::Info:
+                line = "[kit] " + message + "\n";
+                break;
+            case Level::Debug:
+                line = "[DEBUG] " + message + "\n";
+                break;
+            }
+            std::lock_guard<std::mutex> lock(s.console);
+            if (to_stderr)
+            {
+                // Keep the order of a combined stream: what stdout buffered so far comes first
+                std::cout.flush();
+            }
+            std::ostream &out = to_stderr ? std::cerr : std::cout;
+            out.write(line.data(), static_cast<std::streamsize>(line.size()));
+        }
+    } // namespace detail
+
+    inline Level level()
+    {
+        return static_cast<Level>(detail::level.load(std::memory_order_relaxed));
+    }
+
+    inline void set_level(Level level)
+    {
+        detail::level.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    inline bool enabled(Level level)
+    {
+        return static_cast<int>(level) <= detail::level.load(std::memory_order_relaxed);
+    }
+
+    // Parse "error", "warning", "info" or "debug" (or 0-3)
+    inline bool parse_level(const std::string &name, Level &level)
+    {
+        static const char *const names[] = {"error", "warning", "info", "debug"};
+        for (int i = 0; i < 4; ++i)
+        {
+            if (name == names[i] || name == std::to_string(i))
+            {
+                level = static_cast<Level>(i);
+                return true;
+            }
+        }
+        if (name == "warn")
+        {
+            level = Level::Warning;
+            return true;
+        }
+        return false;
+    }
+
+    // Write everything queued for the log file
+    inline void flush()
+    {
+        detail::State &s = detail::state();
+        std::lock_guard<std::mutex> lock(s.sink_mutex);
+        std::cout.flush();
+        if (s.sink)
+        {
+            s.sink->flush();
+        }
+    }
+
+    // Stop writing to the log file, after writing what is queued
+    inline void close_file()
+    {
+        detail::State &s = detail::state();
+        std::lock_guard<std::mutex> lock(s.sink_mutex);
+        s.sink.reset();
+    }
+
+    // Also append every message to `path`; the file is closed on exit
+    inline void open_file(const std::string &path)
+    {
+        auto sink = std::make_unique<detail::FileSink>(path);
+        detail::State &s = detail::state();
+        std::lock_guard<std::mutex> lock(s.sink_mutex);
+        s.sink = std::move(sink);
+        if (!s.exit_hook)
+        {
+            s.exit_hook = true;
+            std::atexit(close_file);
+        }
+    }
+
+    inline bool has_file()
+    {
+        detail::State &s = detail::state();
+        std::lock_guard<std::mutex> lock(s.sink_mutex);
+        return s.sink != nullptr;
+    }
+
+    // In a child process after fork(): the writer thread was not copied, so the sink is abandoned
+    // rather than joined, and only the console is used
+    inline void after_fork()
+    {
+        detail::State &s = detail::state();
+        s.sink.release();
+    }
+
+    // Apply KIT_LOG_LEVEL and KIT_LOG_FILE
+    inline void configure_from_environment()
+    {
+        Level parsed;
+        const char *name = std::getenv("KIT_LOG_LEVEL");
+        if (name && parse_level(name, parsed))
+        {
+            set_level(parsed);
+        }
+        const char *path = std::getenv("KIT_LOG_FILE");
+        if (path && *path)
+        {
+            open_file(path);
+        }
+    }
+
+    // Log `message`, or the string returned by calling it; a callable is only called when the
+    // level is enabled
+    template <typename Message>
+    void log(Level level, Message &&message)
+    {
+        if (!enabled(level))
+        {
+            return;
+        }
+        if constexpr (std::is_invocable_v<Message>)
+        {
+            detail::write(level, std::string(message()));
+        }
+        else
+        {
+            detail::write(level, std::string(std::forward<Message>(message)));
+        }
+    }
+
+    template <typename Message>
+    void error(Message &&message)
+    {
+        log(Level::Error, std::forward<Message>(message));
+    }
+
+    template <typename Message>
+    void warning(Message &&message)
+    {
+        log(Level::Warning, std::forward<Message>(message));
     }
 
-    inline void info(const std::string &message)
+    template <typename Message>
+    void info(Message &&message)
     {
-        std::cout << "[INFO] " << message << std::endl;
+        log(Level::Info, std::forward<Message>(message));
     }
 
-    inline void error(const std::string &message)
+    template <typename Message>
+    void debug(Message &&message)
     {
-        std::cerr << "[ERROR] " << message << std::endl;
+        log(Level::Debug, std::forward<Message>(message));
     }
-}
+} // namespace logger
 
 #endif // LOGGER_HPP
@@ -0,0 +1,126 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace lru_cache
+{
+    // Counters of one cache
+    struct Stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0; // sum of the charges of the cached values
+        size_t budget = 0;
+    };
+
+    // Thread-safe least-recently-used cache bounded by a byte budget. Every value is inserted with
+    // the number of bytes it is charged for; values are shared, so an evicted value stays alive for
+    // callers still holding it. A value charged more than the whole budget is not cached.
+    template <typename Key, typename Value, typename Hash = std::hash<Key>>
+    class LruCache
+    {
+    public:
+        explicit LruCache(size_t budget) : budget_(budget) {}
+
+        LruCache(const LruCache &) = delete;
+        LruCache &operator=(const LruCache &) = delete;
+
+        // Cached value for `key`, or null; a hit makes the entry the most recently used
+        std::shared_ptr<const Value> get(const Key &key)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = map_.find(key);
+            if (it == map_.end())
+            {
+                ++stats_.misses;
+                return nullptr;
+            }
+            ++stats_.hits;
+            order_.splice(order_.begin(), order_, it->second);
+            return it->second->value;
+        }
+
+        // Insert or replace a value, evicting the least recently used entries over budget
+        void put(const Key &key, std::shared_ptr<const Value> value, size_t charge)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = map_.find(key);
+            if (it != map_.end())
+            {
+                stats_.bytes -= it->second->charge;
+                order_.erase(it->second);
+                map_.erase(it);
+            }
+            if (charge > budget_)
+            {
+                return;
+            }
+            order_.push_front({key, std::move(value), charge});
+            map_.emplace(key, order_.begin());
+            stats_.bytes += charge;
+            trim();
+        }
+
+        // Change the budget, evicting entries if it shrank
+        void set_budget(size_t budget)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            budget_ = budget;
+            trim();
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            map_.clear();
+            order_.clear();
+            stats_.bytes = 0;
+        }
+
+        Stats stats() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Stats stats = stats_;
+            stats.entries = map_.size();
+            stats.budget = budget_;
+            return stats;
+        }
+
+    private:
+        struct Node
+        {
+            Key key;
+            std::shared_ptr<const Value> value;
+            size_t charge;
+        };
+
+        void trim()
+        {
+            while (stats_.bytes > budget_ && !order_.empty())
+            {
+                const Node &oldest = order_.back();
+                stats_.bytes -= oldest.charge;
+                map_.erase(oldest.key);
+                order_.pop_back();
+                ++stats_.evictions;
+            }
+        }
+
+        size_t budget_;
+        std::list<Node> order_; // most recently used first
+        std::unordered_map<Key, typename std::list<Node>::iterator, Hash> map_;
+        Stats stats_;
+        mutable std::mutex mutex_;
+    };
+} // namespace lru_cache
+
+#endif // LRU_CACHE_HPP
@@ -0,0 +1,122 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace mapped_file
+{
+    // Convert a timespec to nanoseconds since the epoch
+    inline std::int64_t timespec_ns(const struct timespec &ts)
+    {
+        return static_cast<std::int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    // Read a whole file into `out` straight from the descriptor, without intermediate buffers;
+    // returns false if the file cannot be read
+    inline bool read_all(const std::string &path, std::string &out)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        out.assign(static_cast<size_t>(st.st_size), '\0');
+        size_t done = 0;
+        while (done < out.size())
+        {
+            ssize_t count = ::read(fd, &out[done], out.size() - done);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(count);
+        }
+        ::close(fd);
+        out.resize(done);
+        return done == static_cast<size_t>(st.st_size);
+    }
+
+    // Read-only memory mapping of a whole file; `is_open` is false if the file does not exist
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string &path)
+        {
+            fd_ = ::open(path.c_str(), O_RDONLY);
+            if (fd_ < 0)
+            {
+                return;
+            }
+            struct stat st;
+            if (::fstat(fd_, &st) != 0)
+            {
+                ::close(fd_);
+                throw std::runtime_error("Failed to stat file: " + path);
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            inode_ = static_cast<std::uint64_t>(st.st_ino);
+#ifdef __APPLE__
+            mtime_ns_ = timespec_ns(st.st_mtimespec);
+#else
+            mtime_ns_ = timespec_ns(st.st_mtim);
+#endif
+            if (size_ > 0)
+            {
+                void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+                if (data == MAP_FAILED)
+                {
+                    ::close(fd_);
+                    throw std::runtime_error("Failed to map file: " + path);
+                }
+                data_ = static_cast<const unsigned char *>(data);
+            }
+        }
+
+        ~MappedFile()
+        {
+            if (data_)
+            {
+                ::munmap(const_cast<unsigned char *>(data_), size_);
+            }
+            if (fd_ >= 0)
+            {
+                ::close(fd_);
+            }
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool is_open() const { return fd_ >= 0; }
+        const unsigned char *data() const { return data_; }
+        size_t size() const { return size_; }
+        std::int64_t mtime_ns() const { return mtime_ns_; }
+        std::uint64_t inode() const { return inode_; }
+
+    private:
+        int fd_ = -1;
+        const unsigned char *data_ = nullptr;
+        size_t size_ = 0;
+        std::int64_t mtime_ns_ = 0;
+        std::uint64_t inode_ = 0;
+    };
+} // namespace mapped_file
+
+#endif // MAPPED_FILE_HPP
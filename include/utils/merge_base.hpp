@@ -0,0 +1,322 @@
+#ifndef MERGE_BASE_HPP
+#define MERGE_BASE_HPP
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include "commit_graph.hpp"
+#include "object_id.hpp"
+#include "trace.hpp"
+
+// Merge-base computation. Both sides are walked at once from a priority queue ordered by
+// generation number (then commit time), painting every commit with the side(s) that reach it.
+// A commit painted by both sides is a candidate; everything below it is marked stale, and the
+// walk stops as soon as the queue holds only stale commits. Generation numbers come from the
+// commit-graph; commits outside it count as "infinitely" high, which keeps the walk correct
+// without a graph.
+namespace merge_base
+{
+    namespace detail
+    {
+        enum Flags : std::uint8_t
+        {
+            PARENT1 = 1 << 0,
+            PARENT2 = 1 << 1,
+            STALE = 1 << 2,
+            RESULT = 1 << 3,
+        };
+
+        struct Node
+        {
+            commit_graph::CommitInfo info;
+            std::uint8_t flags = 0;
+            std::uint32_t queued = 0; // entries for this commit currently in the walk queue
+        };
+
+        // Lazily loaded commits and their paint flags for one query
+        class Walk
+        {
+        public:
+            Node &node(const object_id::ObjectId &oid)
+            {
+                auto it = nodes_.find(oid);
+                if (it == nodes_.end())
+                {
+                    Node node;
+                    node.info = commit_graph::lookup(oid);
+                    it = nodes_.emplace(oid, std::move(node)).first;
+                }
+                return it->second;
+            }
+
+            void clear_flags()
+            {
+                for (auto &[oid, node] : nodes_)
+                {
+                    node.flags = 0;
+                    node.queued = 0;
+                }
+            }
+
+        private:
+            std::unordered_map<object_id::ObjectId, Node> nodes_;
+        };
+
+        // Pop order: highest generation first, then newest commit
+        struct QueueOrder
+        {
+            bool operator()(const Node *a, const Node *b) const
+            {
+                if (a->info.generation != b->info.generation)
+                {
+                    return a->info.generation < b->info.generation;
+                }
+                return a->info.timestamp < b->info.timestamp;
+            }
+        };
+
+        using Queue = std::priority_queue<Node *, std::vector<Node *>, QueueOrder>;
+
+        // Paint from `one` (PARENT1) and `twos` (PARENT2) and return the commits reached by both
+        // that are not below another such commit. Commits below `min_generation` are not visited.
+        inline std::vector<Node *> paint_down_to_common(Walk &walk, const object_id::ObjectId &one,
+                                                        const std::vector<object_id::ObjectId> &twos,
+                                                        std::uint32_t min_generation = 0)
+        {
+            // Number of queue entries whose commit is not stale; the walk ends when it drops to zero
+            Queue queue;
+            size_t nonstale = 0;
+            auto push = [&](Node &node)
+            {
+                queue.push(&node);
+                ++node.queued;
+                if (!(node.flags & STALE))
+                {
+                    ++nonstale;
+                }
+            };
+            auto add_flags = [&](Node &node, std::uint8_t flags)
+            {
+                if ((flags & STALE) && !(node.flags & STALE))
+                {
+                    nonstale -= node.queued;
+                }
+                node.flags |= flags;
+            };
+
+            Node &start = walk.node(one);
+            start.flags |= PARENT1;
+            push(start);
+            for (const auto &two : twos)
+            {
+                Node &node = walk.node(two);
+                node.flags |= PARENT2;
+                push(node);
+            }
+
+            std::vector<Node *> result;
+            while (nonstale > 0 && !queue.empty())
+            {
+                Node *commit = queue.top();
+                queue.pop();
+                --commit->queued;
+                if (!(commit->flags & STALE))
+                {
+                    --nonstale;
+                }
+                if (commit->info.generation < min_generation)
+                {
+                    continue;
+                }
+
+                std::uint8_t flags = commit->flags & (PARENT1 | PARENT2 | STALE);
+                if ((flags & (PARENT1 | PARENT2)) == (PARENT1 | PARENT2))
+                {
+                    if (!(commit->flags & RESULT))
+                    {
+                        commit->flags |= RESULT;
+                        result.push_back(commit);
+                    }
+                    // Everything below a common commit is stale
+                    flags |= STALE;
+                }
+
+                for (const auto &parent_id : commit->info.parents)
+                {
+                    Node &parent = walk.node(parent_id);
+                    if ((parent.flags & flags) == flags)
+                    {
+                        continue;
+                    }
+                    add_flags(parent, flags);
+                    push(parent);
+                }
+            }
+
+            result.erase(std::remove_if(result.begin(), result.end(), [](const Node *node)
+                                        { return node->flags & STALE; }),
+                         result.end());
+            return result;
+        }
+
+        // Drop candidates that are ancestors of other candidates
+        inline std::vector<object_id::ObjectId> remove_redundant(Walk &walk,
+                                                                 const std::vector<object_id::ObjectId> &candidates)
+        {
+            if (candidates.size() < 2)
+            {
+                return candidates;
+            }
+
+            std::uint32_t min_generation = commit_graph::GENERATION_INFINITY;
+            for (const auto &candidate : candidates)
+            {
+                min_generation = std::min(min_generation, walk.node(candidate).info.generation);
+            }
+            if (min_generation == commit_graph::GENERATION_INFINITY)
+            {
+                min_generation = 0;
+            }
+
+            std::vector<bool> redundant(candidates.size(), false);
+            for (size_t i = 0; i < candidates.size(); ++i)
+            {
+                if (redundant[i])
+                {
+                    continue;
+                }
+                std::vector<object_id::ObjectId> others;
+                std::vector<size_t> other_index;
+                for (size_t j = 0; j < candidates.size(); ++j)
+                {
+                    if (j != i && !redundant[j])
+                    {
+                        others.push_back(candidates[j]);
+                        other_index.push_back(j);
+                    }
+                }
+
+                walk.clear_flags();
+                paint_down_to_common(walk, candidates[i], others, min_generation);
+                if (walk.node(candidates[i]).flags & PARENT2)
+                {
+                    redundant[i] = true;
+                }
+                for (size_t k = 0; k < others.size(); ++k)
+                {
+                    if (walk.node(others[k]).flags & PARENT1)
+                    {
+                        redundant[other_index[k]] = true;
+                    }
+                }
+            }
+
+            std::vector<object_id::ObjectId> result;
+            for (size_t i = 0; i < candidates.size(); ++i)
+            {
+                if (!redundant[i])
+                {
+                    result.push_back(candidates[i]);
+                }
+            }
+            return result;
+        }
+        inline std::vector<object_id::ObjectId> parse_ids(const std::vector<std::string> &hashes)
+        {
+            std::vector<object_id::ObjectId> ids;
+            ids.reserve(hashes.size());
+            for (const auto &hash : hashes)
+            {
+                ids.push_back(object_id::ObjectId::from_hex(hash));
+            }
+            return ids;
+        }
+
+        inline std::vector<std::string> to_hex(const std::vector<object_id::ObjectId> &ids)
+        {
+            std::vector<std::string> hashes;
+            hashes.reserve(ids.size());
+            for (const auto &oid : ids)
+            {
+                hashes.push_back(oid.hex());
+            }
+            return hashes;
+        }
+    } // namespace detail
+
+    // Best common ancestors of `one` and any of `twos`, best first
+    inline std::vector<std::string> merge_bases_many(const std::string &one, const std::vector<std::string> &twos)
+    {
+        for (const auto &two : twos)
+        {
+            if (one == two)
+            {
+                return {one};
+            }
+        }
+
+        trace::Span span("merge_base.walk");
+        detail::Walk walk;
+        std::vector<object_id::ObjectId> candidates;
+        for (const auto *node : detail::paint_down_to_common(walk, object_id::ObjectId::from_hex(one),
+                                                             detail::parse_ids(twos)))
+        {
+            candidates.push_back(node->info.id);
+        }
+        return detail::to_hex(detail::remove_redundant(walk, candidates));
+    }
+
+    // All best common ancestors of two commits
+    inline std::vector<std::string> merge_bases(const std::string &one, const std::string &two)
+    {
+        return merge_bases_many(one, {two});
+    }
+
+    // The best common ancestor of two commits, or an empty string if they share no history
+    inline std::string merge_base(const std::string &one, const std::string &two)
+    {
+        auto bases = merge_bases(one, two);
+        return bases.empty() ? "" : bases.front();
+    }
+
+    // Common ancestors of all the given commits, as used for an octopus merge
+    inline std::vector<std::string> octopus_bases(const std::vector<std::string> &commits)
+    {
+        if (commits.empty())
+        {
+            return {};
+        }
+
+        std::vector<std::string> result{commits.front()};
+        for (size_t i = 1; i < commits.size() && !result.empty(); ++i)
+        {
+            std::vector<std::string> next;
+            for (const auto &base : result)
+            {
+                for (const auto &found : merge_bases(base, commits[i]))
+                {
+                    if (std::find(next.begin(), next.end(), found) == next.end())
+                    {
+                        next.push_back(found);
+                    }
+                }
+            }
+            // Bases found through different candidates may be ancestors of one another
+            detail::Walk walk;
+            result = detail::to_hex(detail::remove_redundant(walk, detail::parse_ids(next)));
+        }
+        return result;
+    }
+
+    // True if `ancestor` is reachable from `descendant`
+    inline bool is_ancestor(const std::string &ancestor, const std::string &descendant)
+    {
+        auto bases = merge_bases(ancestor, descendant);
+        return std::find(bases.begin(), bases.end(), ancestor) != bases.end();
+    }
+} // namespace merge_base
+
+#endif // MERGE_BASE_HPP
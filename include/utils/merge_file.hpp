@@ -0,0 +1,383 @@
+#ifndef MERGE_FILE_HPP
+#define MERGE_FILE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include "line_diff.hpp"
+#include "object_store.hpp"
+#include "thread_pool.hpp"
+
+// Three-way merge of files and trees.
+//
+// A file is merged by diffing base->ours and base->theirs at line level. Changes of the two sides
+// that overlap or touch in the base are grouped into one region; a region changed on one side only
+// takes that side, a region both sides changed identically takes either, and anything else is a
+// conflict. Conflicts are written with "merge" markers (ours/theirs, with the lines both sides
+// agree on moved out of the region) or "diff3" markers (ours/base/theirs, untrimmed).
+//
+// Trees are merged path by path from their blob ids, so only files both sides changed differently
+// are read; those are merged in parallel.
+namespace merge_file
+{
+    enum class ConflictStyle
+    {
+        Merge,
+        Diff3,
+    };
+
+    struct Options
+    {
+        ConflictStyle style = ConflictStyle::Merge;
+        std::string ours_label = "ours";
+        std::string base_label = "base";
+        std::string theirs_label = "theirs";
+        line_diff::Algorithm algorithm = line_diff::Algorithm::Histogram;
+        unsigned jobs = 0; // threads for tree merges
+    };
+
+    struct Result
+    {
+        std::string content;
+        size_t conflicts = 0; // conflict regions written into the content
+    };
+
+    namespace detail
+    {
+        // Base lines [base_begin, base_end) were replaced by side lines [side_begin, side_end)
+        struct Change
+        {
+            size_t base_begin, base_end, side_begin, side_end;
+        };
+
+        inline std::vector<Change> changes(const line_diff::FileDiff &diff)
+        {
+            std::vector<Change> result;
+            size_t n = diff.removed.size(), m = diff.added.size();
+            size_t i = 0, j = 0;
+            while (i < n || j < m)
+            {
+                if (i < n && j < m && !diff.removed[i] && !diff.added[j])
+                {
+                    ++i;
+                    ++j;
+                    continue;
+                }
+                Change change{i, i, j, j};
+                while (i < n && diff.removed[i])
+                    ++i;
+                while (j < m && diff.added[j])
+                    ++j;
+                change.base_end = i;
+                change.side_end = j;
+                result.push_back(change);
+            }
+            return result;
+        }
+
+        inline std::string_view slice(const line_diff::Lines &lines, size_t begin, size_t end)
+        {
+            return lines.text.substr(lines.starts[begin], lines.starts[end] - lines.starts[begin]);
+        }
+
+        // Append lines that a conflict marker follows, terminating a last line that lacks a newline
+        inline void append_block(std::string &out, std::string_view text)
+        {
+            out.append(text);
+            if (!text.empty() && text.back() != '\n')
+            {
+                out.push_back('\n');
+            }
+        }
+
+        inline void append_marker(std::string &out, char marker, const std::string &label)
+        {
+            out.append(7, marker);
+            if (!label.empty())
+            {
+                out.push_back(' ');
+                out += label;
+            }
+            out.push_back('\n');
+        }
+
+        // Lines [from, to) of one side inside a merge region
+        struct SideRange
+        {
+            const line_diff::Lines *lines;
+            size_t from, to;
+
+            std::string_view text() const { return slice(*lines, from, to); }
+            std::string_view line(size_t i) const { return lines->line(i); }
+        };
+
+        // Map the base region [lo, hi) onto one side, given that side's changes [begin, end) inside it.
+        // `delta` is the side's line offset against the base after its last change so far.
+        inline SideRange side_range(const line_diff::Lines &lines, const std::vector<Change> &list, size_t begin,
+                                    size_t end, size_t lo, size_t hi, long &delta)
+        {
+            if (begin == end)
+            {
+                return {&lines, static_cast<size_t>(static_cast<long>(lo) + delta),
+                        static_cast<size_t>(static_cast<long>(hi) + delta)};
+            }
+            const Change &first = list[begin];
+            const Change &last = list[end - 1];
+            delta = static_cast<long>(last.side_end) - static_cast<long>(last.base_end);
+            return {&lines, first.side_begin - (first.base_begin - lo), last.side_end + (hi - last.base_end)};
+        }
+
+        inline void write_conflict(std::string &out, SideRange ours, std::string_view base, SideRange theirs,
+                                   const Options &options)
+        {
+            if (options.style == ConflictStyle::Merge)
+            {
+                // Lines both sides agree on at the edges of the region are not part of the conflict
+                while (ours.from < ours.to && theirs.from < theirs.to && ours.line(ours.from) == theirs.line(theirs.from))
+                {
+                    out.append(ours.line(ours.from));
+                    ++ours.from;
+                    ++theirs.from;
+                }
+                size_t common_tail = 0;
+                while (ours.to - common_tail > ours.from && theirs.to - common_tail > theirs.from &&
+                       ours.line(ours.to - common_tail - 1) == theirs.line(theirs.to - common_tail - 1))
+                {
+                    ++common_tail;
+                }
+                std::string_view tail = slice(*ours.lines, ours.to - common_tail, ours.to);
+                ours.to -= common_tail;
+                theirs.to -= common_tail;
+                if (!out.empty() && out.back() != '\n')
+                {
+                    out.push_back('\n');
+                }
+
+                append_marker(out, '<', options.ours_label);
+                append_block(out, ours.text());
+                append_marker(out, '=', "");
+                append_block(out, theirs.text());
+                append_marker(out, '>', options.theirs_label);
+                out.append(tail);
+                return;
+            }
+
+            append_marker(out, '<', options.ours_label);
+            append_block(out, ours.text());
+            append_marker(out, '|', options.base_label);
+            append_block(out, base);
+            append_marker(out, '=', "");
+            append_block(out, theirs.text());
+            append_marker(out, '>', options.theirs_label);
+        }
+    } // namespace detail
+
+    // Merge two versions of a text that descend from `base`. Binary content is not merged: a
+    // binary file changed on both sides keeps our version and counts as one conflict.
+    inline Result merge(std::string_view base, std::string_view ours, std::string_view theirs,
+                        const Options &options = {})
+    {
+        Result result;
+        if (ours == theirs || base == theirs)
+        {
+            result.content = std::string(ours);
+            return result;
+        }
+        if (base == ours)
+        {
+            result.content = std::string(theirs);
+            return result;
+        }
+        if (line_diff::is_binary(base) || line_diff::is_binary(ours) || line_diff::is_binary(theirs))
+        {
+            result.content = std::string(ours);
+            result.conflicts = 1;
+            return result;
+        }
+
+        line_diff::FileDiff ours_diff = line_diff::diff(base, ours, options.algorithm);
+        line_diff::FileDiff theirs_diff = line_diff::diff(base, theirs, options.algorithm);
+        const std::vector<detail::Change> ours_changes = detail::changes(ours_diff);
+        const std::vector<detail::Change> theirs_changes = detail::changes(theirs_diff);
+        const line_diff::Lines &base_lines = ours_diff.old_lines;
+
+        std::string &out = result.content;
+        out.reserve(std::max(ours.size(), theirs.size()));
+        size_t i = 0, j = 0;                  // next unmerged change of each side
+        long ours_delta = 0, theirs_delta = 0; // side line = base line + delta between changes
+        size_t copied = 0;                    // base lines already written
+        while (i < ours_changes.size() || j < theirs_changes.size())
+        {
+            // Open a region at the earliest change and absorb every change that overlaps or touches it
+            size_t i_end = i, j_end = j, lo, hi;
+            if (j == theirs_changes.size() ||
+                (i < ours_changes.size() && ours_changes[i].base_begin <= theirs_changes[j].base_begin))
+            {
+                lo = ours_changes[i].base_begin;
+                hi = ours_changes[i_end++].base_end;
+            }
+            else
+            {
+                lo = theirs_changes[j].base_begin;
+                hi = theirs_changes[j_end++].base_end;
+            }
+            for (bool grew = true; grew;)
+            {
+                grew = false;
+                for (; i_end < ours_changes.size() && ours_changes[i_end].base_begin <= hi; ++i_end, grew = true)
+                {
+                    hi = std::max(hi, ours_changes[i_end].base_end);
+                }
+                for (; j_end < theirs_changes.size() && theirs_changes[j_end].base_begin <= hi; ++j_end, grew = true)
+                {
+                    hi = std::max(hi, theirs_changes[j_end].base_end);
+                }
+            }
+
+            out.append(detail::slice(base_lines, copied, lo));
+            detail::SideRange ours_range =
+                detail::side_range(ours_diff.new_lines, ours_changes, i, i_end, lo, hi, ours_delta);
+            detail::SideRange theirs_range =
+                detail::side_range(theirs_diff.new_lines, theirs_changes, j, j_end, lo, hi, theirs_delta);
+
+            if (j_end == j || ours_range.text() == theirs_range.text())
+            {
+                out.append(ours_range.text());
+            }
+            else if (i_end == i)
+            {
+                out.append(theirs_range.text());
+            }
+            else
+            {
+                detail::write_conflict(out, ours_range, detail::slice(base_lines, lo, hi), theirs_range, options);
+                ++result.conflicts;
+            }
+
+            copied = hi;
+            i = i_end;
+            j = j_end;
+        }
+        out.append(detail::slice(base_lines, copied, base_lines.size()));
+        return result;
+    }
+
+    enum class Conflict
+    {
+        None,
+        Content,      // both sides changed the same lines
+        AddAdd,       // both sides added the path with different contents
+        ModifyDelete, // one side changed the file, the other deleted it
+    };
+
+    // Outcome of a tree merge for one path
+    struct FileResult
+    {
+        std::string path;
+        std::string oid;     // resulting blob when no content merge was needed
+        std::string content; // merged content when `merged` is set
+        bool merged = false;
+        Conflict conflict = Conflict::None;
+    };
+
+    inline const char *conflict_name(Conflict conflict)
+    {
+        switch (conflict)
+        {
+        case Conflict::Content:
+            return "content";
+        case Conflict::AddAdd:
+            return "add/add";
+        case Conflict::ModifyDelete:
+            return "modify/delete";
+        default:
+            return "none";
+        }
+    }
+
+    // Merge three path -> blob id maps. Paths deleted in the result are left out; modify/delete
+    // conflicts keep the modified file. Files changed differently on both sides are read and
+    // merged on `options.jobs` threads.
+    inline std::vector<FileResult> merge_trees(const std::map<std::string, std::string> &base,
+                                               const std::map<std::string, std::string> &ours,
+                                               const std::map<std::string, std::string> &theirs,
+                                               const Options &options = {})
+    {
+        static const std::string NONE;
+        auto find = [](const std::map<std::string, std::string> &files, const std::string &path) -> const std::string &
+        {
+            auto it = files.find(path);
+            return it == files.end() ? NONE : it->second;
+        };
+
+        std::vector<std::string> paths;
+        paths.reserve(std::max({base.size(), ours.size(), theirs.size()}));
+        for (const auto *files : {&base, &ours, &theirs})
+        {
+            for (const auto &[path, oid] : *files)
+            {
+                paths.push_back(path);
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+        std::vector<FileResult> results;
+        std::vector<size_t> pending; // results that need a content merge
+        for (const auto &path : paths)
+        {
+            const std::string &b = find(base, path);
+            const std::string &o = find(ours, path);
+            const std::string &t = find(theirs, path);
+
+            FileResult file;
+            file.path = path;
+            if (o == t || t == b)
+            {
+                file.oid = o;
+            }
+            else if (o == b)
+            {
+                file.oid = t;
+            }
+            else if (o.empty() || t.empty())
+            {
+                file.oid = o.empty() ? t : o;
+                file.conflict = Conflict::ModifyDelete;
+            }
+            else
+            {
+                pending.push_back(results.size());
+                results.push_back(std::move(file));
+                continue;
+            }
+
+            if (!file.oid.empty())
+            {
+                results.push_back(std::move(file));
+            }
+        }
+
+        thread_pool::parallel_for(pending.size(), options.jobs, [&](size_t k)
+                                  {
+            FileResult &file = results[pending[k]];
+            const std::string &b = find(base, file.path);
+            std::string base_content = b.empty() ? std::string() : object_store::read_object(b, "blob");
+            std::string ours_content = object_store::read_object(find(ours, file.path), "blob");
+            std::string theirs_content = object_store::read_object(find(theirs, file.path), "blob");
+
+            Result merged = merge(base_content, ours_content, theirs_content, options);
+            file.content = std::move(merged.content);
+            file.merged = true;
+            if (merged.conflicts > 0)
+            {
+                file.conflict = b.empty() ? Conflict::AddAdd : Conflict::Content;
+            } });
+        return results;
+    }
+} // namespace merge_file
+
+#endif // MERGE_FILE_HPP
@@ -4,6 +4,7 @@
 #include <gmock/gmock.h>
 #include <string>
 #include <unordered_map>
+#include "kit_utils.hpp"
 
 class MockKitUtils
 {
@@ -21,12 +22,12 @@ public:
     MOCK_METHOD(std::string, find_common_ancestor, (const std::string &commit1, const std::string &commit2), ());
 
     // Mock method for performing a three-way merge
-    MOCK_METHOD((std::unordered_map<std::string, std::string>), perform_three_way_merge,
+    MOCK_METHOD(kit_utils::MergedFiles, perform_three_way_merge,
                 (const std::string &base_commit, const std::string &current_commit, const std::string &target_commit), ());
 
     // Mock method for creating a commit
     MOCK_METHOD(std::string, create_commit,
-                (const std::unordered_map<std::string, std::string> &files, const std::string &message), ());
+                (const kit_utils::MergedFiles &files, const std::string &message), ());
 };
 
 #endif // MOCK_KIT_UTILS_HPP
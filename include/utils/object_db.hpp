@@ -0,0 +1,120 @@
+#ifndef OBJECT_DB_HPP
+#define OBJECT_DB_HPP
+
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include "commit_object.hpp"
+#include "lru_cache.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "pack.hpp"
+#include "trace.hpp"
+
+// Parsed object layer over the object store. Commits and trees are read, inflated and parsed
+// once and then shared from a byte-budgeted LRU cache, so history walks and merges that revisit
+// the same objects within one process do no further I/O. Objects are immutable and named by
+// their content, so cached entries never go stale. Delta bases are cached separately, in pack.
+namespace object_db
+{
+    constexpr size_t PARSED_CACHE_BYTES = 32 * 1024 * 1024;
+
+    namespace detail
+    {
+        // A parsed object of any kind, tagged with its object type
+        struct Parsed
+        {
+            std::string type;
+            std::shared_ptr<const void> value;
+        };
+
+        using ParsedCache = lru_cache::LruCache<object_id::ObjectId, Parsed>;
+
+        inline ParsedCache &parsed_cache()
+        {
+            static ParsedCache cache(PARSED_CACHE_BYTES);
+            return cache;
+        }
+    } // namespace detail
+
+    // Read the object `hash`, check it is a `type` and parse it with `parse`, reusing an earlier
+    // parse while it is cached. `charge` estimates the bytes the parsed value occupies.
+    template <typename T, typename Parse, typename Charge>
+    std::shared_ptr<const T> read_parsed(const std::string &hash, const std::string &type, Parse parse, Charge charge)
+    {
+        object_id::ObjectId oid;
+        if (!object_id::ObjectId::parse(hash, oid))
+        {
+            return std::make_shared<const T>(parse(object_store::read_object(hash, type)));
+        }
+
+        detail::ParsedCache &cache = detail::parsed_cache();
+        if (auto cached = cache.get(oid))
+        {
+            trace::count(trace::Counter::CacheHits);
+            if (cached->type != type)
+            {
+                throw std::runtime_error("Object " + hash + " is a " + cached->type + ", expected " + type);
+            }
+            return std::static_pointer_cast<const T>(cached->value);
+        }
+
+        trace::count(trace::Counter::CacheMisses);
+        auto value = std::make_shared<const T>(parse(object_store::read_object(hash, type)));
+        auto entry = std::make_shared<detail::Parsed>();
+        entry->type = type;
+        entry->value = value;
+        cache.put(oid, std::move(entry), sizeof(detail::Parsed) + type.size() + charge(*value));
+        return value;
+    }
+
+    inline size_t commit_charge(const commit_object::Commit &commit)
+    {
+        size_t bytes = sizeof(commit) + commit.tree.size() + commit.message.size();
+        for (const auto &parent : commit.parents)
+        {
+            bytes += sizeof(parent) + parent.size();
+        }
+        return bytes;
+    }
+
+    // Load and parse a commit object
+    inline std::shared_ptr<const commit_object::Commit> read_commit(const std::string &hash)
+    {
+        return read_parsed<commit_object::Commit>(hash, "commit", commit_object::parse, commit_charge);
+    }
+
+    struct Stats
+    {
+        lru_cache::Stats parsed;      // commits and trees
+        lru_cache::Stats delta_bases; // inflated pack objects that deltas apply to
+    };
+
+    inline Stats stats()
+    {
+        return {detail::parsed_cache().stats(), pack::delta_base_cache_stats()};
+    }
+
+    // One-line summary of the cache counters
+    inline std::string describe_stats()
+    {
+        auto describe = [](const char *name, const lru_cache::Stats &stats)
+        {
+            return std::string(name) + ": " + std::to_string(stats.hits) + " hits, " + std::to_string(stats.misses) +
+                   " misses, " + std::to_string(stats.evictions) + " evictions, " + std::to_string(stats.entries) +
+                   " entries (" + std::to_string(stats.bytes / 1024) + " of " + std::to_string(stats.budget / 1024) +
+                   " KiB)";
+        };
+        Stats current = stats();
+        return describe("object cache", current.parsed) + "; " + describe("delta base cache", current.delta_bases);
+    }
+
+    // Drop every cached object, e.g. when switching to another repository
+    inline void clear()
+    {
+        detail::parsed_cache().clear();
+        pack::detail::delta_base_cache().clear();
+    }
+} // namespace object_db
+
+#endif // OBJECT_DB_HPP
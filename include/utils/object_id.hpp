@@ -0,0 +1,88 @@
+#ifndef OBJECT_ID_HPP
+#define OBJECT_ID_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include "hash_object.hpp"
+
+namespace object_id
+{
+    // Raw object id: 20 (SHA-1) or 32 (SHA-256) bytes held inline. Trivially copyable, so it can
+    // key hash tables and sit in vectors without allocating.
+    struct ObjectId
+    {
+        unsigned char bytes[hash_object::MAX_OID_SIZE] = {};
+        std::uint8_t size = 0;
+
+        const unsigned char *data() const { return bytes; }
+        bool empty() const { return size == 0; }
+
+        static ObjectId from_raw(const unsigned char *raw, size_t length)
+        {
+            ObjectId id;
+            std::memcpy(id.bytes, raw, length);
+            id.size = static_cast<std::uint8_t>(length);
+            return id;
+        }
+
+        // Parse a 40- or 64-character hex id; returns false on malformed input
+        static bool parse(const std::string &hex, ObjectId &out)
+        {
+            if ((hex.size() != 2 * SHA_DIGEST_LENGTH && hex.size() != 2 * SHA256_DIGEST_LENGTH) ||
+                !hash_object::from_hex(hex.data(), out.bytes, hex.size() / 2))
+            {
+                return false;
+            }
+            std::memset(out.bytes + hex.size() / 2, 0, sizeof(out.bytes) - hex.size() / 2);
+            out.size = static_cast<std::uint8_t>(hex.size() / 2);
+            return true;
+        }
+
+        static ObjectId from_hex(const std::string &hex)
+        {
+            ObjectId id;
+            if (!parse(hex, id))
+            {
+                throw std::runtime_error("Invalid object id: " + hex);
+            }
+            return id;
+        }
+
+        std::string hex() const { return hash_object::to_hex(bytes, size); }
+
+        bool operator==(const ObjectId &other) const
+        {
+            return size == other.size && std::memcmp(bytes, other.bytes, size) == 0;
+        }
+        bool operator!=(const ObjectId &other) const { return !(*this == other); }
+        bool operator<(const ObjectId &other) const
+        {
+            int cmp = std::memcmp(bytes, other.bytes, size < other.size ? size : other.size);
+            return cmp != 0 ? cmp < 0 : size < other.size;
+        }
+    };
+
+    // Ids are already uniformly distributed, so their leading bytes make a good hash
+    struct Hash
+    {
+        size_t operator()(const ObjectId &id) const
+        {
+            size_t value;
+            std::memcpy(&value, id.bytes, sizeof(value));
+            return value;
+        }
+    };
+} // namespace object_id
+
+namespace std
+{
+    template <>
+    struct hash<object_id::ObjectId> : object_id::Hash
+    {
+    };
+} // namespace std
+
+#endif // OBJECT_ID_HPP
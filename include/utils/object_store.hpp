@@ -0,0 +1,512 @@
+#ifndef OBJECT_STORE_HPP
+#define OBJECT_STORE_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "constants.hpp"
+#include "compression.hpp"
+#include "hash_object.hpp"
+#include "mapped_file.hpp"
+#include "object_id.hpp"
+#include "pack.hpp"
+#include "trace.hpp"
+
+namespace object_store
+{
+    // Path of a loose object: objects/ab/cdef... (two-character fan-out directory)
+    inline std::string object_path(const std::string &hash)
+    {
+        if (hash.size() < 3)
+        {
+            throw std::runtime_error("Invalid object id: " + hash);
+        }
+        return OBJECTS_DIR + "/" + hash.substr(0, 2) + "/" + hash.substr(2);
+    }
+
+    // Check whether an object is stored loose (outside any pack)
+    inline bool loose_object_exists(const std::string &hash)
+    {
+        if (hash.size() < 3)
+        {
+            return false;
+        }
+        std::error_code ec;
+        return std::filesystem::is_regular_file(object_path(hash), ec);
+    }
+
+    // Check whether an object is present in the store, looking in packs first
+    inline bool object_exists(const std::string &hash)
+    {
+        return pack::contains(hash) || loose_object_exists(hash);
+    }
+
+    // Check whether an object is stored and bump the modification time of the file holding it, so
+    // gc treats an object that was just written again as recent rather than as old garbage
+    inline bool freshen_object(const std::string &hash)
+    {
+        if (loose_object_exists(hash))
+        {
+            ::utimensat(AT_FDCWD, object_path(hash).c_str(), nullptr, 0); // best effort, the object is there
+            return true;
+        }
+        object_id::ObjectId oid;
+        if (!object_id::ObjectId::parse(hash, oid))
+        {
+            return false;
+        }
+        std::uint32_t position;
+        for (const auto &p : *pack::packs())
+        {
+            if (p->find(oid.data(), position))
+            {
+                ::utimensat(AT_FDCWD, (PACK_DIR + "/" + p->name() + ".pack").c_str(), nullptr, 0);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // List the ids of all loose objects
+    inline std::vector<std::string> list_loose_objects()
+    {
+        const size_t name_length = 2 * hash_object::oid_size() - 2;
+        std::vector<std::string> ids;
+        std::error_code ec;
+        if (!std::filesystem::is_directory(OBJECTS_DIR, ec))
+        {
+            return ids;
+        }
+        for (const auto &fanout : std::filesystem::directory_iterator(OBJECTS_DIR))
+        {
+            std::string prefix = fanout.path().filename().string();
+            if (!fanout.is_directory() || prefix.size() != 2 || !std::isxdigit(static_cast<unsigned char>(prefix[0])) ||
+                !std::isxdigit(static_cast<unsigned char>(prefix[1])))
+            {
+                continue;
+            }
+            for (const auto &object : std::filesystem::directory_iterator(fanout.path()))
+            {
+                std::string rest = object.path().filename().string();
+                if (object.is_regular_file() && rest.size() == name_length)
+                {
+                    ids.push_back(prefix + rest);
+                }
+            }
+        }
+        return ids;
+    }
+
+    // Build the canonical "<type> <size>\0<content>" representation that is hashed and stored
+    inline std::string encode_object(const std::string &type, const std::string &content)
+    {
+        std::string encoded = type + " " + std::to_string(content.size());
+        encoded.push_back('\0');
+        encoded += content;
+        return encoded;
+    }
+
+    // Compute an object id without writing it
+    inline std::string hash_object(const std::string &type, const std::string &content)
+    {
+        return hash_object::compute_oid(encode_object(type, content));
+    }
+
+    // Size of the chunks that streamed contents are hashed and compressed in
+    constexpr size_t STREAM_CHUNK_SIZE = 256 * 1024;
+
+    namespace detail
+    {
+        // Temporary file next to the loose objects, unique across processes and threads; readers
+        // never observe a partial object
+        inline std::string temp_object_path()
+        {
+            static std::atomic<std::uint64_t> counter{0};
+            return OBJECTS_DIR + "/tmp_obj_" + std::to_string(::getpid()) + "_" +
+                   std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "_" +
+                   std::to_string(counter.fetch_add(1, std::memory_order_relaxed));
+        }
+
+        // Move a fully written temporary object to its final path, or drop it if the object already exists
+        inline void install_object(const std::string &temp_path, const std::string &hash)
+        {
+            if (freshen_object(hash))
+            {
+                std::filesystem::remove(temp_path);
+                return;
+            }
+            std::string path = object_path(hash);
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+            if (trace::enabled())
+            {
+                trace::count(trace::Counter::BytesWritten, std::filesystem::file_size(temp_path));
+            }
+            std::filesystem::rename(temp_path, path);
+            trace::count(trace::Counter::ObjectsWritten);
+        }
+    } // namespace detail
+
+    namespace detail
+    {
+        // Write an encoded object to its loose file
+        inline void write_loose(const std::string &encoded, const std::string &hash)
+        {
+            std::string path = object_path(hash);
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+
+            // Write to a temporary file first so readers never observe a partial object
+            std::string temp_path = temp_object_path();
+            {
+                std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+                if (!file)
+                {
+                    throw std::runtime_error("Failed to create object file: " + temp_path);
+                }
+                std::string compressed = compression::deflate(encoded);
+                file.write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+                if (!file)
+                {
+                    throw std::runtime_error("Failed to write object file: " + temp_path);
+                }
+                trace::count(trace::Counter::BytesWritten, compressed.size());
+            }
+            std::filesystem::rename(temp_path, path);
+            trace::count(trace::Counter::ObjectsWritten);
+        }
+    } // namespace detail
+
+    // Store an object and return its id; an object that already exists is not rewritten, only freshened
+    inline std::string write_object(const std::string &type, const std::string &content)
+    {
+        std::string encoded = encode_object(type, content);
+        std::string hash = hash_object::compute_oid(encoded);
+        if (!freshen_object(hash))
+        {
+            detail::write_loose(encoded, hash);
+        }
+        return hash;
+    }
+
+    // Store an object as a loose file even when a pack already holds it, and return its id
+    inline std::string write_loose_object(const std::string &type, const std::string &content)
+    {
+        std::string encoded = encode_object(type, content);
+        std::string hash = hash_object::compute_oid(encoded);
+        detail::write_loose(encoded, hash);
+        return hash;
+    }
+
+    // Hashes an object whose size is known up front while its content is fed in chunks, and
+    // optionally compresses the encoded object to `out` in the same pass
+    class ObjectStream
+    {
+    public:
+        ObjectStream(const std::string &type, std::uint64_t size, std::ostream *out = nullptr) : size_(size)
+        {
+            if (out)
+            {
+                deflater_ = std::make_unique<compression::Deflater>(*out);
+            }
+            std::string header = type + " " + std::to_string(size);
+            header.push_back('\0');
+            feed(header.data(), header.size());
+        }
+
+        void write(const void *data, size_t size)
+        {
+            written_ += size;
+            if (written_ > size_)
+            {
+                throw std::runtime_error("Object content is larger than its declared size");
+            }
+            feed(data, size);
+        }
+
+        // Finish hashing (and compressing) and return the object id
+        std::string finish()
+        {
+            if (written_ != size_)
+            {
+                throw std::runtime_error("Object content is smaller than its declared size");
+            }
+            if (deflater_)
+            {
+                deflater_->finish();
+            }
+            return hasher_.hex_digest();
+        }
+
+    private:
+        void feed(const void *data, size_t size)
+        {
+            hasher_.update(data, size);
+            if (deflater_)
+            {
+                deflater_->write(data, size);
+            }
+        }
+
+        std::uint64_t size_;
+        std::uint64_t written_ = 0;
+        hash_object::Hasher hasher_;
+        std::unique_ptr<compression::Deflater> deflater_;
+    };
+
+    // Hash `size` bytes read from a file descriptor in fixed-size chunks, compressing them to `out`
+    // when given. Memory use does not depend on the size of the file.
+    inline std::string stream_object(int fd, std::uint64_t size, const std::string &type = "blob",
+                                     std::ostream *out = nullptr)
+    {
+        ObjectStream stream(type, size, out);
+        std::unique_ptr<char[]> buffer(new char[STREAM_CHUNK_SIZE]);
+        std::uint64_t remaining = size;
+        while (remaining > 0)
+        {
+            size_t chunk = static_cast<size_t>(std::min<std::uint64_t>(remaining, STREAM_CHUNK_SIZE));
+            ssize_t count = ::read(fd, buffer.get(), chunk);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("Failed to read file contents");
+            }
+            if (count == 0)
+            {
+                throw std::runtime_error("File shrank while it was being read");
+            }
+            stream.write(buffer.get(), static_cast<size_t>(count));
+            remaining -= static_cast<std::uint64_t>(count);
+        }
+        return stream.finish();
+    }
+
+    // Hash (and optionally compress) an in-memory or memory-mapped range chunk by chunk
+    inline std::string stream_object(const unsigned char *data, size_t size, const std::string &type = "blob",
+                                     std::ostream *out = nullptr)
+    {
+        ObjectStream stream(type, size, out);
+        for (size_t offset = 0; offset < size; offset += STREAM_CHUNK_SIZE)
+        {
+            stream.write(data + offset, std::min(STREAM_CHUNK_SIZE, size - offset));
+        }
+        return stream.finish();
+    }
+
+    namespace detail
+    {
+        // Open a file for one sequential pass and return its descriptor and size
+        inline int open_for_streaming(const std::string &path, std::uint64_t &size)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                throw std::runtime_error("Failed to open file: " + path);
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("Failed to stat file: " + path);
+            }
+#ifdef POSIX_FADV_SEQUENTIAL
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            size = static_cast<std::uint64_t>(st.st_size);
+            return fd;
+        }
+
+        // Closes a descriptor when it goes out of scope
+        struct FdCloser
+        {
+            int fd;
+            ~FdCloser() { ::close(fd); }
+        };
+    } // namespace detail
+
+    // Compute the blob id of a working tree file without storing it or loading it into memory
+    inline std::string hash_file(const std::string &path)
+    {
+        std::uint64_t size = 0;
+        detail::FdCloser file{detail::open_for_streaming(path, size)};
+        try
+        {
+            return stream_object(file.fd, size);
+        }
+        catch (const std::exception &e)
+        {
+            throw std::runtime_error(std::string(e.what()) + ": " + path);
+        }
+    }
+
+    // Read and decompress an object; the object type is returned through `type` when requested.
+    // Packs are consulted first, loose objects second.
+    inline std::string read_object(const std::string &hash, std::string *type = nullptr)
+    {
+        std::string packed_content;
+        std::string packed_type;
+        if (pack::read_object(hash, packed_content, packed_type))
+        {
+            if (type)
+            {
+                *type = packed_type;
+            }
+            trace::count(trace::Counter::ObjectsRead);
+            trace::count(trace::Counter::BytesRead, packed_content.size());
+            return packed_content;
+        }
+
+        std::string compressed;
+        if (!mapped_file::read_all(object_path(hash), compressed))
+        {
+            throw std::runtime_error("Object not found: " + hash);
+        }
+        std::string encoded = compression::inflate(compressed);
+
+        size_t header_end = encoded.find('\0');
+        size_t space = encoded.find(' ');
+        if (header_end == std::string::npos || space == std::string::npos || space > header_end)
+        {
+            throw std::runtime_error("Corrupt object header: " + hash);
+        }
+
+        if (type)
+        {
+            *type = encoded.substr(0, space);
+        }
+        encoded.erase(0, header_end + 1);
+        trace::count(trace::Counter::ObjectsRead);
+        trace::count(trace::Counter::BytesRead, encoded.size());
+        return encoded;
+    }
+
+    // Type and content size of an object, read from its header without inflating the content
+    inline void read_object_info(const std::string &hash, std::string &type, std::uint64_t &size)
+    {
+        if (pack::object_info(hash, type, size))
+        {
+            return;
+        }
+
+        mapped_file::MappedFile file(object_path(hash));
+        if (!file.is_open())
+        {
+            throw std::runtime_error("Object not found: " + hash);
+        }
+        constexpr size_t MAX_HEADER_SIZE = 64; // "<type> <decimal size>\0"
+        std::string header = compression::inflate_prefix(reinterpret_cast<const char *>(file.data()), file.size(),
+                                                         MAX_HEADER_SIZE);
+        size_t header_end = header.find('\0');
+        size_t space = header.find(' ');
+        if (header_end == std::string::npos || space == std::string::npos || space > header_end)
+        {
+            throw std::runtime_error("Corrupt object header: " + hash);
+        }
+        type = header.substr(0, space);
+        size = std::strtoull(header.c_str() + space + 1, nullptr, 10);
+    }
+
+    // Read an object and verify that it has the expected type
+    inline std::string read_object(const std::string &hash, const std::string &expected_type)
+    {
+        std::string type;
+        std::string content = read_object(hash, &type);
+        if (type != expected_type)
+        {
+            throw std::runtime_error("Object " + hash + " is a " + type + ", expected " + expected_type);
+        }
+        return content;
+    }
+
+    // Store the contents of a file in the working tree as a blob. Small files are read once and
+    // stored like any other object. Larger ones are hashed in a streaming pass first, so a blob the
+    // store already has is only freshened, and otherwise hashed and compressed in a second pass;
+    // memory use stays constant however large the file is.
+    inline std::string write_blob_from_file(const std::string &path)
+    {
+        std::uint64_t size = 0;
+        detail::FdCloser file{detail::open_for_streaming(path, size)};
+        if (size <= STREAM_CHUNK_SIZE)
+        {
+            std::string content(static_cast<size_t>(size), '\0');
+            size_t done = 0;
+            while (done < content.size())
+            {
+                ssize_t count = ::read(file.fd, &content[done], content.size() - done);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    throw std::runtime_error("Failed to read file: " + path);
+                }
+                done += static_cast<size_t>(count);
+            }
+            return write_object("blob", content);
+        }
+
+        std::string hash;
+        try
+        {
+            hash = stream_object(file.fd, size);
+        }
+        catch (const std::exception &e)
+        {
+            throw std::runtime_error(std::string(e.what()) + ": " + path);
+        }
+        if (freshen_object(hash))
+        {
+            return hash;
+        }
+        if (::lseek(file.fd, 0, SEEK_SET) != 0)
+        {
+            throw std::runtime_error("Failed to rewind file: " + path);
+        }
+
+        std::filesystem::create_directories(OBJECTS_DIR);
+        std::string temp_path = detail::temp_object_path();
+        try
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                throw std::runtime_error("Failed to create object file: " + temp_path);
+            }
+            if (stream_object(file.fd, size, "blob", &out) != hash)
+            {
+                throw std::runtime_error("File changed while it was being stored");
+            }
+            out.close();
+            if (!out)
+            {
+                throw std::runtime_error("Failed to write object file: " + temp_path);
+            }
+            detail::install_object(temp_path, hash);
+        }
+        catch (const std::exception &e)
+        {
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+            throw std::runtime_error(std::string(e.what()) + ": " + path);
+        }
+        return hash;
+    }
+} // namespace object_store
+
+#endif // OBJECT_STORE_HPP
@@ -0,0 +1,658 @@
+#ifndef PACK_HPP
+#define PACK_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <openssl/sha.h>
+#include <unistd.h>
+#include "constants.hpp"
+#include "binary_io.hpp"
+#include "compression.hpp"
+#include "delta.hpp"
+#include "lru_cache.hpp"
+#include "hash_object.hpp"
+#include "mapped_file.hpp"
+#include "object_id.hpp"
+
+// Packfiles store many objects in one file, optionally as deltas against an earlier object.
+//
+// pack-<sha>.pack: "KPCK" | version u32 | object count u32 | entries | SHA-1 trailer
+//   entry: type u8 | varint size | [varint distance back to the delta base] | zlib data
+// pack-<sha>.idx:  "KPIX" | version u32 | fan-out table 256 x u32 |
+//                  sorted object ids (20 or 32 bytes each, per the object format) |
+//                  pack offsets (u64 each) | pack checksum | index checksum
+// The checksums are always SHA-1; only the object ids follow the repository's object format.
+namespace pack
+{
+    constexpr char PACK_SIGNATURE[4] = {'K', 'P', 'C', 'K'};
+    constexpr char IDX_SIGNATURE[4] = {'K', 'P', 'I', 'X'};
+    constexpr std::uint32_t PACK_VERSION = 1;
+    constexpr size_t CHECKSUM_SIZE = SHA_DIGEST_LENGTH;
+    constexpr size_t FANOUT_OFFSET = 8;
+    constexpr size_t IDS_OFFSET = FANOUT_OFFSET + 256 * 4;
+
+    constexpr unsigned char TYPE_COMMIT = 1;
+    constexpr unsigned char TYPE_TREE = 2;
+    constexpr unsigned char TYPE_BLOB = 3;
+    constexpr unsigned char TYPE_OFS_DELTA = 6;
+
+    constexpr size_t DELTA_WINDOW = 10;
+    constexpr int MAX_DELTA_DEPTH = 50;
+    constexpr size_t MIN_DELTA_SIZE = 64;
+    constexpr size_t MAX_DELTA_SIZE = 64 * 1024 * 1024;
+    constexpr size_t DELTA_BASE_CACHE_BYTES = 32 * 1024 * 1024;
+
+    inline unsigned char type_code(const std::string &type)
+    {
+        if (type == "commit")
+            return TYPE_COMMIT;
+        if (type == "tree")
+            return TYPE_TREE;
+        if (type == "blob")
+            return TYPE_BLOB;
+        throw std::runtime_error("Unknown object type: " + type);
+    }
+
+    inline std::string type_name(unsigned char code)
+    {
+        switch (code)
+        {
+        case TYPE_COMMIT:
+            return "commit";
+        case TYPE_TREE:
+            return "tree";
+        case TYPE_BLOB:
+            return "blob";
+        default:
+            throw std::runtime_error("Unknown pack object type: " + std::to_string(code));
+        }
+    }
+
+    namespace detail
+    {
+        // An inflated object that deltas were resolved against, by pack and offset
+        struct DeltaBase
+        {
+            std::string content;
+            unsigned char type;
+        };
+
+        struct BaseKey
+        {
+            std::uint64_t pack;
+            std::uint64_t offset;
+
+            bool operator==(const BaseKey &other) const { return pack == other.pack && offset == other.offset; }
+        };
+
+        struct BaseKeyHash
+        {
+            size_t operator()(const BaseKey &key) const
+            {
+                return std::hash<std::uint64_t>()(key.offset * 0x9E3779B97F4A7C15ull ^ key.pack);
+            }
+        };
+
+        using DeltaBaseCache = lru_cache::LruCache<BaseKey, DeltaBase, BaseKeyHash>;
+
+        // Objects in a delta chain share their bases, so each base is inflated once while it stays cached
+        inline DeltaBaseCache &delta_base_cache()
+        {
+            static DeltaBaseCache cache(DELTA_BASE_CACHE_BYTES);
+            return cache;
+        }
+
+        inline std::uint64_t next_pack_serial()
+        {
+            static std::atomic<std::uint64_t> serial{0};
+            return ++serial;
+        }
+    } // namespace detail
+
+    // Hit and miss counters of the delta base cache
+    inline lru_cache::Stats delta_base_cache_stats()
+    {
+        return detail::delta_base_cache().stats();
+    }
+
+    // A memory-mapped packfile and its index
+    class Pack
+    {
+    public:
+        explicit Pack(const std::string &idx_path)
+            : idx_(idx_path),
+              pack_(idx_path.substr(0, idx_path.size() - 4) + ".pack"),
+              name_(std::filesystem::path(idx_path).stem().string()),
+              oid_size_(hash_object::oid_size()),
+              serial_(detail::next_pack_serial())
+        {
+            if (!idx_.is_open() || !pack_.is_open())
+            {
+                throw std::runtime_error("Incomplete pack: " + idx_path);
+            }
+            if (idx_.size() < IDS_OFFSET + 2 * CHECKSUM_SIZE || std::memcmp(idx_.data(), IDX_SIGNATURE, 4) != 0 ||
+                pack_.size() < 12 + CHECKSUM_SIZE || std::memcmp(pack_.data(), PACK_SIGNATURE, 4) != 0)
+            {
+                throw std::runtime_error("Corrupt pack: " + idx_path);
+            }
+            count_ = binary_io::get_u32(idx_.data() + FANOUT_OFFSET + 255 * 4);
+            if (idx_.size() != IDS_OFFSET + count_ * (oid_size_ + 8) + 2 * CHECKSUM_SIZE)
+            {
+                throw std::runtime_error("Corrupt pack index: " + idx_path);
+            }
+        }
+
+        const std::string &name() const { return name_; }
+        std::uint32_t count() const { return count_; }
+        size_t pack_size() const { return pack_.size(); }
+        size_t oid_size() const { return oid_size_; }
+
+        const unsigned char *id_at(std::uint32_t position) const
+        {
+            return idx_.data() + IDS_OFFSET + static_cast<size_t>(position) * oid_size_;
+        }
+
+        std::uint64_t offset_at(std::uint32_t position) const
+        {
+            return binary_io::get_u64(idx_.data() + IDS_OFFSET + count_ * oid_size_ + static_cast<size_t>(position) * 8);
+        }
+
+        // Binary search for a raw object id, narrowed by the fan-out table
+        bool find(const unsigned char *oid, std::uint32_t &position) const
+        {
+            unsigned char first = oid[0];
+            std::uint32_t low = first == 0 ? 0 : binary_io::get_u32(idx_.data() + FANOUT_OFFSET + (first - 1) * 4);
+            std::uint32_t high = binary_io::get_u32(idx_.data() + FANOUT_OFFSET + first * 4);
+            while (low < high)
+            {
+                std::uint32_t mid = low + (high - low) / 2;
+                int cmp = std::memcmp(id_at(mid), oid, oid_size_);
+                if (cmp == 0)
+                {
+                    position = mid;
+                    return true;
+                }
+                if (cmp < 0)
+                {
+                    low = mid + 1;
+                }
+                else
+                {
+                    high = mid;
+                }
+            }
+            return false;
+        }
+
+        // Read the object stored at a pack offset, resolving delta chains
+        std::string read_at(std::uint64_t offset, unsigned char &type) const
+        {
+            const unsigned char *data = pack_.data();
+            size_t end = pack_.size() - CHECKSUM_SIZE;
+            size_t pos = static_cast<size_t>(offset);
+            if (pos >= end)
+            {
+                throw std::runtime_error("Pack offset out of range in " + name_);
+            }
+
+            unsigned char code = data[pos++];
+            std::uint64_t size = binary_io::get_varint(data, pos, end);
+
+            if (code == TYPE_OFS_DELTA)
+            {
+                std::uint64_t distance = binary_io::get_varint(data, pos, end);
+                if (distance == 0 || distance > offset)
+                {
+                    throw std::runtime_error("Invalid delta base in " + name_);
+                }
+                std::shared_ptr<const detail::DeltaBase> base = base_at(offset - distance);
+                type = base->type;
+                std::string delta_data = compression::inflate(reinterpret_cast<const char *>(data + pos), end - pos,
+                                                              static_cast<size_t>(size));
+                return delta::apply(base->content, delta_data);
+            }
+
+            type = code;
+            return compression::inflate(reinterpret_cast<const char *>(data + pos), end - pos,
+                                        static_cast<size_t>(size));
+        }
+
+        // Type and size of the object at a pack offset. A delta's size is read from the delta's own
+        // header, so only the delta is inflated, never its base.
+        void info_at(std::uint64_t offset, unsigned char &type, std::uint64_t &size) const
+        {
+            const unsigned char *data = pack_.data();
+            size_t end = pack_.size() - CHECKSUM_SIZE;
+            size_t pos = static_cast<size_t>(offset);
+            if (pos >= end)
+            {
+                throw std::runtime_error("Pack offset out of range in " + name_);
+            }
+
+            unsigned char code = data[pos++];
+            size = binary_io::get_varint(data, pos, end);
+            if (code != TYPE_OFS_DELTA)
+            {
+                type = code;
+                return;
+            }
+
+            std::uint64_t distance = binary_io::get_varint(data, pos, end);
+            if (distance == 0 || distance > offset)
+            {
+                throw std::runtime_error("Invalid delta base in " + name_);
+            }
+            std::uint64_t base_size;
+            info_at(offset - distance, type, base_size);
+            std::string delta_data = compression::inflate(reinterpret_cast<const char *>(data + pos), end - pos,
+                                                          static_cast<size_t>(size));
+            size_t header = 0;
+            binary_io::get_varint(reinterpret_cast<const unsigned char *>(delta_data.data()), header, delta_data.size());
+            size = binary_io::get_varint(reinterpret_cast<const unsigned char *>(delta_data.data()), header, delta_data.size());
+        }
+
+    private:
+        // A delta base, from the cache or inflated and cached now
+        std::shared_ptr<const detail::DeltaBase> base_at(std::uint64_t offset) const
+        {
+            detail::DeltaBaseCache &cache = detail::delta_base_cache();
+            detail::BaseKey key{serial_, offset};
+            if (auto cached = cache.get(key))
+            {
+                return cached;
+            }
+            auto base = std::make_shared<detail::DeltaBase>();
+            base->content = read_at(offset, base->type);
+            cache.put(key, base, base->content.size() + sizeof(detail::DeltaBase));
+            return base;
+        }
+
+        mapped_file::MappedFile idx_;
+        mapped_file::MappedFile pack_;
+        std::string name_;
+        size_t oid_size_;
+        std::uint64_t serial_; // distinguishes packs in the delta base cache, even at a reused address
+        std::uint32_t count_ = 0;
+    };
+
+    using PackList = std::vector<std::shared_ptr<const Pack>>;
+
+    namespace detail
+    {
+        struct Registry
+        {
+            std::mutex mutex;
+            std::shared_ptr<const PackList> packs;
+        };
+
+        inline Registry &registry()
+        {
+            static Registry instance;
+            return instance;
+        }
+
+        inline std::shared_ptr<const PackList> scan_packs()
+        {
+            auto packs = std::make_shared<PackList>();
+            std::error_code ec;
+            if (!std::filesystem::is_directory(PACK_DIR, ec))
+            {
+                return packs;
+            }
+            for (const auto &entry : std::filesystem::directory_iterator(PACK_DIR))
+            {
+                if (entry.path().extension() == ".idx")
+                {
+                    packs->push_back(std::make_shared<const Pack>(entry.path().string()));
+                }
+            }
+            return packs;
+        }
+    } // namespace detail
+
+    // Currently installed packs; loaded on first use
+    inline std::shared_ptr<const PackList> packs()
+    {
+        auto &reg = detail::registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (!reg.packs)
+        {
+            reg.packs = detail::scan_packs();
+        }
+        return reg.packs;
+    }
+
+    // Forget the mapped packs so the next lookup rescans the pack directory
+    inline void reload()
+    {
+        auto &reg = detail::registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.packs.reset();
+    }
+
+    // Check whether any pack contains the object
+    inline bool contains(const object_id::ObjectId &oid)
+    {
+        std::uint32_t position;
+        for (const auto &p : *packs())
+        {
+            if (p->find(oid.data(), position))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool contains(const std::string &hash)
+    {
+        object_id::ObjectId oid;
+        return object_id::ObjectId::parse(hash, oid) && oid.size == hash_object::oid_size() && contains(oid);
+    }
+
+    // Read an object from the packs; returns false if no pack contains it
+    inline bool read_object(const object_id::ObjectId &oid, std::string &content, std::string &type)
+    {
+        std::uint32_t position;
+        for (const auto &p : *packs())
+        {
+            if (p->find(oid.data(), position))
+            {
+                unsigned char code;
+                content = p->read_at(p->offset_at(position), code);
+                type = type_name(code);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool read_object(const std::string &hash, std::string &content, std::string &type)
+    {
+        object_id::ObjectId oid;
+        return object_id::ObjectId::parse(hash, oid) && oid.size == hash_object::oid_size() &&
+               read_object(oid, content, type);
+    }
+
+    // Type and size of a packed object without reconstructing it; returns false if no pack has it
+    inline bool object_info(const std::string &hash, std::string &type, std::uint64_t &size)
+    {
+        object_id::ObjectId oid;
+        if (!object_id::ObjectId::parse(hash, oid) || oid.size != hash_object::oid_size())
+        {
+            return false;
+        }
+        std::uint32_t position;
+        for (const auto &p : *packs())
+        {
+            if (p->find(oid.data(), position))
+            {
+                unsigned char code;
+                p->info_at(p->offset_at(position), code, size);
+                type = type_name(code);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Call `visit` with the hex id of every packed object
+    inline void for_each_object(const std::function<void(const std::string &)> &visit)
+    {
+        for (const auto &p : *packs())
+        {
+            for (std::uint32_t i = 0; i < p->count(); ++i)
+            {
+                visit(hash_object::to_hex(p->id_at(i), p->oid_size()));
+            }
+        }
+    }
+
+    // An object to be written into a new pack; its content is read only when it is written
+    struct PackInput
+    {
+        std::string id; // hex object id
+        std::string type;
+        std::uint64_t size = 0;
+        std::uint32_t name_hash = 0; // groups objects stored under similar paths
+    };
+
+    // Summary of a written pack
+    struct PackResult
+    {
+        std::string name;
+        size_t objects = 0;
+        size_t deltas = 0;
+        std::uint64_t pack_bytes = 0;
+    };
+
+    // Hash of the trailing characters of a path; objects with similar names sort together
+    inline std::uint32_t name_hash(const std::string &path)
+    {
+        std::uint32_t hash = 0;
+        for (unsigned char c : path)
+        {
+            if (std::isspace(c))
+            {
+                continue;
+            }
+            hash = (hash >> 2) + (static_cast<std::uint32_t>(c) << 24);
+        }
+        return hash;
+    }
+
+    // Write all objects into a single pack with delta compression and install it in PACK_DIR.
+    // `read` returns an object's content. The pack is streamed to disk as it is built, and only
+    // the objects in the delta window are held in memory, so memory use does not grow with the
+    // size of the repository.
+    inline PackResult write_pack(std::vector<PackInput> objects,
+                                 const std::function<std::string(const std::string &)> &read)
+    {
+        // Order so that similar objects are adjacent: type, then path hint, then largest first
+        std::sort(objects.begin(), objects.end(), [](const PackInput &a, const PackInput &b)
+                  {
+            if (a.type != b.type)
+                return a.type < b.type;
+            if (a.name_hash != b.name_hash)
+                return a.name_hash < b.name_hash;
+            if (a.size != b.size)
+                return a.size > b.size;
+            return a.id < b.id; });
+
+        struct Written
+        {
+            std::uint64_t offset = 0;
+            int depth = 0;
+        };
+        std::vector<Written> written(objects.size());
+        std::vector<std::string> window_content(objects.size());
+        std::vector<std::unique_ptr<delta::DeltaIndex>> window_index(objects.size());
+
+        std::filesystem::create_directories(PACK_DIR);
+        std::string temp_pack = PACK_DIR + "/tmp_pack_" + std::to_string(::getpid()) + "_" +
+                                std::to_string(detail::next_pack_serial());
+        std::ofstream file(temp_pack, std::ios::binary | std::ios::trunc);
+        hash_object::Hasher checksum(hash_object::Algorithm::Sha1);
+        std::uint64_t pack_size = 0;
+        auto emit = [&](const std::string &bytes)
+        {
+            file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            checksum.update(bytes);
+            pack_size += bytes.size();
+        };
+
+        PackResult result;
+        result.objects = objects.size();
+        unsigned char pack_checksum[hash_object::MAX_OID_SIZE];
+        try
+        {
+            std::string header;
+            header.append(PACK_SIGNATURE, 4);
+            binary_io::put_u32(header, PACK_VERSION);
+            binary_io::put_u32(header, static_cast<std::uint32_t>(objects.size()));
+            emit(header);
+
+            std::string candidate;
+            std::string best;
+            for (size_t i = 0; i < objects.size(); ++i)
+            {
+                const auto &object = objects[i];
+                std::string &content = window_content[i];
+                content = read(object.id);
+                if (content.size() != object.size)
+                {
+                    throw std::runtime_error("Object " + object.id + " changed size while packing");
+                }
+                size_t best_base = SIZE_MAX;
+                best.clear();
+
+                // Try the previous objects in the window as delta bases and keep the smallest delta
+                bool deltable = object.type != "commit" && content.size() >= MIN_DELTA_SIZE &&
+                                content.size() <= MAX_DELTA_SIZE;
+                if (deltable)
+                {
+                    size_t limit = content.size() / 2;
+                    for (size_t back = 1; back <= DELTA_WINDOW && back <= i; ++back)
+                    {
+                        size_t base = i - back;
+                        if (objects[base].type != object.type || written[base].depth >= MAX_DELTA_DEPTH ||
+                            objects[base].size < MIN_DELTA_SIZE || objects[base].size > MAX_DELTA_SIZE)
+                        {
+                            continue;
+                        }
+                        if (!window_index[base])
+                        {
+                            window_index[base] = std::make_unique<delta::DeltaIndex>(window_content[base]);
+                        }
+                        size_t max_size = best_base == SIZE_MAX ? limit : best.size() - 1;
+                        if (delta::create(*window_index[base], content, candidate, max_size))
+                        {
+                            best_base = base;
+                            best.swap(candidate);
+                        }
+                    }
+                }
+                // Objects that dropped out of the window are no longer needed
+                if (i >= DELTA_WINDOW)
+                {
+                    window_index[i - DELTA_WINDOW].reset();
+                    std::string().swap(window_content[i - DELTA_WINDOW]);
+                }
+
+                written[i].offset = pack_size;
+                std::string entry;
+                if (best_base != SIZE_MAX)
+                {
+                    entry.push_back(static_cast<char>(TYPE_OFS_DELTA));
+                    binary_io::put_varint(entry, best.size());
+                    binary_io::put_varint(entry, written[i].offset - written[best_base].offset);
+                    emit(entry);
+                    emit(compression::deflate(best));
+                    written[i].depth = written[best_base].depth + 1;
+                    ++result.deltas;
+                }
+                else
+                {
+                    entry.push_back(static_cast<char>(type_code(object.type)));
+                    binary_io::put_varint(entry, content.size());
+                    emit(entry);
+                    emit(compression::deflate(content));
+                }
+            }
+
+            checksum.digest(pack_checksum);
+            file.write(reinterpret_cast<const char *>(pack_checksum), SHA_DIGEST_LENGTH);
+            file.close();
+            if (!file)
+            {
+                throw std::runtime_error("Failed to write " + temp_pack);
+            }
+        }
+        catch (...)
+        {
+            file.close();
+            std::error_code ec;
+            std::filesystem::remove(temp_pack, ec);
+            throw;
+        }
+        window_index.clear();
+        window_content.clear();
+
+        // Build the index: ids sorted bytewise with their pack offsets
+        const size_t oid_size = hash_object::oid_size();
+        std::vector<std::pair<object_id::ObjectId, std::uint64_t>> sorted;
+        sorted.reserve(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            object_id::ObjectId oid;
+            if (!object_id::ObjectId::parse(objects[i].id, oid) || oid.size != oid_size)
+            {
+                throw std::runtime_error("Invalid object id: " + objects[i].id);
+            }
+            sorted.emplace_back(oid, written[i].offset);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end(), [](const auto &a, const auto &b)
+                                 { return a.first == b.first; }),
+                     sorted.end());
+
+        std::string idx;
+        idx.append(IDX_SIGNATURE, 4);
+        binary_io::put_u32(idx, PACK_VERSION);
+        std::uint32_t fanout[256] = {};
+        for (const auto &[raw, offset] : sorted)
+        {
+            ++fanout[raw.bytes[0]];
+        }
+        std::uint32_t running = 0;
+        for (int i = 0; i < 256; ++i)
+        {
+            running += fanout[i];
+            binary_io::put_u32(idx, running);
+        }
+        for (const auto &[raw, offset] : sorted)
+        {
+            idx.append(reinterpret_cast<const char *>(raw.data()), raw.size);
+        }
+        for (const auto &[raw, offset] : sorted)
+        {
+            binary_io::put_u64(idx, offset);
+        }
+        idx.append(reinterpret_cast<const char *>(pack_checksum), SHA_DIGEST_LENGTH);
+        unsigned char idx_checksum[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char *>(idx.data()), idx.size(), idx_checksum);
+        idx.append(reinterpret_cast<const char *>(idx_checksum), SHA_DIGEST_LENGTH);
+
+        // Install the pack before its index so readers never see an index without data
+        result.name = "pack-" + hash_object::to_hex(pack_checksum, SHA_DIGEST_LENGTH);
+        std::string base_path = PACK_DIR + "/" + result.name;
+        std::filesystem::rename(temp_pack, base_path + ".pack");
+        std::string temp_idx = base_path + ".idx.tmp";
+        {
+            std::ofstream idx_file(temp_idx, std::ios::binary | std::ios::trunc);
+            idx_file.write(idx.data(), static_cast<std::streamsize>(idx.size()));
+            if (!idx_file)
+            {
+                throw std::runtime_error("Failed to write " + temp_idx);
+            }
+        }
+        std::filesystem::rename(temp_idx, base_path + ".idx");
+
+        result.pack_bytes = pack_size + SHA_DIGEST_LENGTH;
+        reload();
+        return result;
+    }
+} // namespace pack
+
+#endif // PACK_HPP
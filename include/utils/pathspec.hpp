@@ -0,0 +1,117 @@
+#ifndef PATHSPEC_HPP
+#define PATHSPEC_HPP
+
+#include <string>
+
+namespace pathspec
+{
+    // True if the pathspec contains glob characters
+    inline bool has_wildcards(const std::string &pattern)
+    {
+        return pattern.find_first_of("*?[") != std::string::npos;
+    }
+
+    // Match a repository-relative path against a glob pattern.
+    // `*` and `?` do not cross directory separators, `**` matches any number of directories
+    // and `[abc]` matches a character class.
+    inline bool match(const char *pattern, const char *path)
+    {
+        while (*pattern)
+        {
+            if (pattern[0] == '*' && pattern[1] == '*')
+            {
+                pattern += 2;
+                if (*pattern == '/')
+                {
+                    ++pattern;
+                }
+                for (const char *p = path;; ++p)
+                {
+                    if ((p == path || p[-1] == '/') && match(pattern, p))
+                    {
+                        return true;
+                    }
+                    if (!*p)
+                    {
+                        return !*pattern;
+                    }
+                }
+            }
+            if (*pattern == '*')
+            {
+                ++pattern;
+                for (const char *p = path;; ++p)
+                {
+                    if (match(pattern, p))
+                    {
+                        return true;
+                    }
+                    if (!*p || *p == '/')
+                    {
+                        return false;
+                    }
+                }
+            }
+            if (!*path)
+            {
+                return false;
+            }
+            if (*pattern == '?')
+            {
+                if (*path == '/')
+                {
+                    return false;
+                }
+            }
+            else if (*pattern == '[')
+            {
+                const char *p = pattern + 1;
+                bool negate = (*p == '!' || *p == '^');
+                if (negate)
+                {
+                    ++p;
+                }
+                bool matched = false;
+                for (; *p && *p != ']'; ++p)
+                {
+                    if (p[1] == '-' && p[2] && p[2] != ']')
+                    {
+                        matched |= (*path >= p[0] && *path <= p[2]);
+                        p += 2;
+                    }
+                    else
+                    {
+                        matched |= (*path == *p);
+                    }
+                }
+                if (!*p || matched == negate)
+                {
+                    return false;
+                }
+                pattern = p;
+            }
+            else if (*pattern != *path)
+            {
+                return false;
+            }
+            ++pattern;
+            ++path;
+        }
+        return !*path;
+    }
+
+    inline bool match(const std::string &pattern, const std::string &path)
+    {
+        return match(pattern.c_str(), path.c_str());
+    }
+
+    // Directory to start walking from: the longest leading part of the pattern without wildcards
+    inline std::string walk_root(const std::string &pattern)
+    {
+        size_t wildcard = pattern.find_first_of("*?[");
+        size_t slash = pattern.rfind('/', wildcard);
+        return slash == std::string::npos ? "." : pattern.substr(0, slash);
+    }
+} // namespace pathspec
+
+#endif // PATHSPEC_HPP
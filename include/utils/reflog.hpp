@@ -0,0 +1,522 @@
+#ifndef REFLOG_HPP
+#define REFLOG_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "binary_io.hpp"
+#include "constants.hpp"
+#include "lock_file.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+// Reflogs: where each ref pointed over time. Every ref change appends one line,
+// "<old id> <new id> <unix time>\t<message>", to .kit/logs/<ref>, and one fixed-size record,
+// the line's offset and time, to .kit/logs/index/<ref>. Appends never rewrite either file.
+// `ref@{n}` reads the n-th record from the end of the index, and `ref@{time}` binary-searches it
+// by time, so neither lookup reads the log beyond the one line it needs.
+//
+// Appends, rewrites and index repairs all hold the log's `.lock`, so records are never
+// duplicated or written for a stale offset. The index starts with a header naming the inode of
+// the log it describes; a rewrite replaces the log with a new file, so an index left from before
+// a crash between the two renames no longer matches and is rebuilt.
+namespace reflog
+{
+    const std::string LOGS_DIR = KIT_DIR + "/logs";
+    const std::string INDEX_DIR = LOGS_DIR + "/index";
+    constexpr size_t RECORD_SIZE = 16; // u64 line offset, u64 unix time
+    const std::string INDEX_SIGNATURE = "KITRLOG1"; // index header: signature, u64 log inode
+    constexpr int LOCK_TIMEOUT_MS = 2000;
+    constexpr std::int64_t DEFAULT_EXPIRE_DAYS = 90;
+
+    struct Entry
+    {
+        std::string old_id; // empty when the ref was created
+        std::string new_id;
+        std::int64_t timestamp = 0;
+        std::string message;
+    };
+
+    inline std::string log_path(const std::string &ref)
+    {
+        return LOGS_DIR + "/" + ref;
+    }
+
+    inline std::string index_path(const std::string &ref)
+    {
+        return INDEX_DIR + "/" + ref;
+    }
+
+    namespace detail
+    {
+        inline void append_to(const std::string &path, const std::string &data)
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd < 0)
+            {
+                throw std::runtime_error("Failed to open reflog '" + path + "': " + std::strerror(errno));
+            }
+            // O_APPEND writes of one small record land whole, even with concurrent appenders
+            ssize_t n = ::write(fd, data.data(), data.size());
+            ::close(fd);
+            if (n != static_cast<ssize_t>(data.size()))
+            {
+                throw std::runtime_error("Failed to append to reflog '" + path + "'");
+            }
+        }
+
+        inline std::string record(std::uint64_t offset, std::int64_t timestamp)
+        {
+            std::string out;
+            binary_io::put_u64(out, offset);
+            binary_io::put_u64(out, static_cast<std::uint64_t>(timestamp));
+            return out;
+        }
+
+        inline std::string header(std::uint64_t log_inode)
+        {
+            std::string out = INDEX_SIGNATURE;
+            binary_io::put_u64(out, log_inode);
+            return out;
+        }
+
+        inline std::uint64_t inode(const std::string &path)
+        {
+            struct stat st;
+            return ::stat(path.c_str(), &st) == 0 ? static_cast<std::uint64_t>(st.st_ino) : 0;
+        }
+
+        inline bool parse_line(const char *line, const char *end, Entry &entry)
+        {
+            const char *tab = static_cast<const char *>(std::memchr(line, '\t', end - line));
+            if (!tab)
+            {
+                return false;
+            }
+            std::string head(line, tab);
+            size_t first = head.find(' ');
+            size_t second = first == std::string::npos ? first : head.find(' ', first + 1);
+            if (second == std::string::npos)
+            {
+                return false;
+            }
+            entry.old_id = head.substr(0, first);
+            entry.new_id = head.substr(first + 1, second - first - 1);
+            entry.timestamp = std::strtoll(head.c_str() + second + 1, nullptr, 10);
+            entry.message.assign(tab + 1, end);
+            if (entry.old_id.find_first_not_of('0') == std::string::npos)
+            {
+                entry.old_id.clear();
+            }
+            return true;
+        }
+
+        // Offset and time of every line in `data` from `offset` on
+        inline std::string index_lines(const char *data, size_t size, size_t offset)
+        {
+            std::string records;
+            while (offset < size)
+            {
+                const char *line = data + offset;
+                const char *newline = static_cast<const char *>(std::memchr(line, '\n', size - offset));
+                if (!newline)
+                {
+                    break; // a torn last line is indexed once it is complete
+                }
+                Entry entry;
+                if (parse_line(line, newline, entry))
+                {
+                    records += record(offset, entry.timestamp);
+                }
+                offset = static_cast<size_t>(newline - data) + 1;
+            }
+            return records;
+        }
+
+        // The log and its index, mapped. The index is brought up to date first if an append was
+        // interrupted between the two files or the log was rewritten behind it. The repair is
+        // written back under the log's lock; while another process holds it, the repaired records
+        // are only kept in memory.
+        class Log
+        {
+        public:
+            explicit Log(const std::string &ref) : ref_(ref)
+            {
+                map();
+                if (!log_->is_open() || indexed_end() == log_->size())
+                {
+                    return;
+                }
+
+                trace::Span span("reflog.reindex");
+                std::unique_ptr<lock_file::LockFile> lock;
+                try
+                {
+                    lock = std::make_unique<lock_file::LockFile>(log_path(ref_));
+                }
+                catch (const std::exception &)
+                {
+                    repaired_ = reindex();
+                    records_ = reinterpret_cast<const unsigned char *>(repaired_.data());
+                    records_size_ = repaired_.size();
+                    return;
+                }
+                map(); // the files may have changed before the lock was taken
+                if (log_->is_open() && indexed_end() != log_->size())
+                {
+                    lock_file::LockFile index_lock(index_path(ref_));
+                    index_lock.write(reindex());
+                    index_lock.commit();
+                    map();
+                }
+            }
+            size_t count() const
+            {
+                return log_->is_open() && records_size_ > RECORD_SIZE ? records_size_ / RECORD_SIZE - 1 : 0;
+            }
+
+            std::uint64_t offset(size_t i) const
+            {
+                return binary_io::get_u64(records_ + (i + 1) * RECORD_SIZE);
+            }
+
+            std::int64_t timestamp(size_t i) const
+            {
+                return static_cast<std::int64_t>(binary_io::get_u64(records_ + (i + 1) * RECORD_SIZE + 8));
+            }
+
+            // Entry `i`, counting from the oldest
+            Entry entry(size_t i) const
+            {
+                Entry result;
+                std::uint64_t start = offset(i);
+                if (start < log_->size())
+                {
+                    const char *line = data() + start;
+                    const char *newline = static_cast<const char *>(std::memchr(line, '\n', log_->size() - start));
+                    parse_line(line, newline ? newline : data() + log_->size(), result);
+                }
+                return result;
+            }
+
+        private:
+            const char *data() const
+            {
+                return reinterpret_cast<const char *>(log_->data());
+            }
+
+            void map()
+            {
+                log_ = std::make_unique<mapped_file::MappedFile>(log_path(ref_));
+                index_ = std::make_unique<mapped_file::MappedFile>(index_path(ref_));
+                records_ = index_->data();
+                records_size_ = index_->size();
+            }
+
+            // Where the indexed part of the log ends, or SIZE_MAX when the index does not describe
+            // this log: a bad header, a torn record, or a last record that does not start a line
+            // at its time, after the one before it
+            size_t indexed_end() const
+            {
+                if (records_size_ < RECORD_SIZE || records_size_ % RECORD_SIZE != 0 ||
+                    std::memcmp(records_, INDEX_SIGNATURE.data(), INDEX_SIGNATURE.size()) != 0 ||
+                    binary_io::get_u64(records_ + INDEX_SIGNATURE.size()) != log_->inode())
+                {
+                    return SIZE_MAX;
+                }
+                size_t n = count();
+                if (n == 0)
+                {
+                    return 0;
+                }
+                std::uint64_t last = offset(n - 1);
+                if (last >= log_->size() || (last > 0 && data()[last - 1] != '\n') || (n > 1 && offset(n - 2) >= last))
+                {
+                    return SIZE_MAX;
+                }
+                const char *line = data() + last;
+                const char *newline = static_cast<const char *>(std::memchr(line, '\n', log_->size() - last));
+                Entry entry;
+                if (!newline || !parse_line(line, newline, entry) || entry.timestamp != timestamp(n - 1))
+                {
+                    return SIZE_MAX;
+                }
+                return static_cast<size_t>(newline - data()) + 1;
+            }
+
+            // The index with records for every line it is missing, or rebuilt when it is invalid
+            std::string reindex() const
+            {
+                size_t end = indexed_end();
+                if (end == SIZE_MAX)
+                {
+                    return header(log_->inode()) + index_lines(data(), log_->size(), 0);
+                }
+                return std::string(reinterpret_cast<const char *>(records_), records_size_) +
+                       index_lines(data(), log_->size(), end);
+            }
+
+            std::string ref_;
+            std::unique_ptr<mapped_file::MappedFile> log_;
+            std::unique_ptr<mapped_file::MappedFile> index_;
+            std::string repaired_;
+            const unsigned char *records_ = nullptr;
+            size_t records_size_ = 0;
+        };
+    } // namespace detail
+
+    // Parse a point in time relative to `now`: "now", "yesterday", "<n>.<unit>.ago" or
+    // "<n> <unit> ago" (seconds up to years), "YYYY-MM-DD" or "YYYY-MM-DD HH:MM:SS" in UTC,
+    // or "@<unix time>"
+    inline bool parse_time(const std::string &text, std::int64_t now, std::int64_t &timestamp)
+    {
+        if (text == "now")
+        {
+            timestamp = now;
+            return true;
+        }
+        if (text == "yesterday")
+        {
+            timestamp = now - 86400;
+            return true;
+        }
+        if (text.size() > 1 && text[0] == '@' && text.find_first_not_of("0123456789", 1) == std::string::npos)
+        {
+            timestamp = std::strtoll(text.c_str() + 1, nullptr, 10);
+            return true;
+        }
+
+        std::string words = text;
+        std::replace(words.begin(), words.end(), '.', ' ');
+        char unit[16] = {};
+        char ago[8] = {};
+        long long amount = 0;
+        if (std::sscanf(words.c_str(), "%lld %15s %7s", &amount, unit, ago) == 3 && std::strcmp(ago, "ago") == 0)
+        {
+            static const std::pair<const char *, std::int64_t> units[] = {
+                {"second", 1}, {"minute", 60}, {"hour", 3600}, {"day", 86400},
+                {"week", 604800}, {"month", 2592000}, {"year", 31536000}};
+            std::string name = unit;
+            if (name.size() > 1 && name.back() == 's')
+            {
+                name.pop_back();
+            }
+            for (const auto &[unit_name, seconds] : units)
+            {
+                if (name == unit_name)
+                {
+                    timestamp = now - amount * seconds;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::tm utc{};
+        int matched = std::sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &utc.tm_year, &utc.tm_mon, &utc.tm_mday,
+                                  &utc.tm_hour, &utc.tm_min, &utc.tm_sec);
+        if (matched == 3 || matched == 6)
+        {
+            utc.tm_year -= 1900;
+            utc.tm_mon -= 1;
+            timestamp = static_cast<std::int64_t>(timegm(&utc));
+            return true;
+        }
+        return false;
+    }
+
+    // Record that `ref` moved from `old_id` to `new_id`
+    inline void append(const std::string &ref, const std::string &old_id, const std::string &new_id,
+                       const std::string &message, std::int64_t timestamp = static_cast<std::int64_t>(std::time(nullptr)))
+    {
+        std::string text = message;
+        std::replace(text.begin(), text.end(), '\n', ' ');
+        std::string line = (old_id.empty() ? std::string(new_id.size(), '0') : old_id) + " " + new_id + " " +
+                           std::to_string(timestamp) + "\t" + text + "\n";
+
+        // Under the log's lock the new line starts where the log ends now. An index is only started
+        // along with a new log; one that is missing later is rebuilt by the next lookup.
+        lock_file::LockFile lock(log_path(ref), LOCK_TIMEOUT_MS);
+        std::error_code ec;
+        std::uint64_t offset = std::filesystem::file_size(log_path(ref), ec);
+        if (ec)
+        {
+            offset = 0;
+        }
+        detail::append_to(log_path(ref), line);
+        std::string records;
+        if (!std::filesystem::exists(index_path(ref), ec))
+        {
+            if (offset > 0)
+            {
+                return;
+            }
+            records = detail::header(detail::inode(log_path(ref)));
+        }
+        detail::append_to(index_path(ref), records + detail::record(offset, timestamp));
+    }
+
+    inline size_t count(const std::string &ref)
+    {
+        return detail::Log(ref).count();
+    }
+
+    // The n-th most recent entry: 0 is the latest change, 1 the one before it
+    inline bool nth(const std::string &ref, size_t n, Entry &entry)
+    {
+        detail::Log log(ref);
+        if (n >= log.count())
+        {
+            return false;
+        }
+        entry = log.entry(log.count() - 1 - n);
+        return true;
+    }
+
+    // The latest entry recorded at or before `timestamp`
+    inline bool at_time(const std::string &ref, std::int64_t timestamp, Entry &entry)
+    {
+        detail::Log log(ref);
+        size_t low = 0;
+        size_t high = log.count();
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            if (log.timestamp(mid) <= timestamp)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        if (low == 0)
+        {
+            return false;
+        }
+        entry = log.entry(low - 1);
+        return true;
+    }
+
+    // Every entry, newest first
+    inline std::vector<Entry> read(const std::string &ref)
+    {
+        detail::Log log(ref);
+        std::vector<Entry> entries;
+        entries.reserve(log.count());
+        for (size_t i = log.count(); i-- > 0;)
+        {
+            entries.push_back(log.entry(i));
+        }
+        return entries;
+    }
+
+    // Names of all refs with a reflog
+    inline std::vector<std::string> list()
+    {
+        std::vector<std::string> refs;
+        std::error_code ec;
+        if (!std::filesystem::is_directory(LOGS_DIR, ec))
+        {
+            return refs;
+        }
+        for (auto it = std::filesystem::recursive_directory_iterator(LOGS_DIR, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            if (it->path() == INDEX_DIR)
+            {
+                it.disable_recursion_pending();
+                continue;
+            }
+            if (it->is_regular_file(ec) && it->path().extension() != ".lock")
+            {
+                refs.push_back(it->path().lexically_relative(LOGS_DIR).generic_string());
+            }
+        }
+        std::sort(refs.begin(), refs.end());
+        return refs;
+    }
+
+    inline void remove(const std::string &ref)
+    {
+        lock_file::LockFile lock(log_path(ref), LOCK_TIMEOUT_MS);
+        std::error_code ec;
+        std::filesystem::remove(log_path(ref), ec);
+        std::filesystem::remove(index_path(ref), ec);
+    }
+
+    namespace detail
+    {
+        // Replace the log and its index with `entries` (newest first), through the log's lock
+        inline void rewrite(lock_file::LockFile &log_lock, const std::string &ref, const std::vector<Entry> &entries)
+        {
+            std::string log;
+            std::string index;
+            for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+            {
+                index += record(log.size(), it->timestamp);
+                log += (it->old_id.empty() ? std::string(it->new_id.size(), '0') : it->old_id) + " " + it->new_id +
+                       " " + std::to_string(it->timestamp) + "\t" + it->message + "\n";
+            }
+            // The index names the new log's inode, so until the log is renamed in too, the two files
+            // do not match and a lookup rebuilds the index from whichever log it finds
+            log_lock.write(log);
+            lock_file::LockFile index_lock(index_path(ref));
+            index_lock.write(header(inode(log_lock.lock_path())) + index);
+            index_lock.commit();
+            log_lock.commit();
+        }
+    } // namespace detail
+
+    // Drop entries older than `cutoff` by rewriting the log and its index. The log's lock is held
+    // from reading to rewriting, so no append is lost. Returns the number of entries removed.
+    inline size_t expire(const std::string &ref, std::int64_t cutoff)
+    {
+        trace::Span span("reflog.expire");
+        lock_file::LockFile lock(log_path(ref), LOCK_TIMEOUT_MS);
+        std::vector<Entry> entries = read(ref);
+        size_t before = entries.size();
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [cutoff](const Entry &entry)
+                                     { return entry.timestamp < cutoff; }),
+                      entries.end());
+        if (entries.size() == before)
+        {
+            return 0;
+        }
+        detail::rewrite(lock, ref, entries);
+        return before - entries.size();
+    }
+
+    // Remove the n-th newest entry, as `ref@{n}` counts, holding the log's lock across the
+    // rewrite. Returns false when there is no such entry.
+    inline bool drop(const std::string &ref, size_t n)
+    {
+        lock_file::LockFile lock(log_path(ref), LOCK_TIMEOUT_MS);
+        std::vector<Entry> entries = read(ref);
+        if (n >= entries.size())
+        {
+            return false;
+        }
+        entries.erase(entries.begin() + static_cast<std::ptrdiff_t>(n));
+        detail::rewrite(lock, ref, entries);
+        return true;
+    }
+} // namespace reflog
+
+#endif // REFLOG_HPP
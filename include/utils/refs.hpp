@@ -0,0 +1,687 @@
+#ifndef REFS_HPP
+#define REFS_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "constants.hpp"
+#include "lock_file.hpp"
+#include "mapped_file.hpp"
+#include "reflog.hpp"
+#include "trace.hpp"
+
+// References: HEAD and the names under refs/. A ref is read from its loose file first and then
+// from packed-refs, a sorted "<id> <name>" file that is memory-mapped and binary-searched, so
+// repositories with many branches pay one lookup instead of one file per branch. Every change goes
+// through a Transaction: each ref is locked with an exclusive `<ref>.lock`, its old value is
+// checked, the new value is written and fsynced, and only when every lock is held and every check
+// passed are the lock files renamed into place. Each change is also appended to the reflog of the
+// ref, and of HEAD when it moves the checked-out branch.
+namespace refs
+{
+    const std::string HEAD = "HEAD";
+    const std::string HEADS_PREFIX = "refs/heads/";
+    const std::string STASH = "refs/stash"; // newest stash; older ones live in its reflog
+    const std::string SYMREF_PREFIX = "ref: ";
+    const std::string PACKED_HEADER = "# pack-refs with: sorted";
+    constexpr int MAX_SYMREF_DEPTH = 5;
+
+    // A ref and its raw value: an object id, or "ref: <name>" for a symbolic ref
+    struct Ref
+    {
+        std::string name;
+        std::string value;
+    };
+
+    // HEAD, or a name under refs/ without empty or dot components, ".lock" suffixes or characters
+    // that are unsafe in paths
+    inline bool is_valid_name(const std::string &name)
+    {
+        if (name == HEAD)
+        {
+            return true;
+        }
+        if (name.rfind("refs/", 0) != 0 || name.back() == '/' || name.find("//") != std::string::npos ||
+            name.find("..") != std::string::npos || name.find("/.") != std::string::npos)
+        {
+            return false;
+        }
+        if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".lock") == 0)
+        {
+            return false;
+        }
+        for (char c : name)
+        {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (u < 0x20 || u == 0x7f || std::strchr(" ~^:?*[\\", c))
+            {
+                return false;
+            }
+        }
+        return name.find(".lock/") == std::string::npos;
+    }
+
+    namespace detail
+    {
+        inline std::string loose_path(const std::string &name)
+        {
+            return KIT_DIR + "/" + name;
+        }
+
+        inline std::string trim(std::string value)
+        {
+            while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+            {
+                value.pop_back();
+            }
+            return value;
+        }
+
+        inline bool read_loose(const std::string &name, std::string &value)
+        {
+            std::error_code ec;
+            std::string path = loose_path(name);
+            if (!std::filesystem::is_regular_file(path, ec) || !mapped_file::read_all(path, value))
+            {
+                return false;
+            }
+            value = trim(value.substr(0, value.find('\n')));
+            return true;
+        }
+
+        // A mapped packed-refs file: the header line followed by "<id> <name>" lines sorted by name
+        class PackedRefs
+        {
+        public:
+            explicit PackedRefs(const std::string &path = PACKED_REFS_FILE) : file_(path)
+            {
+                const char *data = reinterpret_cast<const char *>(file_.data());
+                const char *end = data + file_.size();
+                if (data && end - data > 0 && *data == '#')
+                {
+                    const char *newline = static_cast<const char *>(std::memchr(data, '\n', end - data));
+                    data = newline ? newline + 1 : end;
+                }
+                begin_ = data;
+                end_ = end;
+            }
+
+            // Binary search by name: jump to the middle byte, back up to its line start, compare
+            bool find(const std::string &name, std::string &value) const
+            {
+                const char *low = begin_;
+                const char *high = end_;
+                while (low < high)
+                {
+                    const char *line = line_start(low + (high - low) / 2, low);
+                    const char *next = line_end(line);
+                    std::string line_name;
+                    std::string line_value;
+                    parse(line, next, line_value, line_name);
+                    int order = line_name.compare(name);
+                    if (order == 0)
+                    {
+                        value = line_value;
+                        return true;
+                    }
+                    if (order < 0)
+                    {
+                        low = next < end_ ? next + 1 : end_;
+                    }
+                    else
+                    {
+                        high = line;
+                    }
+                }
+                return false;
+            }
+
+            // Every ref whose name starts with `prefix`, in name order
+            std::vector<Ref> list(const std::string &prefix) const
+            {
+                const char *low = begin_;
+                const char *high = end_;
+                while (low < high)
+                {
+                    const char *line = line_start(low + (high - low) / 2, low);
+                    const char *next = line_end(line);
+                    Ref ref;
+                    parse(line, next, ref.value, ref.name);
+                    if (ref.name < prefix)
+                    {
+                        low = next < end_ ? next + 1 : end_;
+                    }
+                    else
+                    {
+                        high = line;
+                    }
+                }
+
+                std::vector<Ref> refs;
+                for (const char *line = low; line < end_;)
+                {
+                    const char *next = line_end(line);
+                    Ref ref;
+                    parse(line, next, ref.value, ref.name);
+                    if (ref.name.compare(0, prefix.size(), prefix) != 0)
+                    {
+                        break;
+                    }
+                    if (!ref.name.empty())
+                    {
+                        refs.push_back(std::move(ref));
+                    }
+                    line = next < end_ ? next + 1 : end_;
+                }
+                return refs;
+            }
+
+        private:
+            const char *line_start(const char *p, const char *low) const
+            {
+                while (p > low && p[-1] != '\n')
+                {
+                    --p;
+                }
+                return p;
+            }
+
+            const char *line_end(const char *line) const
+            {
+                const char *newline = static_cast<const char *>(std::memchr(line, '\n', end_ - line));
+                return newline ? newline : end_;
+            }
+
+            static void parse(const char *line, const char *end, std::string &value, std::string &name)
+            {
+                const char *space = static_cast<const char *>(std::memchr(line, ' ', end - line));
+                if (!space)
+                {
+                    value.clear();
+                    name.clear();
+                    return;
+                }
+                value.assign(line, space);
+                name.assign(space + 1, end);
+            }
+
+            mapped_file::MappedFile file_;
+            const char *begin_ = nullptr;
+            const char *end_ = nullptr;
+        };
+
+        // Loose refs under `prefix`, read from the files below .kit/<prefix>
+        inline void list_loose(const std::string &prefix, std::map<std::string, std::string> &refs)
+        {
+            std::string directory = prefix.substr(0, prefix.rfind('/'));
+            std::filesystem::path base = loose_path(directory);
+            std::error_code ec;
+            if (directory.empty() || !std::filesystem::is_directory(base, ec))
+            {
+                return;
+            }
+            for (auto it = std::filesystem::recursive_directory_iterator(base, ec);
+                 !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+            {
+                if (!it->is_regular_file(ec) || it->path().extension() == ".lock")
+                {
+                    continue;
+                }
+                std::string name = directory + "/" + it->path().lexically_relative(base).generic_string();
+                std::string value;
+                if (name.compare(0, prefix.size(), prefix) == 0 && read_loose(name, value))
+                {
+                    refs[name] = value;
+                }
+            }
+        }
+
+        inline std::string serialize_packed(const std::map<std::string, std::string> &refs)
+        {
+            std::string out = PACKED_HEADER + "\n";
+            for (const auto &[name, value] : refs)
+            {
+                out += value + " " + name + "\n";
+            }
+            return out;
+        }
+
+        using LockFile = lock_file::LockFile;
+
+        // The exact content of a file, or nullopt when it does not exist
+        inline std::optional<std::string> snapshot(const std::string &path)
+        {
+            std::error_code ec;
+            std::string content;
+            if (!std::filesystem::is_regular_file(path, ec) || !mapped_file::read_all(path, content))
+            {
+                return std::nullopt;
+            }
+            return content;
+        }
+
+        // Put back a file that a failed transaction already replaced or deleted. The rename released
+        // its lock, so this is best effort: if another writer holds the lock now, its change stands.
+        inline void restore(const std::string &path, const std::optional<std::string> &content)
+        {
+            try
+            {
+                LockFile lock(path);
+                if (content)
+                {
+                    lock.write(*content);
+                    lock.commit();
+                }
+                else
+                {
+                    lock.remove();
+                }
+            }
+            catch (const std::exception &)
+            {
+            }
+        }
+
+        // Remove directories under refs/heads/ left empty by deleted or packed refs
+        inline void prune_empty_parents(const std::string &name)
+        {
+            std::filesystem::path dir = std::filesystem::path(loose_path(name)).parent_path();
+            std::filesystem::path stop = loose_path("refs/heads");
+            std::error_code ec;
+            while (dir != stop && dir.string().size() > stop.string().size() && std::filesystem::is_empty(dir, ec) && !ec)
+            {
+                std::filesystem::remove(dir, ec);
+                dir = dir.parent_path();
+            }
+        }
+    } // namespace detail
+
+    // Read the raw value of `name`, from its loose file or else from packed-refs
+    inline bool read(const std::string &name, std::string &value)
+    {
+        if (detail::read_loose(name, value))
+        {
+            return true;
+        }
+        return name != HEAD && detail::PackedRefs().find(name, value);
+    }
+
+    // Follow symbolic refs to an object id; empty if the ref or its target does not exist
+    inline std::string resolve(const std::string &name)
+    {
+        std::string current = name;
+        for (int depth = 0; depth <= MAX_SYMREF_DEPTH; ++depth)
+        {
+            std::string value;
+            if (!read(current, value))
+            {
+                return "";
+            }
+            if (value.rfind(SYMREF_PREFIX, 0) != 0)
+            {
+                return value;
+            }
+            current = value.substr(SYMREF_PREFIX.size());
+        }
+        throw std::runtime_error("Too many levels of symbolic refs at " + name);
+    }
+
+    inline bool exists(const std::string &name)
+    {
+        std::string value;
+        return read(name, value);
+    }
+
+    // Refs whose names start with `prefix` (e.g. "refs/heads/"), loose and packed, in name order.
+    // A loose ref overrides a packed one of the same name.
+    inline std::vector<Ref> list(const std::string &prefix)
+    {
+        std::map<std::string, std::string> merged;
+        for (auto &ref : detail::PackedRefs().list(prefix))
+        {
+            merged[ref.name] = std::move(ref.value);
+        }
+        detail::list_loose(prefix, merged);
+
+        std::vector<Ref> refs;
+        refs.reserve(merged.size());
+        for (auto &[name, value] : merged)
+        {
+            refs.push_back({name, std::move(value)});
+        }
+        return refs;
+    }
+
+    // The branch HEAD points at ("refs/heads/<name>"), or empty when HEAD is detached. A HEAD
+    // holding a bare branch name, as older repositories have, is read as that branch.
+    inline std::string head_target()
+    {
+        std::string value;
+        if (!detail::read_loose(HEAD, value))
+        {
+            return "";
+        }
+        if (value.rfind(SYMREF_PREFIX, 0) == 0)
+        {
+            return value.substr(SYMREF_PREFIX.size());
+        }
+        if (!value.empty() && is_valid_name(HEADS_PREFIX + value) && exists(HEADS_PREFIX + value))
+        {
+            return HEADS_PREFIX + value;
+        }
+        return "";
+    }
+
+    // The ref a commit on HEAD moves: the current branch, or HEAD itself when detached
+    inline std::string head_ref_name()
+    {
+        std::string target = head_target();
+        return target.empty() ? HEAD : target;
+    }
+
+    // A set of ref changes applied all-or-nothing by commit()
+    class Transaction
+    {
+    public:
+        // `message` is recorded in the reflog of every ref the transaction moves
+        explicit Transaction(std::string message = "") : message_(std::move(message)) {}
+
+        // Point `name` at `value`. With `expected_old`, fail unless the ref currently holds that
+        // raw value; an empty `expected_old` means the ref must not exist yet.
+        void update(const std::string &name, const std::string &value,
+                    std::optional<std::string> expected_old = std::nullopt)
+        {
+            updates_.push_back({name, value, std::move(expected_old), false});
+        }
+
+        void create(const std::string &name, const std::string &value)
+        {
+            update(name, value, std::string());
+        }
+
+        void remove(const std::string &name, std::optional<std::string> expected_old = std::nullopt)
+        {
+            updates_.push_back({name, "", std::move(expected_old), true});
+        }
+
+        // Make `name` a symbolic ref to `target`
+        void set_symbolic(const std::string &name, const std::string &target,
+                          std::optional<std::string> expected_old = std::nullopt)
+        {
+            update(name, SYMREF_PREFIX + target, std::move(expected_old));
+        }
+
+        bool empty() const { return updates_.empty(); }
+
+        // Apply every change, or none of them; throws describing the first failure
+        void commit()
+        {
+            trace::Span span("refs.transaction");
+            span.arg("updates", updates_.size());
+
+            std::sort(updates_.begin(), updates_.end(), [](const Update &a, const Update &b)
+                      { return a.name < b.name; });
+            bool deletes = false;
+            for (size_t i = 0; i < updates_.size(); ++i)
+            {
+                const Update &u = updates_[i];
+                if (!is_valid_name(u.name))
+                {
+                    throw std::runtime_error("Invalid ref name: " + u.name);
+                }
+                if (i > 0 && updates_[i - 1].name == u.name)
+                {
+                    throw std::runtime_error("Ref updated twice in one transaction: " + u.name);
+                }
+                deletes = deletes || u.remove;
+            }
+
+            // A change to the branch HEAD points at is also logged to HEAD, which needs HEAD's lock.
+            // HEAD sorts before every name under refs/, so taking it first keeps the name order.
+            bool head_updated = std::any_of(updates_.begin(), updates_.end(), [](const Update &u)
+                                            { return u.name == HEAD; });
+            std::string head = head_target();
+            bool log_head = !head_updated && std::any_of(updates_.begin(), updates_.end(), [&](const Update &u)
+                                                         { return u.name == head; });
+
+            // Lock in name order so concurrent transactions cannot deadlock on each other
+            std::unique_ptr<detail::LockFile> head_lock;
+            if (log_head)
+            {
+                head_lock = std::make_unique<detail::LockFile>(detail::loose_path(HEAD));
+                head = head_target(); // HEAD cannot move from here on
+            }
+            std::vector<std::unique_ptr<detail::LockFile>> locks;
+            for (const auto &u : updates_)
+            {
+                locks.push_back(std::make_unique<detail::LockFile>(detail::loose_path(u.name)));
+            }
+            std::unique_ptr<detail::LockFile> packed_lock;
+            if (deletes)
+            {
+                packed_lock = std::make_unique<detail::LockFile>(PACKED_REFS_FILE);
+            }
+
+            std::vector<std::string> old_ids;
+            for (const auto &u : updates_)
+            {
+                std::string current;
+                bool found = read(u.name, current);
+                old_ids.push_back(found ? peel(current) : "");
+                if (u.expected_old && (found ? current : "") != *u.expected_old)
+                {
+                    throw std::runtime_error("Ref " + u.name + " is at " + (found ? "'" + current + "'" : "nothing") +
+                                             " but expected " +
+                                             (u.expected_old->empty() ? "nothing" : "'" + *u.expected_old + "'"));
+                }
+                if (u.remove && !found)
+                {
+                    throw std::runtime_error("Ref does not exist: " + u.name);
+                }
+            }
+
+            for (size_t i = 0; i < updates_.size(); ++i)
+            {
+                if (!updates_[i].remove)
+                {
+                    locks[i]->write(updates_[i].value + "\n");
+                }
+            }
+
+            // Deleted refs leave packed-refs first, so they never fall back to a stale packed value.
+            // Every file replaced so far is remembered, so a failed rename can put them all back.
+            std::vector<std::pair<std::string, std::optional<std::string>>> replaced;
+            try
+            {
+                if (packed_lock)
+                {
+                    std::map<std::string, std::string> packed;
+                    for (auto &ref : detail::PackedRefs().list("refs/"))
+                    {
+                        packed[ref.name] = std::move(ref.value);
+                    }
+                    size_t before = packed.size();
+                    for (const auto &u : updates_)
+                    {
+                        if (u.remove)
+                        {
+                            packed.erase(u.name);
+                        }
+                    }
+                    if (packed.size() != before)
+                    {
+                        packed_lock->write(detail::serialize_packed(packed));
+                        auto previous = detail::snapshot(PACKED_REFS_FILE);
+                        packed_lock->commit();
+                        replaced.emplace_back(PACKED_REFS_FILE, std::move(previous));
+                    }
+                }
+
+                for (size_t i = 0; i < updates_.size(); ++i)
+                {
+                    auto previous = detail::snapshot(locks[i]->path());
+                    if (updates_[i].remove)
+                    {
+                        locks[i]->remove();
+                    }
+                    else
+                    {
+                        locks[i]->commit();
+                    }
+                    replaced.emplace_back(locks[i]->path(), std::move(previous));
+                }
+            }
+            catch (const std::exception &)
+            {
+                for (auto it = replaced.rbegin(); it != replaced.rend(); ++it)
+                {
+                    detail::restore(it->first, it->second);
+                }
+                throw;
+            }
+
+            // Only moves that happened are logged; HEAD's lock is still held for its entry
+            for (size_t i = 0; i < updates_.size(); ++i)
+            {
+                const Update &u = updates_[i];
+                std::string new_id = u.remove ? "" : peel(u.value);
+                bool symbolic = u.value.rfind(SYMREF_PREFIX, 0) == 0;
+                if (new_id.empty() || (!symbolic && new_id == old_ids[i]))
+                {
+                    continue;
+                }
+                reflog::append(u.name, old_ids[i], new_id, message_);
+                if (head_lock && u.name == head)
+                {
+                    reflog::append(HEAD, old_ids[i], new_id, message_);
+                }
+            }
+            head_lock.reset();
+            locks.clear();
+            for (const auto &u : updates_)
+            {
+                if (u.remove)
+                {
+                    reflog::remove(u.name);
+                    detail::prune_empty_parents(u.name);
+                }
+            }
+            updates_.clear();
+        }
+
+    private:
+        // The object id a raw ref value stands for
+        static std::string peel(const std::string &value)
+        {
+            return value.rfind(SYMREF_PREFIX, 0) == 0 ? resolve(value.substr(SYMREF_PREFIX.size())) : value;
+        }
+
+        struct Update
+        {
+            std::string name;
+            std::string value;
+            std::optional<std::string> expected_old;
+            bool remove;
+        };
+
+        std::string message_;
+        std::vector<Update> updates_;
+    };
+
+    // Drop reflog entries of `name` older than `cutoff`, holding the ref's lock
+    inline size_t expire_reflog(const std::string &name, std::int64_t cutoff)
+    {
+        detail::LockFile lock(detail::loose_path(name));
+        return reflog::expire(name, cutoff);
+    }
+
+    // Drop the n-th newest reflog entry of `name` and point the ref at the newest entry left,
+    // deleting the ref with its last entry; this is how the stash stack pops. Returns false when
+    // the entry does not exist.
+    inline bool drop_reflog_entry(const std::string &name, size_t n)
+    {
+        std::string top;
+        {
+            detail::LockFile lock(detail::loose_path(name));
+            if (!reflog::drop(name, n))
+            {
+                return false;
+            }
+            reflog::Entry newest;
+            if (reflog::nth(name, 0, newest))
+            {
+                lock.write(newest.new_id + "\n");
+                lock.commit();
+                return true;
+            }
+            read(name, top);
+        }
+        Transaction transaction;
+        transaction.remove(name, top);
+        transaction.commit();
+        return true;
+    }
+
+    // Move every loose ref under refs/ into packed-refs and delete the loose files. A loose ref
+    // that is locked or changes while packing is left in place; it still overrides its packed copy.
+    // Returns the number of refs in packed-refs.
+    inline size_t pack_refs()
+    {
+        trace::Span span("refs.pack");
+        detail::LockFile packed_lock(PACKED_REFS_FILE);
+
+        std::map<std::string, std::string> loose;
+        detail::list_loose("refs/", loose);
+        std::map<std::string, std::string> packed;
+        for (auto &ref : detail::PackedRefs().list("refs/"))
+        {
+            packed[ref.name] = std::move(ref.value);
+        }
+        for (const auto &[name, value] : loose)
+        {
+            if (value.rfind(SYMREF_PREFIX, 0) != 0 && !value.empty())
+            {
+                packed[name] = value;
+            }
+        }
+        packed_lock.write(detail::serialize_packed(packed));
+        packed_lock.commit();
+        span.arg("refs", packed.size());
+
+        for (const auto &[name, value] : loose)
+        {
+            auto it = packed.find(name);
+            if (it == packed.end() || it->second != value)
+            {
+                continue;
+            }
+            try
+            {
+                detail::LockFile lock(detail::loose_path(name));
+                std::string current;
+                if (detail::read_loose(name, current) && current == value)
+                {
+                    lock.remove();
+                }
+            }
+            catch (const std::exception &)
+            {
+                continue; // held by another process: the loose ref stays authoritative
+            }
+            detail::prune_empty_parents(name);
+        }
+        return packed.size();
+    }
+} // namespace refs
+
+#endif // REFS_HPP
@@ -0,0 +1,248 @@
+#ifndef REPO_DAEMON_HPP
+#define REPO_DAEMON_HPP
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "commit_graph.hpp"
+#include "constants.hpp"
+#include "fsmonitor.hpp"
+#include "index.hpp"
+#include "pack.hpp"
+#include "trace.hpp"
+
+// Repository daemon.
+//
+// A background process that answers read-only commands (status, log, diff, rev-parse) for one
+// repository, so the index, the commit-graph, the object and pack caches and the working tree
+// listing stay in memory between invocations instead of being rebuilt by every `kit` process.
+// The CLI forwards those commands whenever the socket answers and runs them itself otherwise.
+//
+// Protocol, one request per connection:
+//   "<log level> <command> [args...]\n" -> "<stdout bytes> <stderr bytes>\n" + stdout + stderr
+//   "ping\n"                            -> "ok <pid>\n"
+//   "stop\n"                            -> "ok\n", and the daemon exits
+// The daemon also exits after a period without requests.
+namespace repo_daemon
+{
+    const std::string SOCKET_FILE = KIT_DIR + "/daemon.sock";
+    constexpr int DEFAULT_IDLE_TIMEOUT = 600; // seconds
+
+    // What a forwarded command printed
+    struct Reply
+    {
+        std::string out;
+        std::string err;
+    };
+
+    // Runs one forwarded command inside the daemon
+    using Handler = std::function<Reply(const std::string &request)>;
+
+    namespace detail
+    {
+        // Set inside the daemon so the commands it runs do not forward to it again
+        inline bool &serving()
+        {
+            static bool value = false;
+            return value;
+        }
+    } // namespace detail
+
+    inline bool is_serving()
+    {
+        return detail::serving();
+    }
+
+    // Send one raw request; returns false when no daemon answers
+    inline bool send(const std::string &line, std::string &reply, const std::string &socket_path = SOCKET_FILE)
+    {
+        // Most repositories have no daemon: one stat and no socket work in that case
+        if (::access(socket_path.c_str(), F_OK) != 0)
+        {
+            return false;
+        }
+        return fsmonitor::request(line, reply, socket_path);
+    }
+
+    // Run a command in the daemon; returns false when there is none to ask
+    inline bool forward(const std::string &request, Reply &reply, const std::string &socket_path = SOCKET_FILE)
+    {
+        std::string raw;
+        if (!send(request, raw, socket_path))
+        {
+            return false;
+        }
+        size_t newline = raw.find('\n');
+        unsigned long long out_size = 0, err_size = 0;
+        if (newline == std::string::npos ||
+            std::sscanf(raw.c_str(), "%llu %llu", &out_size, &err_size) != 2 ||
+            raw.size() - newline - 1 != out_size + err_size)
+        {
+            return false;
+        }
+        reply.out = raw.substr(newline + 1, out_size);
+        reply.err = raw.substr(newline + 1 + out_size);
+        return true;
+    }
+
+    inline bool is_running(const std::string &socket_path = SOCKET_FILE)
+    {
+        std::string reply;
+        return send("ping", reply, socket_path) && reply.rfind("ok", 0) == 0;
+    }
+
+    // Accepts requests on the socket and hands each to the handler until stopped or idle
+    class Server
+    {
+    public:
+        Server(Handler handler, int idle_timeout = DEFAULT_IDLE_TIMEOUT, const std::string &socket_path = SOCKET_FILE)
+            : handler_(std::move(handler)), idle_timeout_(idle_timeout), socket_path_(socket_path)
+        {
+            if (is_running(socket_path_))
+            {
+                throw std::runtime_error("A repository daemon is already running");
+            }
+            sockaddr_un address;
+            if (!fsmonitor::detail::socket_address(socket_path_, address))
+            {
+                throw std::runtime_error("Socket path too long: " + socket_path_);
+            }
+            listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            ::unlink(socket_path_.c_str()); // left behind by a daemon that did not shut down cleanly
+            if (listen_fd_ < 0 || ::bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+                ::listen(listen_fd_, 64) != 0)
+            {
+                std::string reason = std::strerror(errno);
+                if (listen_fd_ >= 0)
+                {
+                    ::close(listen_fd_);
+                    listen_fd_ = -1;
+                }
+                throw std::runtime_error("Failed to listen on " + socket_path_ + ": " + reason);
+            }
+        }
+
+        ~Server() { close(); }
+
+        Server(const Server &) = delete;
+        Server &operator=(const Server &) = delete;
+
+        // Serve until a stop request, or until no request arrived for the idle timeout
+        void run()
+        {
+            detail::serving() = true;
+            while (running_)
+            {
+                pollfd fd{listen_fd_, POLLIN, 0};
+                int ready = ::poll(&fd, 1, idle_timeout_ > 0 ? idle_timeout_ * 1000 : -1);
+                if (ready < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ready < 0)
+                {
+                    throw std::runtime_error("poll failed: " + std::string(std::strerror(errno)));
+                }
+                if (ready == 0)
+                {
+                    break; // idle
+                }
+                serve();
+            }
+            detail::serving() = false;
+            close();
+        }
+
+    private:
+        void close()
+        {
+            if (listen_fd_ >= 0)
+            {
+                ::close(listen_fd_);
+                ::unlink(socket_path_.c_str());
+                listen_fd_ = -1;
+            }
+        }
+
+        void serve()
+        {
+            fsmonitor::detail::Fd client(::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC));
+            if (client.fd < 0)
+            {
+                return;
+            }
+            fsmonitor::detail::set_timeout(client.fd, 30);
+            std::string line;
+            if (!fsmonitor::detail::read_all(client.fd, line, '\n'))
+            {
+                return;
+            }
+            line = line.substr(0, line.find('\n'));
+            fsmonitor::detail::write_all(client.fd, answer(line));
+        }
+
+        std::string answer(const std::string &line)
+        {
+            if (line == "stop")
+            {
+                running_ = false;
+                return "ok\n";
+            }
+            if (line == "ping")
+            {
+                return "ok " + std::to_string(::getpid()) + "\n";
+            }
+
+            trace::Span span("daemon.request");
+            refresh_caches();
+            Reply reply;
+            try
+            {
+                reply = handler_(line);
+            }
+            catch (const std::exception &e)
+            {
+                reply.err += std::string("[kit] Error: ") + e.what() + "\n";
+            }
+            return std::to_string(reply.out.size()) + " " + std::to_string(reply.err.size()) + "\n" + reply.out +
+                   reply.err;
+        }
+
+        // Other processes may have written a commit-graph layer or a pack since the last request;
+        // the graph and pack registries are reloaded only when their files changed
+        void refresh_caches()
+        {
+            kit_index::StatData graph, chain, packs; // all zero for files that do not exist
+            kit_index::stat_file(commit_graph::GRAPH_FILE, graph);
+            kit_index::stat_file(commit_graph::CHAIN_FILE, chain);
+            kit_index::stat_file(PACK_DIR, packs);
+            if (graph != graph_ || chain != chain_)
+            {
+                commit_graph::reload();
+            }
+            if (packs != packs_)
+            {
+                pack::reload();
+            }
+            graph_ = graph;
+            chain_ = chain;
+            packs_ = packs;
+        }
+
+        Handler handler_;
+        int idle_timeout_;
+        std::string socket_path_;
+        int listen_fd_ = -1;
+        bool running_ = true;
+        kit_index::StatData graph_, chain_, packs_;
+    };
+} // namespace repo_daemon
+
+#endif // REPO_DAEMON_HPP
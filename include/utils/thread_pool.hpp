@@ -0,0 +1,262 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "trace.hpp"
+
+namespace thread_pool
+{
+    // Number of workers to use when the caller does not specify one
+    inline unsigned default_jobs(unsigned requested = 0)
+    {
+        if (requested > 0)
+        {
+            return requested;
+        }
+        unsigned hardware = std::thread::hardware_concurrency();
+        return hardware > 0 ? hardware : 4;
+    }
+
+    // Bounded multi-producer / multi-consumer queue; `close` wakes all consumers once drained
+    template <typename T>
+    class BlockingQueue
+    {
+    public:
+        explicit BlockingQueue(size_t capacity = 1024) : capacity_(capacity) {}
+
+        bool push(T value)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this]
+                           { return closed_ || items_.size() < capacity_; });
+            if (closed_)
+            {
+                return false;
+            }
+            items_.push_back(std::move(value));
+            not_empty_.notify_one();
+            return true;
+        }
+
+        std::optional<T> pop()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this]
+                            { return closed_ || !items_.empty(); });
+            if (items_.empty())
+            {
+                return std::nullopt;
+            }
+            T value = std::move(items_.front());
+            items_.pop_front();
+            not_full_.notify_one();
+            return value;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+    private:
+        size_t capacity_;
+        bool closed_ = false;
+        std::deque<T> items_;
+        std::mutex mutex_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+    };
+
+    // Call fn(i) for every i in [0, count) on up to `jobs` threads, handing out indices one at a
+    // time so uneven items balance out. Rethrows the first exception fn raised.
+    template <typename Fn>
+    void parallel_for(size_t count, unsigned jobs, Fn fn)
+    {
+        unsigned threads = static_cast<unsigned>(std::min<size_t>(default_jobs(jobs), count));
+        if (threads <= 1)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                fn(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next{0};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&]
+                                 {
+                trace::Span span("parallel_for.worker");
+                for (size_t i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+                     i = next.fetch_add(1, std::memory_order_relaxed))
+                {
+                    try
+                    {
+                        fn(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        if (!error)
+                        {
+                            error = std::current_exception();
+                        }
+                    }
+                } });
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Pool for recursive workloads such as directory walks. Each worker owns a deque it pushes
+    // to and pops from at the back; an idle worker steals from the front of another worker's deque,
+    // so large subtrees get split up while each worker mostly stays on its own recent work.
+    template <typename T>
+    class WorkStealingPool
+    {
+    public:
+        explicit WorkStealingPool(unsigned jobs = 0) : queues_(default_jobs(jobs)) {}
+
+        WorkStealingPool(const WorkStealingPool &) = delete;
+        WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+        size_t size() const { return queues_.size(); }
+
+        // Process `roots` and everything spawned from them; returns once all work is done.
+        // The handler is called as handler(item, worker, spawn), where `worker` is in [0, size())
+        // and spawn(T) queues more work. Rethrows the first exception a handler raised.
+        template <typename Handler>
+        void run(std::vector<T> roots, Handler handler)
+        {
+            outstanding_ = roots.size();
+            for (size_t i = 0; i < roots.size(); ++i)
+            {
+                queues_[i % queues_.size()].items.push_back(std::move(roots[i]));
+            }
+
+            std::vector<std::thread> workers;
+            workers.reserve(queues_.size());
+            for (unsigned worker = 0; worker < queues_.size(); ++worker)
+            {
+                workers.emplace_back([this, worker, &handler]
+                                     { work(worker, handler); });
+            }
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+
+            if (error_)
+            {
+                std::exception_ptr error = error_;
+                error_ = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<T> items;
+        };
+
+        template <typename Handler>
+        void work(unsigned self, Handler &handler)
+        {
+            trace::Span span("work_stealing.worker");
+            auto spawn = [this, self](T item)
+            {
+                outstanding_.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(queues_[self].mutex);
+                queues_[self].items.push_back(std::move(item));
+            };
+
+            while (true)
+            {
+                std::optional<T> item = take(self);
+                if (!item)
+                {
+                    // Items are only retired after their children were counted, so zero means done
+                    if (outstanding_.load(std::memory_order_acquire) == 0)
+                    {
+                        return;
+                    }
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                try
+                {
+                    handler(*item, self, spawn);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex_);
+                    if (!error_)
+                    {
+                        error_ = std::current_exception();
+                    }
+                }
+                outstanding_.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+
+        // Pop from the back of our own deque, or steal from the front of another one
+        std::optional<T> take(unsigned self)
+        {
+            {
+                Queue &own = queues_[self];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.items.empty())
+                {
+                    T item = std::move(own.items.back());
+                    own.items.pop_back();
+                    return item;
+                }
+            }
+            for (size_t offset = 1; offset < queues_.size(); ++offset)
+            {
+                Queue &victim = queues_[(self + offset) % queues_.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.items.empty())
+                {
+                    T item = std::move(victim.items.front());
+                    victim.items.pop_front();
+                    return item;
+                }
+            }
+            return std::nullopt;
+        }
+
+        std::vector<Queue> queues_;
+        std::atomic<size_t> outstanding_{0};
+        std::mutex error_mutex_;
+        std::exception_ptr error_;
+    };
+} // namespace thread_pool
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,308 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "logger.hpp"
+
+// Low-overhead tracing of where a command spends its time. Scoped spans record when each phase
+// ran and on which thread; counters tally bytes, objects and cache hits. Tracing is turned on by
+// --trace[=path] or KIT_TRACE=path and the trace is written as Chrome trace-event JSON (load it in
+// chrome://tracing or ui.perfetto.dev) when the process exits. While it is off, every span and
+// counter costs one relaxed atomic load and a branch.
+namespace trace
+{
+    const std::string DEFAULT_FILE = "kit-trace.json";
+
+    enum class Counter
+    {
+        BytesRead,      // object contents read from loose objects and packs
+        BytesWritten,   // compressed bytes written to the object store
+        ObjectsRead,
+        ObjectsWritten, // new objects; objects that already existed are not counted
+        BytesHashed,
+        ObjectsHashed,
+        CacheHits,      // parsed commits and trees served from the object cache
+        CacheMisses,
+        Count
+    };
+
+    namespace detail
+    {
+        constexpr size_t COUNTERS = static_cast<size_t>(Counter::Count);
+        constexpr const char *COUNTER_NAMES[COUNTERS] = {"bytes_read",    "bytes_written",  "objects_read",
+                                                         "objects_written", "bytes_hashed", "objects_hashed",
+                                                         "cache_hits",    "cache_misses"};
+
+        inline std::atomic<bool> enabled{false};
+        inline std::array<std::atomic<std::uint64_t>, COUNTERS> counters{};
+
+        // One recorded event: a complete span ('X') or a counter sample ('C')
+        struct Event
+        {
+            const char *name;
+            char phase;
+            std::uint64_t start; // nanoseconds since tracing started
+            std::uint64_t duration;
+            std::string args;    // body of the JSON args object
+        };
+
+        // Events of one thread. Only its thread appends, so the lock is uncontended until the
+        // trace is written; buffers outlive their threads so nothing recorded is lost.
+        struct ThreadBuffer
+        {
+            unsigned tid;
+            std::mutex mutex;
+            std::vector<Event> events;
+        };
+
+        struct Registry
+        {
+            std::mutex mutex;
+            std::string path;
+            std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+            bool exit_hook = false;
+        };
+
+        inline Registry &registry()
+        {
+            static Registry instance;
+            return instance;
+        }
+
+        inline ThreadBuffer &thread_buffer()
+        {
+            thread_local std::shared_ptr<ThreadBuffer> buffer;
+            if (!buffer)
+            {
+                buffer = std::make_shared<ThreadBuffer>();
+                Registry &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                buffer->tid = static_cast<unsigned>(r.buffers.size()) + 1;
+                r.buffers.push_back(buffer);
+            }
+            return *buffer;
+        }
+
+        // Spans open on this thread; counters are sampled whenever an outermost span closes
+        inline unsigned &depth()
+        {
+            thread_local unsigned value = 0;
+            return value;
+        }
+
+        inline std::uint64_t now()
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                  std::chrono::steady_clock::now() - registry().origin)
+                                                  .count());
+        }
+
+        inline void record(Event event)
+        {
+            ThreadBuffer &buffer = thread_buffer();
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            buffer.events.push_back(std::move(event));
+        }
+
+        inline void sample_counters()
+        {
+            std::string args;
+            for (size_t i = 0; i < COUNTERS; ++i)
+            {
+                args += std::string(i ? "," : "") + "\"" + COUNTER_NAMES[i] +
+                        "\":" + std::to_string(counters[i].load(std::memory_order_relaxed));
+            }
+            record({"counters", 'C', now(), 0, std::move(args)});
+        }
+
+        inline std::string escape(const std::string &text)
+        {
+            std::string out;
+            out.reserve(text.size());
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out += '\\';
+                    out += c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", c);
+                    out += code;
+                }
+                else
+                {
+                    out += c;
+                }
+            }
+            return out;
+        }
+
+        // Microseconds with nanosecond precision, as trace viewers expect
+        inline std::string micros(std::uint64_t nanos)
+        {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%llu.%03llu", static_cast<unsigned long long>(nanos / 1000),
+                          static_cast<unsigned long long>(nanos % 1000));
+            return text;
+        }
+    } // namespace detail
+
+    inline bool enabled()
+    {
+        return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    // Add `amount` to a counter
+    inline void count(Counter counter, std::uint64_t amount = 1)
+    {
+        if (enabled())
+        {
+            detail::counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+        }
+    }
+
+    // Records the time between its construction and destruction as one span. `name` must outlive
+    // the trace; string literals are the intended use.
+    class Span
+    {
+    public:
+        explicit Span(const char *name)
+        {
+            if (enabled())
+            {
+                name_ = name;
+                ++detail::depth();
+                start_ = detail::now();
+            }
+        }
+
+        ~Span()
+        {
+            if (!name_)
+            {
+                return;
+            }
+            std::uint64_t end = detail::now();
+            detail::record({name_, 'X', start_, end - start_, std::move(args_)});
+            if (--detail::depth() == 0)
+            {
+                detail::sample_counters();
+            }
+        }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+        // Attach a value shown with the span; ignored while tracing is off
+        void arg(const char *key, std::uint64_t value)
+        {
+            if (name_)
+            {
+                append(key, std::to_string(value));
+            }
+        }
+
+        void arg(const char *key, const std::string &value)
+        {
+            if (name_)
+            {
+                append(key, "\"" + detail::escape(value) + "\"");
+            }
+        }
+
+    private:
+        void append(const char *key, const std::string &json)
+        {
+            args_ += std::string(args_.empty() ? "" : ",") + "\"" + key + "\":" + json;
+        }
+
+        const char *name_ = nullptr;
+        std::uint64_t start_ = 0;
+        std::string args_;
+    };
+
+    // Write everything recorded so far to the trace file and stop tracing
+    inline void finish()
+    {
+        if (!detail::enabled.exchange(false))
+        {
+            return;
+        }
+        detail::sample_counters();
+
+        detail::Registry &r = detail::registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::ofstream out(r.path, std::ios::binary | std::ios::trunc);
+        long pid = static_cast<long>(::getpid());
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":1,\"args\":{\"name\":\"kit\"}}";
+        for (const auto &buffer : r.buffers)
+        {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":\"" << (buffer->tid == 1 ? std::string("main") : "thread " + std::to_string(buffer->tid))
+                << "\"}}";
+            for (const auto &event : buffer->events)
+            {
+                out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"kit\",\"ph\":\"" << event.phase
+                    << "\",\"ts\":" << detail::micros(event.start);
+                if (event.phase == 'X')
+                {
+                    out << ",\"dur\":" << detail::micros(event.duration);
+                }
+                out << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid << ",\"args\":{" << event.args << "}}";
+            }
+            buffer->events.clear();
+        }
+        out << "\n]}\n";
+        if (!out)
+        {
+            logger::error("Failed to write trace file: " + r.path);
+        }
+    }
+
+    // Start recording; the trace is written to `path` by finish(), at the latest on exit
+    inline void start(const std::string &path = DEFAULT_FILE)
+    {
+        detail::Registry &r = detail::registry();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.path = path.empty() ? DEFAULT_FILE : path;
+            r.origin = std::chrono::steady_clock::now();
+            if (!r.exit_hook)
+            {
+                r.exit_hook = true;
+                std::atexit(finish);
+            }
+        }
+        detail::thread_buffer(); // the thread that starts tracing is listed first, as "main"
+        detail::enabled.store(true, std::memory_order_relaxed);
+    }
+
+    // Start tracing when KIT_TRACE names a trace file
+    inline void start_from_environment()
+    {
+        const char *path = std::getenv("KIT_TRACE");
+        if (path && *path)
+        {
+            start(path);
+        }
+    }
+} // namespace trace
+
+#endif // TRACE_HPP
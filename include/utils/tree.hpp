@@ -0,0 +1,233 @@
+#ifndef TREE_HPP
+#define TREE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include "hash_object.hpp"
+#include "index.hpp"
+#include "object_db.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "trace.hpp"
+
+// Tree objects describe one directory: a sorted list of "<octal mode> <name>\0<raw object id>"
+// records. Subdirectories point at further trees, so unchanged directories share their tree id
+// between commits.
+namespace tree_object
+{
+    constexpr std::uint32_t MODE_TREE = 040000;
+    constexpr std::uint32_t MODE_FILE = 0100644;
+
+    struct TreeEntry
+    {
+        std::uint32_t mode = MODE_FILE;
+        std::string name;
+        object_id::ObjectId oid;
+
+        bool is_tree() const { return mode == MODE_TREE; }
+    };
+
+    // Directories sort as if their name ended in '/', which keeps flattened paths in index order
+    inline bool entry_less(const TreeEntry &a, const TreeEntry &b)
+    {
+        std::string left = a.is_tree() ? a.name + "/" : a.name;
+        std::string right = b.is_tree() ? b.name + "/" : b.name;
+        return left < right;
+    }
+
+    inline std::string serialize(std::vector<TreeEntry> entries)
+    {
+        std::sort(entries.begin(), entries.end(), entry_less);
+
+        const size_t oid_size = hash_object::oid_size();
+        std::string out;
+        for (const auto &entry : entries)
+        {
+            char mode[16];
+            std::snprintf(mode, sizeof(mode), "%o", entry.mode);
+            out += mode;
+            out.push_back(' ');
+            out += entry.name;
+            out.push_back('\0');
+            if (entry.oid.size != oid_size)
+            {
+                throw std::runtime_error("Invalid object id in tree entry: " + entry.name);
+            }
+            out.append(reinterpret_cast<const char *>(entry.oid.data()), oid_size);
+        }
+        return out;
+    }
+
+    inline std::vector<TreeEntry> parse(const std::string &content)
+    {
+        const size_t oid_size = hash_object::oid_size();
+        std::vector<TreeEntry> entries;
+        size_t pos = 0;
+        while (pos < content.size())
+        {
+            size_t space = content.find(' ', pos);
+            size_t nul = content.find('\0', space == std::string::npos ? pos : space);
+            if (space == std::string::npos || nul == std::string::npos || nul + 1 + oid_size > content.size())
+            {
+                throw std::runtime_error("Corrupt tree object");
+            }
+            TreeEntry entry;
+            entry.mode = static_cast<std::uint32_t>(std::stoul(content.substr(pos, space - pos), nullptr, 8));
+            entry.name = content.substr(space + 1, nul - space - 1);
+            entry.oid = object_id::ObjectId::from_raw(reinterpret_cast<const unsigned char *>(content.data() + nul + 1),
+                                                      oid_size);
+            entries.push_back(std::move(entry));
+            pos = nul + 1 + oid_size;
+        }
+        return entries;
+    }
+
+    inline size_t tree_charge(const std::vector<TreeEntry> &entries)
+    {
+        size_t bytes = sizeof(entries) + entries.size() * sizeof(TreeEntry);
+        for (const auto &entry : entries)
+        {
+            bytes += entry.name.capacity();
+        }
+        return bytes;
+    }
+
+    // Load and parse a tree object; shared with other readers through the object cache
+    inline std::shared_ptr<const std::vector<TreeEntry>> read_tree(const std::string &tree_oid)
+    {
+        return object_db::read_parsed<std::vector<TreeEntry>>(tree_oid, "tree", parse, tree_charge);
+    }
+
+    namespace detail
+    {
+        inline std::uint32_t entry_mode(const kit_index::Entry &entry)
+        {
+            return entry.stat.mode != 0 ? entry.stat.mode : MODE_FILE;
+        }
+
+        // Build the tree for index entries [begin, end), all of which live below `dir`
+        inline object_id::ObjectId build(kit_index::Index &index, const std::string &dir, size_t begin, size_t end,
+                                 size_t prefix_length, size_t &written)
+        {
+            auto cached = index.cache_tree.find(dir);
+            if (cached != index.cache_tree.end() && cached->second.entry_count == end - begin)
+            {
+                return cached->second.oid;
+            }
+
+            std::vector<TreeEntry> entries;
+            size_t i = begin;
+            while (i < end)
+            {
+                const std::string &path = index.entries[i].path;
+                size_t slash = path.find('/', prefix_length);
+                if (slash == std::string::npos)
+                {
+                    entries.push_back({entry_mode(index.entries[i]), path.substr(prefix_length), index.entries[i].oid});
+                    ++i;
+                    continue;
+                }
+
+                // Entries of a subdirectory are contiguous in the sorted index
+                std::string subdir = path.substr(0, slash);
+                size_t j = i;
+                while (j < end && index.entries[j].path.compare(0, slash + 1, path, 0, slash + 1) == 0)
+                {
+                    ++j;
+                }
+                object_id::ObjectId subtree = build(index, subdir, i, j, slash + 1, written);
+                entries.push_back({MODE_TREE, path.substr(prefix_length, slash - prefix_length), subtree});
+                i = j;
+            }
+
+            object_id::ObjectId oid = object_id::ObjectId::from_hex(
+                object_store::write_object("tree", serialize(std::move(entries))));
+            ++written;
+            index.cache_tree[dir] = {oid, static_cast<std::uint32_t>(end - begin)};
+            return oid;
+        }
+    } // namespace detail
+
+    // Write the trees for the index, reusing cached trees of unchanged directories.
+    // The cache in `index` is refreshed; the caller is responsible for saving it.
+    inline std::string write_tree(kit_index::Index &index, size_t *trees_written = nullptr)
+    {
+        trace::Span span("tree.write");
+        size_t written = 0;
+        object_id::ObjectId oid = detail::build(index, "", 0, index.entries.size(), 0, written);
+        span.arg("trees_written", written);
+        if (trees_written)
+        {
+            *trees_written = written;
+        }
+        return oid.hex();
+    }
+
+    // Write the trees for a path -> blob id map
+    inline std::string write_tree(const std::map<std::string, std::string> &files)
+    {
+        kit_index::Index index;
+        index.entries.reserve(files.size());
+        for (const auto &[path, blob] : files)
+        {
+            kit_index::Entry entry;
+            entry.path = path;
+            entry.oid = object_id::ObjectId::from_hex(blob);
+            index.entries.push_back(std::move(entry));
+        }
+        return write_tree(index);
+    }
+
+    // Flatten a tree into index entries (without stat data), recording every directory's tree
+    // in `cache` so a freshly built index can reuse them
+    inline size_t flatten(const std::string &tree_oid, const std::string &dir, std::vector<kit_index::Entry> &out,
+                          std::map<std::string, kit_index::CachedTree> *cache = nullptr)
+    {
+        size_t count = 0;
+        std::string prefix = dir.empty() ? "" : dir + "/";
+        for (const auto &entry : *read_tree(tree_oid))
+        {
+            if (entry.is_tree())
+            {
+                count += flatten(entry.oid.hex(), prefix + entry.name, out, cache);
+            }
+            else
+            {
+                kit_index::Entry file;
+                file.path = prefix + entry.name;
+                file.oid = entry.oid;
+                file.stat.mode = entry.mode;
+                out.push_back(std::move(file));
+                ++count;
+            }
+        }
+        if (cache)
+        {
+            (*cache)[dir] = {object_id::ObjectId::from_hex(tree_oid), static_cast<std::uint32_t>(count)};
+        }
+        return count;
+    }
+
+    // All files below a tree as a path -> blob id map
+    inline std::map<std::string, std::string> read_tree_files(const std::string &tree_oid)
+    {
+        trace::Span span("tree.walk");
+        std::vector<kit_index::Entry> entries;
+        flatten(tree_oid, "", entries);
+        span.arg("files", entries.size());
+        std::map<std::string, std::string> files;
+        for (auto &entry : entries)
+        {
+            files.emplace(std::move(entry.path), entry.oid.hex());
+        }
+        return files;
+    }
+} // namespace tree_object
+
+#endif // TREE_HPP
@@ -0,0 +1,436 @@
+#ifndef TREE_CHECKOUT_HPP
+#define TREE_CHECKOUT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "index.hpp"
+#include "object_id.hpp"
+#include "object_store.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include "tree.hpp"
+
+// Moving the working tree and the index from one tree to another. The trees are compared by
+// object id, so directories whose tree did not change are never read, and only the files that
+// differ are written, removed or chmodded.
+namespace tree_checkout
+{
+    constexpr std::uint32_t MODE_EXECUTABLE = 0100755;
+    constexpr std::uint32_t MODE_SYMLINK = 0120000;
+
+    // One side of a change; a mode of 0 means the path does not exist on that side
+    struct Side
+    {
+        std::uint32_t mode = 0;
+        object_id::ObjectId oid;
+
+        bool present() const { return mode != 0; }
+    };
+
+    struct Change
+    {
+        std::string path;
+        Side from;
+        Side to;
+    };
+
+    struct Result
+    {
+        size_t written = 0;
+        size_t removed = 0;
+        size_t chmodded = 0;
+    };
+
+    namespace detail
+    {
+        inline void add_subtree(const std::string &tree_oid, const std::string &dir, bool to_side,
+                                std::vector<Change> &out)
+        {
+            std::vector<kit_index::Entry> files;
+            tree_object::flatten(tree_oid, dir, files);
+            for (auto &file : files)
+            {
+                Change change;
+                change.path = std::move(file.path);
+                (to_side ? change.to : change.from) = {file.stat.mode, file.oid};
+                out.push_back(std::move(change));
+            }
+        }
+
+        inline void add_entry(const tree_object::TreeEntry &entry, const std::string &path, bool to_side,
+                              std::vector<Change> &out)
+        {
+            if (entry.is_tree())
+            {
+                add_subtree(entry.oid.hex(), path, to_side, out);
+                return;
+            }
+            Change change;
+            change.path = path;
+            (to_side ? change.to : change.from) = {entry.mode, entry.oid};
+            out.push_back(std::move(change));
+        }
+
+        // Both trees list their entries in tree order, so one merge pass pairs them up
+        inline void diff(const std::string &from_tree, const std::string &to_tree, const std::string &dir,
+                         std::vector<Change> &out)
+        {
+            static const std::vector<tree_object::TreeEntry> empty;
+            auto from_entries = from_tree.empty() ? nullptr : tree_object::read_tree(from_tree);
+            auto to_entries = to_tree.empty() ? nullptr : tree_object::read_tree(to_tree);
+            const auto &from = from_entries ? *from_entries : empty;
+            const auto &to = to_entries ? *to_entries : empty;
+            std::string prefix = dir.empty() ? "" : dir + "/";
+
+            size_t i = 0, j = 0;
+            while (i < from.size() || j < to.size())
+            {
+                if (j == to.size() || (i < from.size() && tree_object::entry_less(from[i], to[j])))
+                {
+                    add_entry(from[i], prefix + from[i].name, false, out);
+                    ++i;
+                }
+                else if (i == from.size() || tree_object::entry_less(to[j], from[i]))
+                {
+                    add_entry(to[j], prefix + to[j].name, true, out);
+                    ++j;
+                }
+                else
+                {
+                    // Same name and kind; identical ids mean identical contents all the way down
+                    const auto &a = from[i++];
+                    const auto &b = to[j++];
+                    if (a.oid == b.oid && a.mode == b.mode)
+                    {
+                        continue;
+                    }
+                    if (a.is_tree())
+                    {
+                        diff(a.oid.hex(), b.oid.hex(), prefix + a.name, out);
+                    }
+                    else
+                    {
+                        out.push_back({prefix + a.name, {a.mode, a.oid}, {b.mode, b.oid}});
+                    }
+                }
+            }
+        }
+
+        inline bool matches(const kit_index::Entry &entry, const Side &side)
+        {
+            return side.present() && entry.oid == side.oid && entry.stat.mode == side.mode;
+        }
+
+        // Replace `path` with the blob's contents, creating it with the blob's mode
+        inline void write_file(const std::string &path, const Side &side)
+        {
+            std::string content = object_store::read_object(side.oid.hex(), "blob");
+            if (::unlink(path.c_str()) != 0 && errno != ENOENT)
+            {
+                throw std::runtime_error("Failed to remove " + path + ": " + std::strerror(errno));
+            }
+            if (side.mode == MODE_SYMLINK)
+            {
+                if (::symlink(content.c_str(), path.c_str()) != 0)
+                {
+                    throw std::runtime_error("Failed to create symlink " + path + ": " + std::strerror(errno));
+                }
+                return;
+            }
+
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                            side.mode == MODE_EXECUTABLE ? 0777 : 0666);
+            if (fd < 0)
+            {
+                throw std::runtime_error("Failed to create " + path + ": " + std::strerror(errno));
+            }
+            size_t done = 0;
+            while (done < content.size())
+            {
+                ssize_t n = ::write(fd, content.data() + done, content.size() - done);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n < 0)
+                {
+                    std::string reason = std::strerror(errno);
+                    ::close(fd);
+                    throw std::runtime_error("Failed to write " + path + ": " + reason);
+                }
+                done += static_cast<size_t>(n);
+            }
+            ::close(fd);
+        }
+
+        // True when the file at `path` provably still holds the blob of `side`: its index entry
+        // names that blob and the entry's stat data matches the file. A file that only might be
+        // unchanged is rewritten rather than trusted.
+        inline bool holds_blob(const kit_index::Index &index, const std::string &path, const Side &side)
+        {
+            const kit_index::Entry *entry = kit_index::find_entry(index, path);
+            kit_index::StatData current;
+            return entry && entry->oid == side.oid && kit_index::stat_file(path, current) &&
+                   current.mode != MODE_SYMLINK && kit_index::is_stat_clean(index, *entry, current);
+        }
+
+        // Set or clear the executable bits the way a fresh file of that mode would have them
+        inline void change_mode(const std::string &path, std::uint32_t mode)
+        {
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+            {
+                throw std::runtime_error("Failed to stat " + path + ": " + std::strerror(errno));
+            }
+            mode_t bits = st.st_mode & 07777;
+            bits = mode == MODE_EXECUTABLE ? bits | ((bits & 0444) >> 2) : bits & ~static_cast<mode_t>(0111);
+            if (::chmod(path.c_str(), bits) != 0)
+            {
+                throw std::runtime_error("Failed to chmod " + path + ": " + std::strerror(errno));
+            }
+        }
+
+        inline std::string parent_dir(const std::string &path)
+        {
+            size_t slash = path.rfind('/');
+            return slash == std::string::npos ? "" : path.substr(0, slash);
+        }
+
+        // A directory where a file is to be written is in the way unless it holds only tracked
+        // files that the same changes remove
+        inline bool directory_in_the_way(const kit_index::Index &index, const std::vector<Change> &changes,
+                                         const std::string &path)
+        {
+            std::error_code ec;
+            for (std::filesystem::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+            {
+                if (it->is_directory(ec) && !it->is_symlink(ec))
+                {
+                    continue;
+                }
+                std::string file = it->path().generic_string();
+                auto change = std::lower_bound(changes.begin(), changes.end(), file,
+                                               [](const Change &c, const std::string &key)
+                                               { return c.path < key; });
+                if (change == changes.end() || change->path != file || change->to.present() ||
+                    !kit_index::find_entry(index, file))
+                {
+                    return true;
+                }
+            }
+            return static_cast<bool>(ec);
+        }
+
+        // An untracked file standing where a new file needs a directory, or ""
+        inline std::string blocking_file(const kit_index::Index &index, const std::string &path)
+        {
+            for (std::string dir = parent_dir(path); !dir.empty(); dir = parent_dir(dir))
+            {
+                struct stat st;
+                if (::lstat(dir.c_str(), &st) == 0)
+                {
+                    return S_ISDIR(st.st_mode) || kit_index::find_entry(index, dir) ? "" : dir;
+                }
+            }
+            return "";
+        }
+    } // namespace detail
+
+    // Files that differ between two trees, in index order; an empty id stands for the empty tree
+    inline std::vector<Change> diff_trees(const std::string &from_tree, const std::string &to_tree)
+    {
+        trace::Span span("checkout.diff_trees");
+        std::vector<Change> changes;
+        if (from_tree != to_tree)
+        {
+            detail::diff(from_tree, to_tree, "", changes);
+        }
+        span.arg("changes", changes.size());
+        return changes;
+    }
+
+    // Paths where applying the changes would lose work: staged changes, modified files, and
+    // untracked files in the way of new ones. Only the changed paths are examined.
+    inline std::vector<std::string> find_conflicts(const kit_index::Index &index, const std::vector<Change> &changes)
+    {
+        trace::Span span("checkout.check");
+        std::vector<std::string> conflicts;
+        for (const auto &change : changes)
+        {
+            const kit_index::Entry *entry = kit_index::find_entry(index, change.path);
+            kit_index::StatData stat;
+            bool on_disk = kit_index::stat_file(change.path, stat);
+
+            if (!entry)
+            {
+                // A deletion that is already staged is fine; anything else on disk is not ours to replace
+                bool staged_delete = change.from.present() && !change.to.present();
+                bool in_the_way = false;
+                if (on_disk && change.to.present())
+                {
+                    in_the_way = std::filesystem::is_directory(std::filesystem::symlink_status(change.path))
+                                     ? detail::directory_in_the_way(index, changes, change.path)
+                                     : object_store::hash_file(change.path) != change.to.oid.hex();
+                }
+                if ((change.from.present() && !staged_delete) || in_the_way)
+                {
+                    conflicts.push_back(change.path);
+                }
+                else if (!change.from.present())
+                {
+                    std::string blocker = detail::blocking_file(index, change.path);
+                    if (!blocker.empty())
+                    {
+                        conflicts.push_back(blocker);
+                    }
+                }
+                continue;
+            }
+            if (!detail::matches(*entry, change.from) && !detail::matches(*entry, change.to))
+            {
+                conflicts.push_back(change.path); // staged change
+            }
+            else if (on_disk && !kit_index::is_stat_clean(index, *entry, stat) &&
+                     object_store::hash_file(change.path) != entry->oid.hex())
+            {
+                conflicts.push_back(change.path); // unstaged change
+            }
+        }
+        return conflicts;
+    }
+
+    // Apply the changes to the index alone. `stats` (one per change) holds the stat data of the
+    // written files; without it new entries carry only their mode, so the next status hashes
+    // just those files.
+    inline void update_index(kit_index::Index &index, const std::vector<Change> &changes,
+                             const std::vector<kit_index::StatData> *stats = nullptr)
+    {
+        // Changes and entries are both sorted by path, so the new index is one merge
+        std::vector<kit_index::Entry> entries;
+        entries.reserve(index.entries.size() + changes.size());
+        size_t e = 0;
+        for (size_t i = 0; i < changes.size(); ++i)
+        {
+            const Change &change = changes[i];
+            while (e < index.entries.size() && index.entries[e].path < change.path)
+            {
+                entries.push_back(std::move(index.entries[e++]));
+            }
+            if (e < index.entries.size() && index.entries[e].path == change.path)
+            {
+                ++e;
+            }
+            if (change.to.present())
+            {
+                kit_index::Entry entry;
+                entry.path = change.path;
+                entry.oid = change.to.oid;
+                if (stats)
+                {
+                    entry.stat = (*stats)[i];
+                }
+                entry.stat.mode = change.to.mode;
+                entries.push_back(std::move(entry));
+            }
+            kit_index::invalidate_cache_tree(index, change.path);
+        }
+        std::move(index.entries.begin() + static_cast<std::ptrdiff_t>(e), index.entries.end(),
+                  std::back_inserter(entries));
+        index.entries = std::move(entries);
+    }
+
+    // Apply the changes to the working tree and the index. Removals run first, then the writes
+    // are spread across `jobs` threads; every written file's stat data goes into its index entry
+    // so the next status does not read it again. The caller saves the index.
+    inline Result apply(kit_index::Index &index, const std::vector<Change> &changes, unsigned jobs = 0)
+    {
+        trace::Span span("checkout.apply");
+        Result result;
+
+        std::set<std::string> emptied;
+        std::set<std::string> needed;
+        std::vector<size_t> writes;
+        for (size_t i = 0; i < changes.size(); ++i)
+        {
+            const Change &change = changes[i];
+            if (change.to.present())
+            {
+                writes.push_back(i);
+                for (std::string dir = detail::parent_dir(change.path); !dir.empty(); dir = detail::parent_dir(dir))
+                {
+                    needed.insert(dir);
+                }
+            }
+            else if (::unlink(change.path.c_str()) == 0 || errno == ENOENT)
+            {
+                ++result.removed;
+                emptied.insert(detail::parent_dir(change.path));
+            }
+            else
+            {
+                throw std::runtime_error("Failed to remove " + change.path + ": " + std::strerror(errno));
+            }
+        }
+
+        // Directories left empty go, deepest first; a file may need the name of one of them
+        for (auto it = emptied.rbegin(); it != emptied.rend(); ++it)
+        {
+            for (std::string dir = *it; !dir.empty() && !needed.count(dir); dir = detail::parent_dir(dir))
+            {
+                if (::rmdir(dir.c_str()) != 0)
+                {
+                    break;
+                }
+            }
+        }
+        for (const auto &dir : needed)
+        {
+            struct stat st;
+            if (::lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+            {
+                std::filesystem::create_directories(dir);
+            }
+        }
+
+        std::vector<kit_index::StatData> stats(changes.size());
+        std::vector<char> mode_only(writes.size(), 0);
+        thread_pool::parallel_for(writes.size(), jobs, [&](size_t k)
+                                  {
+            const Change &change = changes[writes[k]];
+            if (change.from.present() && change.from.oid == change.to.oid && change.from.mode != MODE_SYMLINK &&
+                change.to.mode != MODE_SYMLINK && detail::holds_blob(index, change.path, change.from))
+            {
+                detail::change_mode(change.path, change.to.mode);
+                mode_only[k] = 1;
+            }
+            else
+            {
+                detail::write_file(change.path, change.to);
+            }
+            kit_index::stat_file(change.path, stats[writes[k]]); });
+
+        for (char chmod_only : mode_only)
+        {
+            result.chmodded += chmod_only;
+            result.written += !chmod_only;
+        }
+        update_index(index, changes, &stats);
+
+        span.arg("written", result.written);
+        span.arg("removed", result.removed);
+        span.arg("chmodded", result.chmodded);
+        return result;
+    }
+} // namespace tree_checkout
+
+#endif // TREE_CHECKOUT_HPP
@@ -0,0 +1,283 @@
+#ifndef WORKTREE_HPP
+#define WORKTREE_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <unordered_set>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "constants.hpp"
+#include "index.hpp"
+#include "pathspec.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+// Working tree scanner.
+//
+// Directories are read in parallel on a work-stealing pool and every file is reported as a
+// (repository-relative path, stat data) record; file contents are never opened here, so callers
+// only read the files whose stat data disagrees with the index. The scan never descends into
+// `.kit`, into build trees (directories holding a CMakeCache.txt) or into directories matched by
+// `.kitignore`, unless the index tracks something below them.
+namespace worktree
+{
+    // A file found in the working tree
+    struct FileRecord
+    {
+        std::string path;
+        kit_index::StatData stat;
+    };
+
+    // Patterns from `.kitignore`: one glob per line, `#` starts a comment. A trailing `/` only
+    // matches directories; a pattern without any other `/` matches the name at any depth, one
+    // with a `/` is matched against the whole path from the top of the working tree.
+    class IgnoreRules
+    {
+    public:
+        IgnoreRules() = default;
+
+        static IgnoreRules load(const std::string &path = IGNORE_FILE)
+        {
+            IgnoreRules rules;
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line))
+            {
+                while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+                {
+                    line.pop_back();
+                }
+                if (line.empty() || line[0] == '#')
+                {
+                    continue;
+                }
+                rules.add(line);
+            }
+            return rules;
+        }
+
+        void add(std::string pattern)
+        {
+            Rule rule;
+            if (pattern.back() == '/')
+            {
+                rule.directory_only = true;
+                pattern.pop_back();
+            }
+            if (pattern.empty())
+            {
+                return;
+            }
+            rule.anchored = pattern.find('/') != std::string::npos;
+            if (pattern[0] == '/')
+            {
+                pattern.erase(0, 1);
+            }
+            rule.pattern = std::move(pattern);
+            rules_.push_back(std::move(rule));
+        }
+
+        bool empty() const { return rules_.empty(); }
+
+        bool is_ignored(const std::string &path, bool is_directory) const
+        {
+            size_t slash = path.rfind('/');
+            const char *name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+            for (const auto &rule : rules_)
+            {
+                if (rule.directory_only && !is_directory)
+                {
+                    continue;
+                }
+                if (pathspec::match(rule.pattern.c_str(), rule.anchored ? path.c_str() : name))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        struct Rule
+        {
+            std::string pattern;
+            bool directory_only = false;
+            bool anchored = false;
+        };
+
+        std::vector<Rule> rules_;
+    };
+
+    struct ScanOptions
+    {
+        unsigned jobs = 0;
+        const kit_index::Index *index = nullptr; // tracked paths are reported even when ignored
+    };
+
+    namespace detail
+    {
+        // Marker file of a CMake build tree
+        constexpr char BUILD_TREE_MARKER[] = "CMakeCache.txt";
+
+        // A directory waiting to be read; inside an ignored directory only tracked paths are kept
+        struct PendingDir
+        {
+            std::string path;
+            bool ignored = false;
+        };
+
+        struct DirEntry
+        {
+            std::string name;
+            unsigned char type;
+        };
+
+        // Read the names and types of a directory's entries, without `.` and `..`
+        inline std::vector<DirEntry> read_directory(const std::string &dir)
+        {
+            std::vector<DirEntry> entries;
+            DIR *handle = ::opendir(dir.empty() ? "." : dir.c_str());
+            if (!handle)
+            {
+                return entries;
+            }
+            while (const struct dirent *entry = ::readdir(handle))
+            {
+                const char *name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                {
+                    continue;
+                }
+                entries.push_back({name, entry->d_type});
+            }
+            ::closedir(handle);
+            return entries;
+        }
+
+        // Every directory containing a tracked file
+        inline std::unordered_set<std::string> tracked_directories(const kit_index::Index &index)
+        {
+            std::unordered_set<std::string> dirs;
+            for (const auto &entry : index.entries)
+            {
+                for (size_t slash = entry.path.rfind('/'); slash != std::string::npos && slash > 0;
+                     slash = entry.path.rfind('/', slash - 1))
+                {
+                    if (!dirs.insert(entry.path.substr(0, slash)).second)
+                    {
+                        break;
+                    }
+                }
+            }
+            return dirs;
+        }
+    } // namespace detail
+
+    // Scan the working tree below `root` and return its files sorted by path
+    inline std::vector<FileRecord> scan(const std::string &root = ".", const ScanOptions &options = {})
+    {
+        trace::Span span("worktree.scan");
+        const IgnoreRules rules = IgnoreRules::load();
+        const std::unordered_set<std::string> tracked_dirs =
+            options.index ? detail::tracked_directories(*options.index) : std::unordered_set<std::string>{};
+
+        auto is_tracked_file = [&](const std::string &path)
+        {
+            return options.index && kit_index::find_entry(*options.index, path) != nullptr;
+        };
+        auto is_tracked_dir = [&](const std::string &path)
+        {
+            return tracked_dirs.count(path) > 0;
+        };
+
+        std::string start = kit_index::normalize_path(root);
+        if (start == ".")
+        {
+            start.clear();
+        }
+
+        thread_pool::WorkStealingPool<detail::PendingDir> pool(options.jobs);
+        std::vector<std::vector<FileRecord>> found(pool.size());
+
+        pool.run({detail::PendingDir{start}}, [&](const detail::PendingDir &pending, unsigned worker, auto &spawn)
+                 {
+            const std::string &dir = pending.path;
+            std::vector<detail::DirEntry> entries = detail::read_directory(dir);
+            if (dir != start && !is_tracked_dir(dir))
+            {
+                for (const auto &entry : entries)
+                {
+                    if (entry.name == detail::BUILD_TREE_MARKER)
+                    {
+                        return;
+                    }
+                }
+            }
+
+            for (auto &entry : entries)
+            {
+                std::string path = dir.empty() ? entry.name : dir + "/" + entry.name;
+                unsigned char type = entry.type;
+                if (type == DT_UNKNOWN)
+                {
+                    // Some filesystems do not report entry types; fall back to lstat
+                    struct stat st;
+                    if (::lstat(path.c_str(), &st) != 0)
+                    {
+                        continue;
+                    }
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK
+                                                      : S_ISREG(st.st_mode)   ? DT_REG
+                                                                              : DT_UNKNOWN;
+                }
+
+                if (type == DT_DIR)
+                {
+                    if (entry.name == KIT_DIR)
+                    {
+                        continue;
+                    }
+                    bool ignored = pending.ignored || (!rules.empty() && rules.is_ignored(path, true));
+                    if (ignored && !is_tracked_dir(path))
+                    {
+                        continue;
+                    }
+                    spawn(detail::PendingDir{std::move(path), ignored});
+                }
+                else if (type == DT_REG || type == DT_LNK)
+                {
+                    bool ignored = pending.ignored || (!rules.empty() && rules.is_ignored(path, false));
+                    if (ignored && !is_tracked_file(path))
+                    {
+                        continue;
+                    }
+                    kit_index::StatData stat;
+                    if (kit_index::stat_file(path, stat))
+                    {
+                        found[worker].push_back({std::move(path), stat});
+                    }
+                }
+            } });
+
+        std::vector<FileRecord> files;
+        size_t total = 0;
+        for (const auto &batch : found)
+        {
+            total += batch.size();
+        }
+        files.reserve(total);
+        for (auto &batch : found)
+        {
+            std::move(batch.begin(), batch.end(), std::back_inserter(files));
+        }
+        std::sort(files.begin(), files.end(), [](const FileRecord &a, const FileRecord &b)
+                  { return a.path < b.path; });
+        span.arg("files", files.size());
+        return files;
+    }
+} // namespace worktree
+
+#endif // WORKTREE_HPP
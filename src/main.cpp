@@ -4,14 +4,33 @@
 
 int main(int argc, char *argv[])
 {
+    trace::start_from_environment();
+
     try
     {
         // Define CLI options
         cxxopts::Options options("kit", "Kit - A minimal version control system");
 
-        options.add_options()("init", "Initialize a new kit repository")("add", "Add file(s) to the staging area", cxxopts::value<std::vector<std::string>>())("commit", "Commit staged files", cxxopts::value<std::string>())("status", "Show repository status")("log", "Show commit history")("stash", "Stash changes temporarily")("branch", "Manage branches")("checkout", "Switch branches", cxxopts::value<std::string>())("merge", "Merge branches", cxxopts::value<std::string>())("reset", "Reset to a specific commit", cxxopts::value<std::string>())("diff", "Show differences between commits or the working directory")("version", "Show the version of kit-vcs")("h,help", "Print help");
+        options.add_options()("init", "Initialize a new kit repository")("object-format", "Object id hash for init: sha1 or sha256", cxxopts::value<std::string>()->default_value("sha1"))("add", "Add files, directories or pathspecs to the staging area", cxxopts::value<std::vector<std::string>>())("j,jobs", "Number of worker threads", cxxopts::value<unsigned>()->default_value("0"))("commit", "Commit staged files", cxxopts::value<std::string>())("status", "Show repository status")("log", "Show commit history")("stash", "Stash changes: push, list, show, apply, pop or drop", cxxopts::value<std::string>()->implicit_value("push"))("stash-entry", "Stash that stash show, apply, pop and drop act on", cxxopts::value<std::string>()->default_value("stash@{0}"))("stash-message", "Description of the stash that stash push saves", cxxopts::value<std::string>()->default_value(""))("branch", "Manage branches")("checkout", "Switch branches", cxxopts::value<std::string>())("merge", "Merge branches", cxxopts::value<std::string>())("merge-base", "Find common ancestors of commits", cxxopts::value<std::vector<std::string>>())("all", "Show all merge bases")("octopus", "Find merge bases for an octopus merge")("reset", "Reset to a specific commit", cxxopts::value<std::string>())("soft", "Reset only the branch")("mixed", "Reset the branch and the index (default)")("hard", "Reset the branch, the index and the working tree")("diff", "Show differences between commits or the working directory")("U,unified", "Lines of context in diffs", cxxopts::value<size_t>()->default_value("3"))("stat", "Show a diffstat instead of a patch")("numstat", "Show machine-readable diff statistics")("diff-algorithm", "Diff algorithm: histogram or myers", cxxopts::value<std::string>()->default_value("histogram"))("repack", "Pack loose objects into a packfile")("gc", "Remove unreachable objects and repack")("prune", "Age of the unreachable objects gc deletes", cxxopts::value<std::string>()->default_value("2.weeks.ago"))("commit-graph", "Write the commit-graph", cxxopts::value<std::string>())("pack-refs", "Pack branch refs into packed-refs")("batch", "Answer requests read from stdin")("buffer", "In batch mode, flush responses only on request")("reflog", "Show the reflog of HEAD or a branch, or expire old entries", cxxopts::value<std::string>()->implicit_value("HEAD"))("expire", "Age of the reflog entries that reflog=expire drops", cxxopts::value<std::string>()->default_value("90.days.ago"))("rev-parse", "Print the object id of a revision", cxxopts::value<std::string>())("daemon", "Control the repository daemon: start, run, stop or status", cxxopts::value<std::string>())("idle-timeout", "Seconds without requests before the daemon exits (0: never)", cxxopts::value<int>()->default_value("600"))("fsmonitor", "Control the filesystem monitor: start, run, stop or status", cxxopts::value<std::string>())("trace", "Write a Chrome trace of this command to a file", cxxopts::value<std::string>()->implicit_value(trace::DEFAULT_FILE))("q,quiet", "Only print warnings and errors")("v,verbose", "Also print debug messages")("log-file", "Append log messages to a file", cxxopts::value<std::string>())("version", "Show the version of kit-vcs")("h,help", "Print help");
 
         auto result = options.parse(argc, argv);
+        logger::configure_from_environment();
+        if (result.count("quiet"))
+        {
+            logger::set_level(logger::Level::Warning);
+        }
+        if (result.count("verbose"))
+        {
+            logger::set_level(logger::Level::Debug);
+        }
+        if (result.count("log-file"))
+        {
+            logger::open_file(result["log-file"].as<std::string>());
+        }
+        if (result.count("trace"))
+        {
+            trace::start(result["trace"].as<std::string>());
+        }
 
         // Handle help command or no arguments
         if (result.count("help") || argc == 1)
@@ -30,11 +49,11 @@ int main(int argc, char *argv[])
         // Handle other commands
         if (result.count("init"))
         {
-            cli::handle_init();
+            cli::handle_init(result["object-format"].as<std::string>());
         }
         if (result.count("add"))
         {
-            cli::handle_add(result["add"].as<std::vector<std::string>>());
+            cli::handle_add(result["add"].as<std::vector<std::string>>(), result["jobs"].as<unsigned>());
         }
         if (result.count("commit"))
         {
@@ -50,7 +69,8 @@ int main(int argc, char *argv[])
         }
         if (result.count("stash"))
         {
-            cli::handle_stash();
+            cli::handle_stash(result["stash"].as<std::string>(), result["stash-entry"].as<std::string>(),
+                              result["stash-message"].as<std::string>(), result["jobs"].as<unsigned>());
         }
         if (result.count("branch"))
         {
@@ -58,20 +78,80 @@ int main(int argc, char *argv[])
         }
         if (result.count("checkout"))
         {
-            cli::handle_checkout(result["checkout"].as<std::string>());
+            cli::handle_checkout(result["checkout"].as<std::string>(), result["jobs"].as<unsigned>());
         }
         if (result.count("merge"))
         {
             cli::handle_merge(result["merge"].as<std::string>());
         }
+        if (result.count("merge-base"))
+        {
+            cli::handle_merge_base(result["merge-base"].as<std::vector<std::string>>(), result.count("all") > 0,
+                                   result.count("octopus") > 0);
+        }
         if (result.count("reset"))
         {
-            cli::handle_reset(result["reset"].as<std::string>());
+            kit_vcs::ResetMode mode = kit_vcs::ResetMode::Mixed;
+            if (result.count("soft"))
+            {
+                mode = kit_vcs::ResetMode::Soft;
+            }
+            else if (result.count("hard"))
+            {
+                mode = kit_vcs::ResetMode::Hard;
+            }
+            cli::handle_reset(result["reset"].as<std::string>(), mode, result["jobs"].as<unsigned>());
         }
         if (result.count("diff"))
         {
-            cli::handle_diff();
+            kit_vcs::DiffOptions diff_options;
+            diff_options.context = result["unified"].as<size_t>();
+            diff_options.stat = result.count("stat") > 0;
+            diff_options.numstat = result.count("numstat") > 0;
+            if (result["diff-algorithm"].as<std::string>() == "myers")
+            {
+                diff_options.algorithm = line_diff::Algorithm::Myers;
+            }
+            cli::handle_diff(diff_options);
+        }
+        if (result.count("repack"))
+        {
+            cli::handle_repack();
+        }
+        if (result.count("gc"))
+        {
+            cli::handle_gc(result["prune"].as<std::string>(), result["jobs"].as<unsigned>());
+        }
+        if (result.count("commit-graph"))
+        {
+            cli::handle_commit_graph(result["commit-graph"].as<std::string>());
+        }
+        if (result.count("reflog"))
+        {
+            cli::handle_reflog(result["reflog"].as<std::string>(), result["expire"].as<std::string>());
+        }
+        if (result.count("batch"))
+        {
+            cli::handle_batch(result.count("buffer") > 0);
+        }
+        if (result.count("pack-refs"))
+        {
+            cli::handle_pack_refs();
+        }
+        if (result.count("rev-parse"))
+        {
+            cli::handle_rev_parse(result["rev-parse"].as<std::string>());
+        }
+        if (result.count("daemon"))
+        {
+            cli::handle_daemon(result["daemon"].as<std::string>(), result["idle-timeout"].as<int>());
+        }
+        if (result.count("fsmonitor"))
+        {
+            cli::handle_fsmonitor(result["fsmonitor"].as<std::string>());
         }
+        logger::debug([]
+                      { return object_db::describe_stats(); });
     }
     catch (const cxxopts::exceptions::invalid_option_syntax &e)
     {
@@ -1,5 +1,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <sstream>
+#include <random>
+#include <set>
+#include <thread>
 #include "../include/kit_vcs.hpp"
 #include "../include/utils/kit_utils.hpp"
 
@@ -10,7 +14,7 @@ class MockKitUtils
 {
 public:
     MOCK_METHOD(std::string, find_common_ancestor, (const std::string &, const std::string &), ());
-    MOCK_METHOD((std::unordered_map<std::string, std::string>), perform_three_way_merge,
+    MOCK_METHOD(kit_utils::MergedFiles, perform_three_way_merge,
                 (const std::string &, const std::string &, const std::string &), ());
     MOCK_METHOD(bool, ensure_repository_initialized, (), ());
     MOCK_METHOD(void, create_file, (const std::string &, const std::string &), ());
@@ -21,6 +25,8 @@ public:
 void initialize_repository()
 {
     kit_utils::initialize_repository();
+    pack::reload();
+    commit_graph::reload();
     ASSERT_TRUE(std::filesystem::exists(".kit"));
 }
 
@@ -28,6 +34,10 @@ void initialize_repository()
 void cleanup_repository()
 {
     std::filesystem::remove_all(".kit");
+    // The pack and commit-graph registries and the object cache are process-wide
+    pack::reload();
+    commit_graph::reload();
+    object_db::clear();
 }
 
 // Test for `merge` command
@@ -38,9 +48,9 @@ TEST(MergeTest, MergeBranch_Success)
     kit_utils::create_file(".kit/refs/heads/branch2", "commit2");
 
     MockKitUtils mock_kit_utils;
-    std::unordered_map<std::string, std::string> mock_merged_files = {
-        {"file1.txt", "Merged content of file1"},
-        {"file2.txt", "Merged content of file2"}};
+    kit_utils::MergedFiles mock_merged_files = {
+        {"file1.txt", {"", tree_object::MODE_FILE, "Merged content of file1"}},
+        {"file2.txt", {"", tree_object::MODE_FILE, "Merged content of file2"}}};
 
     EXPECT_CALL(mock_kit_utils, find_common_ancestor(_, _)).WillOnce(Return("common_commit"));
     EXPECT_CALL(mock_kit_utils, perform_three_way_merge(_, _, _)).WillOnce(Return(mock_merged_files));
@@ -95,7 +105,7 @@ TEST(CommitTest, CreateCommit_Success)
     std::string commit_hash = kit_utils::create_commit(files, commit_message);
 
     ASSERT_FALSE(commit_hash.empty());
-    ASSERT_TRUE(std::filesystem::exists(".kit/objects/" + commit_hash));
+    ASSERT_TRUE(std::filesystem::exists(".kit/objects/" + commit_hash.substr(0, 2) + "/" + commit_hash.substr(2)));
 
     cleanup_repository();
 }
@@ -127,3 +137,1486 @@ TEST(StashTest, StashChanges_Success)
 
     cleanup_repository();
 }
+
+// Test for the binary index
+TEST(IndexTest, SaveAndLoad_Success)
+{
+    initialize_repository();
+
+    kit_index::Index index;
+    kit_index::Entry entry;
+    entry.path = "dir/file1.txt";
+    entry.oid = object_id::ObjectId::from_hex(hash_object::compute_sha1("Content of file1"));
+    entry.stat.mode = 0100644;
+    entry.stat.size = 16;
+    entry.stat.mtime_ns = 1234567890;
+    kit_index::upsert_entry(index, entry);
+    kit_index::save(index);
+
+    auto loaded = kit_index::load();
+    ASSERT_EQ(loaded.entries.size(), 1u);
+    ASSERT_EQ(loaded.entries[0].path, "dir/file1.txt");
+    ASSERT_EQ(loaded.entries[0].oid, entry.oid);
+    ASSERT_TRUE(loaded.entries[0].stat == entry.stat);
+
+    cleanup_repository();
+}
+
+// Test that index writers hold the lock across read-modify-write
+TEST(IndexTest, UpdateHoldsLock_Success)
+{
+    initialize_repository();
+
+    auto make_entry = [](const std::string &path)
+    {
+        kit_index::Entry entry;
+        entry.path = path;
+        entry.oid = object_id::ObjectId::from_hex(hash_object::compute_sha1(path));
+        entry.stat.mode = 0100644;
+        return entry;
+    };
+    const std::string lock_path = INDEX_FILE + ".lock";
+    {
+        kit_index::Update update;
+        kit_index::upsert_entry(update.index(), make_entry("a.txt"));
+        ASSERT_TRUE(std::filesystem::exists(lock_path));
+        ASSERT_THROW(lock_file::LockFile{INDEX_FILE}, std::runtime_error);
+        ASSERT_FALSE(kit_index::save_refreshed(kit_index::Index()));
+        update.commit();
+    }
+    ASSERT_FALSE(std::filesystem::exists(lock_path));
+    ASSERT_EQ(kit_index::load().entries.size(), 1u);
+
+    // An update that is not committed leaves the index as it was and removes its lock
+    {
+        kit_index::Update update;
+        kit_index::upsert_entry(update.index(), make_entry("b.txt"));
+    }
+    ASSERT_FALSE(std::filesystem::exists(lock_path));
+    ASSERT_EQ(kit_index::load().entries.size(), 1u);
+
+    // Concurrent writers are serialized, so no update is lost
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t)
+    {
+        writers.emplace_back([&, t]
+                             {
+                                 for (int i = 0; i < 10; ++i)
+                                 {
+                                     kit_index::Update update;
+                                     kit_index::upsert_entry(update.index(), make_entry("w" + std::to_string(t) + "_" + std::to_string(i)));
+                                     update.commit();
+                                 } });
+    }
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    ASSERT_EQ(kit_index::load().entries.size(), 41u);
+
+    cleanup_repository();
+}
+
+// Test that blobs round-trip through the fan-out object store and are written once
+TEST(ObjectStoreTest, BlobRoundTripAndFanOut_Success)
+{
+    initialize_repository();
+
+    const std::string content = "blob content\nwith two lines\n";
+    std::string id = object_store::write_object("blob", content);
+    ASSERT_EQ(id, object_store::hash_object("blob", content));
+    ASSERT_EQ(object_store::object_path(id), OBJECTS_DIR + "/" + id.substr(0, 2) + "/" + id.substr(2));
+    ASSERT_TRUE(std::filesystem::exists(object_store::object_path(id)));
+
+    std::string type;
+    ASSERT_EQ(object_store::read_object(id, &type), content);
+    ASSERT_EQ(type, "blob");
+
+    auto count_objects = []
+    {
+        size_t count = 0;
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(OBJECTS_DIR))
+        {
+            count += entry.is_regular_file() ? 1 : 0;
+        }
+        return count;
+    };
+    size_t stored = count_objects();
+    ASSERT_EQ(object_store::write_object("blob", content), id);
+    kit_utils::create_file("same.txt", content);
+    ASSERT_TRUE(kit_vcs::stage_file("same.txt"));
+    ASSERT_EQ(kit_index::find_entry(kit_index::load(), "same.txt")->oid.hex(), id);
+    ASSERT_EQ(count_objects(), stored);
+
+    std::filesystem::remove("same.txt");
+    cleanup_repository();
+}
+
+// Test for pack deltas
+TEST(PackTest, DeltaRoundTrip_Success)
+{
+    std::string base;
+    for (int i = 0; i < 200; ++i)
+    {
+        base += "line " + std::to_string(i) + " of the base file\n";
+    }
+    std::string target = base;
+    target.insert(target.size() / 2, "a line added in the middle\n");
+
+    delta::DeltaIndex index(base);
+    std::string encoded;
+    ASSERT_TRUE(delta::create(index, target, encoded, target.size()));
+    ASSERT_LT(encoded.size(), target.size() / 10);
+    ASSERT_EQ(delta::apply(base, encoded), target);
+
+    // Corrupt deltas throw instead of reading past the base, the delta or the result
+    auto header = [&](std::uint64_t result_size)
+    {
+        std::string out;
+        binary_io::put_varint(out, base.size());
+        binary_io::put_varint(out, result_size);
+        return out;
+    };
+    std::string past_base = header(16);
+    delta::detail::emit_copy(past_base, base.size() - 8, 16);
+    ASSERT_THROW(delta::apply(base, past_base), std::runtime_error);
+    std::string truncated = header(16) + std::string(1, static_cast<char>(0x91)); // offset and size bytes missing
+    ASSERT_THROW(delta::apply(base, truncated), std::runtime_error);
+    std::string short_insert = header(16) + std::string(1, static_cast<char>(10)) + "abc";
+    ASSERT_THROW(delta::apply(base, short_insert), std::runtime_error);
+    std::string overflow = header(4) + std::string(1, static_cast<char>(8)) + "12345678";
+    ASSERT_THROW(delta::apply(base, overflow), std::runtime_error);
+    std::string oversized = header(std::uint64_t(1) << 40) + std::string(1, static_cast<char>(1)) + "x";
+    ASSERT_THROW(delta::apply(base, oversized), std::runtime_error);
+}
+
+// Test for tree objects and the cached tree
+TEST(TreeTest, WriteTreeFromIndex_Success)
+{
+    initialize_repository();
+
+    kit_index::Index index;
+    for (const std::string path : {"a.txt", "dir/b.txt", "dir/sub/c.txt"})
+    {
+        kit_index::Entry entry;
+        entry.path = path;
+        entry.oid = object_id::ObjectId::from_hex(object_store::write_object("blob", path));
+        kit_index::upsert_entry(index, entry);
+    }
+
+    std::string root = tree_object::write_tree(index);
+    ASSERT_EQ(index.cache_tree.size(), 3u);
+    ASSERT_EQ(tree_object::read_tree_files(root).size(), 3u);
+
+    // Changing one file invalidates only the directories above it
+    kit_index::Entry changed;
+    changed.path = "dir/b.txt";
+    changed.oid = object_id::ObjectId::from_hex(object_store::write_object("blob", "changed"));
+    kit_index::upsert_entry(index, changed);
+    ASSERT_EQ(index.cache_tree.count("dir/sub"), 1u);
+    ASSERT_EQ(index.cache_tree.count("dir"), 0u);
+
+    size_t trees_written = 0;
+    ASSERT_NE(tree_object::write_tree(index, &trees_written), root);
+    ASSERT_EQ(trees_written, 2u);
+
+    cleanup_repository();
+}
+
+// Test for the commit-graph and its incremental layers
+TEST(CommitGraphTest, WriteAndAppend_Success)
+{
+    initialize_repository();
+    commit_graph::reload();
+
+    std::string tree = tree_object::write_tree(std::map<std::string, std::string>{});
+    std::string first = kit_utils::write_commit(tree, "first");
+    std::string second = kit_utils::write_commit(tree, "second");
+
+    ASSERT_EQ(commit_graph::write({second}), 2u);
+    std::string third = kit_utils::write_commit(tree, "third");
+
+    auto graph = commit_graph::graph();
+    ASSERT_NE(graph, nullptr);
+    ASSERT_EQ(graph->size(), 3u);
+
+    std::uint32_t position;
+    ASSERT_TRUE(graph->find(third, position));
+    auto info = graph->info(position);
+    ASSERT_EQ(info.tree.hex(), tree);
+    ASSERT_EQ(info.parents, std::vector<object_id::ObjectId>{object_id::ObjectId::from_hex(second)});
+    ASSERT_EQ(info.generation, 3u);
+    ASSERT_EQ(kit_utils::get_parent_commit(second), first);
+    ASSERT_FALSE(std::filesystem::exists(commit_graph::GRAPH_FILE + ".lock"));
+    ASSERT_FALSE(std::filesystem::exists(commit_graph::CHAIN_FILE + ".lock"));
+
+    // A held chain lock makes the append fail without touching the chain or losing the commit
+    {
+        lock_file::LockFile held(commit_graph::CHAIN_FILE);
+        std::string fourth = kit_utils::write_commit(tree, "fourth");
+        ASSERT_EQ(kit_utils::resolve_head(), fourth);
+    }
+    commit_graph::reload();
+    ASSERT_EQ(commit_graph::graph()->size(), 3u);
+
+    cleanup_repository();
+    commit_graph::reload();
+}
+
+// Test for merge-base computation on a criss-cross history
+TEST(MergeBaseTest, CrissCross_Success)
+{
+    initialize_repository();
+    commit_graph::reload();
+
+    std::string tree = tree_object::write_tree(std::map<std::string, std::string>{});
+    auto commit = [&](const std::vector<std::string> &parents, const std::string &message)
+    {
+        commit_object::Commit c;
+        c.tree = tree;
+        c.parents = parents;
+        c.message = message;
+        return object_store::write_object("commit", commit_object::serialize(c));
+    };
+
+    std::string root = commit({}, "root");
+    std::string a = commit({root}, "a");
+    std::string b = commit({root}, "b");
+    std::string left = commit({a, b}, "left");
+    std::string right = commit({b, a}, "right");
+
+    auto bases = merge_base::merge_bases(left, right);
+    std::sort(bases.begin(), bases.end());
+    std::vector<std::string> expected{a, b};
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(bases, expected);
+    ASSERT_EQ(merge_base::merge_base(a, b), root);
+    ASSERT_TRUE(merge_base::is_ancestor(root, left));
+    ASSERT_EQ(merge_base::octopus_bases({left, right, a}), std::vector<std::string>{a});
+
+    cleanup_repository();
+}
+
+// Test for the line diff engine and unified output
+TEST(LineDiffTest, UnifiedOutput_Success)
+{
+    std::string old_text = "a\nb\nc\nd\ne\nf\ng\nh\n";
+    std::string new_text = "a\nB\nc\nd\ne\nf\ng\nh\ni";
+
+    for (auto algorithm : {line_diff::Algorithm::Histogram, line_diff::Algorithm::Myers})
+    {
+        auto diff = line_diff::diff(old_text, new_text, algorithm);
+        ASSERT_EQ(diff.insertions(), 2u);
+        ASSERT_EQ(diff.deletions(), 1u);
+
+        std::ostringstream out;
+        line_diff::write_unified(out, diff, 1);
+        ASSERT_EQ(out.str(), "@@ -1,3 +1,3 @@\n a\n-b\n+B\n c\n"
+                             "@@ -8 +8,2 @@\n h\n+i\n\\ No newline at end of file\n");
+    }
+}
+
+// Test for the working tree scanner
+TEST(WorktreeTest, ScanSkipsIgnoredAndBuildTrees_Success)
+{
+    for (const auto *dir : {"scan_root/a", "scan_root/b", "scan_root/logs", "scan_root/out", "scan_root/.kit"})
+    {
+        std::filesystem::create_directories(dir);
+    }
+    for (const auto *file : {"scan_root/a/same.txt", "scan_root/b/same.txt", "scan_root/b/debug.tmp",
+                             "scan_root/logs/run.log", "scan_root/logs/keep.log", "scan_root/out/CMakeCache.txt",
+                             "scan_root/out/app.o", "scan_root/.kit/HEAD"})
+    {
+        kit_utils::create_file(file, "content");
+    }
+    kit_utils::create_file(".kitignore", "# build noise\nlogs/\n*.tmp\n");
+
+    kit_index::Index index;
+    index.entries.push_back({"scan_root/logs/keep.log", {}, {}});
+
+    worktree::ScanOptions options;
+    options.jobs = 4;
+    options.index = &index;
+    std::vector<std::string> paths;
+    for (const auto &record : worktree::scan("scan_root", options))
+    {
+        ASSERT_EQ(record.stat.size, 7u);
+        paths.push_back(record.path);
+    }
+
+    std::vector<std::string> expected{"scan_root/a/same.txt", "scan_root/b/same.txt", "scan_root/logs/keep.log"};
+    ASSERT_EQ(paths, expected);
+
+    std::filesystem::remove_all("scan_root");
+    std::filesystem::remove(".kitignore");
+}
+
+// Test for streaming blob hashing and storage
+TEST(ObjectStreamTest, StreamedBlobMatchesInMemory_Success)
+{
+    initialize_repository();
+
+    std::string content;
+    for (size_t i = 0; content.size() < 3 * object_store::STREAM_CHUNK_SIZE + 17; ++i)
+    {
+        content += "line " + std::to_string(i) + "\n";
+    }
+    kit_utils::create_file("streamed.txt", content);
+
+    std::string expected = object_store::hash_object("blob", content);
+    ASSERT_EQ(object_store::hash_file("streamed.txt"), expected);
+    ASSERT_EQ(object_store::stream_object(reinterpret_cast<const unsigned char *>(content.data()), content.size()),
+              expected);
+    ASSERT_EQ(object_store::write_blob_from_file("streamed.txt"), expected);
+    ASSERT_EQ(object_store::read_object(expected, "blob"), content);
+
+    // Storing a blob the store already has only freshens its file, for small and streamed files alike
+    kit_utils::create_file("small.txt", "small\n");
+    std::string small = object_store::write_blob_from_file("small.txt");
+    auto long_ago = std::filesystem::file_time_type::clock::now() - std::chrono::hours(24 * 30);
+    for (const auto &id : {expected, small})
+    {
+        std::filesystem::last_write_time(object_store::object_path(id), long_ago);
+    }
+    ASSERT_EQ(object_store::write_blob_from_file("streamed.txt"), expected);
+    ASSERT_EQ(object_store::write_blob_from_file("small.txt"), small);
+    for (const auto &id : {expected, small})
+    {
+        ASSERT_GT(std::filesystem::last_write_time(object_store::object_path(id)), long_ago + std::chrono::hours(24));
+    }
+
+    std::filesystem::remove("small.txt");
+    std::filesystem::remove("streamed.txt");
+    cleanup_repository();
+}
+
+// Test for binary object ids and SHA-256 repositories
+TEST(ObjectIdTest, Sha256Repository_Success)
+{
+    std::string hex = hash_object::compute_sha1("abc");
+    object_id::ObjectId oid = object_id::ObjectId::from_hex(hex);
+    ASSERT_EQ(oid.size, 20u);
+    ASSERT_EQ(oid.hex(), hex);
+    object_id::ObjectId invalid;
+    ASSERT_FALSE(object_id::ObjectId::parse("xyz", invalid));
+
+    ASSERT_TRUE(kit_vcs::initialize_repository("sha256"));
+    ASSERT_EQ(hash_object::oid_size(), 32u);
+
+    kit_index::Index index;
+    kit_index::Entry entry;
+    entry.path = "dir/file.txt";
+    std::string blob = object_store::write_object("blob", "content");
+    ASSERT_EQ(blob.size(), 64u);
+    entry.oid = object_id::ObjectId::from_hex(blob);
+    kit_index::upsert_entry(index, entry);
+    kit_index::save(index);
+    kit_index::Index loaded = kit_index::load();
+    ASSERT_EQ(loaded.entries[0].oid, entry.oid);
+
+    std::string tree = tree_object::write_tree(loaded);
+    ASSERT_EQ(tree_object::read_tree_files(tree).at("dir/file.txt"), blob);
+
+    cleanup_repository();
+    hash_object::reload_repository_algorithm();
+}
+
+// Test that config settings are replaced through the lock file
+TEST(ConfigTest, SetReplacesThroughLock_Success)
+{
+    initialize_repository();
+    kit_config::set("first", "1");
+    kit_config::set("second", "2");
+    kit_config::set("first", "one");
+    ASSERT_EQ(kit_config::get("first"), "one");
+    ASSERT_EQ(kit_config::get("second"), "2");
+    ASSERT_FALSE(std::filesystem::exists(CONFIG_FILE + ".lock"));
+
+    // A writer holding the lock keeps the config as it was
+    {
+        lock_file::LockFile held(CONFIG_FILE);
+        ASSERT_THROW(kit_config::set("first", "blocked"), std::runtime_error);
+    }
+    ASSERT_EQ(kit_config::get("first"), "one");
+
+    cleanup_repository();
+}
+
+// Test for the three-way file and tree merge
+TEST(MergeFileTest, ThreeWayMerge_Success)
+{
+    std::string base = "a\nb\nc\nd\ne\nf\ng\n";
+    std::string ours = "A\nb\nc\nd\ne\nf\ng\n";
+    std::string theirs = "a\nb\nc\nd\ne\nf\nG\n";
+    auto clean = merge_file::merge(base, ours, theirs);
+    ASSERT_EQ(clean.conflicts, 0u);
+    ASSERT_EQ(clean.content, "A\nb\nc\nd\ne\nf\nG\n");
+
+    merge_file::Options options;
+    std::string conflicting = "a\nb\nX\ny\ne\nf\nG\n";
+    std::string other = "a\nb\nZ\ny\ne\nf\ng\n";
+    auto conflict = merge_file::merge(base, conflicting, other, options);
+    ASSERT_EQ(conflict.conflicts, 1u);
+    ASSERT_EQ(conflict.content, "a\nb\n<<<<<<< ours\nX\n=======\nZ\n>>>>>>> theirs\ny\ne\nf\nG\n");
+
+    options.style = merge_file::ConflictStyle::Diff3;
+    conflict = merge_file::merge(base, conflicting, other, options);
+    ASSERT_EQ(conflict.content,
+              "a\nb\n<<<<<<< ours\nX\ny\n||||||| base\nc\nd\n=======\nZ\ny\n>>>>>>> theirs\ne\nf\nG\n");
+
+    initialize_repository();
+    auto blob = [](const std::string &content)
+    { return object_store::write_object("blob", content); };
+    std::map<std::string, std::string> base_tree{{"edit.txt", blob(base)}, {"gone.txt", blob("x\n")}};
+    std::map<std::string, std::string> ours_tree{{"edit.txt", blob(ours)}, {"gone.txt", blob("y\n")},
+                                                 {"both.txt", blob("1\n")}, {"mine.txt", blob("m\n")}};
+    std::map<std::string, std::string> theirs_tree{{"edit.txt", blob(theirs)}, {"both.txt", blob("2\n")},
+                                                   {"new.txt", blob("n\n")}};
+
+    auto results = merge_file::merge_trees(base_tree, ours_tree, theirs_tree);
+    std::map<std::string, merge_file::FileResult> by_path;
+    for (auto &file : results)
+    {
+        by_path[file.path] = file;
+    }
+    ASSERT_EQ(by_path.size(), 5u);
+    ASSERT_EQ(by_path["edit.txt"].content, "A\nb\nc\nd\ne\nf\nG\n");
+    ASSERT_EQ(by_path["edit.txt"].conflict, merge_file::Conflict::None);
+    ASSERT_EQ(by_path["gone.txt"].conflict, merge_file::Conflict::ModifyDelete);
+    ASSERT_EQ(by_path["both.txt"].conflict, merge_file::Conflict::AddAdd);
+    ASSERT_EQ(by_path["mine.txt"].oid, ours_tree["mine.txt"]);
+    ASSERT_EQ(by_path["new.txt"].oid, theirs_tree["new.txt"]);
+
+    cleanup_repository();
+}
+
+// Test that a merge keeps untouched files by id and mode and only stores merged content
+TEST(MergeFileTest, ThreeWayMergeKeepsIdsAndModes_Success)
+{
+    initialize_repository();
+    auto commit = [](const std::vector<std::tuple<std::string, std::string, std::uint32_t>> &files)
+    {
+        kit_index::Index index;
+        for (const auto &[path, content, mode] : files)
+        {
+            kit_index::Entry entry;
+            entry.path = path;
+            entry.oid = object_id::ObjectId::from_hex(object_store::write_object("blob", content));
+            entry.stat.mode = mode;
+            index.entries.push_back(std::move(entry));
+        }
+        return kit_utils::write_commit(tree_object::write_tree(index), "commit");
+    };
+    std::string base = commit({{"edit.txt", "a\nb\nc\n", 0100644}, {"run.sh", "echo\n", 0100755},
+                               {"same.txt", "same\n", 0100644}});
+    std::string ours = commit({{"edit.txt", "A\nb\nc\n", 0100644}, {"run.sh", "echo\n", 0100755},
+                               {"same.txt", "same\n", 0100644}});
+    std::string theirs = commit({{"edit.txt", "a\nb\nC\n", 0100644}, {"run.sh", "echo hi\n", 0100755},
+                                 {"same.txt", "same\n", 0100755}});
+
+    auto merged = kit_utils::perform_three_way_merge(base, ours, theirs);
+    ASSERT_EQ(merged.size(), 3u);
+    ASSERT_TRUE(merged["edit.txt"].oid.empty());
+    ASSERT_EQ(merged["edit.txt"].content, "A\nb\nC\n");
+    ASSERT_EQ(merged["run.sh"].oid, object_store::hash_object("blob", "echo hi\n"));
+    ASSERT_TRUE(merged["run.sh"].content.empty());
+    ASSERT_EQ(merged["run.sh"].mode, 0100755u);
+    ASSERT_EQ(merged["same.txt"].mode, 0100755u);
+
+    std::string result = kit_utils::create_commit(merged, "merge");
+    std::vector<kit_index::Entry> entries;
+    tree_object::flatten(kit_utils::read_commit(result)->tree, "", entries);
+    ASSERT_EQ(entries.size(), 3u);
+    ASSERT_EQ(entries[0].path, "edit.txt");
+    ASSERT_EQ(entries[0].oid.hex(), object_store::hash_object("blob", "A\nb\nC\n"));
+    ASSERT_EQ(entries[1].stat.mode, 0100755u);
+    ASSERT_EQ(entries[2].stat.mode, 0100755u);
+
+    cleanup_repository();
+}
+
+// Test for the fsmonitor daemon against a scripted file churn
+TEST(FsmonitorTest, ChurnMatchesFullScan_Success)
+{
+    initialize_repository();
+    std::filesystem::create_directories("churn");
+    kit_utils::create_file(".kitignore", "*.tmp\n");
+
+    fsmonitor::Daemon daemon;
+    std::thread server([&daemon]
+                       { daemon.run(); });
+
+    std::mt19937 random(13);
+    auto pick = [&random](const std::vector<std::string> &items)
+    { return items[random() % items.size()]; };
+    std::vector<std::string> dirs{"churn"};
+    std::vector<std::string> files;
+    auto refresh = [&]
+    {
+        dirs.assign(1, "churn");
+        files.clear();
+        for (const auto &entry : std::filesystem::recursive_directory_iterator("churn"))
+        {
+            (entry.is_directory() ? dirs : files).push_back(entry.path().generic_string());
+        }
+    };
+
+    for (int batch = 0; batch < 30; ++batch)
+    {
+        for (int step = 0; step < 25; ++step)
+        {
+            std::string name = std::to_string(batch) + "_" + std::to_string(step);
+            switch (files.empty() ? 0 : random() % 9)
+            {
+            case 0:
+            case 1:
+                kit_utils::create_file(pick(dirs) + "/f" + name + ".txt", name);
+                break;
+            case 2:
+                kit_utils::create_file(pick(dirs) + "/f" + name + ".tmp", name);
+                break;
+            case 3:
+                std::ofstream(pick(files), std::ios::app) << name;
+                break;
+            case 4:
+                std::filesystem::remove(pick(files));
+                break;
+            case 5:
+                std::filesystem::rename(pick(files), pick(dirs) + "/r" + name + ".txt");
+                break;
+            case 6:
+                std::filesystem::create_directories(pick(dirs) + "/d" + name);
+                break;
+            case 7:
+            {
+                // Move a directory below the top level somewhere that is not inside itself
+                std::string from = pick(dirs), to = pick(dirs);
+                if (from != "churn" && to.rfind(from, 0) != 0)
+                {
+                    std::filesystem::rename(from, to + "/m" + name);
+                }
+                break;
+            }
+            default:
+                if (random() % 3 == 0)
+                {
+                    std::string dir = pick(dirs);
+                    if (dir != "churn")
+                    {
+                        std::filesystem::remove_all(dir);
+                    }
+                }
+                else
+                {
+                    std::string file = pick(files);
+                    if (file.size() > 4 && file.compare(file.size() - 4, 4, ".txt") == 0)
+                    {
+                        kit_vcs::stage_paths({file});
+                    }
+                }
+                break;
+            }
+            refresh();
+        }
+        if (batch % 10 == 9)
+        {
+            // Turning a directory into a build tree hides its untracked files
+            kit_utils::create_file(pick(dirs) + "/CMakeCache.txt", "");
+            refresh();
+        }
+
+        kit_index::Index index = kit_index::load();
+        worktree::ScanOptions options;
+        options.index = &index;
+        auto monitored = fsmonitor::scan(".", options);
+        auto scanned = worktree::scan(".", options);
+        ASSERT_EQ(monitored.size(), scanned.size()) << "batch " << batch;
+        for (size_t i = 0; i < scanned.size(); ++i)
+        {
+            ASSERT_EQ(monitored[i].path, scanned[i].path) << "batch " << batch;
+            ASSERT_TRUE(monitored[i].stat == scanned[i].stat) << monitored[i].path;
+        }
+    }
+
+    // After the first listing the daemon answers with the changed paths only
+    fsmonitor::State state;
+    fsmonitor::Changes changes;
+    ASSERT_TRUE(fsmonitor::load_state(state));
+    ASSERT_TRUE(fsmonitor::query(state.token, changes));
+    ASSERT_FALSE(changes.full);
+
+    std::string reply;
+    ASSERT_TRUE(fsmonitor::request("stop", reply));
+    server.join();
+    ASSERT_FALSE(fsmonitor::is_running());
+
+    std::filesystem::remove_all("churn");
+    std::filesystem::remove(".kitignore");
+    cleanup_repository();
+}
+
+// Test for the object cache and the delta base cache
+TEST(ObjectCacheTest, LruAndObjectReuse_Success)
+{
+    lru_cache::LruCache<int, std::string> cache(10);
+    cache.put(1, std::make_shared<const std::string>("aaaa"), 4);
+    cache.put(2, std::make_shared<const std::string>("bbbb"), 4);
+    ASSERT_EQ(*cache.get(1), "aaaa"); // 1 is now the most recently used
+    cache.put(3, std::make_shared<const std::string>("cccc"), 4);
+    ASSERT_EQ(cache.get(2), nullptr);
+    ASSERT_NE(cache.get(3), nullptr);
+    cache.put(4, std::make_shared<const std::string>("too large"), 11);
+    ASSERT_EQ(cache.get(4), nullptr);
+    auto stats = cache.stats();
+    ASSERT_EQ(stats.hits, 2u);
+    ASSERT_EQ(stats.misses, 2u);
+    ASSERT_EQ(stats.evictions, 1u);
+    ASSERT_EQ(stats.bytes, 8u);
+
+    initialize_repository();
+    std::string content;
+    for (int i = 0; i < 200; ++i)
+    {
+        content += "line " + std::to_string(i) + "\n";
+    }
+    std::map<std::string, std::string> files;
+    for (int version = 0; version < 5; ++version)
+    {
+        content += "version " + std::to_string(version) + "\n";
+        files["file" + std::to_string(version) + ".txt"] = object_store::write_object("blob", content);
+    }
+    std::string tree = tree_object::write_tree(files);
+    commit_object::Commit commit;
+    commit.tree = tree;
+    commit.message = "cached";
+    std::string commit_hash = object_store::write_object("commit", commit_object::serialize(commit));
+
+    auto before = object_db::stats();
+    auto first = object_db::read_commit(commit_hash);
+    auto second = object_db::read_commit(commit_hash);
+    ASSERT_EQ(first.get(), second.get());
+    ASSERT_EQ(tree_object::read_tree(tree).get(), tree_object::read_tree(tree).get());
+    ASSERT_THROW(tree_object::read_tree(commit_hash), std::runtime_error);
+    auto after = object_db::stats();
+    ASSERT_EQ(after.parsed.misses - before.parsed.misses, 2u);
+    ASSERT_EQ(after.parsed.hits - before.parsed.hits, 3u);
+
+    // Every version is a delta against a neighbour, so the bases are inflated once
+    std::string type;
+    std::uint64_t size = 0;
+    object_store::read_object_info(commit_hash, type, size);
+    ASSERT_EQ(type, "commit");
+    ASSERT_EQ(size, commit_object::serialize(commit).size());
+    ASSERT_TRUE(kit_vcs::repack_objects());
+    for (const auto &entry : std::filesystem::directory_iterator(PACK_DIR))
+    {
+        ASSERT_EQ(entry.path().filename().string().rfind("pack-", 0), 0u);
+    }
+    // Packed objects report their size from the entry or delta header
+    for (const auto &[path, oid] : files)
+    {
+        object_store::read_object_info(oid, type, size);
+        ASSERT_EQ(type, "blob");
+        ASSERT_EQ(size, object_store::read_object(oid).size());
+    }
+    before = object_db::stats();
+    for (const auto &[path, oid] : files)
+    {
+        ASSERT_FALSE(object_store::read_object(oid, "blob").empty());
+    }
+    after = object_db::stats();
+    ASSERT_GT(after.delta_bases.hits, before.delta_bases.hits);
+
+    cleanup_repository();
+}
+
+TEST(TraceTest, ChromeTraceJson_Success)
+{
+    initialize_repository();
+    ASSERT_FALSE(trace::enabled());
+    trace::Span untraced("untraced");
+
+    const std::string path = "trace-test.json";
+    trace::start(path);
+    ASSERT_TRUE(trace::enabled());
+    kit_utils::create_file("traced.txt", "traced \"content\"\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"traced.txt"}, 2));
+    {
+        trace::Span span("test.span");
+        span.arg("path", std::string("quoted \"name\""));
+        object_db::clear();
+        ASSERT_FALSE(kit_vcs::get_repository_status().empty());
+    }
+    trace::finish();
+    ASSERT_FALSE(trace::enabled());
+
+    std::string json = kit_utils::read_file(path);
+    ASSERT_EQ(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0u);
+    for (const char *expected : {"\"name\":\"add\"", "\"name\":\"add.hash\"", "\"name\":\"index.load\"",
+                                 "\"name\":\"status\"", "\"ph\":\"X\"", "\"ph\":\"C\"", "\"objects_hashed\":",
+                                 "\"name\":\"thread_name\"", "\"path\":\"quoted \\\"name\\\"\""})
+    {
+        ASSERT_NE(json.find(expected), std::string::npos) << expected;
+    }
+    ASSERT_EQ(json.find("untraced"), std::string::npos);
+    ASSERT_EQ(json.find("\"objects_hashed\":0}"), std::string::npos);
+
+    std::filesystem::remove(path);
+    cleanup_repository();
+}
+
+TEST(LoggerTest, LevelsAndFileSink_Success)
+{
+    logger::Level level;
+    ASSERT_TRUE(logger::parse_level("warning", level));
+    ASSERT_EQ(level, logger::Level::Warning);
+    ASSERT_FALSE(logger::parse_level("loud", level));
+
+    const std::string path = "logger-test.log";
+    std::filesystem::remove(path);
+    std::ostringstream captured;
+    std::streambuf *out = std::cout.rdbuf(captured.rdbuf());
+    logger::open_file(path);
+
+    // Filtered messages are never built
+    logger::set_level(logger::Level::Info);
+    bool built = false;
+    logger::debug([&]
+                  { built = true; return std::string("hidden"); });
+    ASSERT_FALSE(built);
+    for (int i = 0; i < 10000; ++i)
+    {
+        logger::info([i]
+                     { return "line " + std::to_string(i); });
+    }
+    kit_utils::print_message("from kit_utils");
+    logger::set_level(logger::Level::Debug);
+    logger::debug("shown");
+    logger::set_level(logger::Level::Info);
+
+    logger::flush();
+    logger::close_file();
+    std::cout.rdbuf(out);
+
+    std::string console = captured.str();
+    ASSERT_NE(console.find("[kit] line 9999\n"), std::string::npos);
+    ASSERT_NE(console.find("[kit] from kit_utils\n"), std::string::npos);
+    ASSERT_NE(console.find("[DEBUG] shown\n"), std::string::npos);
+    ASSERT_EQ(console.find("hidden"), std::string::npos);
+
+    std::string file = kit_utils::read_file(path);
+    ASSERT_EQ(std::count(file.begin(), file.end(), '\n'), 10002);
+    ASSERT_LT(file.find(" INFO line 0\n"), file.find(" INFO line 9999\n"));
+    ASSERT_NE(file.find(" DEBUG shown\n"), std::string::npos);
+    std::filesystem::remove(path);
+}
+
+TEST(RefsTest, TransactionsAndPackedRefs_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::string first = kit_utils::create_commit({{"a.txt", "a"}}, "first");
+    std::string second = kit_utils::create_commit({{"a.txt", "b"}}, "second");
+    ASSERT_EQ(refs::resolve(refs::HEAD), second);
+    ASSERT_EQ(refs::head_target(), "refs/heads/master");
+
+    // A failed old-value check leaves every ref in the transaction untouched
+    refs::Transaction stale;
+    stale.create("refs/heads/topic", second);
+    stale.update("refs/heads/master", first, first);
+    ASSERT_THROW(stale.commit(), std::runtime_error);
+    ASSERT_FALSE(refs::exists("refs/heads/topic"));
+    ASSERT_EQ(refs::resolve("refs/heads/master"), second);
+    ASSERT_FALSE(std::filesystem::exists(".kit/refs/heads/topic.lock"));
+
+    // So does a lock held by someone else, and the error names the lock file
+    kit_utils::create_file(".kit/refs/heads/master.lock", "");
+    refs::Transaction locked;
+    locked.create("refs/heads/topic", second);
+    locked.update("refs/heads/master", first);
+    try
+    {
+        locked.commit();
+        FAIL() << "commit succeeded while a ref was locked";
+    }
+    catch (const std::runtime_error &e)
+    {
+        ASSERT_NE(std::string(e.what()).find("master.lock"), std::string::npos);
+    }
+    ASSERT_FALSE(refs::exists("refs/heads/topic"));
+    std::filesystem::remove(".kit/refs/heads/master.lock");
+
+    // Moving the checked-out branch also logs to HEAD, so it takes HEAD's lock too
+    kit_utils::create_file(".kit/HEAD.lock", "");
+    refs::Transaction head_locked;
+    head_locked.update("refs/heads/master", first);
+    ASSERT_THROW(head_locked.commit(), std::runtime_error);
+    ASSERT_EQ(refs::resolve("refs/heads/master"), second);
+    std::filesystem::remove(".kit/HEAD.lock");
+
+    // A rename that fails after others succeeded puts them back, and nothing is logged
+    size_t master_log = reflog::count("refs/heads/master");
+    size_t head_log = reflog::count(refs::HEAD);
+    std::filesystem::create_directories(".kit/refs/heads/zz/in-the-way");
+    refs::Transaction blocked;
+    blocked.update("refs/heads/master", first);
+    blocked.create("refs/heads/zz", first);
+    ASSERT_THROW(blocked.commit(), std::runtime_error);
+    ASSERT_EQ(refs::resolve("refs/heads/master"), second);
+    ASSERT_EQ(reflog::count("refs/heads/master"), master_log);
+    ASSERT_EQ(reflog::count(refs::HEAD), head_log);
+    ASSERT_FALSE(std::filesystem::exists(".kit/refs/heads/master.lock"));
+    std::filesystem::remove_all(".kit/refs/heads/zz");
+
+    refs::Transaction branches;
+    for (int i = 0; i < 300; ++i)
+    {
+        branches.create("refs/heads/b" + std::to_string(i), i % 2 ? first : second);
+    }
+    branches.commit();
+    ASSERT_FALSE(refs::is_valid_name("refs/heads/../HEAD"));
+    ASSERT_FALSE(kit_vcs::create_branch("bad..name"));
+
+    ASSERT_EQ(refs::pack_refs(), 301u);
+    ASSERT_FALSE(std::filesystem::exists(".kit/refs/heads/b17"));
+    std::string packed = kit_utils::read_file(PACKED_REFS_FILE);
+    ASSERT_EQ(packed.rfind(refs::PACKED_HEADER + "\n", 0), 0u);
+    for (int i = 0; i < 300; ++i)
+    {
+        ASSERT_EQ(refs::resolve("refs/heads/b" + std::to_string(i)), i % 2 ? first : second) << i;
+    }
+    ASSERT_FALSE(refs::exists("refs/heads/b300"));
+    ASSERT_FALSE(refs::exists("refs/heads/a"));
+    ASSERT_EQ(kit_vcs::list_branches().size(), 301u);
+    ASSERT_EQ(kit_utils::resolve_head(), second);
+
+    // A loose update overrides the packed value; a delete removes both copies
+    kit_utils::update_head(first, second);
+    ASSERT_EQ(kit_utils::resolve_head(), first);
+    ASSERT_TRUE(kit_vcs::delete_branch("b42"));
+    ASSERT_FALSE(refs::exists("refs/heads/b42"));
+    ASSERT_EQ(kit_utils::read_file(PACKED_REFS_FILE).find("refs/heads/b42\n"), std::string::npos);
+    ASSERT_FALSE(kit_vcs::delete_branch("master"));
+
+    cleanup_repository();
+}
+
+TEST(ReflogTest, AppendLookupAndExpire_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::string first = kit_utils::create_commit({{"a.txt", "a"}}, "first");
+    std::string second = kit_utils::create_commit({{"a.txt", "b"}}, "second");
+    ASSERT_TRUE(kit_vcs::reset_to_commit("HEAD@{1}"));
+    ASSERT_EQ(kit_utils::resolve_head(), first);
+
+    // Commits and resets are logged for the branch and for HEAD
+    auto entries = reflog::read("HEAD");
+    ASSERT_EQ(entries.size(), 3u);
+    ASSERT_EQ(entries[0].message, "reset: moving to HEAD@{1}");
+    ASSERT_EQ(entries[0].old_id, second);
+    ASSERT_EQ(entries[2].message, "commit (initial): first");
+    ASSERT_TRUE(entries[2].old_id.empty());
+    ASSERT_EQ(reflog::count("refs/heads/master"), 3u);
+    ASSERT_EQ(kit_utils::resolve_revision("master@{1}"), second);
+    ASSERT_EQ(kit_utils::resolve_revision("@{2}"), first);
+    ASSERT_THROW(kit_utils::resolve_revision("HEAD@{3}"), std::runtime_error);
+
+    // Time lookups binary-search the side index
+    const std::string ref = "refs/heads/timed";
+    for (int i = 0; i < 1000; ++i)
+    {
+        reflog::append(ref, i ? std::to_string(i - 1) : "", std::to_string(i), "step " + std::to_string(i), 1000 + i * 10);
+    }
+    reflog::Entry entry;
+    ASSERT_TRUE(reflog::at_time(ref, 1000 + 500 * 10 + 5, entry));
+    ASSERT_EQ(entry.new_id, "500");
+    ASSERT_FALSE(reflog::at_time(ref, 999, entry));
+    ASSERT_TRUE(reflog::nth(ref, 0, entry));
+    ASSERT_EQ(entry.message, "step 999");
+
+    // An index that lost its tail, or was lost entirely, is rebuilt from the log
+    std::filesystem::resize_file(reflog::index_path(ref), 100 * reflog::RECORD_SIZE);
+    ASSERT_TRUE(reflog::nth(ref, 10, entry));
+    ASSERT_EQ(entry.new_id, "989");
+    std::filesystem::remove(reflog::index_path(ref));
+    ASSERT_EQ(reflog::count(ref), 1000u);
+
+    std::int64_t timestamp;
+    ASSERT_TRUE(reflog::parse_time("2.hours.ago", 10000, timestamp));
+    ASSERT_EQ(timestamp, 10000 - 7200);
+    ASSERT_TRUE(reflog::parse_time("1970-01-02", 0, timestamp));
+    ASSERT_EQ(timestamp, 86400);
+
+    ASSERT_EQ(refs::expire_reflog(ref, 1000 + 900 * 10), 900u);
+    ASSERT_EQ(reflog::count(ref), 100u);
+    ASSERT_TRUE(reflog::nth(ref, 99, entry));
+    ASSERT_EQ(entry.new_id, "900");
+    ASSERT_FALSE(std::filesystem::exists(".kit/refs/heads/timed.lock"));
+
+    // An index left from before a rewrite names the old log, so it is rebuilt rather than trusted
+    std::string stale_index = kit_utils::read_file(reflog::index_path(ref));
+    ASSERT_EQ(refs::expire_reflog(ref, 1000 + 950 * 10), 50u);
+    kit_utils::create_file(reflog::index_path(ref), stale_index);
+    ASSERT_EQ(reflog::count(ref), 50u);
+    ASSERT_TRUE(reflog::nth(ref, 49, entry));
+    ASSERT_EQ(entry.new_id, "950");
+
+    // Concurrent appenders to one log are serialized: every entry is indexed exactly once
+    const std::string busy = "refs/heads/busy";
+    std::vector<std::thread> appenders;
+    for (int t = 0; t < 4; ++t)
+    {
+        appenders.emplace_back([&, t]
+                               {
+                                   for (int i = 0; i < 50; ++i)
+                                   {
+                                       reflog::append(busy, "", std::to_string(t * 50 + i), "append", 1000);
+                                   } });
+    }
+    for (auto &appender : appenders)
+    {
+        appender.join();
+    }
+    std::set<std::string> ids;
+    for (const auto &logged : reflog::read(busy))
+    {
+        ids.insert(logged.new_id);
+    }
+    ASSERT_EQ(ids.size(), 200u);
+    ASSERT_EQ(reflog::count(busy), 200u);
+    ASSERT_EQ(std::filesystem::file_size(reflog::index_path(busy)), 201 * reflog::RECORD_SIZE);
+    ASSERT_FALSE(std::filesystem::exists(reflog::log_path(busy) + ".lock"));
+
+    cleanup_repository();
+}
+
+TEST(BatchTest, RequestsOverStreams_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    kit_utils::create_file("tracked.txt", "one\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"tracked.txt"}));
+    kit_index::Index index = kit_index::load();
+    std::string commit = kit_utils::write_commit(tree_object::write_tree(index), "first");
+    std::string blob = object_store::hash_object("blob", "one\n");
+    kit_utils::create_file("tracked.txt", "two\n");
+    kit_utils::create_file("new.txt", "new\n");
+
+    std::istringstream in("object " + blob + "\ninfo HEAD\nrev-parse master\nref master\nref nope\n"
+                          "status tracked.txt\nstatus new.txt\nstatus gone.txt\nbogus\n\nflush\nrev-parse HEAD@{0}\n");
+    std::ostringstream out;
+    ASSERT_TRUE(kit_vcs::run_batch(in, out, true));
+
+    std::string commit_size = std::to_string(object_store::read_object(commit, "commit").size());
+    std::string expected = blob + " blob 4\none\n\n" +
+                           commit + " commit " + commit_size + "\n" +
+                           commit + "\n" +
+                           commit + " refs/heads/master\n" +
+                           "nope missing\n" +
+                           ".M tracked.txt\n" +
+                           "?? new.txt\n" +
+                           "gone.txt missing\n" +
+                           "error 22\nUnknown request: bogus\n" +
+                           "error 13\nEmpty request\n" +
+                           commit + "\n";
+    ASSERT_EQ(out.str(), expected);
+
+    // The cached index and HEAD tree follow changes made between requests
+    kit_vcs::BatchSession session;
+    std::string response;
+    session.handle("status tracked.txt", response);
+    ASSERT_TRUE(kit_vcs::stage_paths({"tracked.txt"}));
+    session.handle("status tracked.txt", response);
+    ASSERT_EQ(response, ".M tracked.txt\nM. tracked.txt\n");
+
+    // So do the ignore rules
+    response.clear();
+    session.handle("status new.txt", response);
+    kit_utils::create_file(IGNORE_FILE, "new.txt\n");
+    session.handle("status new.txt", response);
+    ASSERT_EQ(response, "?? new.txt\n!! new.txt\n");
+
+    std::filesystem::remove(IGNORE_FILE);
+    std::filesystem::remove("tracked.txt");
+    std::filesystem::remove("new.txt");
+    cleanup_repository();
+}
+
+TEST(DaemonTest, ForwardedRequestsSeeIndexChanges_Success)
+{
+    initialize_repository();
+    kit_utils::create_file("one.txt", "one\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"one.txt"}));
+    ASSERT_FALSE(repo_daemon::is_running());
+
+    auto count_entries = [](const std::string &request)
+    {
+        if (request == "0 fail")
+        {
+            throw std::runtime_error("failed");
+        }
+        return repo_daemon::Reply{request + " " + std::to_string(kit_index::load().entries.size()), "warn\n"};
+    };
+    repo_daemon::Server daemon(count_entries, 0);
+    kit_index::keep_resident(true);
+    std::thread server([&daemon]
+                       { daemon.run(); });
+    ASSERT_TRUE(repo_daemon::is_running());
+
+    repo_daemon::Reply reply;
+    ASSERT_TRUE(repo_daemon::forward("0 count", reply));
+    ASSERT_EQ(reply.out, "0 count 1");
+    ASSERT_EQ(reply.err, "warn\n");
+    // An unchanged index is handed out without copying it
+    auto resident = kit_index::load_shared();
+    ASSERT_EQ(kit_index::load_shared(), resident);
+
+    // Saving the index replaces the file, so the resident copy is not reused
+    kit_utils::create_file("two.txt", "two\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"two.txt"}));
+    ASSERT_TRUE(repo_daemon::forward("0 count", reply));
+    ASSERT_EQ(reply.out, "0 count 2");
+    ASSERT_NE(kit_index::load_shared(), resident);
+
+    ASSERT_TRUE(repo_daemon::forward("0 fail", reply));
+    ASSERT_EQ(reply.out, "");
+    ASSERT_EQ(reply.err, "[kit] Error: failed\n");
+
+    std::string stopped;
+    ASSERT_TRUE(repo_daemon::send("stop", stopped));
+    server.join();
+    kit_index::keep_resident(false);
+    ASSERT_FALSE(repo_daemon::is_running());
+    ASSERT_FALSE(std::filesystem::exists(repo_daemon::SOCKET_FILE));
+    ASSERT_FALSE(repo_daemon::forward("0 count", reply));
+
+    std::filesystem::remove("one.txt");
+    std::filesystem::remove("two.txt");
+    cleanup_repository();
+}
+
+TEST(CheckoutTest, RewritesOnlyChangedFiles_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::filesystem::create_directories("co/same");
+    std::filesystem::create_directories("co/moved");
+    kit_utils::create_file("co/same/keep.txt", "keep\n");
+    kit_utils::create_file("co/edit.txt", "old\n");
+    kit_utils::create_file("co/moved/gone.txt", "gone\n");
+    kit_utils::create_file("co/run.sh", "echo\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"co"}));
+    kit_index::Index index = kit_index::load();
+    std::string base = kit_utils::write_commit(tree_object::write_tree(index), "base");
+    ASSERT_TRUE(kit_vcs::create_branch("other"));
+
+    std::filesystem::remove_all("co/moved");
+    kit_utils::create_file("co/edit.txt", "new\n");
+    kit_utils::create_file("co/moved", "now a file\n");
+    std::filesystem::permissions("co/run.sh", std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+    index = kit_index::load();
+    kit_index::remove_entry(index, "co/moved/gone.txt");
+    kit_index::save(index);
+    ASSERT_TRUE(kit_vcs::stage_paths({"co"}));
+    index = kit_index::load();
+    std::string tip = kit_utils::write_commit(tree_object::write_tree(index), "tip");
+
+    auto changes = tree_checkout::diff_trees(kit_utils::read_commit(tip)->tree, kit_utils::read_commit(base)->tree);
+    std::vector<std::string> paths;
+    for (const auto &change : changes)
+    {
+        paths.push_back(change.path);
+    }
+    ASSERT_EQ(paths, (std::vector<std::string>{"co/edit.txt", "co/moved", "co/moved/gone.txt", "co/run.sh"}));
+
+    // A modified file in the way stops the checkout before anything is written
+    kit_index::StatData untouched;
+    ASSERT_TRUE(kit_index::stat_file("co/same/keep.txt", untouched));
+    kit_utils::create_file("co/edit.txt", "local\n");
+    ASSERT_FALSE(kit_vcs::switch_branch("other"));
+    ASSERT_EQ(kit_utils::read_file("co/edit.txt"), "local\n");
+    ASSERT_EQ(refs::head_target(), "refs/heads/master");
+
+    kit_utils::create_file("co/edit.txt", "new\n");
+    ASSERT_TRUE(kit_vcs::switch_branch("other", 4));
+    ASSERT_EQ(refs::head_target(), "refs/heads/other");
+    ASSERT_EQ(kit_utils::read_file("co/edit.txt"), "old\n");
+    ASSERT_EQ(kit_utils::read_file("co/moved/gone.txt"), "gone\n");
+    ASSERT_EQ(std::filesystem::status("co/run.sh").permissions() & std::filesystem::perms::owner_exec,
+              std::filesystem::perms::none);
+    kit_index::StatData after;
+    ASSERT_TRUE(kit_index::stat_file("co/same/keep.txt", after));
+    ASSERT_EQ(after, untouched);
+
+    // The index matches the target tree and carries the new stat data
+    index = kit_index::load();
+    ASSERT_EQ(tree_object::write_tree(index), kit_utils::read_commit(base)->tree);
+    for (const auto &entry : index.entries)
+    {
+        ASSERT_TRUE(kit_index::stat_file(entry.path, after));
+        ASSERT_EQ(entry.stat, after) << entry.path;
+    }
+
+    ASSERT_TRUE(kit_vcs::switch_branch("master"));
+    ASSERT_EQ(kit_utils::read_file("co/moved"), "now a file\n");
+    ASSERT_FALSE(std::filesystem::exists("co/moved/gone.txt"));
+    index = kit_index::load();
+    ASSERT_EQ(tree_object::write_tree(index), kit_utils::read_commit(tip)->tree);
+
+    std::filesystem::remove_all("co");
+    cleanup_repository();
+}
+
+TEST(ResetTest, ModesRewriteOnlyDifferences_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::filesystem::create_directories("rs");
+    kit_utils::create_file("rs/same.txt", "same\n");
+    kit_utils::create_file("rs/edit.txt", "one\n");
+    kit_utils::create_file("rs/gone.txt", "gone\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"rs"}));
+    kit_index::Index index = kit_index::load();
+    std::string first = kit_utils::write_commit(tree_object::write_tree(index), "first");
+
+    kit_utils::create_file("rs/edit.txt", "two\n");
+    kit_utils::create_file("rs/new.txt", "new\n");
+    std::filesystem::remove("rs/gone.txt");
+    index = kit_index::load();
+    kit_index::remove_entry(index, "rs/gone.txt");
+    kit_index::save(index);
+    ASSERT_TRUE(kit_vcs::stage_paths({"rs"}));
+    index = kit_index::load();
+    std::string second = kit_utils::write_commit(tree_object::write_tree(index), "second");
+    kit_index::StatData same_stat = kit_index::find_entry(index, "rs/same.txt")->stat;
+
+    // --soft moves only the branch
+    ASSERT_TRUE(kit_vcs::reset_to_commit(first, kit_vcs::ResetMode::Soft));
+    ASSERT_EQ(kit_utils::resolve_head(), first);
+    index = kit_index::load();
+    ASSERT_EQ(tree_object::write_tree(index), kit_utils::read_commit(second)->tree);
+
+    // --mixed resets the index but keeps the stat data of unchanged entries and the files
+    ASSERT_TRUE(kit_vcs::reset_to_commit(first, kit_vcs::ResetMode::Mixed));
+    index = kit_index::load();
+    ASSERT_EQ(tree_object::write_tree(index), kit_utils::read_commit(first)->tree);
+    ASSERT_EQ(kit_index::find_entry(index, "rs/same.txt")->stat, same_stat);
+    ASSERT_EQ(kit_utils::read_file("rs/edit.txt"), "two\n");
+    ASSERT_FALSE(std::filesystem::exists("rs/gone.txt"));
+
+    // --hard rewrites what differs, including local edits, and leaves untracked files alone
+    kit_utils::create_file("rs/same.txt", "dirty\n");
+    kit_utils::create_file("rs/untracked.txt", "mine\n");
+    ASSERT_TRUE(kit_vcs::reset_to_commit(second, kit_vcs::ResetMode::Hard));
+    ASSERT_EQ(kit_utils::resolve_head(), second);
+    ASSERT_EQ(kit_utils::read_file("rs/same.txt"), "same\n");
+    ASSERT_EQ(kit_utils::read_file("rs/edit.txt"), "two\n");
+    ASSERT_EQ(kit_utils::read_file("rs/new.txt"), "new\n");
+    ASSERT_FALSE(std::filesystem::exists("rs/gone.txt"));
+    ASSERT_EQ(kit_utils::read_file("rs/untracked.txt"), "mine\n");
+    index = kit_index::load();
+    ASSERT_EQ(tree_object::write_tree(index), kit_utils::read_commit(second)->tree);
+    for (const auto &entry : index.entries)
+    {
+        kit_index::StatData stat;
+        ASSERT_TRUE(kit_index::stat_file(entry.path, stat));
+        ASSERT_EQ(entry.stat, stat) << entry.path;
+    }
+
+    ASSERT_TRUE(kit_vcs::reset_to_commit(first, kit_vcs::ResetMode::Hard));
+    ASSERT_EQ(kit_utils::read_file("rs/gone.txt"), "gone\n");
+    ASSERT_FALSE(std::filesystem::exists("rs/new.txt"));
+
+    std::filesystem::remove_all("rs");
+    cleanup_repository();
+}
+
+// Test that reset --hard rewrites a locally edited file whose target differs only in mode
+TEST(ResetTest, HardOverwritesEditBehindModeChange_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::filesystem::create_directories("rm");
+    kit_utils::create_file("rm/f.txt", "one\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"rm"}));
+    kit_index::Index index = kit_index::load();
+    std::string first = kit_utils::write_commit(tree_object::write_tree(index), "644");
+    std::filesystem::permissions("rm/f.txt", std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+    ASSERT_TRUE(kit_vcs::stage_paths({"rm"}));
+    index = kit_index::load();
+    std::string second = kit_utils::write_commit(tree_object::write_tree(index), "755");
+
+    ASSERT_TRUE(kit_vcs::reset_to_commit(first, kit_vcs::ResetMode::Mixed));
+    kit_utils::create_file("rm/f.txt", "LOCAL EDIT\n");
+    kit_utils::create_file("rm/other.txt", "other\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"rm/other.txt"}));
+
+    ASSERT_TRUE(kit_vcs::reset_to_commit(second, kit_vcs::ResetMode::Hard));
+    ASSERT_EQ(kit_utils::read_file("rm/f.txt"), "one\n");
+    ASSERT_NE(std::filesystem::status("rm/f.txt").permissions() & std::filesystem::perms::owner_exec,
+              std::filesystem::perms::none);
+    index = kit_index::load();
+    kit_index::StatData stat;
+    ASSERT_TRUE(kit_index::stat_file("rm/f.txt", stat));
+    ASSERT_EQ(kit_index::find_entry(index, "rm/f.txt")->stat, stat);
+
+    std::filesystem::remove_all("rm");
+    cleanup_repository();
+}
+
+// Test for stashes stored as commits: push, apply with staged changes, conflicts, pop and drop
+TEST(StashTest, PushApplyPopDrop_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::filesystem::create_directories("st");
+    kit_utils::create_file("st/staged.txt", "base\n");
+    kit_utils::create_file("st/edited.txt", "one\ntwo\nthree\n");
+    kit_utils::create_file("st/gone.txt", "gone\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"st"}));
+    kit_index::Index index = kit_index::load();
+    std::string base_tree = tree_object::write_tree(index);
+    kit_utils::write_commit(base_tree, "base");
+
+    // One staged change, one unstaged edit and one deleted file
+    kit_utils::create_file("st/staged.txt", "staged\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"st/staged.txt"}));
+    kit_utils::create_file("st/edited.txt", "ONE\ntwo\nthree\n");
+    std::filesystem::remove("st/gone.txt");
+    ASSERT_TRUE(kit_vcs::push_stash("first"));
+    ASSERT_EQ(kit_utils::read_file("st/staged.txt"), "base\n");
+    ASSERT_EQ(kit_utils::read_file("st/edited.txt"), "one\ntwo\nthree\n");
+    ASSERT_EQ(kit_utils::read_file("st/gone.txt"), "gone\n");
+    index = kit_index::load();
+    ASSERT_EQ(tree_object::write_tree(index), base_tree);
+    ASSERT_EQ(kit_utils::resolve_revision("stash"), kit_utils::resolve_revision("stash@{0}"));
+
+    // A second stash goes on top of the stack
+    kit_utils::create_file("st/staged.txt", "second\n");
+    ASSERT_TRUE(kit_vcs::push_stash());
+    ASSERT_EQ(reflog::count(refs::STASH), 2u);
+    ASSERT_TRUE(kit_vcs::drop_stash("stash@{0}"));
+    ASSERT_EQ(reflog::count(refs::STASH), 1u);
+
+    // Apply merges the stashed edit into a non-overlapping local commit and restores the staging
+    kit_utils::create_file("st/edited.txt", "one\ntwo\nTHREE\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"st/edited.txt"}));
+    index = kit_index::load();
+    kit_utils::write_commit(tree_object::write_tree(index), "local");
+    ASSERT_TRUE(kit_vcs::apply_stash("stash@{0}"));
+    ASSERT_EQ(kit_utils::read_file("st/edited.txt"), "ONE\ntwo\nTHREE\n");
+    ASSERT_EQ(kit_utils::read_file("st/staged.txt"), "staged\n");
+    ASSERT_FALSE(std::filesystem::exists("st/gone.txt"));
+    index = kit_index::load();
+    std::string staged = object_store::read_object(kit_index::find_entry(index, "st/staged.txt")->oid.hex(), "blob");
+    ASSERT_EQ(staged, "staged\n");
+    std::string unstaged = object_store::read_object(kit_index::find_entry(index, "st/edited.txt")->oid.hex(), "blob");
+    ASSERT_EQ(unstaged, "one\ntwo\nTHREE\n");
+
+    // Applying over the stash's own changes is refused instead of overwriting them
+    ASSERT_FALSE(kit_vcs::pop_stash("stash@{0}"));
+    ASSERT_EQ(reflog::count(refs::STASH), 1u);
+
+    // Pop from a clean tree applies and drops the stash, which removes refs/stash
+    ASSERT_TRUE(kit_vcs::reset_to_commit("HEAD", kit_vcs::ResetMode::Hard));
+    ASSERT_TRUE(kit_vcs::pop_stash("0"));
+    ASSERT_EQ(kit_utils::read_file("st/edited.txt"), "ONE\ntwo\nTHREE\n");
+    ASSERT_EQ(reflog::count(refs::STASH), 0u);
+    ASSERT_FALSE(refs::exists(refs::STASH));
+
+    std::filesystem::remove_all("st");
+    cleanup_repository();
+}
+
+// Test for `gc`: only unreachable objects older than the prune time are deleted
+TEST(GcTest, PrunesUnreachableObjects_Success)
+{
+    initialize_repository();
+    refs::Transaction head;
+    head.set_symbolic(refs::HEAD, "refs/heads/master");
+    head.commit();
+    std::filesystem::create_directories("gc");
+    kit_utils::create_file("gc/file.txt", "one\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"gc"}));
+    kit_index::Index index = kit_index::load();
+    std::string first = kit_utils::write_commit(tree_object::write_tree(index), "first");
+    kit_utils::create_file("gc/file.txt", "two\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"gc"}));
+    index = kit_index::load();
+    std::string second = kit_utils::write_commit(tree_object::write_tree(index), "second");
+
+    // Reachable only through the reflog, the stash and the index
+    ASSERT_TRUE(kit_vcs::reset_to_commit(first, kit_vcs::ResetMode::Soft));
+    kit_utils::create_file("gc/file.txt", "stashed\n");
+    ASSERT_TRUE(kit_vcs::push_stash());
+    std::string stash = refs::resolve(refs::STASH);
+    kit_utils::create_file("gc/staged.txt", "staged\n");
+    ASSERT_TRUE(kit_vcs::stage_paths({"gc/staged.txt"}));
+    index = kit_index::load();
+    std::string staged = kit_index::find_entry(index, "gc/staged.txt")->oid.hex();
+
+    // An abandoned commit with its own tree and blob, made long ago, and a fresh unreachable blob
+    auto long_ago = std::filesystem::file_time_type::clock::now() - std::chrono::hours(24 * 30);
+    auto write_old_commit = [&](const std::string &content, const std::vector<std::string> &parents)
+    {
+        std::string blob = object_store::write_object("blob", content);
+        commit_object::Commit lost;
+        lost.tree = tree_object::write_tree(std::map<std::string, std::string>{{"lost.txt", blob}});
+        lost.parents = parents;
+        lost.message = "lost";
+        std::string commit = object_store::write_object("commit", commit_object::serialize(lost));
+        for (const auto &id : {blob, lost.tree, commit})
+        {
+            std::filesystem::last_write_time(object_store::object_path(id), long_ago);
+        }
+        return std::vector<std::string>{blob, lost.tree, commit};
+    };
+    std::vector<std::string> old_objects = write_old_commit("abandoned\n", {second});
+    std::string new_blob = object_store::write_object("blob", "just written\n");
+
+    // A fresh unreachable commit keeps the old tree and blob it refers to
+    std::vector<std::string> referenced = write_old_commit("still referenced\n", {});
+    commit_object::Commit fresh;
+    fresh.tree = referenced[1];
+    fresh.message = "fresh";
+    std::string fresh_commit = object_store::write_object("commit", commit_object::serialize(fresh));
+    std::filesystem::remove(object_store::object_path(referenced[2]));
+
+    size_t stored = object_store::list_loose_objects().size();
+    ASSERT_TRUE(kit_vcs::collect_garbage("2.weeks.ago", 4));
+    for (const auto &id : old_objects)
+    {
+        ASSERT_FALSE(object_store::object_exists(id)) << id;
+    }
+    for (const auto &id : {first, second, stash, staged})
+    {
+        ASSERT_TRUE(object_store::object_exists(id)) << id;
+    }
+    std::vector<std::string> loose = object_store::list_loose_objects();
+    std::sort(loose.begin(), loose.end());
+    std::vector<std::string> kept = {new_blob, fresh_commit, referenced[0], referenced[1]};
+    std::sort(kept.begin(), kept.end());
+    ASSERT_EQ(loose, kept);
+    ASSERT_EQ(pack::packs()->size(), 1u);
+    ASSERT_EQ(pack::packs()->front()->count(), stored - old_objects.size() - kept.size());
+    ASSERT_EQ(kit_utils::read_commit(second)->parents, std::vector<std::string>{first});
+    ASSERT_TRUE(kit_vcs::pop_stash("stash@{0}"));
+    ASSERT_EQ(kit_utils::read_file("gc/file.txt"), "stashed\n");
+
+    // The dropped stash is unreachable but its pack is recent: it moves out of the new pack, loose
+    ASSERT_TRUE(kit_vcs::collect_garbage("2.weeks.ago", 4));
+    ASSERT_TRUE(object_store::loose_object_exists(stash));
+    ASSERT_TRUE(object_store::loose_object_exists(kit_utils::read_commit(stash)->tree));
+    ASSERT_EQ(pack::packs()->size(), 1u);
+    ASSERT_TRUE(pack::contains(second));
+    ASSERT_FALSE(pack::contains(stash));
+
+    std::filesystem::remove_all("gc");
+    cleanup_repository();
+}
+
+// Test for bulk staging of directories and globs, its stat cache and staged deletions
+TEST(AddTest, StagePathsDirectoriesGlobsAndDeletions_Success)
+{
+    initialize_repository();
+    std::filesystem::create_directories("ad/sub");
+    kit_utils::create_file("ad/a.txt", "a\n");
+    kit_utils::create_file("ad/sub/b.txt", "b\n");
+    kit_utils::create_file("ad/c.md", "c\n");
+    kit_utils::create_file("ad_other.txt", "other\n");
+    // Back-date the files so the stat cache does not treat them as racily clean
+    auto past = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    for (const char *path : {"ad/a.txt", "ad/sub/b.txt", "ad/c.md", "ad_other.txt"})
+    {
+        std::filesystem::last_write_time(path, past);
+    }
+    auto staged_paths = []
+    {
+        std::vector<std::string> paths;
+        for (const auto &entry : kit_index::load().entries)
+        {
+            paths.push_back(entry.path);
+        }
+        return paths;
+    };
+
+    kit_vcs::StageStats stats;
+    ASSERT_TRUE(kit_vcs::stage_paths({"ad/**/*.txt", "ad_other.txt"}, 2, &stats));
+    ASSERT_EQ(stats.files, 3u);
+    ASSERT_EQ(stats.hashed_files, 3u);
+    ASSERT_EQ(stats.jobs, 2u);
+    ASSERT_EQ(staged_paths(), (std::vector<std::string>{"ad/a.txt", "ad/sub/b.txt", "ad_other.txt"}));
+
+    // Hashing on four threads only reads the file whose stat data is not cached
+    ASSERT_TRUE(kit_vcs::stage_paths({"ad"}, 4, &stats));
+    ASSERT_EQ(stats.files, 3u);
+    ASSERT_EQ(stats.hashed_files, 1u);
+    ASSERT_EQ(stats.jobs, 4u);
+    ASSERT_EQ(kit_index::find_entry(kit_index::load(), "ad/c.md")->oid.hex(), object_store::hash_object("blob", "c\n"));
+
+    ASSERT_TRUE(kit_vcs::stage_paths({"ad"}, 4, &stats));
+    ASSERT_EQ(stats.hashed_files, 0u);
+    ASSERT_EQ(stats.removed, 0u);
+
+    // Deleted files under a directory or glob pathspec are staged as deletions
+    std::filesystem::remove("ad/sub/b.txt");
+    ASSERT_TRUE(kit_vcs::stage_paths({"ad"}, 4, &stats));
+    ASSERT_EQ(stats.removed, 1u);
+    ASSERT_EQ(staged_paths(), (std::vector<std::string>{"ad/a.txt", "ad/c.md", "ad_other.txt"}));
+
+    std::filesystem::remove("ad/c.md");
+    ASSERT_TRUE(kit_vcs::stage_paths({"ad/*.md"}, 1, &stats));
+    ASSERT_EQ(stats.removed, 1u);
+
+    // A directory that is gone entirely still matches its tracked files; siblings are untouched
+    std::filesystem::remove_all("ad");
+    ASSERT_TRUE(kit_vcs::stage_paths({"ad"}, 1, &stats));
+    ASSERT_EQ(stats.files, 0u);
+    ASSERT_EQ(stats.removed, 1u);
+    ASSERT_EQ(staged_paths(), (std::vector<std::string>{"ad_other.txt"}));
+    ASSERT_FALSE(kit_vcs::stage_paths({"ad"}, 1, &stats));
+
+    std::filesystem::remove("ad_other.txt");
+    cleanup_repository();
+}
+
+// Test that repacking large near-identical blobs produces long copies that read back
+TEST(RepackTest, LargeNearIdenticalBlobs_Success)
+{
+    initialize_repository();
+
+    std::mt19937 random(42);
+    std::string first(10 * 1024 * 1024, '\0');
+    for (auto &c : first)
+    {
+        c = static_cast<char>('a' + random() % 26);
+    }
+    std::string second = first;
+    second[second.size() / 2] = '!';
+    std::string first_id = object_store::write_object("blob", first);
+    std::string second_id = object_store::write_object("blob", second);
+
+    ASSERT_TRUE(kit_vcs::repack_objects());
+    ASSERT_TRUE(object_store::list_loose_objects().empty());
+    ASSERT_EQ(pack::packs()->size(), 1u);
+    ASSERT_LT(pack::packs()->front()->pack_size(), first.size());
+    ASSERT_EQ(object_store::read_object(first_id, "blob"), first);
+    ASSERT_EQ(object_store::read_object(second_id, "blob"), second);
+
+    cleanup_repository();
+}